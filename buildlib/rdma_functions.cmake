@@ -10,6 +10,9 @@ set(RDMA_STATIC_LIBS "" CACHE INTERNAL "Doc" FORCE)
 # Global list of tuples of (PROVIDER_NAME LIB_NAME)
 set(RDMA_PROVIDER_LIST "" CACHE INTERNAL "Doc" FORCE)
 
+# Global list of provider match entries, see rdma_provider_index()
+set(RDMA_PROVIDER_INDEX "" CACHE INTERNAL "Doc" FORCE)
+
 set(COMMON_LIBS_PIC ccan_pic rdma_util_pic)
 set(COMMON_LIBS ccan rdma_util)
 
@@ -135,6 +138,7 @@ function(rdma_shared_provider DEST VERSION_SCRIPT SOVERSION VERSION)
 
   list(APPEND RDMA_PROVIDER_LIST ${DEST} ${DEST})
   set(RDMA_PROVIDER_LIST "${RDMA_PROVIDER_LIST}" CACHE INTERNAL "")
+  rdma_provider_index(${DEST} ${ARGN})
 
   # Create a static provider library
   if (ENABLE_STATIC)
@@ -169,6 +173,33 @@ function(rdma_shared_provider DEST VERSION_SCRIPT SOVERSION VERSION)
   rdma_create_symlink("lib${DEST}.so.${VERSION}" "${BUILD_LIB}/lib${DEST}${IBVERBS_PROVIDER_SUFFIX}")
 endfunction()
 
+# Record the driver ID, name and modalias matches of a provider so that
+# libibverbs can load only the provider a device needs. PCI matches are not
+# recorded, devices that only match on those use the full provider scan.
+function(rdma_provider_index DEST)
+  foreach(SRC ${ARGN})
+    get_filename_component(SRC "${SRC}" ABSOLUTE)
+    if (SRC MATCHES "\\.c$" AND EXISTS "${SRC}")
+      # Re-run cmake when the match tables change
+      set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${SRC}")
+      file(STRINGS "${SRC}" LINES REGEX "VERBS_(DRIVER_ID|NAME_MATCH|MODALIAS_MATCH)\\(")
+    else()
+      set(LINES "")
+    endif()
+
+    foreach(LINE ${LINES})
+      if (LINE MATCHES "VERBS_DRIVER_ID\\((RDMA_DRIVER_[A-Z0-9_]+)\\)")
+        list(APPEND RDMA_PROVIDER_INDEX "PROVIDER_DRIVER_ID(\"${DEST}\", ${CMAKE_MATCH_1})")
+      elseif (LINE MATCHES "VERBS_NAME_MATCH\\(\"([^\"]+)\"")
+        list(APPEND RDMA_PROVIDER_INDEX "PROVIDER_MODALIAS(\"${DEST}\", \"rdma_device:*N${CMAKE_MATCH_1}*\")")
+      elseif (LINE MATCHES "VERBS_MODALIAS_MATCH\\(\"([^\"]+)\"")
+        list(APPEND RDMA_PROVIDER_INDEX "PROVIDER_MODALIAS(\"${DEST}\", \"${CMAKE_MATCH_1}\")")
+      endif()
+    endforeach()
+  endforeach()
+  set(RDMA_PROVIDER_INDEX "${RDMA_PROVIDER_INDEX}" CACHE INTERNAL "")
+endfunction()
+
 # Create a provider shared library for libibverbs
 function(rdma_provider DEST)
   # Installed driver file
@@ -181,6 +212,7 @@ function(rdma_provider DEST)
 
   list(APPEND RDMA_PROVIDER_LIST ${DEST} "${DEST}-rdmav${IBVERBS_PABI_VERSION}")
   set(RDMA_PROVIDER_LIST "${RDMA_PROVIDER_LIST}" CACHE INTERNAL "")
+  rdma_provider_index(${DEST} ${ARGN})
 
   # Create a static provider library
   if (ENABLE_STATIC)
@@ -49,7 +49,6 @@
 #include <infiniband/umad_sa_mcm.h>
 #include <ifaddrs.h>
 #include <dlfcn.h>
-#include <search.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -100,13 +99,16 @@ enum acmp_addr_preload {
 };
 
 /*
- * Nested locking order: dest -> ep, dest -> port
+ * Nested locking order: dest -> ep, dest -> port.  The dest cache shard
+ * locks nest inside all others.
  */
 struct acmp_ep;
 
 struct acmp_dest {
-	uint8_t                address[ACM_MAX_ADDRESS]; /* keep first */
+	uint8_t                address[ACM_MAX_ADDRESS];
 	char                   name[ACM_MAX_ADDRESS];
+	struct acmp_dest       *hnext;
+	uint32_t               hash;
 	struct ibv_ah          *ah;
 	struct ibv_ah_attr     av;
 	struct ibv_path_record path;
@@ -153,6 +155,22 @@ struct acmp_device {
 	struct acmp_port        port[0];
 };
 
+/*
+ * Destinations are cached in a hash table split into shards, each with
+ * its own lock, so that concurrent resolves of different addresses do
+ * not serialize on the endpoint lock.  Each shard grows independently.
+ */
+#define ACMP_DEST_SHARD_BITS  4
+#define ACMP_DEST_SHARDS      (1 << ACMP_DEST_SHARD_BITS)
+#define ACMP_DEST_MIN_BUCKETS 16
+
+struct acmp_dest_shard {
+	pthread_rwlock_t      lock;
+	struct acmp_dest      **buckets;
+	uint32_t              size;
+	uint32_t              count;
+};
+
 /* Maintain separate virtual send queues to avoid deadlock */
 struct acmp_send_queue {
 	int                   credits;
@@ -179,7 +197,7 @@ struct acmp_ep {
 	uint8_t               *recv_bufs;
 	struct list_node      entry;
 	char		      id_string[IBV_SYSFS_NAME_MAX + 11];
-	void                  *dest_map[ACM_ADDRESS_RESERVED - 1];
+	struct acmp_dest_shard dest_map[ACMP_DEST_SHARDS];
 	struct acmp_dest      mc_dest[MAX_EP_MC];
 	int                   mc_cnt;
 	uint16_t              pkey_index;
@@ -290,9 +308,66 @@ static enum acmp_addr_preload addr_preload;
 
 static int acmp_initialized = 0;
 
-static int acmp_compare_dest(const void *dest1, const void *dest2)
+static uint32_t acmp_hash_dest(uint8_t addr_type, const uint8_t *addr)
+{
+	uint64_t hash = addr_type, word;
+	int i;
+
+	for (i = 0; i < ACM_MAX_ADDRESS; i += sizeof word) {
+		memcpy(&word, addr + i, sizeof word);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static struct acmp_dest_shard *
+acmp_dest_shard(struct acmp_ep *ep, uint32_t hash)
 {
-	return memcmp(dest1, dest2, ACM_MAX_ADDRESS);
+	return &ep->dest_map[hash >> (32 - ACMP_DEST_SHARD_BITS)];
+}
+
+/* Caller must hold shard lock. */
+static struct acmp_dest **
+acmp_find_dest(struct acmp_dest_shard *shard, uint32_t hash,
+	       uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest **pdest;
+
+	if (!shard->size)
+		return NULL;
+
+	for (pdest = &shard->buckets[hash & (shard->size - 1)]; *pdest;
+	     pdest = &(*pdest)->hnext) {
+		if ((*pdest)->hash == hash && (*pdest)->addr_type == addr_type &&
+		    !memcmp((*pdest)->address, addr, ACM_MAX_ADDRESS))
+			return pdest;
+	}
+	return NULL;
+}
+
+/* Caller must hold shard write lock. */
+static int acmp_grow_dest_shard(struct acmp_dest_shard *shard)
+{
+	struct acmp_dest **buckets, *dest;
+	uint32_t size, i;
+
+	size = shard->size ? shard->size << 1 : ACMP_DEST_MIN_BUCKETS;
+	buckets = calloc(size, sizeof *buckets);
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < shard->size; i++) {
+		while ((dest = shard->buckets[i])) {
+			shard->buckets[i] = dest->hnext;
+			dest->hnext = buckets[dest->hash & (size - 1)];
+			buckets[dest->hash & (size - 1)] = dest;
+		}
+	}
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->size = size;
+	return 0;
 }
 
 static void
@@ -301,7 +376,8 @@ acmp_set_dest_addr(struct acmp_dest *dest, uint8_t addr_type,
 {
 	memcpy(dest->address, addr, size);
 	dest->addr_type = addr_type;
-	acm_format_name(0, dest->name, sizeof dest->name, addr_type, addr, size);
+	/* The name is only ever used for logging */
+	acm_format_name(1, dest->name, sizeof dest->name, addr_type, addr, size);
 }
 
 static void
@@ -333,19 +409,33 @@ acmp_alloc_dest(uint8_t addr_type, const uint8_t *addr)
 	return dest;
 }
 
-/* Caller must hold ep lock. */
 static struct acmp_dest *
-acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
+acmp_lookup_dest(struct acmp_ep *ep, uint32_t hash,
+		 uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest, **tdest;
+	struct acmp_dest_shard *shard = acmp_dest_shard(ep, hash);
+	struct acmp_dest *dest = NULL, **pdest;
 
-	tdest = tfind(addr, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-	if (tdest) {
-		dest = *tdest;
+	pthread_rwlock_rdlock(&shard->lock);
+	pdest = acmp_find_dest(shard, hash, addr_type, addr);
+	if (pdest) {
+		dest = *pdest;
 		(void) atomic_inc(&dest->refcnt);
+	}
+	pthread_rwlock_unlock(&shard->lock);
+	return dest;
+}
+
+static struct acmp_dest *
+acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest *dest;
+
+	dest = acmp_lookup_dest(ep, acmp_hash_dest(addr_type, addr),
+				addr_type, addr);
+	if (dest) {
 		acm_log(2, "%s\n", dest->name);
 	} else {
-		dest = NULL;
 		acm_format_name(2, log_data, sizeof log_data,
 				addr_type, addr, ACM_MAX_ADDRESS);
 		acm_log(2, "%s not found\n", log_data);
@@ -362,50 +452,104 @@ acmp_put_dest(struct acmp_dest *dest)
 	}
 }
 
-/* Caller must hold ep lock. */
+/*
+ * Drop the cache's reference to dest.  The caller must hold its own
+ * reference.  Losing a race with another remover is harmless.
+ */
 static void
 acmp_remove_dest(struct acmp_ep *ep, struct acmp_dest *dest)
 {
+	struct acmp_dest_shard *shard = acmp_dest_shard(ep, dest->hash);
+	struct acmp_dest **pdest;
+
 	acm_log(2, "%s\n", dest->name);
-	if (!tdelete(dest->address, &ep->dest_map[dest->addr_type - 1],
-		     acmp_compare_dest))
-		acm_log(0, "ERROR: %s not found!!\n", dest->name);
+	pthread_rwlock_wrlock(&shard->lock);
+	pdest = acmp_find_dest(shard, dest->hash, dest->addr_type,
+			       dest->address);
+	if (pdest && *pdest == dest) {
+		*pdest = dest->hnext;
+		shard->count--;
+	} else {
+		dest = NULL;
+	}
+	pthread_rwlock_unlock(&shard->lock);
 
-	acmp_put_dest(dest);
+	if (dest)
+		acmp_put_dest(dest);
+}
+
+static int acmp_dest_expired(struct acmp_dest *dest)
+{
+	int64_t rec_expr_minutes;
+
+	if (dest->state != ACMP_READY || dest->addr_timeout == (uint64_t)~0ULL)
+		return 0;
+
+	rec_expr_minutes = dest->addr_timeout - time_stamp_min();
+	if (rec_expr_minutes <= 0) {
+		acm_log(2, "Record expired\n");
+		return 1;
+	}
+
+	acm_log(2, "Record valid for the next %" PRId64 " minute(s)\n",
+		rec_expr_minutes);
+	return 0;
 }
 
+/*
+ * Lookups only take the shard read lock.  Expired records are dropped
+ * lazily here, when they are next asked for, rather than by a sweeper.
+ */
 static struct acmp_dest *
 acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest;
-	int64_t rec_expr_minutes;
+	struct acmp_dest_shard *shard;
+	struct acmp_dest *dest, *new_dest, **pdest;
+	uint32_t hash;
 
 	acm_format_name(2, log_data, sizeof log_data,
 			addr_type, addr, ACM_MAX_ADDRESS);
 	acm_log(2, "%s\n", log_data);
-	pthread_mutex_lock(&ep->lock);
-	dest = acmp_get_dest(ep, addr_type, addr);
-	if (dest && dest->state == ACMP_READY &&
-	    dest->addr_timeout != (uint64_t)~0ULL) {
-		rec_expr_minutes = dest->addr_timeout - time_stamp_min();
-		if (rec_expr_minutes <= 0) {
-			acm_log(2, "Record expired\n");
-			acmp_remove_dest(ep, dest);
-			dest = NULL;
-		} else {
-			acm_log(2, "Record valid for the next %" PRId64 " minute(s)\n",
-				rec_expr_minutes);
-		}
+	hash = acmp_hash_dest(addr_type, addr);
+	dest = acmp_lookup_dest(ep, hash, addr_type, addr);
+	if (dest) {
+		if (!acmp_dest_expired(dest))
+			return dest;
+
+		acmp_remove_dest(ep, dest);
+		acmp_put_dest(dest);
 	}
-	if (!dest) {
-		dest = acmp_alloc_dest(addr_type, addr);
-		if (dest) {
-			dest->ep = ep;
-			tsearch(dest, &ep->dest_map[addr_type - 1], acmp_compare_dest);
+
+	new_dest = acmp_alloc_dest(addr_type, addr);
+	if (!new_dest)
+		return NULL;
+	new_dest->ep = ep;
+	new_dest->hash = hash;
+
+	dest = NULL;
+	shard = acmp_dest_shard(ep, hash);
+	pthread_rwlock_wrlock(&shard->lock);
+	pdest = acmp_find_dest(shard, hash, addr_type, addr);
+	if (pdest) {
+		/* Another thread inserted the address first */
+		dest = *pdest;
+		(void) atomic_inc(&dest->refcnt);
+	} else {
+		/* If the table cannot grow, the chains just get longer */
+		if (shard->count >= shard->size)
+			acmp_grow_dest_shard(shard);
+		if (shard->size) {
+			dest = new_dest;
+			dest->hnext = shard->buckets[hash & (shard->size - 1)];
+			shard->buckets[hash & (shard->size - 1)] = dest;
+			shard->count++;
 			(void) atomic_inc(&dest->refcnt);
 		}
 	}
-	pthread_mutex_unlock(&ep->lock);
+	pthread_rwlock_unlock(&shard->lock);
+
+	if (dest != new_dest)
+		acmp_put_dest(new_dest);
 	return dest;
 }
 
@@ -2499,9 +2643,8 @@ static void acmp_remove_addr(void *addr_context)
 				dest = acmp_get_dest(ep, address->type, address->addr.info.addr);
 				if (dest) {
 					acm_log(2, "Found a dest addr, deleting it\n");
-					pthread_mutex_lock(&ep->lock);
 					acmp_remove_dest(ep, dest);
-					pthread_mutex_unlock(&ep->lock);
+					acmp_put_dest(dest);
 				}
 				pthread_mutex_lock(&port->lock);
 			}
@@ -2599,6 +2742,9 @@ acmp_alloc_ep(struct acmp_port *port, struct acm_endpoint *endpoint)
 	sprintf(ep->id_string, "%s-%d-0x%x", port->dev->verbs->device->name,
 		port->port_num, endpoint->pkey);
 
+	for (i = 0; i < ACMP_DEST_SHARDS; i++)
+		pthread_rwlock_init(&ep->dest_map[i].lock, NULL);
+
 	if (pthread_rwlock_init(&ep->rwlock, NULL)) {
 		free(ep);
 		return NULL;
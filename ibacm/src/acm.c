@@ -54,6 +54,8 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <net/if_arp.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -71,6 +73,10 @@
 #define NL_MSG_BUF_SIZE 4096
 #define ACM_PROV_NAME_SIZE 64
 #define NL_CLIENT_INDEX 0
+#define ACM_CLIENT_CHUNK 1024
+#define ACM_MAX_CLIENT_CHUNKS 1024
+#define ACM_POLL_EVENTS 64
+#define ACM_POLL_FD (1ULL << 63) /* epoll data of fds other than clients */
 
 struct acmc_subnet {
 	struct list_node       entry;
@@ -147,6 +153,10 @@ struct acmc_client {
 	int      sock;
 	int      index;
 	atomic_t refcnt;
+	struct list_node free_entry;
+	/* partial request data, the stream may split or join requests */
+	int      rcv_len;
+	uint8_t  rcv_buf[sizeof(struct acm_msg)];
 };
 
 union socket_addr {
@@ -185,7 +195,16 @@ static LIST_HEAD(dev_list);
 
 static int listen_socket;
 static int ip_mon_socket;
-static struct acmc_client client_array[FD_SETSIZE - 1];
+static int epoll_fd;
+
+/*
+ * The client id given to the providers indexes a table of chunks that never
+ * move, so a response thread can find its client while the table grows.
+ * Client slots are only allocated and freed by the server thread.
+ */
+static struct acmc_client *client_chunks[ACM_MAX_CLIENT_CHUNKS];
+static int client_cnt;
+static LIST_HEAD(free_clients);
 
 static FILE *flog;
 static pthread_mutex_t log_lock;
@@ -496,9 +515,14 @@ __be64 acm_path_comp_mask(struct ibv_path_record *path)
 	return comp_mask;
 }
 
+static struct acmc_client *acm_get_client(uint64_t id)
+{
+	return &client_chunks[id / ACM_CLIENT_CHUNK][id % ACM_CLIENT_CHUNK];
+}
+
 int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_get_client(id);
 	int ret;
 
 	acm_log(2, "client %d, status 0x%x\n", client->index, msg->hdr.status);
@@ -545,7 +569,7 @@ acmc_resolve_response(uint64_t id, struct acm_msg *req_msg, uint8_t status)
 
 int acm_query_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_get_client(id);
 	int ret;
 
 	acm_log(2, "status 0x%x\n", msg->hdr.status);
@@ -576,17 +600,84 @@ static int acmc_query_response(uint64_t id, struct acm_msg *msg, uint8_t status)
 	return acm_query_response(id, msg);
 }
 
+static int acm_client_send(struct acmc_client *client, struct acm_msg *msg,
+			   int len)
+{
+	int ret;
+
+	/* responses from the providers may be sent at the same time */
+	pthread_mutex_lock(&client->lock);
+	ret = send(client->sock, (char *) msg, len, 0);
+	pthread_mutex_unlock(&client->lock);
+	return ret;
+}
+
+/*
+ * Reuse the slot of a disconnected client once all of its responses went
+ * out, otherwise take a new slot from the table.
+ */
+static struct acmc_client *acm_alloc_client(void)
+{
+	struct acmc_client *client;
+	int i, chunk;
+
+	list_for_each(&free_clients, client, free_entry) {
+		if (!atomic_get(&client->refcnt)) {
+			list_del(&client->free_entry);
+			return client;
+		}
+	}
+
+	chunk = client_cnt / ACM_CLIENT_CHUNK;
+	if (chunk == ACM_MAX_CLIENT_CHUNKS)
+		return NULL;
+
+	if (!client_chunks[chunk]) {
+		client = calloc(ACM_CLIENT_CHUNK, sizeof(*client));
+		if (!client)
+			return NULL;
+		for (i = 0; i < ACM_CLIENT_CHUNK; i++) {
+			pthread_mutex_init(&client[i].lock, NULL);
+			client[i].index = chunk * ACM_CLIENT_CHUNK + i;
+			client[i].sock = -1;
+			atomic_init(&client[i].refcnt);
+		}
+		client_chunks[chunk] = client;
+	}
+	return acm_get_client(client_cnt++);
+}
+
+static int acm_poll_add(int fd, uint64_t data)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u64 = data,
+	};
+
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/* Every rank of a job may connect, allow as many clients as we can */
+static void acm_raise_fd_limit(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == rlim.rlim_max)
+		return;
+
+	rlim.rlim_cur = rlim.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rlim))
+		acm_log(0, "notice - unable to raise open file limit\n");
+}
+
 static void acm_init_server(void)
 {
 	FILE *f;
-	int i;
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		pthread_mutex_init(&client_array[i].lock, NULL);
-		client_array[i].index = i;
-		client_array[i].sock = -1;
-		atomic_init(&client_array[i].refcnt);
-	}
+	/* the netlink client takes the first slot, NL_CLIENT_INDEX */
+	if (!acm_alloc_client())
+		acm_log(0, "ERROR - unable to allocate client table\n");
+	acm_raise_fd_limit();
 
 	if (server_mode != IBACM_SERVER_MODE_UNIX) {
 		f = fopen(IBACM_IBACME_PORT_FILE, "w");
@@ -681,7 +772,7 @@ static int acm_listen(void)
 		}
 	}
 
-	ret = listen(listen_socket, 0);
+	ret = listen(listen_socket, SOMAXCONN);
 	if (ret == -1) {
 		acm_log(0, "ERROR - unable to start listen\n");
 		return errno;
@@ -713,12 +804,12 @@ static int acm_listen_systemd(void)
 			/* ListenNetlink for RDMA_NL_GROUP_LS multicast
 			 * messages from the kernel
 			 */
-			if (client_array[NL_CLIENT_INDEX].sock != -1) {
+			if (acm_get_client(NL_CLIENT_INDEX)->sock != -1) {
 				fprintf(stderr,
 					"sd_listen_fds returned more than one netlink socket\n");
 				return -1;
 			}
-			client_array[NL_CLIENT_INDEX].sock = fd;
+			acm_get_client(NL_CLIENT_INDEX)->sock = fd;
 
 			/* systemd sets NONBLOCK on the netlink socket, while
 			 * we want blocking send to the kernel.
@@ -755,36 +846,38 @@ static void acm_disconnect_client(struct acmc_client *client)
 	client->sock = -1;
 	pthread_mutex_unlock(&client->lock);
 	(void) atomic_dec(&client->refcnt);
+	list_add_tail(&free_clients, &client->free_entry);
 }
 
 static void acm_svr_accept(void)
 {
+	struct acmc_client *client;
 	int s;
-	int i;
 
 	acm_log(2, "\n");
-	s = accept(listen_socket, NULL, NULL);
-	if (s == -1) {
-		acm_log(0, "ERROR - failed to accept connection\n");
-		return;
-	}
-
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		if (i == NL_CLIENT_INDEX)
+	/* the listen socket is non-blocking, take all pending connections */
+	while ((s = accept(listen_socket, NULL, NULL)) != -1) {
+		client = acm_alloc_client();
+		if (!client) {
+			acm_log(0, "ERROR - all connections busy - rejecting\n");
+			close(s);
 			continue;
-		if (!atomic_get(&client_array[i].refcnt))
-			break;
-	}
+		}
 
-	if (i == FD_SETSIZE - 1) {
-		acm_log(0, "ERROR - all connections busy - rejecting\n");
-		close(s);
-		return;
+		client->sock = s;
+		client->rcv_len = 0;
+		atomic_set(&client->refcnt, 1);
+		if (acm_poll_add(s, client->index)) {
+			acm_log(0, "ERROR - unable to poll client %d\n",
+				client->index);
+			acm_disconnect_client(client);
+			continue;
+		}
+		acm_log(2, "assigned client %d\n", client->index);
 	}
 
-	client_array[i].sock = s;
-	atomic_set(&client_array[i].refcnt, 1);
-	acm_log(2, "assigned client %d\n", i);
+	if (errno != EAGAIN && errno != EWOULDBLOCK)
+		acm_log(0, "ERROR - failed to accept connection\n");
 }
 
 static int
@@ -1187,7 +1280,7 @@ static int acm_svr_perf_query(struct acmc_client *client, struct acm_msg *msg)
 	}
 	msg->hdr.length = htobe16(len);
 
-	ret = send(client->sock, (char *) msg, len, 0);
+	ret = acm_client_send(client, msg, len);
 	if (ret != len)
 		acm_log(0, "ERROR - failed to send response\n");
 	else
@@ -1272,7 +1365,7 @@ static int acm_svr_ep_query(struct acmc_client *client, struct acm_msg **_msg)
 	msg->hdr.dst_index = 0;
 	msg->hdr.length = htobe16(len);
 
-	ret = send(client->sock, (char *) msg, len, 0);
+	ret = acm_client_send(client, msg, len);
 	if (ret != len)
 		acm_log(0, "ERROR - failed to send response\n");
 	else
@@ -1287,27 +1380,21 @@ static int acm_msg_length(struct acm_msg *msg)
 		msg->hdr.length : be16toh(msg->hdr.length);
 }
 
-static void acm_svr_receive(struct acmc_client *client)
+static int acm_svr_process(struct acmc_client *client, void *buf, int len)
 {
 	struct acm_msg *msg = malloc(sizeof(*msg));
 	int ret;
 
 	if (!msg) {
 		acm_log(0, "ERROR - Unable to alloc acm_msg\n");
-		ret = ENOMEM;
-		goto out;
-	}
-
-	acm_log(2, "client %d\n", client->index);
-	ret = recv(client->sock, (char *)msg, sizeof(*msg), 0);
-	if (ret <= 0 || ret != acm_msg_length(msg)) {
-		acm_log(2, "client disconnected\n");
-		ret = ACM_STATUS_ENOTCONN;
-		goto out;
+		return ENOMEM;
 	}
 
+	/* ep query may grow msg, so handle a copy of the request */
+	memcpy(msg, buf, len);
 	if (msg->hdr.version != ACM_VERSION) {
 		acm_log(0, "ERROR - unsupported version %d\n", msg->hdr.version);
+		ret = EINVAL;
 		goto out;
 	}
 
@@ -1324,13 +1411,60 @@ static void acm_svr_receive(struct acmc_client *client)
 		break;
 	default:
 		acm_log(0, "ERROR - unknown opcode 0x%x\n", msg->hdr.opcode);
+		ret = 0;
 		break;
 	}
 
 out:
 	free(msg);
-	if (ret)
-		acm_disconnect_client(client);
+	return ret;
+}
+
+/*
+ * Clients may queue several requests before reading any response, so data
+ * is collected until a complete request is buffered and every complete
+ * request in the stream is handled.
+ */
+static void acm_svr_receive(struct acmc_client *client)
+{
+	struct acm_msg *msg;
+	int ret, len;
+
+	acm_log(2, "client %d\n", client->index);
+	if (client->sock == -1)
+		return;
+
+	ret = recv(client->sock, client->rcv_buf + client->rcv_len,
+		   sizeof(client->rcv_buf) - client->rcv_len, MSG_DONTWAIT);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (ret <= 0) {
+		acm_log(2, "client disconnected\n");
+		goto err;
+	}
+	client->rcv_len += ret;
+
+	for (ret = 0; client->rcv_len >= sizeof(msg->hdr); ret += len) {
+		msg = (struct acm_msg *) (client->rcv_buf + ret);
+		len = acm_msg_length(msg);
+		if (len < sizeof(msg->hdr) || len > sizeof(*msg)) {
+			acm_log(0, "ERROR - invalid message length %d\n", len);
+			goto err;
+		}
+		if (len > client->rcv_len)
+			break;
+
+		if (acm_svr_process(client, msg, len))
+			goto err;
+		client->rcv_len -= len;
+	}
+
+	if (ret && client->rcv_len)
+		memmove(client->rcv_buf, client->rcv_buf + ret, client->rcv_len);
+	return;
+
+err:
+	acm_disconnect_client(client);
 }
 
 static int acm_nl_to_addr_data(struct acm_ep_addr_data *ad,
@@ -1874,20 +2008,21 @@ static int acm_init_nl(void)
 	}
 
 	/* init nl client structure */
-	client_array[NL_CLIENT_INDEX].sock = nl_rcv_socket;
+	acm_get_client(NL_CLIENT_INDEX)->sock = nl_rcv_socket;
 	return 0;
 }
 
 static void acm_server(bool systemd)
 {
-	fd_set readfds;
-	int i, n, ret;
+	struct epoll_event events[ACM_POLL_EVENTS];
+	struct acmc_client *client;
+	int i, n, ret, fd;
 	struct acmc_device *dev;
 
 	acm_log(0, "started\n");
 	acm_init_server();
 
-	client_array[NL_CLIENT_INDEX].sock = -1;
+	acm_get_client(NL_CLIENT_INDEX)->sock = -1;
 	listen_socket = -1;
 	if (systemd) {
 		ret = acm_listen_systemd();
@@ -1905,65 +2040,84 @@ static void acm_server(bool systemd)
 		}
 	}
 
-	if (client_array[NL_CLIENT_INDEX].sock == -1) {
+	if (acm_get_client(NL_CLIENT_INDEX)->sock == -1) {
 		ret = acm_init_nl();
 		if (ret)
 			acm_log(1, "Warn - Netlink init failed\n");
 	}
 
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		acm_log(0, "ERROR - unable to create epoll fd\n");
+		return;
+	}
+
+	if (set_fd_nonblock(listen_socket, true) ||
+	    acm_poll_add(listen_socket, ACM_POLL_FD | listen_socket)) {
+		acm_log(0, "ERROR - unable to poll listen socket\n");
+		goto out;
+	}
+	if (ip_mon_socket >= 0 &&
+	    acm_poll_add(ip_mon_socket, ACM_POLL_FD | ip_mon_socket))
+		acm_log(0, "ERROR - unable to poll ip monitor socket\n");
+
+	client = acm_get_client(NL_CLIENT_INDEX);
+	if (client->sock != -1 && acm_poll_add(client->sock, client->index))
+		acm_log(0, "ERROR - unable to poll netlink socket\n");
+
+	list_for_each(&dev_list, dev, entry) {
+		fd = dev->device.verbs->async_fd;
+		if (acm_poll_add(fd, ACM_POLL_FD | fd))
+			acm_log(0, "ERROR - unable to poll %s events\n",
+				dev->device.verbs->device->name);
+	}
+
 	if (systemd)
 		sd_notify(0, "READY=1");
 
 	while (1) {
-		n = (int) listen_socket;
-		FD_ZERO(&readfds);
-		FD_SET(listen_socket, &readfds);
-		n = max(n, (int) ip_mon_socket);
-		FD_SET(ip_mon_socket, &readfds);
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1) {
-				FD_SET(client_array[i].sock, &readfds);
-				n = max(n, (int) client_array[i].sock);
-			}
-		}
-
-		list_for_each(&dev_list, dev, entry) {
-			FD_SET(dev->device.verbs->async_fd, &readfds);
-			n = max(n, (int) dev->device.verbs->async_fd);
-		}
-
-		ret = select(n + 1, &readfds, NULL, NULL, NULL);
-		if (ret == -1) {
-			acm_log(0, "ERROR - server select error\n");
+		n = epoll_wait(epoll_fd, events, ACM_POLL_EVENTS, -1);
+		if (n == -1) {
+			if (errno != EINTR)
+				acm_log(0, "ERROR - server epoll error\n");
 			continue;
 		}
 
-		if (FD_ISSET(listen_socket, &readfds))
-			acm_svr_accept();
-
-		if (FD_ISSET(ip_mon_socket, &readfds))
-			acm_ipnl_handler();
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1 &&
-				FD_ISSET(client_array[i].sock, &readfds)) {
-				acm_log(2, "receiving from client %d\n", i);
-				if (i == NL_CLIENT_INDEX)
-					acm_nl_receive(&client_array[i]);
+		for (i = 0; i < n; i++) {
+			if (!(events[i].data.u64 & ACM_POLL_FD)) {
+				client = acm_get_client(events[i].data.u64);
+				acm_log(2, "receiving from client %d\n",
+					client->index);
+				if (client->index == NL_CLIENT_INDEX)
+					acm_nl_receive(client);
 				else
-					acm_svr_receive(&client_array[i]);
+					acm_svr_receive(client);
+				continue;
+			}
+
+			fd = (int) (events[i].data.u64 & ~ACM_POLL_FD);
+			if (fd == listen_socket) {
+				acm_svr_accept();
+				continue;
+			}
+			if (fd == ip_mon_socket) {
+				acm_ipnl_handler();
+				continue;
 			}
-		}
 
-		list_for_each(&dev_list, dev, entry) {
-			if (FD_ISSET(dev->device.verbs->async_fd, &readfds)) {
-				acm_log(2, "handling event from %s\n",
-					dev->device.verbs->device->name);
-				acm_event_handler(dev);
+			list_for_each(&dev_list, dev, entry) {
+				if (dev->device.verbs->async_fd == fd) {
+					acm_log(2, "handling event from %s\n",
+						dev->device.verbs->device->name);
+					acm_event_handler(dev);
+					break;
+				}
 			}
 		}
 	}
+
+out:
+	close(epoll_fd);
 }
 
 enum ibv_rate acm_get_rate(uint8_t width, uint8_t speed)
@@ -3383,8 +3537,8 @@ int main(int argc, char **argv)
 	acm_server(systemd);
 
 	acm_log(0, "shutting down\n");
-	if (client_array[NL_CLIENT_INDEX].sock != -1)
-		close(client_array[NL_CLIENT_INDEX].sock);
+	if (acm_get_client(NL_CLIENT_INDEX)->sock != -1)
+		close(acm_get_client(NL_CLIENT_INDEX)->sock);
 	acm_close_providers();
 	acm_stop_sa_handler();
 	umad_done();
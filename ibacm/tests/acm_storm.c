@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Resolve storm: fork a number of clients, as a job launcher would start
+ * ranks, and have each resolve a list of destinations through ibacm as
+ * fast as it can.  Reports the aggregate resolve rate and the latency
+ * distribution seen by the clients.
+ *
+ * With -l the clients are launched as a job would be: every client connects
+ * and holds its connection, and they only start resolving once all of them
+ * are connected.  This also shows how many connections ibacm turns away.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#include <infiniband/verbs.h>
+#include <infiniband/acm.h>
+#include "libacm.h"
+
+#define MAX_DESTS	4096
+#define LAT_BUCKETS	24	/* log2 microsecond buckets */
+
+struct storm_dest {
+	char			*name;
+	struct sockaddr_storage	addr;
+	int			is_ip;
+};
+
+struct storm_stats {
+	uint64_t	rejected;
+	uint64_t	resolved;
+	uint64_t	failed;
+	uint64_t	total_us;
+	uint64_t	max_us;
+	uint64_t	lat[LAT_BUCKETS];
+};
+
+#if IBACM_SERVER_MODE_DEFAULT == IBACM_SERVER_MODE_UNIX
+static const char *svc = IBACM_IBACME_SERVER_PATH;
+#else
+static const char *svc = "localhost";
+#endif
+static char *src_addr;
+static struct storm_dest dests[MAX_DESTS];
+static int dest_cnt;
+static int clients = 64;
+static int repetitions = 10;
+static int nodelay;
+static int launch;
+static int go_fd = -1;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int inet_any_pton(const char *addr, struct sockaddr *sa)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *) sa;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) sa;
+
+	sa->sa_family = AF_INET;
+	if (inet_pton(AF_INET, addr, &sin->sin_addr) > 0)
+		return 1;
+	sa->sa_family = AF_INET6;
+	return inet_pton(AF_INET6, addr, &sin6->sin6_addr) > 0;
+}
+
+static int add_dest(const char *name)
+{
+	struct storm_dest *dest;
+
+	if (!*name)
+		return 0;
+	if (dest_cnt == MAX_DESTS) {
+		fprintf(stderr, "too many destinations, max %d\n", MAX_DESTS);
+		return -1;
+	}
+
+	dest = &dests[dest_cnt++];
+	dest->name = strdup(name);
+	if (!dest->name)
+		return -1;
+	dest->is_ip = inet_any_pton(name, (struct sockaddr *) &dest->addr);
+	return 0;
+}
+
+static int parse_dests(char *arg)
+{
+	char *tok, *save;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		if (add_dest(tok))
+			return -1;
+	}
+	return 0;
+}
+
+static int read_dests(const char *file)
+{
+	char line[256];
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (!ret && fgets(line, sizeof line, f)) {
+		line[strcspn(line, " \t\r\n#")] = '\0';
+		ret = add_dest(line);
+	}
+	fclose(f);
+	return ret;
+}
+
+static int resolve_one(struct storm_dest *dest, struct sockaddr *saddr)
+{
+	struct ibv_path_data *paths = NULL;
+	uint32_t flags = nodelay ? ACM_FLAGS_NODELAY : 0;
+	int ret, count;
+
+	if (dest->is_ip)
+		ret = ib_acm_resolve_ip(saddr, (struct sockaddr *) &dest->addr,
+					&paths, &count, flags, 0);
+	else
+		ret = ib_acm_resolve_name(src_addr, dest->name,
+					  &paths, &count, flags, 0);
+	/* libacm reports success without paths if ibacm dropped us */
+	if ((!ret && !paths) ||
+	    (ret && (errno == EPIPE || errno == ECONNRESET)))
+		return ENOTCONN;
+	if (!ret)
+		ib_acm_free_paths(paths);
+	return ret;
+}
+
+static void run_client(int id, int fd)
+{
+	struct storm_stats stats;
+	struct sockaddr_storage src;
+	struct sockaddr *saddr = NULL;
+	uint64_t start, lat;
+	char connected;
+	int i, d, b, ret;
+
+	memset(&stats, 0, sizeof stats);
+	if (src_addr && inet_any_pton(src_addr, (struct sockaddr *) &src))
+		saddr = (struct sockaddr *) &src;
+
+	connected = !ib_acm_connect((char *) svc);
+	if (launch) {
+		/* report in, then wait until the whole job is connected */
+		if (write(fd, &connected, 1) != 1)
+			perror("write");
+		while (read(go_fd, &b, sizeof b) > 0)
+			;
+	}
+	if (!connected) {
+		fprintf(stderr, "client %d: unable to contact %s\n", id, svc);
+		stats.rejected = 1;
+		stats.failed = (uint64_t) repetitions * dest_cnt;
+		goto out;
+	}
+
+	/* Start each client at a different destination to spread the load */
+	for (i = 0; i < repetitions && !stats.rejected; i++) {
+		for (d = 0; d < dest_cnt; d++) {
+			start = now_us();
+			ret = resolve_one(&dests[(d + id) % dest_cnt], saddr);
+			if (ret == ENOTCONN) {
+				stats.rejected = 1;
+				stats.failed += (uint64_t) (repetitions - i) *
+						dest_cnt - d;
+				break;
+			}
+			if (ret) {
+				stats.failed++;
+				continue;
+			}
+			lat = now_us() - start;
+			stats.resolved++;
+			stats.total_us += lat;
+			if (lat > stats.max_us)
+				stats.max_us = lat;
+			for (b = 0; b < LAT_BUCKETS - 1 && (1ULL << b) < lat; b++)
+				;
+			stats.lat[b]++;
+		}
+	}
+	ib_acm_disconnect();
+out:
+	if (write(fd, &stats, sizeof stats) != sizeof stats)
+		perror("write");
+	close(fd);
+	exit(0);
+}
+
+static uint64_t percentile(struct storm_stats *stats, int pct)
+{
+	uint64_t want, seen = 0;
+	int b;
+
+	want = (stats->resolved * pct + 99) / 100;
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += stats->lat[b];
+		if (seen >= want)
+			return 1ULL << b;
+	}
+	return stats->max_us;
+}
+
+static void show_usage(char *program)
+{
+	printf("usage: %s [options]\n", program);
+	printf("   -d dest[,dest...] - destination IP addresses or names\n");
+	printf("   -f file           - read destinations from file, one per line\n");
+	printf("   [-s src]          - source address\n");
+	printf("   [-S svc]          - ibacm service address (default %s)\n", svc);
+	printf("   [-c clients]      - number of client processes (default %d)\n",
+	       clients);
+	printf("   [-r repetitions]  - passes over the destination list per client (default %d)\n",
+	       repetitions);
+	printf("   [-o]              - nodelay: do not wait for resolution to complete\n");
+	printf("   [-l]              - launch: connect all clients before resolving\n");
+}
+
+/* Each client holds a pipe to us, allow as many as the hard limit */
+static void raise_fd_limit(void)
+{
+	struct rlimit rlim;
+
+	if (!getrlimit(RLIMIT_NOFILE, &rlim)) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct storm_stats total, stats;
+	uint64_t start, elapsed, connect_us = 0;
+	int *fds, pipefd[2], gofd[2];
+	int op, i, ret = 0, connected = 0;
+	char status;
+	pid_t pid;
+
+	while ((op = getopt(argc, argv, "d:f:s:S:c:r:ol")) != -1) {
+		switch (op) {
+		case 'd':
+			if (parse_dests(optarg))
+				exit(1);
+			break;
+		case 'f':
+			if (read_dests(optarg))
+				exit(1);
+			break;
+		case 's':
+			src_addr = optarg;
+			break;
+		case 'S':
+			svc = optarg;
+			break;
+		case 'c':
+			clients = atoi(optarg);
+			break;
+		case 'r':
+			repetitions = atoi(optarg);
+			break;
+		case 'o':
+			nodelay = 1;
+			break;
+		case 'l':
+			launch = 1;
+			break;
+		default:
+			show_usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (!dest_cnt || clients <= 0 || repetitions <= 0) {
+		show_usage(argv[0]);
+		exit(1);
+	}
+
+	fds = calloc(clients, sizeof *fds);
+	if (!fds)
+		exit(1);
+
+	raise_fd_limit();
+	signal(SIGPIPE, SIG_IGN);
+	if (launch) {
+		if (pipe(gofd)) {
+			perror("pipe");
+			exit(1);
+		}
+		go_fd = gofd[0];
+	}
+
+	start = now_us();
+	for (i = 0; i < clients; i++) {
+		if (pipe(pipefd)) {
+			perror("pipe");
+			exit(1);
+		}
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (!pid) {
+			close(pipefd[0]);
+			if (launch)
+				close(gofd[1]);
+			run_client(i, pipefd[1]);
+		}
+		close(pipefd[1]);
+		fds[i] = pipefd[0];
+	}
+
+	if (launch) {
+		close(gofd[0]);
+		for (i = 0; i < clients; i++) {
+			if (read(fds[i], &status, 1) == 1 && status)
+				connected++;
+		}
+		connect_us = now_us() - start;
+		/* closing the pipe releases all clients at once */
+		close(gofd[1]);
+	}
+
+	memset(&total, 0, sizeof total);
+	for (i = 0; i < clients; i++) {
+		if (read(fds[i], &stats, sizeof stats) != sizeof stats) {
+			fprintf(stderr, "client %d: no result\n", i);
+			ret = 1;
+		} else {
+			total.rejected += stats.rejected;
+			total.resolved += stats.resolved;
+			total.failed += stats.failed;
+			total.total_us += stats.total_us;
+			if (stats.max_us > total.max_us)
+				total.max_us = stats.max_us;
+			for (op = 0; op < LAT_BUCKETS; op++)
+				total.lat[op] += stats.lat[op];
+		}
+		close(fds[i]);
+	}
+	while (wait(NULL) > 0)
+		;
+	elapsed = now_us() - start;
+	free(fds);
+
+	printf("clients %d destinations %d repetitions %d\n",
+	       clients, dest_cnt, repetitions);
+	if (launch)
+		printf("connected %d in %.3f s\n", connected,
+		       connect_us / 1000000.0);
+	if (total.rejected)
+		printf("rejected %" PRIu64 " clients\n", total.rejected);
+	printf("resolved %" PRIu64 " failed %" PRIu64 " in %.3f s: %.0f resolves/s\n",
+	       total.resolved, total.failed, elapsed / 1000000.0,
+	       total.resolved * 1000000.0 / (elapsed ? elapsed : 1));
+	if (total.resolved)
+		printf("latency us: avg %" PRIu64 " p50 <=%" PRIu64
+		       " p99 <=%" PRIu64 " max %" PRIu64 "\n",
+		       total.total_us / total.resolved,
+		       percentile(&total, 50), percentile(&total, 99),
+		       total.max_us);
+
+	for (i = 0; i < dest_cnt; i++)
+		free(dests[i].name);
+	return ret || total.failed;
+}
@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <assert.h>
@@ -44,6 +45,7 @@
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
 #include <util/node_name_map.h>
+#include <ccan/minmax.h>
 
 #include <infiniband/ibnetdisc.h>
 
@@ -55,6 +57,12 @@ static unsigned startlid, endlid;
 
 static int brief, dump_all, multicast;
 
+static unsigned outstanding_smps;
+
+/* SMPs on the wire while reading the tables, and to any one switch */
+#define DEFAULT_TABLE_SMPS	32
+#define MAX_SMPS_PER_SWITCH	4
+
 static char *node_name_map_file = NULL;
 static nn_map_t *node_name_map = NULL;
 
@@ -105,8 +113,76 @@ static int dump_mlid(char *str, int strlen, unsigned mlid, unsigned nports,
 
 static __be16 mft[16][IB_MLIDS_IN_BLOCK];
 
+/* The MLID range of node to dump, warn about illegal bounds if asked to */
+static void multicast_range(ibnd_node_t *node, unsigned *startl,
+			    unsigned *endl, int warn)
+{
+	unsigned cap, top;
+
+	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_CAP_F, &cap);
+	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_TOP_F, &top);
+
+	if (!*endl || *endl > IB_MIN_MCAST_LID + cap - 1)
+		*endl = IB_MIN_MCAST_LID + cap - 1;
+	if (!dump_all && top && top < *endl) {
+		if (top < IB_MIN_MCAST_LID - 1) {
+			if (warn)
+				IBWARN("illegal top mlid %x", top);
+		} else
+			*endl = top;
+	}
+
+	if (!*startl)
+		*startl = IB_MIN_MCAST_LID;
+	else if (*startl < IB_MIN_MCAST_LID) {
+		if (warn)
+			IBWARN("illegal start mlid %x, set to %x", *startl,
+			       IB_MIN_MCAST_LID);
+		*startl = IB_MIN_MCAST_LID;
+	}
+
+	if (*endl > IB_MAX_MCAST_LID) {
+		if (warn)
+			IBWARN("illegal end mlid %x, truncate to %x", *endl,
+			       IB_MAX_MCAST_LID);
+		*endl = IB_MAX_MCAST_LID;
+	}
+}
+
+/* Queue the MFT blocks dump_multicast_tables() prints, block by block */
+static unsigned read_multicast_tables(ibnd_node_t *node, unsigned startl,
+				      unsigned endl,
+				      struct ibdiag_rpc_req *reqs,
+				      uint8_t (*data)[IB_SMP_DATA_SIZE],
+				      unsigned target,
+				      struct ibmad_port *mad_port)
+{
+	unsigned block, j, chunks, num = 0;
+	uint32_t mod;
+
+	multicast_range(node, &startl, &endl, 0);
+	chunks = ALIGN(node->numports + 1, 16) / 16;
+
+	for (block = startl / IB_MLIDS_IN_BLOCK;
+	     block <= endl / IB_MLIDS_IN_BLOCK; block++) {
+		for (j = 0; j < chunks; j++, num++) {
+			mod = (block - IB_MIN_MCAST_LID / IB_MLIDS_IN_BLOCK)
+			    | (j << 28);
+
+			if (!reqs)
+				continue;
+			DEBUG("reading block %x chunk %d mod %x", block, j,
+			      mod);
+			ibdiag_smp_req_init(&reqs[num], &node->path_portid,
+					    IB_ATTR_MULTICASTFORWTBL, mod,
+					    data[num], target, mad_port);
+		}
+	}
+	return num;
+}
+
 static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
-				  unsigned endl, struct ibmad_port *mad_port)
+				  unsigned endl, struct ibdiag_rpc_req *reqs)
 {
 	ib_portid_t *portid = &node->path_portid;
 	char nd[IB_SMP_DATA_SIZE] = { 0 };
@@ -126,28 +202,7 @@ static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
 	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_CAP_F, &cap);
 	mad_decode_field(node->switchinfo, IB_SW_MCAST_FDB_TOP_F, &top);
 
-	if (!endl || endl > IB_MIN_MCAST_LID + cap - 1)
-		endl = IB_MIN_MCAST_LID + cap - 1;
-	if (!dump_all && top && top < endl) {
-		if (top < IB_MIN_MCAST_LID - 1)
-			IBWARN("illegal top mlid %x", top);
-		else
-			endl = top;
-	}
-
-	if (!startl)
-		startl = IB_MIN_MCAST_LID;
-	else if (startl < IB_MIN_MCAST_LID) {
-		IBWARN("illegal start mlid %x, set to %x", startl,
-		       IB_MIN_MCAST_LID);
-		startl = IB_MIN_MCAST_LID;
-	}
-
-	if (endl > IB_MAX_MCAST_LID) {
-		IBWARN("illegal end mlid %x, truncate to %x", endl,
-		       IB_MAX_MCAST_LID);
-		endl = IB_MAX_MCAST_LID;
-	}
+	multicast_range(node, &startl, &endl, 1);
 
 	mapnd = remap_node_name(node_name_map, nodeguid, nd);
 
@@ -180,24 +235,21 @@ static void dump_multicast_tables(ibnd_node_t *node, unsigned startl,
 	startblock = startl / IB_MLIDS_IN_BLOCK;
 	lastblock = endl / IB_MLIDS_IN_BLOCK;
 	for (block = startblock; block <= lastblock; block++) {
-		for (j = 0; j < chunks; j++) {
-			int status;
+		for (j = 0; j < chunks; j++, reqs++) {
 			mod = (block - IB_MIN_MCAST_LID / IB_MLIDS_IN_BLOCK)
 			    | (j << 28);
 
-			DEBUG("reading block %x chunk %d mod %x", block, j,
-			      mod);
-			if (!smp_query_status_via
-			    (mft + j, portid, IB_ATTR_MULTICASTFORWTBL, mod, 0,
-			     &status, mad_port)) {
+			/* A block that failed leaves the last one read */
+			if (!reqs->status)
+				memcpy(mft + j, reqs->data, sizeof(mft[j]));
+			else
 				fprintf(stderr, "SubnGet(MFT) failed on switch "
 						"'%s' %s Node GUID 0x%"PRIx64
 						" SMA LID %d; MAD status 0x%x "
 						"AM 0x%x\n",
 						mapnd, portid2str(portid),
 						node->guid, node->smalid,
-						status, mod);
-			}
+						reqs->rpc.rstatus, mod);
 		}
 
 		i = block * IB_MLIDS_IN_BLOCK;
@@ -296,13 +348,57 @@ static int dump_lid(char *str, int str_len, int lid, int valid,
 	return rc;
 }
 
+/* The LID range of node to dump, warn about illegal bounds if asked to */
+static void unicast_range(ibnd_node_t *node, int *endl, int warn)
+{
+	int top;
+
+	mad_decode_field(node->switchinfo, IB_SW_LINEAR_FDB_TOP_F, &top);
+
+	if (!*endl || *endl > top)
+		*endl = top;
+
+	if (*endl > IB_MAX_UCAST_LID) {
+		if (warn)
+			IBWARN("illegal lft top %d, truncate to %d", *endl,
+			       IB_MAX_UCAST_LID);
+		*endl = IB_MAX_UCAST_LID;
+	}
+}
+
+/* Queue the LFT blocks dump_unicast_tables() prints */
+static unsigned read_unicast_tables(ibnd_node_t *node, int startl, int endl,
+				    struct ibdiag_rpc_req *reqs,
+				    uint8_t (*data)[IB_SMP_DATA_SIZE],
+				    unsigned target,
+				    struct ibmad_port *mad_port)
+{
+	int block, startblock, endblock;
+	unsigned num = 0;
+
+	unicast_range(node, &endl, 0);
+
+	startblock = startl / IB_SMP_DATA_SIZE;
+	endblock = ALIGN(endl, IB_SMP_DATA_SIZE) / IB_SMP_DATA_SIZE;
+	for (block = startblock; block < endblock; block++, num++) {
+		if (!reqs)
+			continue;
+		DEBUG("reading block %d", block);
+		ibdiag_smp_req_init(&reqs[num], &node->path_portid,
+				    IB_ATTR_LINEARFORWTBL, block, data[num],
+				    target, mad_port);
+	}
+	return num;
+}
+
 static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
-				struct ibmad_port *mad_port,
+				struct ibdiag_rpc_req *reqs,
 				ibnd_fabric_t *fabric)
 {
 	ib_portid_t * portid = &node->path_portid;
-	char lft[IB_SMP_DATA_SIZE] = { 0 };
+	char empty[IB_SMP_DATA_SIZE] = { 0 };
 	char nd[IB_SMP_DATA_SIZE] = { 0 };
+	char *lft = empty;
 	char str[200];
 	uint64_t nodeguid;
 	int block, i, e, top;
@@ -317,14 +413,7 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 	nports = node->numports;
 	memcpy(nd, node->nodedesc, strlen(node->nodedesc));
 
-	if (!endl || endl > top)
-		endl = top;
-
-	if (endl > IB_MAX_UCAST_LID) {
-		IBWARN("illegal lft top %d, truncate to %d", endl,
-		       IB_MAX_UCAST_LID);
-		endl = IB_MAX_UCAST_LID;
-	}
+	unicast_range(node, &endl, 1);
 
 	mapnd = remap_node_name(node_name_map, nodeguid, nd);
 
@@ -338,18 +427,17 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 	printf("       Port     Info \n");
 	startblock = startl / IB_SMP_DATA_SIZE;
 	endblock = ALIGN(endl, IB_SMP_DATA_SIZE) / IB_SMP_DATA_SIZE;
-	for (block = startblock; block < endblock; block++) {
-		int status;
-		DEBUG("reading block %d", block);
-		if (!smp_query_status_via(lft, portid, IB_ATTR_LINEARFORWTBL, block,
-				   0, &status, mad_port)) {
+	for (block = startblock; block < endblock; block++, reqs++) {
+		/* A block that failed leaves the last one read */
+		if (!reqs->status)
+			lft = reqs->data;
+		else
 			fprintf(stderr, "SubnGet(LFT) failed on switch "
 					"'%s' %s Node GUID 0x%"PRIx64
 					" SMA LID %d; MAD status 0x%x AM 0x%x\n",
 					mapnd, portid2str(portid),
 					node->guid, node->smalid,
-					status, block);
-		}
+					reqs->rpc.rstatus, block);
 		i = block * IB_SMP_DATA_SIZE;
 		e = i + IB_SMP_DATA_SIZE;
 		if (i < startl)
@@ -374,19 +462,102 @@ static void dump_unicast_tables(ibnd_node_t *node, int startl, int endl,
 	free(mapnd);
 }
 
-static void dump_node(ibnd_node_t *node, struct ibmad_port *mad_port,
+static unsigned read_node(ibnd_node_t *node, struct ibdiag_rpc_req *reqs,
+			  uint8_t (*data)[IB_SMP_DATA_SIZE], unsigned target,
+			  struct ibmad_port *mad_port)
+{
+	if (multicast)
+		return read_multicast_tables(node, startlid, endlid, reqs,
+					     data, target, mad_port);
+	else
+		return read_unicast_tables(node, startlid, endlid, reqs, data,
+					   target, mad_port);
+}
+
+static void dump_node(ibnd_node_t *node, struct ibdiag_rpc_req *reqs,
 		      ibnd_fabric_t *fabric)
 {
 	if (multicast)
-		dump_multicast_tables(node, startlid, endlid, mad_port);
+		dump_multicast_tables(node, startlid, endlid, reqs);
 	else
-		dump_unicast_tables(node, startlid, endlid,
-						mad_port, fabric);
+		dump_unicast_tables(node, startlid, endlid, reqs, fabric);
+}
+
+struct switch_list {
+	ibnd_node_t **nodes;
+	unsigned num, size;
+};
+
+static void add_switch(ibnd_node_t *node, void *user_data)
+{
+	struct switch_list *list = user_data;
+	ibnd_node_t **nodes;
+
+	if (list->num == list->size) {
+		list->size = list->size ? 2 * list->size : 64;
+		nodes = realloc(list->nodes, list->size * sizeof(*nodes));
+		if (!nodes)
+			IBEXIT("out of memory for the switch list");
+		list->nodes = nodes;
+	}
+	list->nodes[list->num++] = node;
 }
 
-static void process_switch(ibnd_node_t *node, void *fabric)
+/*
+ * Read the tables of a group of switches with many SMPs in flight, but no
+ * more than MAX_SMPS_PER_SWITCH to one switch, then print them in the order
+ * the fabric lists them, as reading them one block at a time did.
+ */
+static void dump_switches(ibnd_fabric_t *fabric, struct ibmad_port *mad_port)
 {
-	dump_node(node, srcport, (ibnd_fabric_t *)fabric);
+	struct switch_list list = { 0 };
+	struct ibdiag_rpc_req *reqs;
+	uint8_t (*data)[IB_SMP_DATA_SIZE];
+	unsigned max_smps = outstanding_smps ? outstanding_smps :
+			    DEFAULT_TABLE_SMPS;
+	unsigned per_switch = min_t(unsigned, max_smps, MAX_SMPS_PER_SWITCH);
+	unsigned group = max(1U, 2 * max_smps / per_switch);
+	unsigned *first;
+	unsigned i, end, k, num;
+
+	ibnd_iter_nodes_type(fabric, add_switch, IB_NODE_SWITCH, &list);
+
+	first = calloc(group + 1, sizeof(*first));
+	if (!first)
+		IBEXIT("out of memory");
+
+	for (i = 0; i < list.num; i = end) {
+		end = min(list.num, i + group);
+
+		num = 0;
+		for (k = i; k < end; k++) {
+			first[k - i] = num;
+			num += read_node(list.nodes[k], NULL, NULL, 0, mad_port);
+		}
+		first[end - i] = num;
+
+		reqs = calloc(num, sizeof(*reqs));
+		data = calloc(num, sizeof(*data));
+		if (num && (!reqs || !data))
+			IBEXIT("out of memory for %u table blocks", num);
+
+		for (k = i; k < end; k++)
+			read_node(list.nodes[k], reqs + first[k - i],
+				  data + first[k - i], k - i, mad_port);
+		if (ibdiag_rpc_batch(reqs, num, max_smps, per_switch,
+				     mad_port))
+			IBWARN("reading forwarding tables failed: %s",
+			       strerror(errno));
+
+		for (k = i; k < end; k++)
+			dump_node(list.nodes[k], reqs + first[k - i], fabric);
+
+		free(reqs);
+		free(data);
+	}
+
+	free(first);
+	free(list.nodes);
 }
 
 static int process_opt(void *context, int ch)
@@ -401,6 +572,9 @@ static int process_opt(void *context, int ch)
 	case 'n':
 		brief++;
 		break;
+	case 'o':
+		outstanding_smps = strtoul(optarg, NULL, 0);
+		break;
 	case 1:
 		node_name_map_file = strdup(optarg);
 		if (node_name_map_file == NULL)
@@ -427,6 +601,9 @@ int main(int argc, char **argv)
 		 "do not try to resolve destinations"},
 		{"Multicast", 'M', 0, NULL, "show multicast forwarding tables"},
 		{"node-name-map", 1, 1, "<file>", "node name map file"},
+		{"outstanding_smps", 'o', 1, NULL,
+		 "specify the number of outstanding SMP's which should be "
+		 "issued during the scan and while reading the tables"},
 		{}
 	};
 	char usage_args[] = "[<dest dr_path|lid|guid> [<startlid> [<endlid>]]]";
@@ -459,6 +636,7 @@ int main(int argc, char **argv)
 	if (ibd_timeout)
 		config.timeout_ms = ibd_timeout;
 
+	config.max_smps = outstanding_smps;
 	config.flags = ibd_ibnetdisc_flags;
 	config.mkey = ibd_mkey;
 
@@ -478,7 +656,7 @@ int main(int argc, char **argv)
 			mad_rpc_set_timeout(srcport, ibd_timeout);
 		}
 
-		ibnd_iter_nodes_type(fabric, process_switch, IB_NODE_SWITCH, fabric);
+		dump_switches(fabric, srcport);
 
 		mad_rpc_close_port(srcport);
 
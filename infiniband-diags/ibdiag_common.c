@@ -939,6 +939,121 @@ void dump_portinfo(void *pi, int tabs)
 	}
 }
 
+void ibdiag_smp_req_init(struct ibdiag_rpc_req *req, ib_portid_t *portid,
+			 unsigned attrid, unsigned mod, void *data,
+			 unsigned target, const struct ibmad_port *srcport)
+{
+	memset(req, 0, sizeof(*req));
+	req->rpc.method = IB_MAD_METHOD_GET;
+	req->rpc.attr.id = attrid;
+	req->rpc.attr.mod = mod;
+	req->rpc.datasz = IB_SMP_DATA_SIZE;
+	req->rpc.dataoffs = IB_SMP_DATA_OFFS;
+	req->rpc.mkey = smp_mkey_get(srcport);
+
+	if ((portid->lid <= 0) ||
+	    (portid->drpath.drslid == 0xffff) ||
+	    (portid->drpath.drdlid == 0xffff))
+		req->rpc.mgtclass = IB_SMI_DIRECT_CLASS;	/* direct SMI */
+	else
+		req->rpc.mgtclass = IB_SMI_CLASS;	/* Lid routed SMI */
+
+	req->portid = *portid;
+	req->portid.sl = 0;
+	req->portid.qp = 0;
+	req->data = data;
+	req->target = target;
+}
+
+struct rpc_batch_target {
+	unsigned next, end, inflight;
+};
+
+int ibdiag_rpc_batch(struct ibdiag_rpc_req *reqs, unsigned num,
+		     unsigned max_outstanding, unsigned max_per_target,
+		     const struct ibmad_port *srcport)
+{
+	struct ibmad_async_wc wc[16];
+	struct rpc_batch_target *targets, *t;
+	struct ibmad_async *async;
+	struct ibdiag_rpc_req *req;
+	unsigned i, num_targets, first = 0, done = 0;
+	int n, rc = 0;
+
+	if (!num)
+		return 0;
+	if (!max_outstanding)
+		max_outstanding = 1;
+	if (!max_per_target)
+		max_per_target = 1;
+
+	num_targets = reqs[num - 1].target + 1;
+	targets = calloc(num_targets, sizeof(*targets));
+	if (!targets)
+		return -1;
+	for (i = num; i--;) {
+		reqs[i].status = EINPROGRESS;
+		targets[reqs[i].target].next = i;
+	}
+	for (i = 0; i < num; i++)
+		targets[reqs[i].target].end = i + 1;
+
+	async = mad_rpc_async_create(srcport, max_outstanding);
+	if (!async) {
+		free(targets);
+		return -1;
+	}
+
+	while (done < num) {
+		/* Top up the window, oldest targets first */
+		for (i = first; i < num_targets &&
+		     mad_rpc_async_outstanding(async) < max_outstanding; i++) {
+			t = &targets[i];
+			while (t->next < t->end && t->inflight < max_per_target &&
+			       mad_rpc_async_outstanding(async) <
+			       max_outstanding) {
+				req = &reqs[t->next++];
+				DEBUG("attr 0x%x mod 0x%x route %s",
+				      req->rpc.attr.id, req->rpc.attr.mod,
+				      portid2str(&req->portid));
+				if (mad_rpc_async_submit(async, &req->rpc,
+							 &req->portid,
+							 req->data, req->data,
+							 NULL, req)) {
+					req->status = errno;
+					done++;
+					continue;
+				}
+				t->inflight++;
+			}
+			if (i == first && t->next == t->end)
+				first++;
+		}
+		if (!mad_rpc_async_outstanding(async))
+			continue;
+
+		n = mad_rpc_async_poll(async, wc, 16, -1);
+		if (n < 0) {
+			n = errno;
+			for (i = 0; i < num; i++)
+				if (reqs[i].status == EINPROGRESS)
+					reqs[i].status = n;
+			rc = -1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			req = wc[i].context;
+			req->status = wc[i].status;
+			targets[req->target].inflight--;
+			done++;
+		}
+	}
+
+	mad_rpc_async_destroy(async);
+	free(targets);
+	return rc;
+}
+
 op_fn_t *match_op(const match_rec_t match_tbl[], char *name)
 {
 	const match_rec_t *r;
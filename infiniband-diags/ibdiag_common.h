@@ -120,6 +120,31 @@ int snprint_field(char *buf, size_t n, enum MAD_FIELDS f, int spacing,
 	__attribute__((format(printf, 5, 6)));
 void dump_portinfo(void *pi, int tabs);
 
+/*
+ * A MAD issued with ibdiag_rpc_batch(). Requests to the same node share a
+ * target number; targets are numbered from 0 and the array is sorted by them.
+ */
+struct ibdiag_rpc_req {
+	ib_rpc_t rpc;
+	ib_portid_t portid;
+	void *data;		/* payload, replaced by the response data */
+	unsigned target;
+	int status;		/* 0, EIO if rpc.rstatus is set, or errno */
+};
+
+/* Set up req as smp_query_status_via() would send it */
+void ibdiag_smp_req_init(struct ibdiag_rpc_req *req, ib_portid_t *portid,
+			 unsigned attrid, unsigned mod, void *data,
+			 unsigned target, const struct ibmad_port *srcport);
+/*
+ * Issue all requests with up to max_outstanding of them, and at most
+ * max_per_target to one target, on the wire at once. Returns 0 once every
+ * request has its status, -1 if the port failed.
+ */
+int ibdiag_rpc_batch(struct ibdiag_rpc_req *reqs, unsigned num,
+		     unsigned max_outstanding, unsigned max_per_target,
+		     const struct ibmad_port *srcport);
+
 /**
  * Some common command line parsing
  */
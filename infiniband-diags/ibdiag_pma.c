@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ibdiag_pma.h"
+
+void ibdiag_pma_req_init(struct ibdiag_rpc_req *req, ib_portid_t *portid,
+			 int port, unsigned attrid, unsigned timeout,
+			 void *data, unsigned target)
+{
+	memset(req, 0, sizeof(*req));
+	req->rpc.mgtclass = IB_PERFORMANCE_CLASS;
+	req->rpc.method = IB_MAD_METHOD_GET;
+	req->rpc.attr.id = attrid;
+	req->rpc.timeout = timeout;
+	req->rpc.datasz = IB_PC_DATA_SZ;
+	req->rpc.dataoffs = IB_PC_DATA_OFFS;
+
+	req->portid = *portid;
+	if (!req->portid.qp)
+		req->portid.qp = 1;
+	if (!req->portid.qkey)
+		req->portid.qkey = IB_DEFAULT_QP1_QKEY;
+
+	memset(data, 0, IB_PC_DATA_SZ);
+	mad_set_field(data, 0, IB_PC_PORT_SELECT_F, port);
+	req->data = data;
+	req->target = target;
+}
+
+struct ibdiag_pma_table *ibdiag_pma_table_alloc(const uint16_t *attrs,
+						unsigned num_attrs)
+{
+	struct ibdiag_pma_table *t;
+
+	if (num_attrs > IBDIAG_PMA_MAX_ATTRS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->num_attrs = num_attrs;
+	memcpy(t->attrs, attrs, num_attrs * sizeof(*attrs));
+	return t;
+}
+
+void ibdiag_pma_table_free(struct ibdiag_pma_table *t)
+{
+	unsigned i;
+
+	if (!t)
+		return;
+	for (i = 0; i < t->num_attrs; i++) {
+		free(t->data[i]);
+		free(t->status[i]);
+	}
+	free(t->portid);
+	free(t->port);
+	free(t->node);
+	free(t);
+}
+
+void ibdiag_pma_table_reset(struct ibdiag_pma_table *t)
+{
+	t->num_rows = 0;
+}
+
+static int grow(void **array, size_t size)
+{
+	void *p = realloc(*array, size);
+
+	if (!p)
+		return -1;
+	*array = p;
+	return 0;
+}
+
+static int table_grow(struct ibdiag_pma_table *t)
+{
+	unsigned max = t->max_rows ? 2 * t->max_rows : 64;
+	unsigned i;
+
+	if (grow((void **)&t->portid, max * sizeof(*t->portid)) ||
+	    grow((void **)&t->port, max * sizeof(*t->port)) ||
+	    grow((void **)&t->node, max * sizeof(*t->node)))
+		return -1;
+	for (i = 0; i < t->num_attrs; i++)
+		if (grow((void **)&t->data[i], (size_t)max * IB_PC_DATA_SZ) ||
+		    grow((void **)&t->status[i], max * sizeof(*t->status[i])))
+			return -1;
+	t->max_rows = max;
+	return 0;
+}
+
+int ibdiag_pma_add_row(struct ibdiag_pma_table *t, ib_portid_t *portid,
+		       int port, unsigned node)
+{
+	unsigned row = t->num_rows;
+	unsigned i;
+
+	if (row == t->max_rows && table_grow(t))
+		return -1;
+
+	t->portid[row] = *portid;
+	t->port[row] = port;
+	t->node[row] = node;
+	for (i = 0; i < t->num_attrs; i++)
+		t->status[i][row] = ENODATA;
+	t->num_rows++;
+	return row;
+}
+
+void ibdiag_pma_want(struct ibdiag_pma_table *t, unsigned row, unsigned attr)
+{
+	t->status[attr][row] = EINPROGRESS;
+}
+
+struct pma_cell {
+	unsigned node, row, attr;
+};
+
+static int cell_cmp(const void *a, const void *b)
+{
+	const struct pma_cell *x = a, *y = b;
+
+	if (x->node != y->node)
+		return x->node < y->node ? -1 : 1;
+	if (x->row != y->row)
+		return x->row < y->row ? -1 : 1;
+	return x->attr < y->attr ? -1 : x->attr > y->attr;
+}
+
+int ibdiag_pma_read(struct ibdiag_pma_table *t, unsigned max_outstanding,
+		    unsigned max_per_node, unsigned timeout,
+		    const struct ibmad_port *srcport)
+{
+	struct ibdiag_rpc_req *reqs;
+	struct pma_cell *cells, *c;
+	unsigned row, attr, i, num = 0, target = 0;
+	int rc = -1;
+
+	for (row = 0; row < t->num_rows; row++)
+		for (attr = 0; attr < t->num_attrs; attr++)
+			if (t->status[attr][row] == EINPROGRESS)
+				num++;
+	if (!num)
+		return 0;
+
+	cells = calloc(num, sizeof(*cells));
+	reqs = calloc(num, sizeof(*reqs));
+	if (!cells || !reqs)
+		goto out;
+
+	num = 0;
+	for (row = 0; row < t->num_rows; row++)
+		for (attr = 0; attr < t->num_attrs; attr++)
+			if (t->status[attr][row] == EINPROGRESS) {
+				cells[num].node = t->node[row];
+				cells[num].row = row;
+				cells[num++].attr = attr;
+			}
+
+	/* The batch wants the requests of a target together, numbered from 0 */
+	qsort(cells, num, sizeof(*cells), cell_cmp);
+	for (i = 0; i < num; i++) {
+		c = &cells[i];
+		if (i && c->node != cells[i - 1].node)
+			target++;
+		ibdiag_pma_req_init(&reqs[i], &t->portid[c->row],
+				    t->port[c->row], t->attrs[c->attr], timeout,
+				    t->data[c->attr] +
+				    (size_t)c->row * IB_PC_DATA_SZ,
+				    target);
+	}
+
+	rc = ibdiag_rpc_batch(reqs, num, max_outstanding, max_per_node,
+			      srcport);
+
+	for (i = 0; i < num; i++)
+		t->status[cells[i].attr][cells[i].row] = reqs[i].status;
+out:
+	free(reqs);
+	free(cells);
+	return rc;
+}
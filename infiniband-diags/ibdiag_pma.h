@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef _IBDIAG_PMA_H_
+#define _IBDIAG_PMA_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <infiniband/mad.h>
+
+#include "ibdiag_common.h"
+
+#define IBDIAG_PMA_DEFAULT_OUTSTANDING	32
+#define IBDIAG_PMA_MAX_PER_NODE		4
+#define IBDIAG_PMA_MAX_ATTRS		8
+
+/*
+ * PMA attributes read from a set of ports, kept by column: each attribute
+ * has one array holding IB_PC_DATA_SZ bytes for every row, and one with the
+ * status of every row.  A row is a port select value sent to a PMA, the
+ * tools add a row for AllPortSelect (0xFF) or ClassPortInfo the same way.
+ *
+ * A cell starts out as ENODATA, ibdiag_pma_want() marks it EINPROGRESS and
+ * ibdiag_pma_read() fetches all marked cells at once.  After that the status
+ * is 0, EIO if the PMA returned an error status, or an errno.
+ */
+struct ibdiag_pma_table {
+	unsigned num_attrs;
+	uint16_t attrs[IBDIAG_PMA_MAX_ATTRS];
+	unsigned num_rows, max_rows;
+
+	ib_portid_t *portid;
+	int *port;
+	unsigned *node;
+
+	uint8_t *data[IBDIAG_PMA_MAX_ATTRS];
+	int *status[IBDIAG_PMA_MAX_ATTRS];
+};
+
+/* Set up req as pma_query_via() would send it */
+void ibdiag_pma_req_init(struct ibdiag_rpc_req *req, ib_portid_t *portid,
+			 int port, unsigned attrid, unsigned timeout,
+			 void *data, unsigned target);
+
+struct ibdiag_pma_table *ibdiag_pma_table_alloc(const uint16_t *attrs,
+						unsigned num_attrs);
+void ibdiag_pma_table_free(struct ibdiag_pma_table *t);
+/* Drop all rows, the table keeps its memory for the next set of ports */
+void ibdiag_pma_table_reset(struct ibdiag_pma_table *t);
+/*
+ * Add a row and return its index, or -1 if out of memory.  node identifies
+ * the PMA the row is read from.
+ */
+int ibdiag_pma_add_row(struct ibdiag_pma_table *t, ib_portid_t *portid,
+		       int port, unsigned node);
+void ibdiag_pma_want(struct ibdiag_pma_table *t, unsigned row, unsigned attr);
+/*
+ * Read every wanted cell with up to max_outstanding queries on the wire and
+ * at most max_per_node to one node.  The nodes are read in ascending order.
+ * Returns 0 once every cell has its status, -1 if the port failed.
+ */
+int ibdiag_pma_read(struct ibdiag_pma_table *t, unsigned max_outstanding,
+		    unsigned max_per_node, unsigned timeout,
+		    const struct ibmad_port *srcport);
+
+static inline int ibdiag_pma_status(struct ibdiag_pma_table *t,
+				    unsigned row, unsigned attr)
+{
+	return t->status[attr][row];
+}
+
+/* The attribute data, or NULL if it was not read successfully */
+static inline uint8_t *ibdiag_pma_data(struct ibdiag_pma_table *t,
+				       unsigned row, unsigned attr)
+{
+	if (t->status[attr][row])
+		return NULL;
+	return t->data[attr] + (size_t)row * IB_PC_DATA_SZ;
+}
+
+#endif /* _IBDIAG_PMA_H_ */
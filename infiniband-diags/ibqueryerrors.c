@@ -48,10 +48,13 @@
 #include <inttypes.h>
 
 #include <util/node_name_map.h>
+#include <ccan/array_size.h>
+#include <ccan/minmax.h>
 #include <infiniband/ibnetdisc.h>
 #include <infiniband/mad.h>
 
 #include "ibdiag_common.h"
+#include "ibdiag_pma.h"
 #include "ibdiag_sa.h"
 
 static struct ibmad_port *ibmad_port;
@@ -72,6 +75,37 @@ static enum MAD_FIELDS suppressed_fields[SUP_MAX];
 static char *dr_path;
 static uint8_t node_type_to_print;
 static unsigned clear_errors, clear_counts, details;
+static unsigned max_pmas = IBDIAG_PMA_DEFAULT_OUTSTANDING;
+
+/* The attributes read for every node, in the order of pma_attrs[] */
+enum {
+	PMA_CPI,
+	PMA_PC,
+	PMA_PC_EXT,
+	PMA_XMIT_DISC,
+	PMA_RCV_ERR,
+};
+
+static const uint16_t pma_attrs[] = {
+	CLASS_PORT_INFO,
+	IB_GSI_PORT_COUNTERS,
+	IB_GSI_PORT_COUNTERS_EXT,
+	IB_GSI_PORT_XMIT_DISCARD_DETAILS,
+	IB_GSI_PORT_RCV_ERROR_DETAILS,
+};
+
+static struct ibdiag_pma_table *pma;
+
+/* A node being swept, with the rows of pma it was read into */
+struct node_sweep {
+	ibnd_node_t *node;
+	char *node_name;
+	int cpi_row, all_row;
+	int first_row, end_row;	/* one row for each port */
+	__be16 cap_mask;
+	uint32_t cap_mask2;
+	int all_port_sup;
+};
 
 #define PRINT_SWITCH 0x1
 #define PRINT_CA     0x2
@@ -363,22 +397,23 @@ Exit:
      return ret;
 }
 
-static int query_and_dump(char *buf, size_t size, ib_portid_t * portid,
-			  char *node_name, int portnum,
-			  const char *attr_name, uint16_t attr_id,
-			  int start_field, int end_field)
+static void pma_warn(struct node_sweep *ns, int row, const char *attr_name)
 {
-	uint8_t pc[1024];
+	IBWARN("%s query failed on %s, %s port %d", attr_name, ns->node_name,
+	       portid2str(&pma->portid[row]), pma->port[row]);
+	summary.pma_query_failures++;
+}
+
+static int dump_details(char *buf, size_t size, struct node_sweep *ns,
+			int row, int attr, const char *attr_name,
+			int start_field, int end_field)
+{
+	uint8_t *pc = ibdiag_pma_data(pma, row, attr);
 	uint32_t val = 0;
 	int i, n;
 
-	memset(pc, 0, sizeof(pc));
-
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout, attr_id,
-			   ibmad_port)) {
-		IBWARN("%s query failed on %s, %s port %d", attr_name,
-		       node_name, portid2str(portid), portnum);
-		summary.pma_query_failures++;
+	if (!pc) {
+		pma_warn(ns, row, attr_name);
 		return 0;
 	}
 
@@ -423,14 +458,22 @@ static int check_threshold(uint8_t *pc, uint8_t *pce, uint32_t cap_mask2,
 	return is_exceeds;
 }
 
-static int print_results(ib_portid_t * portid, char *node_name,
-			 ibnd_node_t * node, uint8_t * pc, int portnum,
-			 int *header_printed, uint8_t *pce, __be16 cap_mask,
-			 uint32_t cap_mask2)
+/*
+ * Print the counters beyond their threshold to str.  With want_details the
+ * details of PortXmitDiscards and PortRcvErrors are not printed, they are
+ * marked to be read for the row instead.
+ */
+static int check_errors(char *str, size_t size, struct node_sweep *ns,
+			int row, uint8_t *pc, uint8_t *pce, int want_details)
 {
-	char buf[2048];
-	char *str = buf;
 	int i, ext_i, n;
+	int attr;
+
+	if (!(ns->cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
+		/* if PortCounters:PortXmitWait not supported clear this counter */
+		uint32_t foo = 0;
+		mad_encode_field(pc, IB_PC_XMT_WAIT_F, &foo);
+	}
 
 	for (n = 0, i = IB_PC_ERR_SYM_F, ext_i = IB_PC_EXT_ERR_SYM_F;
 			i <= IB_PC_VL15_DROPPED_F; i++, ext_i++ ) {
@@ -443,33 +486,56 @@ static int print_results(ib_portid_t * portid, char *node_name,
 			continue;
 		}
 
-		if (check_threshold(pc, pce, cap_mask2, i, ext_i, &n, str, sizeof(buf))) {
+		if (check_threshold(pc, pce, ns->cap_mask2, i, ext_i, &n, str,
+				    size)) {
+			if (!details)
+				continue;
+
+			attr = i == IB_PC_XMT_DISCARDS_F ? PMA_XMIT_DISC :
+			       i == IB_PC_ERR_RCV_F ? PMA_RCV_ERR : -1;
+			if (attr < 0)
+				continue;
+			if (want_details) {
+				if (ibdiag_pma_status(pma, row, attr) == ENODATA)
+					ibdiag_pma_want(pma, row, attr);
+				continue;
+			}
 
 			/* If there are PortXmitDiscards, get details (if supported) */
-			if (i == IB_PC_XMT_DISCARDS_F && details) {
-				n += query_and_dump(str + n, sizeof(buf) - n, portid,
-						    node_name, portnum,
-						    "PortXmitDiscardDetails",
-						    IB_GSI_PORT_XMIT_DISCARD_DETAILS,
-						    IB_PC_RCV_LOCAL_PHY_ERR_F,
-						    IB_PC_RCV_ERR_LAST_F);
+			if (attr == PMA_XMIT_DISC) {
+				n += dump_details(str + n, size - n, ns, row,
+						  attr, "PortXmitDiscardDetails",
+						  IB_PC_RCV_LOCAL_PHY_ERR_F,
+						  IB_PC_RCV_ERR_LAST_F);
 				/* If there are PortRcvErrors, get details (if supported) */
-			} else if (i == IB_PC_ERR_RCV_F && details) {
-				n += query_and_dump(str + n, sizeof(buf) - n, portid,
-						    node_name, portnum,
-						    "PortRcvErrorDetails",
-						    IB_GSI_PORT_RCV_ERROR_DETAILS,
-						    IB_PC_XMT_INACT_DISC_F,
-						    IB_PC_XMT_DISC_LAST_F);
+			} else {
+				n += dump_details(str + n, size - n, ns, row,
+						  attr, "PortRcvErrorDetails",
+						  IB_PC_XMT_INACT_DISC_F,
+						  IB_PC_XMT_DISC_LAST_F);
 			}
 		}
 	}
 
 	if (!suppress(IB_PC_XMT_WAIT_F)) {
-		check_threshold(pc, pce, cap_mask2, IB_PC_XMT_WAIT_F,
-				IB_PC_EXT_XMT_WAIT_F, &n, str, sizeof(buf));
+		check_threshold(pc, pce, ns->cap_mask2, IB_PC_XMT_WAIT_F,
+				IB_PC_EXT_XMT_WAIT_F, &n, str, size);
 	}
 
+	return n;
+}
+
+static int print_results(struct node_sweep *ns, int row, uint8_t *pc,
+			 uint8_t *pce, int *header_printed)
+{
+	ibnd_node_t *node = ns->node;
+	int portnum = pma->port[row];
+	char buf[2048];
+	char *str = buf;
+	int i, n;
+
+	n = check_errors(str, sizeof(buf), ns, row, pc, pce, 0);
+
 	/* if we found errors. */
 	if (n != 0) {
 		if (data_counters) {
@@ -480,7 +546,7 @@ static int print_results(ib_portid_t * portid, char *node_name,
 			if (pce) {
 				pkt = pce;
 				start_field = IB_PC_EXT_XMT_BYTES_F;
-				if (cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
+				if (ns->cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
 					end_field = IB_PC_EXT_RCV_MPKTS_F;
 				else
 					end_field = IB_PC_EXT_RCV_PKTS_F;
@@ -512,9 +578,9 @@ static int print_results(ib_portid_t * portid, char *node_name,
 		if (!*header_printed) {
 			if (node->type == IB_NODE_SWITCH)
 				printf("Errors for 0x%" PRIx64 " \"%s\"\n",
-					node->ports[0]->guid, node_name);
+					node->ports[0]->guid, ns->node_name);
 			else
-				printf("Errors for \"%s\"\n", node_name);
+				printf("Errors for \"%s\"\n", ns->node_name);
 			*header_printed = 1;
 			summary.bad_nodes++;
 		}
@@ -534,65 +600,31 @@ static int print_results(ib_portid_t * portid, char *node_name,
 	return (n);
 }
 
-static int query_cap_mask(ib_portid_t * portid, char *node_name, int portnum,
-			  __be16 * cap_mask, uint32_t * cap_mask2)
-{
-	uint8_t pc[1024] = { 0 };
-	__be16 rc_cap_mask;
-	__be32 rc_cap_mask2;
-
-	portid->sl = lid2sl_table[portid->lid];
-
-	/* PerfMgt ClassPortInfo is a required attribute */
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout, CLASS_PORT_INFO,
-			   ibmad_port)) {
-		IBWARN("classportinfo query failed on %s, %s port %d",
-		       node_name, portid2str(portid), portnum);
-		summary.pma_query_failures++;
-		return -1;
-	}
-
-	/* ClassPortInfo should be supported as part of libibmad */
-	memcpy(&rc_cap_mask, pc + 2, sizeof(rc_cap_mask));	/* CapabilityMask */
-	memcpy(&rc_cap_mask2, pc + 4, sizeof(rc_cap_mask2));	/* CapabilityMask2 */
-
-	*cap_mask = rc_cap_mask;
-	*cap_mask2 = ntohl(rc_cap_mask2) >> 5;
-	return 0;
-}
-
-static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
-			   char *node_name, ibnd_node_t * node, int portnum,
+static int print_data_cnts(struct node_sweep *ns, int row,
 			   int *header_printed)
 {
-	uint8_t pc[1024];
+	ibnd_node_t *node = ns->node;
+	int portnum = pma->port[row];
+	uint8_t *pc;
 	int i;
 	int start_field = IB_PC_XMT_BYTES_F;
 	int end_field = IB_PC_RCV_PKTS_F;
 
-	memset(pc, 0, 1024);
-
-	portid->sl = lid2sl_table[portid->lid];
-
-	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
+	if (ns->cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
+		pc = ibdiag_pma_data(pma, row, PMA_PC_EXT);
+		if (!pc) {
+			pma_warn(ns, row, "IB_GSI_PORT_COUNTERS_EXT");
 			return (1);
 		}
 		start_field = IB_PC_EXT_XMT_BYTES_F;
-		if (cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
+		if (ns->cap_mask & IB_PM_EXT_WIDTH_SUPPORTED)
 			end_field = IB_PC_EXT_RCV_MPKTS_F;
 		else
 			end_field = IB_PC_EXT_RCV_PKTS_F;
 	} else {
-		if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-				   IB_GSI_PORT_COUNTERS, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
+		pc = ibdiag_pma_data(pma, row, PMA_PC);
+		if (!pc) {
+			pma_warn(ns, row, "IB_GSI_PORT_COUNTERS");
 			return (1);
 		}
 		start_field = IB_PC_XMT_BYTES_F;
@@ -601,7 +633,7 @@ static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
 
 	if (!*header_printed) {
 		printf("Data Counters for 0x%" PRIx64 " \"%s\"\n", node->guid,
-		       node_name);
+		       ns->node_name);
 		*header_printed = 1;
 	}
 
@@ -632,45 +664,46 @@ static int print_data_cnts(ib_portid_t * portid, __be16 cap_mask,
 	return (0);
 }
 
-static int print_errors(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask2,
-			char *node_name, ibnd_node_t * node, int portnum,
-			int *header_printed)
+static int get_counters(struct node_sweep *ns, int row, uint8_t **pc,
+			uint8_t **pce, int warn)
 {
-	uint8_t pc[1024];
-	uint8_t pce[1024];
-	uint8_t *pc_ext = NULL;
+	*pce = NULL;
+	*pc = ibdiag_pma_data(pma, row, PMA_PC);
+	if (!*pc) {
+		if (warn)
+			pma_warn(ns, row, "IB_GSI_PORT_COUNTERS");
+		return -1;
+	}
 
-	memset(pc, 0, 1024);
-	memset(pce, 0, 1024);
+	if (ns->cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
+		*pce = ibdiag_pma_data(pma, row, PMA_PC_EXT);
+		if (!*pce) {
+			if (warn)
+				pma_warn(ns, row, "IB_GSI_PORT_COUNTERS_EXT");
+			return -1;
+		}
+	}
+	return 0;
+}
 
-	portid->sl = lid2sl_table[portid->lid];
+static int print_errors(struct node_sweep *ns, int row, int *header_printed)
+{
+	uint8_t *pc, *pce;
 
-	if (!pma_query_via(pc, portid, portnum, ibd_timeout,
-			   IB_GSI_PORT_COUNTERS, ibmad_port)) {
-		IBWARN("IB_GSI_PORT_COUNTERS query failed on %s, %s port %d",
-		       node_name, portid2str(portid), portnum);
-		summary.pma_query_failures++;
+	if (get_counters(ns, row, &pc, &pce, 1))
 		return (0);
-	}
+	return (print_results(ns, row, pc, pce, header_printed));
+}
 
-	if (cap_mask & (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP)) {
-		if (!pma_query_via(pce, portid, portnum, ibd_timeout,
-		    IB_GSI_PORT_COUNTERS_EXT, ibmad_port)) {
-			IBWARN("IB_GSI_PORT_COUNTERS_EXT query failed on %s, %s port %d",
-			       node_name, portid2str(portid), portnum);
-			summary.pma_query_failures++;
-			return (0);
-		}
-		pc_ext = pce;
-	}
+/* Returns if a row that has been read has errors, and marks its details */
+static int check_row(struct node_sweep *ns, int row)
+{
+	char buf[2048];
+	uint8_t *pc, *pce;
 
-	if (!(cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
-		/* if PortCounters:PortXmitWait not supported clear this counter */
-		uint32_t foo = 0;
-		mad_encode_field(pc, IB_PC_XMT_WAIT_F, &foo);
-	}
-	return (print_results(portid, node_name, node, pc, portnum,
-			      header_printed, pc_ext, cap_mask, cap_mask2));
+	if (get_counters(ns, row, &pc, &pce, 0))
+		return 0;
+	return check_errors(buf, sizeof(buf), ns, row, pc, pce, 1);
 }
 
 static uint8_t *reset_pc_ext(void *rcvbuf, ib_portid_t *dest, int port,
@@ -770,37 +803,62 @@ static void clear_port(ib_portid_t * portid, __be16 cap_mask, uint32_t cap_mask2
 	}
 }
 
-static void print_node(ibnd_node_t *node, void *user_data)
+static int add_row(ib_portid_t *portid, int port, unsigned idx)
 {
-	int header_printed = 0;
-	int p = 0;
-	int startport = 1;
-	int type = 0;
-	int all_port_sup = 0;
-	ib_portid_t portid = { 0 };
-	__be16 cap_mask = 0;
-	uint32_t cap_mask2 = 0;
-	char *node_name = NULL;
+	int row;
 
-	switch (node->type) {
-	case IB_NODE_SWITCH:
-		type = PRINT_SWITCH;
-		break;
-	case IB_NODE_CA:
-		type = PRINT_CA;
-		break;
-	case IB_NODE_ROUTER:
-		type = PRINT_ROUTER;
-		break;
-	}
+	portid->sl = lid2sl_table[portid->lid];
+	row = ibdiag_pma_add_row(pma, portid, port, idx);
+	if (row < 0)
+		IBEXIT("out of memory");
+	return row;
+}
 
-	if ((type & node_type_to_print) == 0)
-		return;
+static void want_counters(struct node_sweep *ns, int row)
+{
+	int ext = ns->cap_mask &
+		  (IB_PM_EXT_WIDTH_SUPPORTED | IB_PM_EXT_WIDTH_NOIETF_SUP);
+
+	if (!data_counters_only || !ext)
+		ibdiag_pma_want(pma, row, PMA_PC);
+	if (ext)
+		ibdiag_pma_want(pma, row, PMA_PC_EXT);
+}
+
+static void add_port_rows(struct node_sweep *ns, unsigned idx)
+{
+	ibnd_node_t *node = ns->node;
+	ib_portid_t portid = { 0 };
+	int startport = 1;
+	int p;
 
 	if (node->type == IB_NODE_SWITCH && node->smaenhsp0)
 		startport = 0;
 
-	node_name = remap_node_name(node_name_map, node->guid, node->nodedesc);
+	ns->first_row = pma->num_rows;
+	for (p = startport; p <= node->numports; p++) {
+		if (node->ports[p]) {
+			if (node->type == IB_NODE_SWITCH)
+				ib_portid_set(&portid, node->smalid, 0, 0);
+			else
+				ib_portid_set(&portid, node->ports[p]->base_lid,
+					      0, 0);
+
+			want_counters(ns, add_row(&portid, p, idx));
+		}
+	}
+	ns->end_row = pma->num_rows;
+}
+
+static void add_node(struct node_sweep *ns, ibnd_node_t *node, unsigned idx)
+{
+	ib_portid_t portid = { 0 };
+	int p = 0;
+
+	ns->node = node;
+	ns->node_name = remap_node_name(node_name_map, node->guid,
+					node->nodedesc);
+	ns->all_row = -1;
 
 	if (node->type == IB_NODE_SWITCH) {
 		ib_portid_set(&portid, node->smalid, 0, 0);
@@ -816,57 +874,191 @@ static void print_node(ibnd_node_t *node, void *user_data)
 		}
 	}
 
-	if ((query_cap_mask(&portid, node_name, p, &cap_mask, &cap_mask2) == 0) &&
-	    (cap_mask & IB_PM_ALL_PORT_SELECT))
-		all_port_sup = 1;
+	/* PerfMgt ClassPortInfo is a required attribute */
+	ns->cpi_row = add_row(&portid, p, idx);
+	ibdiag_pma_want(pma, ns->cpi_row, PMA_CPI);
+}
+
+static void add_counters(struct node_sweep *ns, unsigned idx)
+{
+	uint8_t *pc = ibdiag_pma_data(pma, ns->cpi_row, PMA_CPI);
+	ib_portid_t portid = pma->portid[ns->cpi_row];
+	__be32 rc_cap_mask2;
+
+	if (!pc) {
+		pma_warn(ns, ns->cpi_row, "classportinfo");
+	} else {
+		/* ClassPortInfo should be supported as part of libibmad */
+		memcpy(&ns->cap_mask, pc + 2, sizeof(ns->cap_mask));	/* CapabilityMask */
+		memcpy(&rc_cap_mask2, pc + 4, sizeof(rc_cap_mask2));	/* CapabilityMask2 */
+		ns->cap_mask2 = ntohl(rc_cap_mask2) >> 5;
+		if (ns->cap_mask & IB_PM_ALL_PORT_SELECT)
+			ns->all_port_sup = 1;
+	}
+
+	if (ns->all_port_sup && !data_counters_only) {
+		ns->all_row = add_row(&portid, 0xFF, idx);
+		want_counters(ns, ns->all_row);
+	} else
+		add_port_rows(ns, idx);
+}
+
+static void print_node(struct node_sweep *ns)
+{
+	int header_printed = 0;
+	ib_portid_t *portid = &pma->portid[ns->cpi_row];
+	int row;
 
 	if (data_counters_only) {
-		for (p = startport; p <= node->numports; p++) {
-			if (node->ports[p]) {
-				if (node->type == IB_NODE_SWITCH)
-					ib_portid_set(&portid, node->smalid, 0, 0);
-				else
-					ib_portid_set(&portid, node->ports[p]->base_lid,
-						      0, 0);
-
-				print_data_cnts(&portid, cap_mask, node_name, node, p,
-						&header_printed);
-				summary.ports_checked++;
-				if (!all_port_sup)
-					clear_port(&portid, cap_mask, cap_mask2, node_name, p);
-			}
+		for (row = ns->first_row; row < ns->end_row; row++) {
+			portid = &pma->portid[row];
+			print_data_cnts(ns, row, &header_printed);
+			summary.ports_checked++;
+			if (!ns->all_port_sup)
+				clear_port(portid, ns->cap_mask, ns->cap_mask2,
+					   ns->node_name, pma->port[row]);
 		}
 	} else {
-		if (all_port_sup)
-			if (!print_errors(&portid, cap_mask, cap_mask2, node_name, node,
-					  0xFF, &header_printed)) {
-				summary.ports_checked += node->numports;
+		if (ns->all_port_sup)
+			if (!print_errors(ns, ns->all_row, &header_printed)) {
+				summary.ports_checked += ns->node->numports;
 				goto clear;
 			}
 
-		for (p = startport; p <= node->numports; p++) {
-			if (node->ports[p]) {
-				if (node->type == IB_NODE_SWITCH)
-					ib_portid_set(&portid, node->smalid, 0, 0);
-				else
-					ib_portid_set(&portid, node->ports[p]->base_lid,
-						      0, 0);
-
-				print_errors(&portid, cap_mask, cap_mask2, node_name, node, p,
-					     &header_printed);
-				summary.ports_checked++;
-				if (!all_port_sup)
-					clear_port(&portid, cap_mask, cap_mask2, node_name, p);
-			}
+		for (row = ns->first_row; row < ns->end_row; row++) {
+			portid = &pma->portid[row];
+			print_errors(ns, row, &header_printed);
+			summary.ports_checked++;
+			if (!ns->all_port_sup)
+				clear_port(portid, ns->cap_mask, ns->cap_mask2,
+					   ns->node_name, pma->port[row]);
 		}
 	}
 
 clear:
 	summary.nodes_checked++;
-	if (all_port_sup)
-		clear_port(&portid, cap_mask, cap_mask2, node_name, 0xFF);
+	if (ns->all_port_sup)
+		clear_port(portid, ns->cap_mask, ns->cap_mask2, ns->node_name,
+			   0xFF);
+}
+
+static void read_pma(void)
+{
+	if (ibdiag_pma_read(pma, max_pmas, IBDIAG_PMA_MAX_PER_NODE,
+			    ibd_timeout, ibmad_port))
+		IBWARN("PMA queries failed: %s", strerror(errno));
+}
+
+/*
+ * Read the counters of a group of nodes with many PMA queries outstanding,
+ * then print the nodes in order.  Every step only reads what the previous
+ * one found is needed: ClassPortInfo, the counters of all ports or of each
+ * port, each port's counters where all ports show errors, and the details
+ * of the errors.
+ */
+static void sweep_nodes(ibnd_node_t **nodes, unsigned num)
+{
+	struct node_sweep *sweep, *ns;
+	int row;
+	unsigned i;
+
+	sweep = calloc(num, sizeof(*sweep));
+	if (!sweep)
+		IBEXIT("out of memory");
+
+	for (i = 0; i < num; i++)
+		add_node(&sweep[i], nodes[i], i);
+	read_pma();
+
+	for (i = 0; i < num; i++)
+		add_counters(&sweep[i], i);
+	read_pma();
+
+	if (!data_counters_only) {
+		for (i = 0; i < num; i++) {
+			ns = &sweep[i];
+			if (ns->all_port_sup && check_row(ns, ns->all_row))
+				add_port_rows(ns, i);
+		}
+		read_pma();
+	}
+
+	if (!data_counters_only && details) {
+		for (i = 0; i < num; i++) {
+			ns = &sweep[i];
+			for (row = ns->first_row; row < ns->end_row; row++)
+				check_row(ns, row);
+		}
+		read_pma();
+	}
+
+	for (i = 0; i < num; i++) {
+		print_node(&sweep[i]);
+		free(sweep[i].node_name);
+	}
+
+	free(sweep);
+	ibdiag_pma_table_reset(pma);
+}
+
+static int print_node_type(ibnd_node_t *node)
+{
+	int type = 0;
+
+	switch (node->type) {
+	case IB_NODE_SWITCH:
+		type = PRINT_SWITCH;
+		break;
+	case IB_NODE_CA:
+		type = PRINT_CA;
+		break;
+	case IB_NODE_ROUTER:
+		type = PRINT_ROUTER;
+		break;
+	}
 
-	free(node_name);
+	return (type & node_type_to_print) != 0;
+}
+
+static void print_node_one(ibnd_node_t *node)
+{
+	if (print_node_type(node))
+		sweep_nodes(&node, 1);
+}
+
+struct node_list {
+	ibnd_node_t **nodes;
+	unsigned num, max;
+};
+
+static void add_to_list(ibnd_node_t *node, void *user_data)
+{
+	struct node_list *list = user_data;
+	ibnd_node_t **nodes;
+
+	if (!print_node_type(node))
+		return;
+
+	if (list->num == list->max) {
+		list->max = list->max ? 2 * list->max : 256;
+		nodes = realloc(list->nodes, list->max * sizeof(*nodes));
+		if (!nodes)
+			IBEXIT("out of memory");
+		list->nodes = nodes;
+	}
+	list->nodes[list->num++] = node;
+}
+
+static void print_fabric(ibnd_fabric_t *fabric)
+{
+	struct node_list list = {};
+	unsigned group = 4 * max_pmas;
+	unsigned i;
+
+	ibnd_iter_nodes(fabric, add_to_list, &list);
+	for (i = 0; i < list.num; i += group)
+		sweep_nodes(list.nodes + i, min_t(unsigned, group, list.num - i));
+	free(list.nodes);
 }
 
 static void add_suppressed(enum MAD_FIELDS field)
@@ -961,6 +1153,11 @@ static int process_opt(void *context, int ch)
 	case 'o':
 		cfg->max_smps = strtoul(optarg, NULL, 0);
 		break;
+	case 11:
+		max_pmas = strtoul(optarg, NULL, 0);
+		if (!max_pmas)
+			max_pmas = 1;
+		break;
 	default:
 		return -1;
 	}
@@ -1017,6 +1214,9 @@ int main(int argc, char **argv)
 		{"outstanding_smps", 'o', 1, NULL,
 		 "specify the number of outstanding SMP's which should be "
 		 "issued during the scan"},
+		{"outstanding_pmas", 11, 1, NULL,
+		 "specify the number of outstanding PMA queries which should "
+		 "be issued while reading the counters"},
 		{}
 	};
 	char usage_args[] = "";
@@ -1121,10 +1321,16 @@ int main(int argc, char **argv)
 	if (ibd_timeout)
 		mad_rpc_set_timeout(ibmad_port, ibd_timeout);
 
+	pma = ibdiag_pma_table_alloc(pma_attrs, ARRAY_SIZE(pma_attrs));
+	if (!pma) {
+		rc = -1;
+		goto close_port;
+	}
+
 	if (port_guid_str) {
 		ibnd_port_t *ndport = ibnd_find_port_guid(fabric, port_guid);
 		if (ndport)
-			print_node(ndport->node, NULL);
+			print_node_one(ndport->node);
 		else
 			fprintf(stderr, "Failed to find node: %s\n",
 				port_guid_str);
@@ -1145,7 +1351,7 @@ int main(int argc, char **argv)
 			if(obtain_sl)
 				if(path_record_query(self_gid,ndport->guid))
 					goto close_port;
-			print_node(ndport->node, NULL);
+			print_node_one(ndport->node);
 		} else
 			fprintf(stderr, "Failed to find node: %s\n", dr_path);
 	} else {
@@ -1153,7 +1359,7 @@ int main(int argc, char **argv)
 			if(path_record_query(self_gid,0))
 				goto close_port;
 
-		ibnd_iter_nodes(fabric, print_node, NULL);
+		print_fabric(fabric);
 	}
 
 	rc = print_summary();
@@ -1161,6 +1367,7 @@ int main(int argc, char **argv)
 		rc = 1;
 
 close_port:
+	ibdiag_pma_table_free(pma);
 	mad_rpc_close_port(ibmad_port);
 	ibnd_destroy_fabric(fabric);
 
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
 
@@ -49,6 +50,10 @@ static struct ibmad_port *srcport;
 
 static int brief, dump_all, multicast;
 
+/* SMPs on the wire while reading the table */
+#define DEFAULT_TABLE_SMPS	4
+static unsigned outstanding_smps = DEFAULT_TABLE_SMPS;
+
 static char *node_name_map_file = NULL;
 static nn_map_t *node_name_map = NULL;
 
@@ -135,12 +140,14 @@ static const char *dump_multicast_tables(ib_portid_t *portid, unsigned startlid,
 {
 	char nd[IB_SMP_DATA_SIZE] = { 0 };
 	uint8_t sw[IB_SMP_DATA_SIZE] = { 0 };
+	struct ibdiag_rpc_req *reqs = NULL, *req;
+	uint8_t (*data)[IB_SMP_DATA_SIZE] = NULL;
 	char str[512], *s;
 	const char *err;
 	uint64_t nodeguid;
 	uint32_t mod;
 	unsigned block, i, j, e, nports, cap, chunks, startblock, lastblock,
-	    top;
+	    top, num;
 	char *mapnd = NULL;
 	int n = 0;
 
@@ -203,23 +210,40 @@ static const char *dump_multicast_tables(ib_portid_t *portid, unsigned startlid,
 
 	startblock = startlid / IB_MLIDS_IN_BLOCK;
 	lastblock = endlid / IB_MLIDS_IN_BLOCK;
-	for (block = startblock; block <= lastblock; block++) {
-		for (j = 0; j < chunks; j++) {
-			int status;
+
+	num = (lastblock - startblock + 1) * chunks;
+	reqs = calloc(num, sizeof(*reqs));
+	data = calloc(num, sizeof(*data));
+	if (!reqs || !data) {
+		err = "out of memory for the table";
+		goto out;
+	}
+	for (block = startblock, req = reqs; block <= lastblock; block++) {
+		for (j = 0; j < chunks; j++, req++) {
 			mod = (block - IB_MIN_MCAST_LID / IB_MLIDS_IN_BLOCK)
 			    | (j << 28);
 
 			DEBUG("reading block %x chunk %d mod %x", block, j,
 			      mod);
-			if (!smp_query_status_via
-			    (mft + j, portid, IB_ATTR_MULTICASTFORWTBL, mod, 0,
-			     &status, srcport)) {
+			ibdiag_smp_req_init(req, portid,
+					    IB_ATTR_MULTICASTFORWTBL, mod,
+					    data[req - reqs], 0, srcport);
+		}
+	}
+	if (ibdiag_rpc_batch(reqs, num, outstanding_smps, outstanding_smps,
+			     srcport))
+		IBWARN("reading the table failed: %s", strerror(errno));
+
+	for (block = startblock, req = reqs; block <= lastblock; block++) {
+		for (j = 0; j < chunks; j++, req++) {
+			if (req->status) {
 				fprintf(stderr, "SubnGet() failed"
 						"; MAD status 0x%x AM 0x%x\n",
-						status, mod);
-				free(mapnd);
-				return NULL;
+						req->rpc.rstatus,
+						req->rpc.attr.mod);
+				goto out;
 			}
+			memcpy(mft + j, req->data, sizeof(mft[j]));
 		}
 
 		i = block * IB_MLIDS_IN_BLOCK;
@@ -239,8 +263,11 @@ static const char *dump_multicast_tables(ib_portid_t *portid, unsigned startlid,
 
 	printf("%d %smlids dumped \n", n, dump_all ? "" : "valid ");
 
+out:
+	free(reqs);
+	free(data);
 	free(mapnd);
-	return NULL;
+	return err;
 }
 
 static int dump_lid(char *str, int strlen, int lid, int valid)
@@ -321,14 +348,16 @@ static int dump_lid(char *str, int strlen, int lid, int valid)
 static const char *dump_unicast_tables(ib_portid_t *portid, int startlid,
 				       int endlid)
 {
-	char lft[IB_SMP_DATA_SIZE] = { 0 };
+	struct ibdiag_rpc_req *reqs = NULL;
+	uint8_t (*data)[IB_SMP_DATA_SIZE] = NULL;
 	char nd[IB_SMP_DATA_SIZE] = { 0 };
 	uint8_t sw[IB_SMP_DATA_SIZE] = { 0 };
+	char *lft;
 	char str[200];
 	const char *s;
 	uint64_t nodeguid;
 	int block, i, e, top;
-	unsigned nports;
+	unsigned nports, num;
 	int n = 0, startblock, endblock;
 	char *mapnd = NULL;
 
@@ -358,17 +387,36 @@ static const char *dump_unicast_tables(ib_portid_t *portid, int startlid,
 	printf("       Port     Info \n");
 	startblock = startlid / IB_SMP_DATA_SIZE;
 	endblock = ALIGN(endlid, IB_SMP_DATA_SIZE) / IB_SMP_DATA_SIZE;
+
+	num = endblock > startblock ? endblock - startblock : 0;
+	if (num) {
+		reqs = calloc(num, sizeof(*reqs));
+		data = calloc(num, sizeof(*data));
+		if (!reqs || !data) {
+			s = "out of memory for the table";
+			goto out;
+		}
+	}
 	for (block = startblock; block < endblock; block++) {
-		int status;
 		DEBUG("reading block %d", block);
-		if (!smp_query_status_via(lft, portid, IB_ATTR_LINEARFORWTBL, block,
-				   0, &status, srcport)) {
+		ibdiag_smp_req_init(&reqs[block - startblock], portid,
+				    IB_ATTR_LINEARFORWTBL, block,
+				    data[block - startblock], 0, srcport);
+	}
+	if (ibdiag_rpc_batch(reqs, num, outstanding_smps, outstanding_smps,
+			     srcport))
+		IBWARN("reading the table failed: %s", strerror(errno));
+
+	for (block = startblock; block < endblock; block++) {
+		struct ibdiag_rpc_req *req = &reqs[block - startblock];
+
+		if (req->status) {
 			fprintf(stderr, "SubnGet() failed"
 					"; MAD status 0x%x AM 0x%x\n",
-					status, block);
-			free(mapnd);
-			return NULL;
+					req->rpc.rstatus, block);
+			goto out;
 		}
+		lft = req->data;
 		i = block * IB_SMP_DATA_SIZE;
 		e = i + IB_SMP_DATA_SIZE;
 		if (i < startlid)
@@ -389,8 +437,11 @@ static const char *dump_unicast_tables(ib_portid_t *portid, int startlid,
 	}
 
 	printf("%d %slids dumped \n", n, dump_all ? "" : "valid ");
+out:
+	free(reqs);
+	free(data);
 	free(mapnd);
-	return NULL;
+	return s;
 }
 
 static int process_opt(void *context, int ch)
@@ -405,6 +456,9 @@ static int process_opt(void *context, int ch)
 	case 'n':
 		brief++;
 		break;
+	case 'o':
+		outstanding_smps = strtoul(optarg, NULL, 0);
+		break;
 	case 1:
 		node_name_map_file = strdup(optarg);
 		if (node_name_map_file == NULL)
@@ -430,6 +484,9 @@ int main(int argc, char **argv)
 		 "do not try to resolve destinations"},
 		{"Multicast", 'M', 0, NULL, "show multicast forwarding tables"},
 		{"node-name-map", 1, 1, "<file>", "node name map file"},
+		{"outstanding_smps", 'o', 1, NULL,
+		 "specify the number of outstanding SMP's which should be "
+		 "issued while reading the table"},
 		{}
 	};
 	char usage_args[] = "[<dest dr_path|lid|guid> [<startlid> [<endlid>]]]";
@@ -43,8 +43,10 @@
 #include <infiniband/mad.h>
 
 #include "ibdiag_common.h"
+#include "ibdiag_pma.h"
 
 static struct ibmad_port *srcport;
+static unsigned max_pmas = IBDIAG_PMA_MAX_PER_NODE;
 
 struct perf_count {
 	uint32_t portselect;
@@ -397,17 +399,17 @@ static void output_aggregate_perfcounters_ext(ib_portid_t * portid,
 	       portid2str(portid), ALL_PORTS, ntohs(cap_mask), cap_mask2, buf);
 }
 
-static void dump_perfcounters(int extended, int timeout, __be16 cap_mask,
+static void dump_perfcounters(int extended, __be16 cap_mask,
 			      uint32_t cap_mask2, ib_portid_t * portid,
-			      int port, int aggregate)
+			      int port, int aggregate, uint8_t *data)
 {
 	char buf[1536];
 
 	if (extended != 1) {
-		memset(pc, 0, sizeof(pc));
-		if (!pma_query_via(pc, portid, port, timeout,
-				   IB_GSI_PORT_COUNTERS, srcport))
+		if (!data)
 			IBEXIT("perfquery");
+		memset(pc, 0, sizeof(pc));
+		memcpy(pc, data, IB_PC_DATA_SZ);
 		if (!(cap_mask & IB_PM_PC_XMIT_WAIT_SUP)) {
 			/* if PortCounters:PortXmitWait not supported clear this counter */
 			VERBOSE("PortXmitWait not indicated"
@@ -431,10 +433,10 @@ static void dump_perfcounters(int extended, int timeout, __be16 cap_mask,
 			    ("PerfMgt ClassPortInfo CapMask 0x%02X; No extended counter support indicated\n",
 			     ntohs(cap_mask));
 
-		memset(pc, 0, sizeof(pc));
-		if (!pma_query_via(pc, portid, port, timeout,
-				   IB_GSI_PORT_COUNTERS_EXT, srcport))
+		if (!data)
 			IBEXIT("perfextquery");
+		memset(pc, 0, sizeof(pc));
+		memcpy(pc, data, IB_PC_DATA_SZ);
 		if (aggregate)
 			aggregate_perfcounters_ext(cap_mask, cap_mask2);
 		else
@@ -455,6 +457,33 @@ static void dump_perfcounters(int extended, int timeout, __be16 cap_mask,
 	}
 }
 
+/* Read the counters of all ports at once, then dump them in order */
+static void dump_ports(int extended, int timeout, __be16 cap_mask,
+		       uint32_t cap_mask2, ib_portid_t * portid,
+		       const int *ports, int num_ports, int aggregate)
+{
+	uint16_t attr = extended != 1 ? IB_GSI_PORT_COUNTERS :
+					IB_GSI_PORT_COUNTERS_EXT;
+	struct ibdiag_pma_table *t;
+	int i;
+
+	t = ibdiag_pma_table_alloc(&attr, 1);
+	if (!t)
+		IBEXIT("out of memory");
+	for (i = 0; i < num_ports; i++) {
+		if (ibdiag_pma_add_row(t, portid, ports[i], 0) < 0)
+			IBEXIT("out of memory");
+		ibdiag_pma_want(t, i, 0);
+	}
+	ibdiag_pma_read(t, max_pmas, max_pmas, timeout, srcport);
+
+	for (i = 0; i < num_ports; i++)
+		dump_perfcounters(extended, cap_mask, cap_mask2, portid,
+				  ports[i], aggregate,
+				  ibdiag_pma_data(t, i, 0));
+	ibdiag_pma_table_free(t);
+}
+
 static void reset_counters(int extended, int timeout, int mask,
 			   ib_portid_t * portid, int port)
 {
@@ -793,6 +822,11 @@ static int process_opt(void *context, int ch)
 	case 12:
 		info.vlxmittimecc = 1;
 		break;
+	case 13:
+		max_pmas = strtoul(optarg, NULL, 0);
+		if (!max_pmas)
+			max_pmas = 1;
+		break;
 	case 'a':
 		info.all_ports++;
 		info.port = ALL_PORTS;
@@ -825,6 +859,7 @@ int main(int argc, char **argv)
 	int node_type, num_ports = 0;
 	uint8_t data[IB_SMP_DATA_SIZE] = { 0 };
 	int start_port = 1;
+	int ports[MAX_PORTS + 1];
 	int enhancedport0;
 	char *tmpstr;
 	int i;
@@ -853,6 +888,8 @@ int main(int argc, char **argv)
 		{"loop_ports", 'l', 0, NULL, "iterate through each port"},
 		{"reset_after_read", 'r', 0, NULL, "reset counters after read"},
 		{"Reset_only", 'R', 0, NULL, "only reset counters"},
+		{"outstanding_pmas", 13, 1, NULL,
+		 "number of outstanding PMA queries when reading several ports"},
 		{}
 	};
 	char usage_args[] = " [<lid|guid> [[port(s)] [reset_mask]]]";
@@ -1069,9 +1106,10 @@ int main(int argc, char **argv)
 	if (all_ports_loop ||
 	    (info.loop_ports && (info.all_ports || info.port == ALL_PORTS))) {
 		for (i = start_port; i <= num_ports; i++)
-			dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-					  cap_mask2, &portid, i,
-					  (all_ports_loop && !info.loop_ports));
+			ports[i - start_port] = i;
+		dump_ports(info.extended, ibd_timeout, cap_mask, cap_mask2,
+			   &portid, ports, num_ports - start_port + 1,
+			   (all_ports_loop && !info.loop_ports));
 		if (all_ports_loop && !info.loop_ports) {
 			if (info.extended != 1)
 				output_aggregate_perfcounters(&portid,
@@ -1081,10 +1119,9 @@ int main(int argc, char **argv)
 								  cap_mask, cap_mask2);
 		}
 	} else if (info.ports_count > 1) {
-		for (i = 0; i < info.ports_count; i++)
-			dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-					  cap_mask2, &portid, info.ports[i],
-					  (info.all_ports && !info.loop_ports));
+		dump_ports(info.extended, ibd_timeout, cap_mask, cap_mask2,
+			   &portid, info.ports, info.ports_count,
+			   (info.all_ports && !info.loop_ports));
 		if (info.all_ports && !info.loop_ports) {
 			if (info.extended != 1)
 				output_aggregate_perfcounters(&portid,
@@ -1094,8 +1131,8 @@ int main(int argc, char **argv)
 								  cap_mask, cap_mask2);
 		}
 	} else
-		dump_perfcounters(info.extended, ibd_timeout, cap_mask,
-				  cap_mask2, &portid, info.port, 0);
+		dump_ports(info.extended, ibd_timeout, cap_mask, cap_mask2,
+			   &portid, &info.port, 1, 0);
 
 	if (!info.reset)
 		goto done;
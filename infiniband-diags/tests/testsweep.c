@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Measure the PMA counter sweep of ibqueryerrors against a stand-in for
+ * libibumad.  Every node answers ClassPortInfo, PortCounters and
+ * PortCountersExtended; the PMA of a node handles one MAD at a time, each
+ * taking the service time, and the answer then needs the wire latency to
+ * come back.  The sweep reads ClassPortInfo for a group of nodes and then
+ * both counter sets of all their ports, through ibdiag_pma_read(), once with
+ * a single query outstanding as the tools used to and once with the window.
+ *
+ * The umad_* functions below take the place of the libibumad ones for
+ * libibmad, this executable is linked with --export-dynamic for that.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+
+#include <infiniband/mad.h>
+#include <infiniband/umad.h>
+
+#include "ibdiag_pma.h"
+
+#define MAD_STATUS_UNSUP_ATTR	0x0c
+
+static const char *argv0 = "testsweep";
+static unsigned nodes = 324;
+static unsigned ports = 36;
+static unsigned group = 128;
+static unsigned latency_us = 50;
+static unsigned service_us = 10;
+static unsigned window = IBDIAG_PMA_DEFAULT_OUTSTANDING;
+static unsigned per_node = IBDIAG_PMA_MAX_PER_NODE;
+
+static unsigned mads_sent;
+
+/* ---- umad stand-in ---- */
+
+struct pending {
+	struct pending *next;
+	uint64_t due;
+	int agent;
+	uint8_t mad[IB_MAD_SIZE];
+};
+
+static struct pending *pending;
+static uint64_t *pma_busy;
+static int port_fd = -1;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t)
+{
+	uint64_t now = now_us();
+
+	if (t > now)
+		usleep(t - now);
+}
+
+static void arm_port(void)
+{
+	struct itimerspec its = {};
+
+	if (pending) {
+		its.it_value.tv_sec = pending->due / 1000000;
+		its.it_value.tv_nsec = (pending->due % 1000000) * 1000 + 1;
+	}
+	timerfd_settime(port_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int umad_init(void)
+{
+	return 0;
+}
+
+int umad_open_port(const char *ca_name, int portnum)
+{
+	port_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	return port_fd;
+}
+
+int umad_close_port(int portid)
+{
+	close(portid);
+	return 0;
+}
+
+int umad_get_fd(int portid)
+{
+	return portid;
+}
+
+int umad_register(int portid, int mgmt_class, int mgmt_version,
+		  uint8_t rmpp_version, long method_mask[16 / sizeof(long)])
+{
+	return mgmt_class;
+}
+
+int umad_unregister(int portid, int agentid)
+{
+	return 0;
+}
+
+static int answer(uint8_t *mad, unsigned lid)
+{
+	uint8_t *data = mad + IB_PC_DATA_OFFS;
+	unsigned port = mad_get_field(data, 0, IB_PC_PORT_SELECT_F);
+
+	switch (mad_get_field(mad, 0, IB_MAD_ATTRID_F)) {
+	case CLASS_PORT_INFO:
+		memset(data, 0, IB_PC_DATA_SZ);
+		mad_set_field(data, 0, IB_CPI_CAPMASK_F,
+			      be16toh(IB_PM_EXT_WIDTH_SUPPORTED));
+		return 0;
+	case IB_GSI_PORT_COUNTERS:
+		mad_set_field(data, 0, IB_PC_XMT_BYTES_F, lid * 1000 + port);
+		return 0;
+	case IB_GSI_PORT_COUNTERS_EXT:
+		mad_set_field64(data, 0, IB_PC_EXT_XMT_BYTES_F,
+				lid * 1000ULL + port);
+		return 0;
+	}
+	return MAD_STATUS_UNSUP_ATTR;
+}
+
+static void add_pending(struct pending *pe)
+{
+	struct pending **pp = &pending;
+
+	while (*pp && (*pp)->due <= pe->due)
+		pp = &(*pp)->next;
+	pe->next = *pp;
+	*pp = pe;
+	arm_port();
+}
+
+int umad_send(int portid, int agentid, void *umad, int length,
+	      int timeout, int kernel_retries)
+{
+	struct pending *pe = calloc(1, sizeof(*pe));
+	unsigned lid = ntohs(umad_get_mad_addr(umad)->lid);
+	uint64_t now = now_us();
+	uint64_t *busy;
+
+	if (!pe)
+		return -ENOMEM;
+	if (!lid || lid > nodes) {
+		free(pe);
+		return -EINVAL;
+	}
+	pe->agent = agentid;
+	memcpy(pe->mad, umad_get_mad(umad), IB_MAD_SIZE);
+	mads_sent++;
+
+	mad_set_field(pe->mad, 0, IB_MAD_STATUS_F, answer(pe->mad, lid));
+	mad_set_field(pe->mad, 0, IB_MAD_METHOD_F, IB_MAD_METHOD_GET_RESPONSE);
+
+	/* The PMA works through its MADs one after the other */
+	busy = &pma_busy[lid - 1];
+	*busy = (*busy > now ? *busy : now) + service_us;
+	pe->due = *busy + latency_us;
+	add_pending(pe);
+	return 0;
+}
+
+int umad_recv(int portid, void *umad, int *length, int timeout)
+{
+	struct ib_user_mad *hdr = umad;
+	struct pending *pe = pending;
+	uint64_t now = now_us();
+	int agent;
+
+	if (!pe || (timeout >= 0 && pe->due > now + timeout * 1000ULL)) {
+		if (timeout < 0) {
+			fprintf(stderr, "umad_recv would block forever\n");
+			return -EIO;
+		}
+		if (!timeout)
+			return -EAGAIN;
+		sleep_until(now + timeout * 1000ULL);
+		return -ETIMEDOUT;
+	}
+
+	if (*length < IB_MAD_SIZE)
+		return -ENOSPC;
+
+	sleep_until(pe->due);
+	pending = pe->next;
+	arm_port();
+
+	hdr->agent_id = pe->agent;
+	hdr->status = 0;
+	hdr->length = umad_size() + IB_MAD_SIZE;
+	memcpy(umad_get_mad(umad), pe->mad, IB_MAD_SIZE);
+	*length = IB_MAD_SIZE;
+	agent = pe->agent;
+	free(pe);
+	return agent;
+}
+
+/* ---- sweep ---- */
+
+enum { PMA_CPI, PMA_PC, PMA_PC_EXT };
+
+static unsigned errors;
+
+#define check(cond, fmt, ...) do {					\
+	if (!(cond) && errors++ < 10)					\
+		fprintf(stderr, "%s:%d: " fmt "\n", __func__, __LINE__,	\
+			## __VA_ARGS__);				\
+} while (0)
+
+static void read_table(struct ibdiag_pma_table *t, struct ibmad_port *srcport,
+		       unsigned max_outstanding, unsigned max_per_node)
+{
+	if (ibdiag_pma_read(t, max_outstanding, max_per_node, 0, srcport))
+		check(0, "ibdiag_pma_read failed");
+}
+
+static void verify(struct ibdiag_pma_table *t, unsigned row)
+{
+	unsigned lid = t->portid[row].lid;
+	unsigned port = t->port[row];
+	uint8_t *pc = ibdiag_pma_data(t, row, PMA_PC);
+	uint8_t *pce = ibdiag_pma_data(t, row, PMA_PC_EXT);
+
+	check(pc && pce, "lid %u port %u: status %d/%d", lid, port,
+	      ibdiag_pma_status(t, row, PMA_PC),
+	      ibdiag_pma_status(t, row, PMA_PC_EXT));
+	if (!pc || !pce)
+		return;
+	check(mad_get_field(pc, 0, IB_PC_XMT_BYTES_F) == lid * 1000 + port &&
+	      mad_get_field64(pce, 0, IB_PC_EXT_XMT_BYTES_F) ==
+	      lid * 1000ULL + port, "lid %u port %u: wrong counters", lid,
+	      port);
+}
+
+/* Sweep the fabric a group of nodes at a time, as ibqueryerrors does */
+static double sweep(struct ibdiag_pma_table *t, struct ibmad_port *srcport,
+		    unsigned max_outstanding, unsigned max_per_node)
+{
+	uint64_t start = now_us();
+	ib_portid_t portid;
+	unsigned first, n, p, row;
+	uint8_t *cpi;
+
+	for (first = 0; first < nodes; first += group) {
+		ibdiag_pma_table_reset(t);
+		for (n = first; n < nodes && n < first + group; n++) {
+			ib_portid_set(&portid, n + 1, 0, 0);
+			ibdiag_pma_want(t, ibdiag_pma_add_row(t, &portid, 0, n),
+					PMA_CPI);
+		}
+		read_table(t, srcport, max_outstanding, max_per_node);
+
+		for (n = first; n < nodes && n < first + group; n++) {
+			row = n - first;
+			cpi = ibdiag_pma_data(t, row, PMA_CPI);
+			check(cpi, "lid %u: no ClassPortInfo", n + 1);
+			if (!cpi)
+				continue;
+			portid = t->portid[row];
+			for (p = 1; p <= ports; p++) {
+				row = ibdiag_pma_add_row(t, &portid, p, n);
+				ibdiag_pma_want(t, row, PMA_PC);
+				ibdiag_pma_want(t, row, PMA_PC_EXT);
+			}
+		}
+		read_table(t, srcport, max_outstanding, max_per_node);
+
+		for (row = 0; row < t->num_rows; row++)
+			if (t->port[row])
+				verify(t, row);
+	}
+	return (now_us() - start) / 1e6;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"   Sweep the PMA counters of a simulated fabric\n"
+		"   -n <n> nodes (default %u)\n"
+		"   -p <n> ports per node (default %u)\n"
+		"   -g <n> nodes swept together (default %u)\n"
+		"   -l <us> wire latency (default %u)\n"
+		"   -s <us> PMA service time per MAD (default %u)\n"
+		"   -w <n> queries outstanding (default %u)\n"
+		"   -m <n> queries outstanding per node (default %u)\n",
+		argv0, nodes, ports, group, latency_us, service_us, window,
+		per_node);
+	exit(-1);
+}
+
+static void report(const char *name, double t, unsigned sent)
+{
+	printf("%-10s %u ports in %.3fs, %.0f ports/s, %.0f MADs/s\n", name,
+	       nodes * ports, t, nodes * ports / t, sent / t);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint16_t attrs[] = {
+		[PMA_CPI] = CLASS_PORT_INFO,
+		[PMA_PC] = IB_GSI_PORT_COUNTERS,
+		[PMA_PC_EXT] = IB_GSI_PORT_COUNTERS_EXT,
+	};
+	int mgmt_classes[] = { IB_SMI_CLASS, IB_PERFORMANCE_CLASS };
+	struct ibdiag_pma_table *t;
+	struct ibmad_port *srcport;
+	double t_one, t_window;
+	unsigned sent;
+	int ch;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "n:p:g:l:s:w:m:h")) != -1) {
+		switch (ch) {
+		case 'n':
+			nodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			ports = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			group = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			service_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			per_node = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!nodes || !ports || !group || !window || !per_node)
+		usage();
+
+	srcport = mad_rpc_open_port(NULL, 0, mgmt_classes, 2);
+	if (!srcport) {
+		fprintf(stderr, "mad_rpc_open_port failed\n");
+		return 1;
+	}
+	mad_rpc_set_timeout(srcport, 1000);
+
+	pma_busy = calloc(nodes, sizeof(*pma_busy));
+	t = ibdiag_pma_table_alloc(attrs, 3);
+	if (!pma_busy || !t) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	t_one = sweep(t, srcport, 1, 1);
+	sent = mads_sent;
+	t_window = sweep(t, srcport, window, per_node);
+
+	report("one", t_one, sent);
+	report("window", t_window, mads_sent - sent);
+	printf("%.1fx faster, %u MADs sent, %u errors\n", t_one / t_window,
+	       mads_sent, errors);
+
+	ibdiag_pma_table_free(t);
+	mad_rpc_close_port(srcport);
+	free(pma_busy);
+	return errors ? 1 : 0;
+}
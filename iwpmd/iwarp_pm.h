@@ -76,10 +76,13 @@
 #define IWARP_PM_REQ_ACK    4
 
 #define IWARP_PM_RECV_PAYLOAD 4096
+#define IWARP_PM_NL_RECV_BATCH 32
 #define IWARP_PM_MAX_CLIENTS  64
 #define IWPM_MAP_REQ_TIMEOUT  10 /* sec */
 #define IWPM_SEND_MSG_RETRIES 3
 
+#define IWPM_HASH_SIZE        4096 /* buckets of the mapped port and request indexes */
+
 #define IWPM_ULIB_NAME  "iWarpPortMapperUser"
 #define IWPM_ULIBNAME_SIZE 32
 #define IWPM_DEVNAME_SIZE  32
@@ -135,6 +138,8 @@ typedef union sockaddr_union {
 
 typedef struct iwpm_mapped_port {
 	struct list_node	    entry;
+	struct list_node	    local_hentry;	/* hashed by the local port */
+	struct list_node	    mapped_hentry;	/* hashed by the mapped port */
 	int			    owner_client;
 	int			    sd;
 	struct sockaddr_storage	    local_addr;
@@ -165,6 +170,7 @@ typedef struct iwpm_send_msg {
 
 typedef struct iwpm_mapping_request {
 	struct list_node		entry;
+	struct list_node		hentry;		/* hashed by assochandle */
 	struct sockaddr_storage		src_addr;
 	struct sockaddr_storage		remote_addr;
 	__u16 				nlmsg_type;     /* Message content */
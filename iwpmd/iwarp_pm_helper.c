@@ -35,6 +35,40 @@
 
 static LIST_HEAD(mapped_ports);		/* list of mapped ports */
 
+/*
+ * Mapped ports are also hashed by the TCP port of their local and of their
+ * mapped address, so a lookup only walks the ports which could match,
+ * including wild card addresses with the same TCP port.  Map requests are
+ * hashed by assochandle.  A bucket is initialized on first use.
+ */
+static struct list_head local_port_hash[IWPM_HASH_SIZE];
+static struct list_head mapped_port_hash[IWPM_HASH_SIZE];
+static struct list_head map_req_hash[IWPM_HASH_SIZE];
+
+static struct list_head *get_iwpm_bucket(struct list_head *table, __u64 key)
+{
+	struct list_head *bucket;
+
+	/* take the high bits of a multiplicative hash */
+	key *= 0x9E3779B97F4A7C15ULL;
+	bucket = &table[(key >> 32) & (IWPM_HASH_SIZE - 1)];
+	if (!bucket->n.next)
+		list_head_init(bucket);
+	return bucket;
+}
+
+static struct list_head *get_iwpm_port_bucket(struct sockaddr_storage *addr,
+					      int not_mapped)
+{
+	return get_iwpm_bucket(not_mapped ? local_port_hash : mapped_port_hash,
+			       get_sockaddr_port(addr));
+}
+
+static struct list_head *get_iwpm_map_req_bucket(__u64 assochandle)
+{
+	return get_iwpm_bucket(map_req_hash, assochandle);
+}
+
 /**
  * create_iwpm_map_request - Create a new map request tracking object
  * @req_nlh: netlink header of the received client message
@@ -89,6 +123,7 @@ void add_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 {
 	pthread_mutex_lock(&map_req_mutex);
 	list_add(&mapping_reqs, &iwpm_map_req->entry);
+	list_add(get_iwpm_map_req_bucket(iwpm_map_req->assochandle), &iwpm_map_req->hentry);
 	/* if not wake, signal the thread that a new request has been posted */
 	if (!wake)
 		pthread_cond_signal(&cond_req_complete);
@@ -109,6 +144,7 @@ void remove_iwpm_map_request(iwpm_mapping_request *iwpm_map_req)
 			iwpm_map_req->msg_type, iwpm_map_req->nlmsg_pid);
 	}
 	list_del(&iwpm_map_req->entry);
+	list_del(&iwpm_map_req->hentry);
 	if (iwpm_map_req->send_msg)
 		free(iwpm_map_req->send_msg);
 	free(iwpm_map_req);
@@ -129,8 +165,8 @@ int update_iwpm_map_request(__u64 assochandle, struct sockaddr_storage *src_addr
 	int ret = -EINVAL;
 
 	pthread_mutex_lock(&map_req_mutex);
-	/* look for a matching entry in the list */
-	list_for_each(&mapping_reqs, iwpm_map_req, entry) {
+	/* look for a matching entry among the requests with the assochandle */
+	list_for_each(get_iwpm_map_req_bucket(assochandle), iwpm_map_req, hentry) {
 		if (assochandle == iwpm_map_req->assochandle &&
 				(msg_type & iwpm_map_req->msg_type) &&
 				check_same_sockaddr(src_addr, &iwpm_map_req->src_addr)) {
@@ -426,6 +462,8 @@ void add_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 		return;
 	iwpm_debug(IWARP_PM_ALL_DBG, "add_iwpm_mapped_port: Adding a new mapping #%d\n", dbg_idx++);
 	list_add(&mapped_ports, &iwpm_port->entry);
+	list_add(get_iwpm_port_bucket(&iwpm_port->local_addr, 1), &iwpm_port->local_hentry);
+	list_add(get_iwpm_port_bucket(&iwpm_port->mapped_addr, 0), &iwpm_port->mapped_hentry);
 }
 
 /**
@@ -467,12 +505,19 @@ int check_same_sockaddr(struct sockaddr_storage *sockaddr_a, struct sockaddr_sto
 	return ret;
 }
 
+/* Offset of the hash entry of the index searched with not_mapped */
+static size_t iwpm_hentry_offset(int not_mapped)
+{
+	return not_mapped ? offsetof(iwpm_mapped_port, local_hentry) :
+			    offsetof(iwpm_mapped_port, mapped_hentry);
+}
+
 /**
  * find_iwpm_mapping - Find saved mapped port object
  * @search_addr: IP address and port to search for in the list
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
+ * Compares the search_sockaddr to the addresses with the same tcp port,
  * to find a saved port object with the sockaddr or
  * a wild card address with the same tcp port
  */
@@ -482,7 +527,8 @@ iwpm_mapped_port *find_iwpm_mapping(struct sockaddr_storage *search_addr,
 	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
 	struct sockaddr_storage *current_addr;
 
-	list_for_each(&mapped_ports, iwpm_port, entry) {
+	list_for_each_off(get_iwpm_port_bucket(search_addr, not_mapped), iwpm_port,
+			  iwpm_hentry_offset(not_mapped)) {
 		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
 
 		if (get_sockaddr_port(search_addr) == get_sockaddr_port(current_addr)) {
@@ -502,7 +548,7 @@ find_mapping_exit:
  * @search_addr: IP address and port to search for in the list
  * @not_mapped: if set, compare local addresses, otherwise compare mapped addresses
  *
- * Compares the search_sockaddr to the addresses in the list,
+ * Compares the search_sockaddr to the addresses with the same tcp port,
  * to find a saved port object with the same sockaddr
  */
 iwpm_mapped_port *find_iwpm_same_mapping(struct sockaddr_storage *search_addr,
@@ -511,7 +557,8 @@ iwpm_mapped_port *find_iwpm_same_mapping(struct sockaddr_storage *search_addr,
 	iwpm_mapped_port *iwpm_port, *saved_iwpm_port = NULL;
 	struct sockaddr_storage *current_addr;
 
-	list_for_each(&mapped_ports, iwpm_port, entry) {
+	list_for_each_off(get_iwpm_port_bucket(search_addr, not_mapped), iwpm_port,
+			  iwpm_hentry_offset(not_mapped)) {
 		current_addr = (not_mapped)? &iwpm_port->local_addr : &iwpm_port->mapped_addr;
 		if (check_same_sockaddr(search_addr, current_addr)) {
 			saved_iwpm_port = iwpm_port;
@@ -545,6 +592,8 @@ void remove_iwpm_mapped_port(iwpm_mapped_port *iwpm_port)
 	iwpm_debug(IWARP_PM_ALL_DBG, "remove_iwpm_mapped_port: index = %d\n", dbg_idx++);
 
 	list_del(&iwpm_port->entry);
+	list_del(&iwpm_port->local_hentry);
+	list_del(&iwpm_port->mapped_hentry);
 }
 
 void print_iwpm_mapped_ports(void)
@@ -600,6 +649,9 @@ void free_iwpm_mapped_ports(void)
 {
 	iwpm_mapped_port *iwpm_port;
 
-	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry)))
+	while ((iwpm_port = list_pop(&mapped_ports, iwpm_mapped_port, entry))) {
+		list_del(&iwpm_port->local_hentry);
+		list_del(&iwpm_port->mapped_hentry);
 		free_iwpm_port(iwpm_port);
+	}
 }
@@ -31,6 +31,7 @@
  *
  */
 
+#define _GNU_SOURCE
 #include "config.h"
 #include <systemd/sd-daemon.h>
 #include <getopt.h>
@@ -1125,38 +1126,17 @@ hello_error:
 }
 
 /**
- * process_iwpm_netlink_msg - Dispatch received netlink messages
- * @nl_sock: netlink socket to read the messages from
+ * process_iwpm_nlmsgs - Dispatch the netlink messages of one datagram
+ * @nlh: the received datagram
+ * @len: length of the datagram
+ * @nl_sock: netlink socket to send the responses to
  */
-static int process_iwpm_netlink_msg(int nl_sock)
+static int process_iwpm_nlmsgs(struct nlmsghdr *nlh, int len, int nl_sock)
 {
-	char *recv_buffer = NULL;
-	struct nlmsghdr *nlh;
-	struct sockaddr_nl src_addr;
-	int len, type, client_idx, op;
-	socklen_t src_addr_len;
+	int type, client_idx, op;
 	const char *str_err = "";
 	int ret = 0;
 
-	recv_buffer = malloc(NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD));
-	if (!recv_buffer) {
-		ret = -ENOMEM;
-		str_err = "Unable to allocate receive socket buffer";
-		goto process_netlink_msg_exit;
-	}
-	/* receive a new message */
-	nlh = (struct nlmsghdr *)recv_buffer;
-	memset(nlh, 0, NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD));
-	memset(&src_addr, 0, sizeof(src_addr));
-
-	src_addr_len = sizeof(src_addr);
-	len = recvfrom(nl_sock, (void *)nlh, NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD), 0,
-			(struct sockaddr *)&src_addr, &src_addr_len);
-	if (len <= 0) {
-		ret = -errno;
-		str_err = "Unable to receive data from netlink socket";
-		goto process_netlink_msg_exit;
-	}
 	/* loop for multiple netlink messages packed together */
 	while (NLMSG_OK(nlh, len) != 0) {
 		if (nlh->nlmsg_type == NLMSG_DONE) {
@@ -1232,13 +1212,55 @@ static int process_iwpm_netlink_msg(int nl_sock)
 	}
 
 process_netlink_msg_exit:
-	if (recv_buffer)
-		free(recv_buffer);
 	if (ret)
 		syslog(LOG_WARNING, "process_netlink_msg: %s error (ret = %d).\n", str_err, ret);
 	return ret;
 }
 
+/* receive buffers of process_iwpm_netlink_msg(), one per datagram */
+static char nl_recv_buffers[IWARP_PM_NL_RECV_BATCH][NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD)];
+
+/**
+ * process_iwpm_netlink_msg - Dispatch received netlink messages
+ * @nl_sock: netlink socket to read the messages from
+ *
+ * Receive up to IWARP_PM_NL_RECV_BATCH datagrams with a single call,
+ * so a burst of client requests costs one wakeup instead of one per request
+ */
+static int process_iwpm_netlink_msg(int nl_sock)
+{
+	struct mmsghdr msgs[IWARP_PM_NL_RECV_BATCH];
+	struct iovec iovs[IWARP_PM_NL_RECV_BATCH];
+	struct sockaddr_nl src_addrs[IWARP_PM_NL_RECV_BATCH];
+	int i, num_msgs, err, ret = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < IWARP_PM_NL_RECV_BATCH; i++) {
+		iovs[i].iov_base = nl_recv_buffers[i];
+		iovs[i].iov_len = sizeof(nl_recv_buffers[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &src_addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(src_addrs[i]);
+	}
+
+	/* receive the new messages, the first one is waiting */
+	num_msgs = recvmmsg(nl_sock, msgs, IWARP_PM_NL_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if (num_msgs <= 0) {
+		ret = -errno;
+		syslog(LOG_WARNING, "process_netlink_msg: Unable to receive data from "
+				"netlink socket error (ret = %d).\n", ret);
+		return ret;
+	}
+	for (i = 0; i < num_msgs; i++) {
+		err = process_iwpm_nlmsgs((struct nlmsghdr *)nl_recv_buffers[i],
+					  msgs[i].msg_len, nl_sock);
+		if (err)
+			ret = err;
+	}
+	return ret;
+}
+
 /**
  * process_iwpm_msg - Dispatch iwpm wire messages, sent by the remote peer
  * @pm_sock: socket handle to read the messages from
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Synthetic load for the iwarp port mapper.  The daemon code is built into
+ * this program and its netlink socket is replaced by a NETLINK_USERSOCK
+ * socket, another one in this program plays the kernel: it registers a
+ * client, adds a mapping per connection a window at a time, removes them
+ * again and reports the rate at growing table sizes.  The mapping request
+ * index is measured by adding and looking up requests directly.
+ */
+
+/* the daemon main() is not used */
+#define main iwpmd_main
+int iwpmd_main(int argc, char *argv[]);
+#include "../iwarp_pm_server.c"
+#undef main
+
+#include <time.h>
+
+static const char *argv0 = "iwpm_load";
+static unsigned int conns = 20000;
+static unsigned int window = IWARP_PM_NL_RECV_BATCH;
+static unsigned int slices = 4;
+
+static int kernel_sock;
+static __u32 kernel_pid, kernel_seq;
+static unsigned int errors;
+
+#define check(cond, fmt, ...) do {					\
+	if (!(cond) && errors++ < 10)					\
+		fprintf(stderr, "%s:%d: " fmt "\n", __func__, __LINE__,	\
+			## __VA_ARGS__);				\
+} while (0)
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_usersock(__u32 *pid)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	socklen_t len = sizeof(addr);
+	int sock;
+
+	sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_USERSOCK);
+	if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(sock, (struct sockaddr *)&addr, &len)) {
+		perror("netlink stand-in");
+		exit(1);
+	}
+	*pid = addr.nl_pid;
+	return sock;
+}
+
+static struct nl_msg *kernel_msg(int op)
+{
+	struct nl_msg *msg = nlmsg_alloc();
+
+	if (!msg || !nlmsg_put(msg, 0, ++kernel_seq,
+			       RDMA_NL_GET_TYPE(RDMA_NL_IWCM, op), 0,
+			       NLM_F_REQUEST)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	nla_put_u32(msg, 1, kernel_seq);	/* the _SEQ attribute of each op */
+	return msg;
+}
+
+static void kernel_send(struct nl_msg *msg, __u32 iwpmd_pid)
+{
+	int ret;
+
+	/* the daemon answers to the pid of the request */
+	nlmsg_hdr(msg)->nlmsg_pid = kernel_pid;
+	ret = send_iwpm_nlmsg(kernel_sock, msg, iwpmd_pid);
+	check(!ret, "send failed: %s", strerror(-ret));
+	nlmsg_free(msg);
+}
+
+/* Let the daemon handle everything the kernel sent it */
+static void run_iwpmd(void)
+{
+	struct pollfd pfd = { .fd = netlink_sock, .events = POLLIN };
+
+	while (poll(&pfd, 1, 0) == 1)
+		process_iwpm_netlink_msg(netlink_sock);
+}
+
+/* Receive num responses and return how many report an error */
+static unsigned int kernel_recv(unsigned int num, int op)
+{
+	char buf[NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD)];
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nlattr *err;
+	unsigned int failed = 0;
+	int len;
+
+	while (num--) {
+		len = recv(kernel_sock, buf, sizeof(buf), 0);
+		if (len <= 0 || !NLMSG_OK(nlh, len)) {
+			check(0, "no response: %s", strerror(errno));
+			return failed + num + 1;
+		}
+		err = nlmsg_find_attr(nlh, 0, IWPM_NLA_RMANAGE_MAPPING_ERR);
+		if (RDMA_NL_GET_OP(nlh->nlmsg_type) != op || !err ||
+		    nla_get_u16(err))
+			failed++;
+	}
+	return failed;
+}
+
+static void register_client(__u32 iwpmd_pid)
+{
+	struct nl_msg *msg = kernel_msg(RDMA_NL_IWPM_REG_PID);
+	char buf[NLMSG_SPACE(IWARP_PM_RECV_PAYLOAD)];
+
+	nla_put_string(msg, IWPM_NLA_REG_IF_NAME, "lo");
+	nla_put_string(msg, IWPM_NLA_REG_IBDEV_NAME, "iwload0");
+	nla_put_string(msg, IWPM_NLA_REG_ULIB_NAME, iwpm_ulib_name);
+	kernel_send(msg, iwpmd_pid);
+	run_iwpmd();
+	check(recv(kernel_sock, buf, sizeof(buf), 0) > 0 &&
+	      client_list[RDMA_NL_IWCM].valid, "client did not register");
+}
+
+static void conn_addr(unsigned int i, struct sockaddr_storage *addr)
+{
+	struct sockaddr_in *in4 = (struct sockaddr_in *)addr;
+
+	memset(addr, 0, sizeof(*addr));
+	in4->sin_family = AF_INET;
+	in4->sin_addr.s_addr = htobe32(INADDR_LOOPBACK);
+	in4->sin_port = htobe16(1 + i);
+}
+
+static void report(const char *name, unsigned int from, unsigned int to,
+		   double t)
+{
+	printf("%-16s %6u..%-6u %8.0f ops/s\n", name, from, to,
+	       (to - from) / t);
+}
+
+/*
+ * Send the requests for connections [first, last) a window at a time and
+ * wait for their responses, like a burst of connection setups
+ */
+static void run_mappings(int op, unsigned int first, unsigned int last,
+			 __u32 iwpmd_pid)
+{
+	struct sockaddr_storage addr;
+	struct nl_msg *msg;
+	unsigned int i, n;
+
+	for (i = first; i < last; i += n) {
+		for (n = 0; n < window && i + n < last; n++) {
+			msg = kernel_msg(op);
+			conn_addr(i + n, &addr);
+			nla_put(msg, IWPM_NLA_MANAGE_ADDR, sizeof(addr), &addr);
+			if (op == RDMA_NL_IWPM_ADD_MAPPING)
+				nla_put_u32(msg, IWPM_NLA_MANAGE_FLAGS,
+					    IWPM_FLAGS_NO_PORT_MAP);
+			kernel_send(msg, iwpmd_pid);
+		}
+		run_iwpmd();
+		/* removes are not answered */
+		if (op == RDMA_NL_IWPM_ADD_MAPPING)
+			check(!kernel_recv(n, op), "add mapping %u..%u failed",
+			      i, i + n);
+	}
+}
+
+static void run_phase(const char *name, int op, __u32 iwpmd_pid)
+{
+	unsigned int s, first, last;
+	double t;
+
+	for (s = 0; s < slices; s++) {
+		first = conns * s / slices;
+		last = conns * (s + 1) / slices;
+		t = now_sec();
+		run_mappings(op, first, last, iwpmd_pid);
+		report(name, first, last, now_sec() - t);
+	}
+}
+
+static void run_map_requests(void)
+{
+	iwpm_mapping_request **reqs, *req, copy;
+	struct sockaddr_storage addr;
+	unsigned int i;
+	double t;
+
+	reqs = calloc(conns, sizeof(*reqs));
+	if (!reqs) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	t = now_sec();
+	for (i = 0; i < conns; i++) {
+		conn_addr(i, &addr);
+		reqs[i] = create_iwpm_map_request(NULL, &addr, &addr, 0,
+						  IWARP_PM_REQ_QUERY, NULL);
+		check(reqs[i], "out of memory");
+		if (reqs[i])
+			add_iwpm_map_request(reqs[i]);
+	}
+	report("add request", 0, conns, now_sec() - t);
+
+	/* the wire accepts come back in the order the requests went out */
+	t = now_sec();
+	for (i = 0; i < conns; i++) {
+		if (!reqs[i])
+			continue;
+		conn_addr(i, &addr);
+		check(!update_iwpm_map_request(reqs[i]->assochandle, &addr,
+					       IWARP_PM_REQ_QUERY, &copy, 1),
+		      "request %u not found", i);
+	}
+	report("update request", 0, conns, now_sec() - t);
+
+	pthread_mutex_lock(&map_req_mutex);
+	while ((req = list_top(&mapping_reqs, iwpm_mapping_request, entry)))
+		remove_iwpm_map_request(req);
+	pthread_mutex_unlock(&map_req_mutex);
+	free(reqs);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"   Drive the iwarp port mapper through a netlink stand-in\n"
+		"   -n <n> connections (default %u, at most 65535)\n"
+		"   -w <n> requests in flight (default %u)\n"
+		"   -s <n> slices to report (default %u)\n",
+		argv0, conns, window, slices);
+	exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timeval timeout = { .tv_sec = 1 };
+	__u32 iwpmd_pid;
+	int ch;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "n:w:s:h")) != -1) {
+		switch (ch) {
+		case 'n':
+			conns = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			slices = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!conns || conns > 65535 || !window || !slices)
+		usage();
+
+	openlog(argv0, LOG_PERROR, LOG_USER);
+	setlogmask(LOG_UPTO(LOG_ERR));
+	pthread_cond_init(&cond_req_complete, NULL);
+
+	netlink_sock = open_usersock(&iwpmd_pid);
+	kernel_sock = open_usersock(&kernel_pid);
+	setsockopt(kernel_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	register_client(iwpmd_pid);
+	run_phase("add mapping", RDMA_NL_IWPM_ADD_MAPPING, iwpmd_pid);
+	run_phase("remove mapping", RDMA_NL_IWPM_REMOVE_MAPPING, iwpmd_pid);
+	run_map_requests();
+	printf("%u errors\n", errors);
+
+	free_iwpm_mapped_ports();
+	close(kernel_sock);
+	close(netlink_sock);
+	return errors ? 1 : 0;
+}
@@ -1488,6 +1488,48 @@ int mad_rpc_class_agent(struct ibmad_port *srcport, int cls);
 int mad_get_timeout(const struct ibmad_port *srcport, int override_ms);
 int mad_get_retries(const struct ibmad_port *srcport);
 
+/*
+ * Asynchronous RPC. Up to max_outstanding requests are on the wire at once
+ * and complete in any order, matched by TID. Timeouts and retries follow the
+ * port settings, like mad_rpc(), and redirection updates dport the same way.
+ * rpc, dport, payload and rcvdata must stay valid until the request
+ * completes; rpc->trid is set by mad_rpc_async_submit() if it was 0.
+ *
+ * mad_rpc_async_poll() returns up to num_wc completions, waiting up to
+ * timeout_ms for the first one. mad_rpc_async_process() polls and calls the
+ * callback given at submit time for each completion. Completions are
+ * only reported by these calls; to drive them from an event loop, wait for
+ * mad_rpc_async_get_fd() to become readable.
+ */
+struct ibmad_async;
+struct ibmad_async_wc;
+
+typedef void (*mad_rpc_async_cb)(struct ibmad_async *async,
+				 struct ibmad_async_wc *wc);
+
+struct ibmad_async_wc {
+	uint64_t trid;
+	int status;		/* 0, EIO if rpc->rstatus is set, or errno */
+	ib_rpc_t *rpc;
+	ib_portid_t *dport;
+	void *rcvdata;
+	void *context;
+	mad_rpc_async_cb cb;
+};
+
+struct ibmad_async *mad_rpc_async_create(const struct ibmad_port *srcport,
+					 int max_outstanding);
+void mad_rpc_async_destroy(struct ibmad_async *async);
+int mad_rpc_async_get_fd(struct ibmad_async *async);
+int mad_rpc_async_outstanding(struct ibmad_async *async);
+/* Fails with EAGAIN when max_outstanding requests are on the wire */
+int mad_rpc_async_submit(struct ibmad_async *async, ib_rpc_t *rpc,
+			 ib_portid_t *dport, void *payload, void *rcvdata,
+			 mad_rpc_async_cb cb, void *context);
+int mad_rpc_async_poll(struct ibmad_async *async, struct ibmad_async_wc *wc,
+		       int num_wc, int timeout_ms);
+int mad_rpc_async_process(struct ibmad_async *async, int timeout_ms);
+
 /* register.c */
 int mad_register_port_client(int port_id, int mgmt, uint8_t rmpp_version);
 int mad_register_client(int mgmt, uint8_t rmpp_version)
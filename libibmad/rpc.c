@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <infiniband/umad.h>
 #include <infiniband/mad.h>
@@ -330,6 +331,382 @@ void *mad_rpc_rmpp(const struct ibmad_port *port, ib_rpc_t * rpc,
 	return data;
 }
 
+/*
+ * Asynchronous RPC: requests are sent as soon as they are submitted and are
+ * matched back to their response by TID. The kernel reports a request that
+ * timed out by returning it through umad_recv() with an error status, so the
+ * umad fd is the only thing an event loop needs to wait on.
+ */
+struct ibmad_async_req {
+	ib_rpc_t *rpc;
+	ib_portid_t *dport;
+	void *payload;
+	void *rcvdata;
+	void *context;
+	mad_rpc_async_cb cb;
+	uint32_t trid;		/* only low 32 bits - see mad_trid() */
+	int len;
+	int timeout;
+	int retries;
+	int tries_left;
+	int next;		/* hash chain, or free list */
+	uint8_t *umad;
+};
+
+struct ibmad_async {
+	const struct ibmad_port *port;
+	int max_outstanding;
+	int outstanding;
+	int free_list;
+	unsigned hash_mask;
+	int *hash;
+	struct ibmad_async_req *reqs;
+	uint8_t *umads;
+	uint8_t *rcvbuf;
+	int rcvbuf_len;
+};
+
+static int async_umad_size(void)
+{
+	return umad_size() + IB_MAD_SIZE;
+}
+
+static int *async_bucket(struct ibmad_async *async, uint32_t trid)
+{
+	return &async->hash[(trid * 0x9e3779b1U) >> 16 & async->hash_mask];
+}
+
+static struct ibmad_async_req *async_find(struct ibmad_async *async,
+					  uint32_t trid)
+{
+	int i;
+
+	for (i = *async_bucket(async, trid); i >= 0; i = async->reqs[i].next)
+		if (async->reqs[i].trid == trid)
+			return &async->reqs[i];
+	return NULL;
+}
+
+static void async_release(struct ibmad_async *async,
+			  struct ibmad_async_req *req)
+{
+	int idx = req - async->reqs;
+	int *p = async_bucket(async, req->trid);
+
+	while (*p != idx)
+		p = &async->reqs[*p].next;
+	*p = req->next;
+
+	req->next = async->free_list;
+	async->free_list = idx;
+	async->outstanding--;
+}
+
+static int async_send(struct ibmad_async *async, struct ibmad_async_req *req)
+{
+	int agent = async->port->class_agents[req->rpc->mgtclass & 0xff];
+
+	if (ibdebug > 1) {
+		IBWARN(">>> sending: len %d pktsz %zu", req->len,
+		       umad_size() + req->len);
+		xdump(stderr, "send buf\n", req->umad, umad_size() + req->len);
+	}
+
+	if (umad_send(async->port->port_id, agent, req->umad, req->len,
+		      req->timeout, 0) < 0) {
+		IBWARN("send failed; %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int async_build(struct ibmad_async_req *req)
+{
+	memset(req->umad, 0, async_umad_size());
+	req->len = mad_build_pkt(req->umad, req->rpc, req->dport, NULL,
+				 req->payload);
+	if (req->len < 0)
+		return -1;
+	req->trid = (uint32_t) mad_get_field64(umad_get_mad(req->umad), 0,
+					       IB_MAD_TRID_F);
+	return 0;
+}
+
+struct ibmad_async *mad_rpc_async_create(const struct ibmad_port *srcport,
+					 int max_outstanding)
+{
+	struct ibmad_async *async;
+	unsigned buckets;
+	int i;
+
+	if (max_outstanding <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return NULL;
+
+	for (buckets = 16; buckets < 2U * max_outstanding; buckets <<= 1)
+		;
+	async->port = srcport;
+	async->max_outstanding = max_outstanding;
+	async->hash_mask = buckets - 1;
+	async->rcvbuf_len = async_umad_size();
+	async->hash = malloc(buckets * sizeof(*async->hash));
+	async->reqs = calloc(max_outstanding, sizeof(*async->reqs));
+	async->umads = calloc(max_outstanding, async_umad_size());
+	async->rcvbuf = calloc(1, async->rcvbuf_len);
+	if (!async->hash || !async->reqs || !async->umads || !async->rcvbuf) {
+		mad_rpc_async_destroy(async);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	memset(async->hash, 0xff, buckets * sizeof(*async->hash));
+	for (i = 0; i < max_outstanding; i++) {
+		async->reqs[i].umad = async->umads + i * async_umad_size();
+		async->reqs[i].next = i + 1 < max_outstanding ? i + 1 : -1;
+	}
+	async->free_list = 0;
+
+	return async;
+}
+
+void mad_rpc_async_destroy(struct ibmad_async *async)
+{
+	free(async->hash);
+	free(async->reqs);
+	free(async->umads);
+	free(async->rcvbuf);
+	free(async);
+}
+
+int mad_rpc_async_get_fd(struct ibmad_async *async)
+{
+	return umad_get_fd(async->port->port_id);
+}
+
+int mad_rpc_async_outstanding(struct ibmad_async *async)
+{
+	return async->outstanding;
+}
+
+int mad_rpc_async_submit(struct ibmad_async *async, ib_rpc_t *rpc,
+			 ib_portid_t *dport, void *payload, void *rcvdata,
+			 mad_rpc_async_cb cb, void *context)
+{
+	struct ibmad_async_req *req;
+	int idx = async->free_list;
+
+	if (idx < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	req = &async->reqs[idx];
+
+	if ((rpc->mgtclass & IB_MAD_RPC_VERSION_MASK) == IB_MAD_RPC_VERSION1)
+		((ib_rpc_v1_t *)rpc)->error = 0;
+
+	req->rpc = rpc;
+	req->dport = dport;
+	req->payload = payload;
+	req->rcvdata = rcvdata;
+	req->cb = cb;
+	req->context = context;
+	req->timeout = mad_get_timeout(async->port, rpc->timeout);
+	req->retries = mad_get_retries(async->port);
+	req->tries_left = req->retries;
+	if (req->retries <= 0) {
+		ERRS("max_retries %d <= 0", req->retries);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (async_build(req))
+		return -1;
+
+	if (save_mad) {
+		memcpy(save_mad, umad_get_mad(req->umad),
+		       save_mad_len < req->len ? save_mad_len : req->len);
+		save_mad = NULL;
+	}
+
+	if (async_find(async, req->trid)) {
+		IBWARN("TID 0x%x is already outstanding", req->trid);
+		errno = EEXIST;
+		return -1;
+	}
+
+	if (async_send(async, req))
+		return -1;
+	req->tries_left--;
+
+	async->free_list = req->next;
+	req->next = *async_bucket(async, req->trid);
+	*async_bucket(async, req->trid) = idx;
+	async->outstanding++;
+
+	return 0;
+}
+
+/* error is 0, or what _do_madrpc() would have failed with */
+static void async_complete(struct ibmad_async_req *req,
+			   struct ibmad_async_wc *wc, int error, uint8_t *mad)
+{
+	ib_rpc_t *rpc = req->rpc;
+
+	if ((rpc->mgtclass & IB_MAD_RPC_VERSION_MASK) == IB_MAD_RPC_VERSION1)
+		((ib_rpc_v1_t *)rpc)->error = error;
+
+	wc->trid = req->trid;
+	wc->status = error;
+	wc->rpc = rpc;
+	wc->dport = req->dport;
+	wc->rcvdata = req->rcvdata;
+	wc->context = req->context;
+	wc->cb = req->cb;
+
+	if (error) {
+		if (error == ETIMEDOUT)
+			ERRS("timeout after %d retries, %d ms; dport (%s)",
+			     req->retries, req->timeout * req->retries,
+			     portid2str(req->dport));
+		return;
+	}
+
+	rpc->rstatus = mad_get_field(mad, 0, IB_DRSMP_STATUS_F);
+	if (rpc->rstatus) {
+		ERRS("MAD completed with error status 0x%x; dport (%s)",
+		     rpc->rstatus, portid2str(req->dport));
+		wc->status = EIO;
+		return;
+	}
+
+	if (req->rcvdata)
+		memcpy(req->rcvdata, mad + rpc->dataoffs, rpc->datasz);
+}
+
+/*
+ * Handle a MAD read from the umad fd. Returns 1 and fills wc if it completed
+ * a request, 0 if the request goes on or the MAD is not ours.
+ */
+static int async_handle(struct ibmad_async *async, struct ibmad_async_wc *wc)
+{
+	struct ibmad_async_req *req;
+	uint8_t *mad = umad_get_mad(async->rcvbuf);
+	int status, error = 0;
+
+	if (ibdebug > 2)
+		umad_addr_dump(umad_get_mad_addr(async->rcvbuf));
+	if (ibdebug > 1) {
+		IBWARN("rcv buf:");
+		xdump(stderr, "rcv buf\n", mad, IB_MAD_SIZE);
+	}
+
+	/* A late answer to a request that already completed is dropped */
+	req = async_find(async,
+			 (uint32_t) mad_get_field64(mad, 0, IB_MAD_TRID_F));
+	if (!req)
+		return 0;
+
+	status = umad_status(async->rcvbuf);
+	if (status && status != ENOMEM) {
+		if (req->tries_left) {
+			ERRS("retry %d (timeout %d ms)",
+			     req->retries - req->tries_left, req->timeout);
+			req->tries_left--;
+			if (!async_send(async, req))
+				return 0;
+			error = errno;
+		} else
+			error = ETIMEDOUT;
+	} else if (mad_get_field(mad, 0, IB_DRSMP_STATUS_F) ==
+		   IB_MAD_STS_REDIRECT && !redirect_port(req->dport, mad)) {
+		/* Same TID as before, mad_rpc() resends the same way */
+		if (!async_build(req) && !async_send(async, req))
+			return 0;
+		error = errno;
+	}
+
+	async_complete(req, wc, error, mad);
+	async_release(async, req);
+	return 1;
+}
+
+int mad_rpc_async_poll(struct ibmad_async *async, struct ibmad_async_wc *wc,
+		       int num_wc, int timeout_ms)
+{
+	struct timespec now;
+	int64_t deadline = 0;
+	int n = 0, ret, length;
+	void *buf;
+
+	if (timeout_ms > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 +
+			   timeout_ms;
+	}
+
+	while (n < num_wc && async->outstanding) {
+		length = async->rcvbuf_len - umad_size();
+		ret = umad_recv(async->port->port_id, async->rcvbuf, &length,
+				timeout_ms);
+		if (ret == -ETIMEDOUT || ret == -EAGAIN)
+			break;
+		if (ret == -ENOSPC) {
+			/* Bigger than a MAD, grow the buffer and read it again */
+			buf = realloc(async->rcvbuf, umad_size() + length);
+			if (!buf)
+				return n ? n : -1;
+			async->rcvbuf = buf;
+			async->rcvbuf_len = umad_size() + length;
+			continue;
+		}
+		if (ret < 0) {
+			IBWARN("recv failed: %s", strerror(-ret));
+			errno = -ret;
+			return n ? n : -1;
+		}
+
+		if (async_handle(async, &wc[n])) {
+			/* Only wait for the first completion, then take what
+			 * is queued */
+			n++;
+			timeout_ms = 0;
+		} else if (timeout_ms > 0) {
+			/* A retry or a stray MAD, wait for what is left */
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout_ms = deadline -
+				     (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+			if (timeout_ms <= 0)
+				break;
+		}
+	}
+
+	return n;
+}
+
+int mad_rpc_async_process(struct ibmad_async *async, int timeout_ms)
+{
+	struct ibmad_async_wc wc[16];
+	int i, n, total = 0;
+
+	do {
+		n = mad_rpc_async_poll(async, wc, 16, total ? 0 : timeout_ms);
+		if (n < 0)
+			return total ? total : -1;
+
+		for (i = 0; i < n; i++)
+			if (wc[i].cb)
+				wc[i].cb(async, &wc[i]);
+		total += n;
+	} while (n == 16);
+
+	return total;
+}
+
 void *madrpc(ib_rpc_t * rpc, ib_portid_t * dport, void *payload, void *rcvdata)
 {
 	return mad_rpc(ibmp, rpc, dport, payload, rcvdata);
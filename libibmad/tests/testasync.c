@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Run the asynchronous MAD RPC calls against a stand-in for libibumad that
+ * answers lid routed NodeInfo/PortInfo SMPs and PortCounters queries.  Each
+ * answer arrives after a configurable latency and jitter, so completions
+ * come back out of order, and a share of the MADs can be lost to exercise
+ * the retries.  LIDs above the node count never answer.
+ *
+ * The umad_* functions below take the place of the libibumad ones for
+ * libibmad, this executable is linked with --export-dynamic for that.  The
+ * stand-in port is a timerfd that is readable when an answer is due, so it
+ * can be waited on like the real umad fd.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+
+#include <infiniband/mad.h>
+#include <infiniband/umad.h>
+
+#define GUID_BASE		0x0002c90300000000ULL
+#define MAD_STATUS_UNSUP_ATTR	0x0c
+
+static const char *argv0 = "testasync";
+static unsigned nodes = 256;
+static unsigned dead = 4;
+static unsigned latency_us = 200;
+static unsigned jitter_us = 100;
+static unsigned window = 64;
+static double loss;
+static int timeout_ms = 20;
+static int retries = 3;
+
+static unsigned mads_sent, mads_lost;
+
+/* ---- umad stand-in ---- */
+
+struct pending {
+	struct pending *next;
+	uint64_t due;
+	int agent;
+	int status;
+	uint8_t mad[IB_MAD_SIZE];
+};
+
+static struct pending *pending;
+static int port_fd = -1;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t)
+{
+	uint64_t now = now_us();
+
+	if (t > now)
+		usleep(t - now);
+}
+
+/* Make the port fd readable when the first answer is due */
+static void arm_port(void)
+{
+	struct itimerspec its = {};
+
+	if (pending) {
+		/* An expiry in the past fires at once, but zero disarms */
+		its.it_value.tv_sec = pending->due / 1000000;
+		its.it_value.tv_nsec = (pending->due % 1000000) * 1000 + 1;
+	}
+	timerfd_settime(port_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int umad_init(void)
+{
+	return 0;
+}
+
+int umad_open_port(const char *ca_name, int portnum)
+{
+	port_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	return port_fd;
+}
+
+int umad_close_port(int portid)
+{
+	close(portid);
+	return 0;
+}
+
+int umad_get_fd(int portid)
+{
+	return portid;
+}
+
+int umad_register(int portid, int mgmt_class, int mgmt_version,
+		  uint8_t rmpp_version, long method_mask[16 / sizeof(long)])
+{
+	return mgmt_class;
+}
+
+int umad_unregister(int portid, int agentid)
+{
+	return 0;
+}
+
+static int answer(uint8_t *mad, unsigned lid)
+{
+	uint8_t *data;
+	unsigned port;
+
+	switch (mad_get_field(mad, 0, IB_MAD_MGMTCLASS_F)) {
+	case IB_SMI_CLASS:
+		data = mad + IB_SMP_DATA_OFFS;
+		port = mad_get_field(mad, 0, IB_MAD_ATTRMOD_F);
+		switch (mad_get_field(mad, 0, IB_MAD_ATTRID_F)) {
+		case IB_ATTR_NODE_INFO:
+			memset(data, 0, IB_SMP_DATA_SIZE);
+			mad_set_field64(data, 0, IB_NODE_GUID_F,
+					GUID_BASE + lid);
+			mad_set_field(data, 0, IB_NODE_TYPE_F, IB_NODE_SWITCH);
+			mad_set_field(data, 0, IB_NODE_NPORTS_F, 36);
+			return 0;
+		case IB_ATTR_PORT_INFO:
+			memset(data, 0, IB_SMP_DATA_SIZE);
+			mad_set_field(data, 0, IB_PORT_LID_F, lid);
+			mad_set_field(data, 0, IB_PORT_LOCAL_PORT_F, port);
+			return 0;
+		}
+		return MAD_STATUS_UNSUP_ATTR;
+	case IB_PERFORMANCE_CLASS:
+		data = mad + IB_PC_DATA_OFFS;
+		if (mad_get_field(mad, 0, IB_MAD_ATTRID_F) !=
+		    IB_GSI_PORT_COUNTERS)
+			return MAD_STATUS_UNSUP_ATTR;
+		port = mad_get_field(data, 0, IB_PC_PORT_SELECT_F);
+		mad_set_field(data, 0, IB_PC_XMT_BYTES_F, lid * 1000 + port);
+		return 0;
+	}
+	return MAD_STATUS_UNSUP_ATTR;
+}
+
+static void add_pending(struct pending *pe)
+{
+	struct pending **pp = &pending;
+
+	while (*pp && (*pp)->due <= pe->due)
+		pp = &(*pp)->next;
+	pe->next = *pp;
+	*pp = pe;
+	arm_port();
+}
+
+/* Like the kernel, a MAD that gets no answer comes back with ETIMEDOUT */
+int umad_send(int portid, int agentid, void *umad, int length,
+	      int timeout, int kernel_retries)
+{
+	struct pending *pe = calloc(1, sizeof(*pe));
+	unsigned lid = ntohs(umad_get_mad_addr(umad)->lid);
+	uint64_t now = now_us();
+
+	if (!pe)
+		return -ENOMEM;
+	pe->agent = agentid;
+	memcpy(pe->mad, umad_get_mad(umad), IB_MAD_SIZE);
+	mads_sent++;
+
+	if (!lid || lid > nodes || (loss && drand48() < loss)) {
+		mads_lost++;
+		pe->status = ETIMEDOUT;
+		pe->due = now + (uint64_t)timeout * 1000;
+		add_pending(pe);
+		return 0;
+	}
+
+	mad_set_field(pe->mad, 0, IB_MAD_STATUS_F, answer(pe->mad, lid));
+	mad_set_field(pe->mad, 0, IB_MAD_METHOD_F, IB_MAD_METHOD_GET_RESPONSE);
+	pe->due = now + latency_us + (jitter_us ? random() % jitter_us : 0);
+	add_pending(pe);
+	return 0;
+}
+
+int umad_recv(int portid, void *umad, int *length, int timeout)
+{
+	struct ib_user_mad *hdr = umad;
+	struct pending *pe = pending;
+	uint64_t now = now_us();
+	int agent;
+
+	if (!pe || (timeout >= 0 && pe->due > now + timeout * 1000ULL)) {
+		if (timeout < 0) {
+			fprintf(stderr, "umad_recv would block forever\n");
+			return -EIO;
+		}
+		if (!timeout)
+			return -EAGAIN;
+		sleep_until(now + timeout * 1000ULL);
+		return -ETIMEDOUT;
+	}
+
+	if (*length < IB_MAD_SIZE)
+		return -ENOSPC;
+
+	sleep_until(pe->due);
+	pending = pe->next;
+	arm_port();
+
+	hdr->agent_id = pe->agent;
+	hdr->status = pe->status;
+	hdr->length = umad_size() + IB_MAD_SIZE;
+	memcpy(umad_get_mad(umad), pe->mad, IB_MAD_SIZE);
+	*length = IB_MAD_SIZE;
+	agent = pe->agent;
+	free(pe);
+	return agent;
+}
+
+/* ---- checks ---- */
+
+struct chain;
+
+struct query {
+	ib_rpc_v1_t rpc;
+	struct chain *chain;
+	ib_portid_t portid;
+	uint8_t data[IB_SMP_DATA_SIZE];
+	unsigned lid, port;
+	int done;
+};
+
+static unsigned errors;
+
+#define check(cond, fmt, ...) do {					\
+	if (!(cond) && errors++ < 10)					\
+		fprintf(stderr, "%s:%d: " fmt "\n", __func__, __LINE__,	\
+			## __VA_ARGS__);				\
+} while (0)
+
+static void setup_smp(struct query *q, unsigned lid, unsigned attr,
+		      unsigned port)
+{
+	memset(q, 0, sizeof(*q));
+	q->lid = lid;
+	q->port = port;
+	ib_portid_set(&q->portid, lid, 0, 0);
+	q->rpc.mgtclass = IB_SMI_CLASS | IB_MAD_RPC_VERSION1;
+	q->rpc.method = IB_MAD_METHOD_GET;
+	q->rpc.attr.id = attr;
+	q->rpc.attr.mod = port;
+	q->rpc.datasz = IB_SMP_DATA_SIZE;
+	q->rpc.dataoffs = IB_SMP_DATA_OFFS;
+}
+
+static void setup_pma(struct query *q, unsigned lid, unsigned port)
+{
+	memset(q, 0, sizeof(*q));
+	q->lid = lid;
+	q->port = port;
+	ib_portid_set(&q->portid, lid, 1, IB_DEFAULT_QP1_QKEY);
+	q->rpc.mgtclass = IB_PERFORMANCE_CLASS | IB_MAD_RPC_VERSION1;
+	q->rpc.method = IB_MAD_METHOD_GET;
+	q->rpc.attr.id = IB_GSI_PORT_COUNTERS;
+	q->rpc.datasz = IB_PC_DATA_SZ;
+	q->rpc.dataoffs = IB_PC_DATA_OFFS;
+	mad_set_field(q->data, 0, IB_PC_PORT_SELECT_F, port);
+}
+
+static void verify(struct query *q, struct ibmad_async_wc *wc)
+{
+	check(!q->done, "lid %u completed twice", q->lid);
+	q->done = 1;
+	check(wc->rpc == (ib_rpc_t *)&q->rpc && wc->rcvdata == q->data,
+	      "lid %u completion does not match its request", q->lid);
+
+	if (q->lid > nodes) {
+		check(wc->status == ETIMEDOUT && q->rpc.error == ETIMEDOUT,
+		      "dead lid %u: status %d", q->lid, wc->status);
+		return;
+	}
+	/* With loss some requests may run out of retries */
+	if (loss && wc->status == ETIMEDOUT)
+		return;
+	if ((q->rpc.mgtclass & 0xff) == IB_SMI_CLASS &&
+	    q->rpc.attr.id == IB_ATTR_SWITCH_INFO) {
+		check(wc->status == EIO &&
+		      q->rpc.rstatus == MAD_STATUS_UNSUP_ATTR,
+		      "lid %u: unsupported attribute status %d/0x%x", q->lid,
+		      wc->status, q->rpc.rstatus);
+		return;
+	}
+
+	check(!wc->status, "lid %u: status %d", q->lid, wc->status);
+	if (wc->status)
+		return;
+
+	switch (q->rpc.attr.id) {
+	case IB_ATTR_NODE_INFO:
+		check(mad_get_field64(q->data, 0, IB_NODE_GUID_F) ==
+		      GUID_BASE + q->lid, "lid %u: wrong NodeInfo", q->lid);
+		break;
+	case IB_ATTR_PORT_INFO:
+		check(mad_get_field(q->data, 0, IB_PORT_LID_F) == q->lid &&
+		      mad_get_field(q->data, 0, IB_PORT_LOCAL_PORT_F) ==
+		      q->port, "lid %u: wrong PortInfo", q->lid);
+		break;
+	case IB_GSI_PORT_COUNTERS:
+		check(mad_get_field(q->data, 0, IB_PC_XMT_BYTES_F) ==
+		      q->lid * 1000 + q->port, "lid %u port %u: wrong counters",
+		      q->lid, q->port);
+		break;
+	}
+}
+
+/* One mad_rpc() at a time, as the diags do today */
+static double run_sync(struct ibmad_port *port, struct query *qs,
+		       unsigned num)
+{
+	uint64_t start = now_us();
+	unsigned i;
+
+	for (i = 0; i < num; i++) {
+		setup_smp(&qs[i], i + 1, IB_ATTR_NODE_INFO, 0);
+		if (!mad_rpc(port, (ib_rpc_t *)&qs[i].rpc, &qs[i].portid,
+			     NULL, qs[i].data))
+			/* With loss some requests may run out of retries */
+			check(loss, "lid %u: mad_rpc failed", i + 1);
+		else
+			check(mad_get_field64(qs[i].data, 0, IB_NODE_GUID_F) ==
+			      GUID_BASE + i + 1, "lid %u: wrong NodeInfo", i + 1);
+	}
+	return (now_us() - start) / 1e6;
+}
+
+/*
+ * Keep the window full from a list of requests and reap with
+ * mad_rpc_async_poll().
+ */
+static double run_poll(struct ibmad_async *async, struct query *qs,
+		       unsigned num)
+{
+	struct ibmad_async_wc wc[16];
+	uint64_t start = now_us();
+	unsigned next = 0, done = 0;
+	int i, n;
+
+	while (done < num) {
+		while (next < num &&
+		       !mad_rpc_async_submit(async, (ib_rpc_t *)&qs[next].rpc,
+					     &qs[next].portid, NULL,
+					     qs[next].data, NULL, &qs[next]))
+			next++;
+		check(next == num || errno == EAGAIN,
+		      "submit failed: %s", strerror(errno));
+		if (next < num && errno != EAGAIN)
+			break;
+
+		n = mad_rpc_async_poll(async, wc, 16, 1000);
+		check(n > 0, "poll returned %d", n);
+		if (n <= 0)
+			break;
+		for (i = 0; i < n; i++)
+			verify(wc[i].context, &wc[i]);
+		done += n;
+	}
+	check(!mad_rpc_async_outstanding(async), "requests left over");
+	return (now_us() - start) / 1e6;
+}
+
+/*
+ * Event loop style: each completion callback submits the next query and
+ * the loop only sleeps in poll() on the umad fd.
+ */
+struct chain {
+	struct query *qs;
+	unsigned num, next, done;
+};
+
+static void chain_cb(struct ibmad_async *async, struct ibmad_async_wc *wc);
+
+static void chain_submit(struct ibmad_async *async, struct chain *c)
+{
+	struct query *q;
+
+	while (c->next < c->num) {
+		q = &c->qs[c->next];
+		if (mad_rpc_async_submit(async, (ib_rpc_t *)&q->rpc,
+					 &q->portid, q->data, q->data,
+					 chain_cb, q)) {
+			check(errno == EAGAIN, "submit failed: %s",
+			      strerror(errno));
+			return;
+		}
+		c->next++;
+	}
+}
+
+static void chain_cb(struct ibmad_async *async, struct ibmad_async_wc *wc)
+{
+	struct query *q = wc->context;
+	struct chain *c = q->chain;
+
+	verify(q, wc);
+	c->done++;
+	chain_submit(async, c);
+}
+
+static double run_event_loop(struct ibmad_async *async, struct query *qs,
+			     unsigned num)
+{
+	struct chain c = { .qs = qs, .num = num };
+	struct pollfd pfd = {
+		.fd = mad_rpc_async_get_fd(async),
+		.events = POLLIN,
+	};
+	uint64_t start = now_us();
+	unsigned i;
+
+	for (i = 0; i < num; i++)
+		qs[i].chain = &c;
+
+	chain_submit(async, &c);
+	while (c.done < num) {
+		if (poll(&pfd, 1, 1000) != 1) {
+			check(0, "umad fd did not become readable");
+			break;
+		}
+		if (mad_rpc_async_process(async, 0) < 0) {
+			check(0, "process failed: %s", strerror(errno));
+			break;
+		}
+	}
+	return (now_us() - start) / 1e6;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"   Check asynchronous MAD RPCs against a umad stand-in\n"
+		"   -n <n> nodes answering (default %u)\n"
+		"   -d <n> dead LIDs queried (default %u)\n"
+		"   -l <us> answer latency (default %u)\n"
+		"   -j <us> answer jitter (default %u)\n"
+		"   -w <n> MADs in flight (default %u)\n"
+		"   -x <p> probability a MAD is lost (default 0)\n"
+		"   -t <ms> timeout (default %d)\n"
+		"   -r <n> retries (default %d)\n",
+		argv0, nodes, dead, latency_us, jitter_us, window, timeout_ms,
+		retries);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	int mgmt_classes[] = { IB_SMI_CLASS, IB_PERFORMANCE_CLASS };
+	struct ibmad_async *async;
+	struct ibmad_port *port;
+	struct query *qs;
+	double t_sync, t_poll, t_loop;
+	unsigned i, num, lid;
+	int ch;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "n:d:l:j:w:x:t:r:h")) != -1) {
+		switch (ch) {
+		case 'n':
+			nodes = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			dead = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			loss = strtod(optarg, NULL);
+			break;
+		case 't':
+			timeout_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			retries = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!nodes || !window || timeout_ms <= 0 || retries <= 0)
+		usage();
+
+	port = mad_rpc_open_port(NULL, 0, mgmt_classes, 2);
+	if (!port) {
+		fprintf(stderr, "mad_rpc_open_port failed\n");
+		return 1;
+	}
+	mad_rpc_set_timeout(port, timeout_ms);
+	mad_rpc_set_retries(port, retries);
+
+	async = mad_rpc_async_create(port, window);
+	qs = calloc(3 * (nodes + dead), sizeof(*qs));
+	if (!async || !qs) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	t_sync = run_sync(port, qs, nodes);
+
+	/* NodeInfo, PortInfo and an unsupported attribute for every LID */
+	num = 0;
+	for (lid = 1; lid <= nodes + dead; lid++) {
+		setup_smp(&qs[num++], lid, IB_ATTR_NODE_INFO, 0);
+		setup_smp(&qs[num++], lid, IB_ATTR_PORT_INFO, lid % 36 + 1);
+		setup_smp(&qs[num++], lid, IB_ATTR_SWITCH_INFO, 0);
+	}
+	t_poll = run_poll(async, qs, num);
+	for (i = 0; i < num; i++)
+		check(qs[i].done, "lid %u never completed", qs[i].lid);
+
+	num = 0;
+	for (lid = 1; lid <= nodes + dead; lid++)
+		setup_pma(&qs[num++], lid, lid % 36 + 1);
+	t_loop = run_event_loop(async, qs, num);
+	for (i = 0; i < num; i++)
+		check(qs[i].done, "lid %u never completed", qs[i].lid);
+
+	printf("sync:       %u NodeInfo in %.3fs, %.0f MADs/s\n", nodes,
+	       t_sync, nodes / t_sync);
+	printf("poll:       %u SMPs in %.3fs, %.0f MADs/s\n",
+	       3 * (nodes + dead), t_poll, 3 * (nodes + dead) / t_poll);
+	printf("event loop: %u PortCounters in %.3fs, %.0f MADs/s\n",
+	       nodes + dead, t_loop, (nodes + dead) / t_loop);
+	printf("%u MADs sent, %u lost, %u errors\n", mads_sent, mads_lost,
+	       errors);
+
+	mad_rpc_async_destroy(async);
+	mad_rpc_close_port(port);
+	free(qs);
+	return errors ? 1 : 0;
+}
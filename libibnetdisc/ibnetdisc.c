@@ -374,7 +374,7 @@ static int recv_port_info(smp_engine_t * engine, ibnd_smp_t * smp,
 		port->lmc = node->smalmc;
 	}
 
-	int rc1 = add_to_portguid_hash(port, f_int->fabric.portstbl);
+	int rc1 = add_to_portguid_hash(port, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -484,7 +484,7 @@ static ibnd_node_t *create_node(smp_engine_t * engine, ib_portid_t * path,
 	rc->path_portid = *path;
 	memcpy(rc->info, node_info, sizeof(rc->info));
 
-	int rc1 = add_to_nodeguid_hash(rc, f_int->fabric.nodestbl);
+	int rc1 = add_to_nodeguid_hash(rc, f_int);
 	if (rc1)
 		IBND_ERROR("Error Occurred when trying"
 			   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -616,19 +616,12 @@ static int query_node_info(smp_engine_t * engine, ib_portid_t * portid,
 
 ibnd_node_t *ibnd_find_node_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_node_t *node;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (node = fabric->nodestbl[hash]; node; node = node->htnext)
-		if (node->guid == guid)
-			return node;
-
-	return NULL;
+	return ibnd_htbl_find(&((f_internal_t *)fabric)->nodeguid_tbl, guid);
 }
 
 ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -637,63 +630,151 @@ ibnd_node_t *ibnd_find_node_dr(ibnd_fabric_t * fabric, char *dr_str)
 	return rc->node;
 }
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[])
+#define IBND_HTBL_MIN_SIZE 64
+
+void *ibnd_htbl_find(const ibnd_htbl_t *tbl, uint64_t key)
 {
-	int rc = 0;
-	ibnd_node_t *tblnode;
-	int hash_idx = HASHGUID(node->guid) % HTSZ;
+	uint32_t i;
 
-	for (tblnode = hash[hash_idx]; tblnode; tblnode = tblnode->htnext) {
-		if (tblnode == node) {
-			IBND_ERROR("Duplicate Node: Node with guid 0x%016"
-				   PRIx64 " already exists in nodes DB\n",
-				   node->guid);
-			return 1;
-		}
+	if (!tbl->entries)
+		return NULL;
+
+	for (i = ibnd_htbl_hash(key) & tbl->mask; tbl->entries[i].val;
+	     i = (i + 1) & tbl->mask) {
+		if (tbl->entries[i].key == key)
+			return tbl->entries[i].val;
 	}
-	node->htnext = hash[hash_idx];
-	hash[hash_idx] = node;
-	return rc;
+
+	return NULL;
 }
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[])
+static int ibnd_htbl_resize(ibnd_htbl_t *tbl, uint32_t size)
 {
-	int rc = 0;
-	ibnd_port_t *tblport;
-	int hash_idx = HASHGUID(port->guid) % HTSZ;
+	ibnd_htbl_entry_t *entries;
+	uint32_t i, j, mask = size - 1;
+
+	entries = calloc(size, sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	for (i = 0; tbl->entries && i <= tbl->mask; i++) {
+		if (!tbl->entries[i].val)
+			continue;
+
+		for (j = ibnd_htbl_hash(tbl->entries[i].key) & mask;
+		     entries[j].val; j = (j + 1) & mask)
+			;
+		entries[j] = tbl->entries[i];
+	}
+
+	free(tbl->entries);
+	tbl->entries = entries;
+	tbl->mask = mask;
+	return 0;
+}
+
+/* Allocate an empty table of size slots, size must be a power of two */
+int ibnd_htbl_init(ibnd_htbl_t *tbl, uint32_t size)
+{
+	memset(tbl, 0, sizeof(*tbl));
+	return ibnd_htbl_resize(tbl, size);
+}
+
+/* Insert or replace the value stored under key.  The previous value,
+ * if any, is returned through old.
+ */
+int ibnd_htbl_insert(ibnd_htbl_t *tbl, uint64_t key, void *val, void **old)
+{
+	uint32_t i;
+
+	if (old)
+		*old = NULL;
+
+	/* keep the load factor at or below 1/2 */
+	if (!tbl->entries || (tbl->count + 1) * 2 > tbl->mask + 1) {
+		if (ibnd_htbl_resize(tbl, tbl->entries ? (tbl->mask + 1) * 2 :
+				     IBND_HTBL_MIN_SIZE))
+			return -1;
+	}
 
-	for (tblport = hash[hash_idx]; tblport; tblport = tblport->htnext) {
-		if (tblport == port) {
-			IBND_ERROR("Duplicate Port: Port with guid 0x%016"
-				   PRIx64 " already exists in ports DB\n",
-				   port->guid);
-			return 1;
+	for (i = ibnd_htbl_hash(key) & tbl->mask; tbl->entries[i].val;
+	     i = (i + 1) & tbl->mask) {
+		if (tbl->entries[i].key == key) {
+			if (old)
+				*old = tbl->entries[i].val;
+			tbl->entries[i].val = val;
+			return 0;
 		}
 	}
-	port->htnext = hash[hash_idx];
-	hash[hash_idx] = port;
-	return rc;
+
+	tbl->entries[i].key = key;
+	tbl->entries[i].val = val;
+	tbl->count++;
+	return 0;
 }
 
-struct lid2guid_item {
-	cl_map_item_t cl_map;
-	ibnd_port_t *port;
-};
+void ibnd_htbl_destroy(ibnd_htbl_t *tbl)
+{
+	free(tbl->entries);
+	memset(tbl, 0, sizeof(*tbl));
+}
 
-void create_lid2guid(f_internal_t *f_int)
+/* The public nodestbl/portstbl chains are still maintained so that
+ * ibnd_iter_ports() and existing users of the fabric struct keep working;
+ * lookups go through the resizable tables in f_internal_t.
+ */
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int)
 {
-	cl_qmap_init(&f_int->lid2guid);
+	ibnd_fabric_t *fabric = &f_int->fabric;
+	int hash_idx = HASHGUID(node->guid) % HTSZ;
+
+	if (ibnd_htbl_find(&f_int->nodeguid_tbl, node->guid) == node) {
+		IBND_ERROR("Duplicate Node: Node with guid 0x%016"
+			   PRIx64 " already exists in nodes DB\n",
+			   node->guid);
+		return 1;
+	}
+
+	if (ibnd_htbl_insert(&f_int->nodeguid_tbl, node->guid, node, NULL)) {
+		IBND_ERROR("OOM: failed to grow node guid table\n");
+		return 1;
+	}
+
+	node->htnext = fabric->nodestbl[hash_idx];
+	fabric->nodestbl[hash_idx] = node;
+	return 0;
 }
 
-void destroy_lid2guid(f_internal_t *f_int)
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int)
 {
-	cl_map_item_t *item;
+	ibnd_fabric_t *fabric = &f_int->fabric;
+	int hash_idx = HASHGUID(port->guid) % HTSZ;
 
-	for (item = cl_qmap_head(&f_int->lid2guid); item != cl_qmap_end(&f_int->lid2guid);
-	     item = cl_qmap_head(&f_int->lid2guid)) {
-		cl_qmap_remove_item(&f_int->lid2guid, item);
-		free(container_of(item, struct lid2guid_item, cl_map));
+	/* All ports of a switch share one GUID; the last one added wins,
+	 * matching the previous chained lookup order.
+	 */
+	if (ibnd_htbl_find(&f_int->portguid_tbl, port->guid) == port) {
+		IBND_ERROR("Duplicate Port: Port with guid 0x%016"
+			   PRIx64 " already exists in ports DB\n",
+			   port->guid);
+		return 1;
+	}
+
+	if (ibnd_htbl_insert(&f_int->portguid_tbl, port->guid, port, NULL)) {
+		IBND_ERROR("OOM: failed to grow port guid table\n");
+		return 1;
 	}
+
+	port->htnext = fabric->portstbl[hash_idx];
+	fabric->portstbl[hash_idx] = port;
+	return 0;
+}
+
+void destroy_fabric_tables(f_internal_t *f_int)
+{
+	ibnd_htbl_destroy(&f_int->nodeguid_tbl);
+	ibnd_htbl_destroy(&f_int->portguid_tbl);
+	ibnd_htbl_destroy(&f_int->lid_tbl);
 }
 
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
@@ -706,14 +787,10 @@ void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int)
 		/* We add the port for all lids
 		 * so it is easier to find any "random" lid specified */
 		for (lid = base_lid; lid <= (base_lid + lid_mask); lid++) {
-			struct lid2guid_item *item;
-
-			item = malloc(sizeof(*item));
-			if (item) {
-				item->port = port;
-				cl_qmap_insert(&f_int->lid2guid, lid,
-					       &item->cl_map);
-			}
+			/* the first port registered for a lid is kept */
+			if (ibnd_htbl_find(&f_int->lid_tbl, lid))
+				continue;
+			ibnd_htbl_insert(&f_int->lid_tbl, lid, port, NULL);
 		}
 	}
 }
@@ -747,6 +824,11 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 
 	if (!config->max_smps)
 		config->max_smps = DEFAULT_MAX_SMP_ON_WIRE;
+	/* the window only adapts when the caller gives a limit */
+	if (config->max_smps > config->max_smps_window)
+		config->max_smps_window = config->max_smps;
+	if (!config->max_smps_per_dest)
+		config->max_smps_per_dest = DEFAULT_MAX_SMP_PER_DEST;
 	if (!config->timeout_ms)
 		config->timeout_ms = DEFAULT_TIMEOUT;
 	if (!config->retries)
@@ -758,8 +840,6 @@ static int set_config(struct ibnd_config *config, struct ibnd_config *cfg)
 f_internal_t *allocate_fabric_internal(void)
 {
 	f_internal_t *f = calloc(1, sizeof(*f));
-	if (f)
-		create_lid2guid(f);
 
 	return (f);
 }
@@ -828,6 +908,9 @@ ibnd_fabric_t *ibnd_discover_fabric(char * ca_name, int ca_port,
 	f_int->fabric.total_mads_used = engine.total_smps;
 	f_int->fabric.maxhops_discovered += scan.initial_hops;
 
+	if (config.flags & IBND_CONFIG_SMP_STATS)
+		smp_engine_print_stats(&engine);
+
 	if (group_nodes(&f_int->fabric))
 		goto error;
 
@@ -866,13 +949,17 @@ void ibnd_destroy_fabric(ibnd_fabric_t * fabric)
 		free(ch);
 		ch = ch_next;
 	}
-	node = fabric->nodes;
-	while (node) {
-		next = node->next;
-		destroy_node(node);
-		node = next;
+	if (((f_internal_t *)fabric)->pool) {
+		free(((f_internal_t *)fabric)->pool);
+	} else {
+		node = fabric->nodes;
+		while (node) {
+			next = node->next;
+			destroy_node(node);
+			node = next;
+		}
 	}
-	destroy_lid2guid((f_internal_t *)fabric);
+	destroy_fabric_tables((f_internal_t *)fabric);
 	free(fabric);
 }
 
@@ -935,26 +1022,17 @@ ibnd_port_t *ibnd_find_port_lid(ibnd_fabric_t * fabric,
 {
 	f_internal_t *f = (f_internal_t *)fabric;
 
-	return container_of(cl_qmap_get(&f->lid2guid, lid),
-			    struct lid2guid_item, cl_map)
-		->port;
+	return ibnd_htbl_find(&f->lid_tbl, lid);
 }
 
 ibnd_port_t *ibnd_find_port_guid(ibnd_fabric_t * fabric, uint64_t guid)
 {
-	int hash = HASHGUID(guid) % HTSZ;
-	ibnd_port_t *port;
-
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return NULL;
 	}
 
-	for (port = fabric->portstbl[hash]; port; port = port->htnext)
-		if (port->guid == guid)
-			return port;
-
-	return NULL;
+	return ibnd_htbl_find(&((f_internal_t *)fabric)->portguid_tbl, guid);
 }
 
 ibnd_port_t *ibnd_find_port_dr(ibnd_fabric_t * fabric, char *dr_str)
@@ -141,9 +141,10 @@ typedef struct ibnd_chassis {
 
 /* define config flags */
 #define IBND_CONFIG_MLX_EPI (1 << 0)
+#define IBND_CONFIG_SMP_STATS (1 << 1)	/* print SMP engine statistics */
 
 typedef struct ibnd_config {
-	unsigned max_smps;
+	unsigned max_smps;	/* initial SMPs on the wire */
 	unsigned show_progress;
 	unsigned max_hops;
 	unsigned debug;
@@ -151,7 +152,12 @@ typedef struct ibnd_config {
 	unsigned retries;
 	uint32_t flags;
 	uint64_t mkey;
-	uint8_t pad[44];
+	/* upper bound for the adaptive SMP window; if 0 the window stays
+	 * at max_smps */
+	uint32_t max_smps_window;
+	uint32_t max_smps_per_dest;	/* SMPs on the wire to one switch/port */
+	uint32_t pace_us;	/* minimum gap between SMPs to one destination */
+	uint8_t pad[32];
 } ibnd_config_t;
 
 /** =========================================================================
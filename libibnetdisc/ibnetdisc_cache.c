@@ -36,14 +36,18 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <endian.h>
 
+#include <ccan/build_assert.h>
 #include <infiniband/ibnetdisc.h>
 
 #include "internal.h"
@@ -51,7 +55,9 @@
 
 /* For this caching lib, we always cache little endian */
 
-/* Cache format
+/* Cache format, version 1
+ *
+ * Only read, version 2 is written by ibnd_cache_fabric().
  *
  * Bytes 1-4 - magic number
  * Bytes 5-8 - version number
@@ -94,6 +100,78 @@
  * 1 byte - port num remotely connected to
  */
 
+/* Cache format, version 2
+ *
+ * A fixed layout file meant to be mmap'ed.  The header below is followed
+ * by four sections whose offsets it records: node records, port records,
+ * a node GUID index and a port GUID index.  Records refer to each other
+ * by array index instead of by GUID, ports of a node are stored
+ * contiguously starting at first_port and in the same order as the node
+ * records.
+ *
+ * The GUID indexes are open addressing tables laid out exactly like the
+ * in-memory ibnd_htbl_t (hash selected by the hash field), so the loader
+ * can adopt them slot for slot instead of rehashing every GUID.  A port
+ * GUID shared by several switch ports maps to the port a lookup on the
+ * cached fabric returned.
+ */
+struct ibnd_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t node_count;
+	uint32_t port_count;
+	uint64_t from_node_guid;
+	uint32_t from_node;
+	uint32_t maxhops;
+	uint32_t node_index_slots;
+	uint32_t port_index_slots;
+	uint32_t hash;
+	uint16_t node_rec_len;
+	uint16_t port_rec_len;
+	uint64_t node_off;
+	uint64_t port_off;
+	uint64_t node_index_off;
+	uint64_t port_index_off;
+};
+
+struct ibnd_cache_node_rec {
+	uint64_t guid;
+	uint32_t first_port;
+	uint16_t smalid;
+	uint8_t smalmc;
+	uint8_t smaenhsp0;
+	uint8_t type;
+	uint8_t numports;
+	uint8_t ports_stored;
+	uint8_t reserved[5];
+	uint8_t switchinfo[IB_SMP_DATA_SIZE];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t nodedesc[IB_SMP_DATA_SIZE];
+};
+
+struct ibnd_cache_port_rec {
+	uint64_t guid;
+	uint32_t node;
+	uint32_t remoteport;
+	uint16_t base_lid;
+	uint8_t portnum;
+	uint8_t ext_portnum;
+	uint8_t lmc;
+	uint8_t reserved[3];
+	uint8_t info[IB_SMP_DATA_SIZE];
+	uint8_t ext_info[IB_SMP_DATA_SIZE];
+};
+
+struct ibnd_cache_index_ent {
+	uint64_t guid;
+	uint32_t idx;
+	uint32_t reserved;
+};
+
+#define IBND_CACHE_NO_INDEX	UINT32_MAX
+/* ibnd_htbl_hash() */
+#define IBND_CACHE_HASH_FIB	1
+
 /* Structs that hold cache info temporarily before
  * the real structs can be reconstructed.
  */
@@ -127,15 +205,15 @@ typedef struct ibnd_fabric_cache {
 	uint64_t from_node_guid;
 	ibnd_node_cache_t *nodes_cache;
 	ibnd_port_cache_t *ports_cache;
-	ibnd_node_cache_t *nodescachetbl[HTSZ];
-	ibnd_port_cache_t *portscachetbl[HTSZ];
+	/* keyed by guid, entries chained through htnext */
+	ibnd_htbl_t node_cache_tbl;
+	ibnd_htbl_t port_cache_tbl;
 } ibnd_fabric_cache_t;
 
 #define IBND_FABRIC_CACHE_BUFLEN  4096
 #define IBND_FABRIC_CACHE_MAGIC   0x8FE7832B
-#define IBND_FABRIC_CACHE_VERSION 0x00000001
-
-#define IBND_FABRIC_CACHE_COUNT_OFFSET 8
+#define IBND_FABRIC_CACHE_VERSION_1 0x00000001
+#define IBND_FABRIC_CACHE_VERSION_2 0x00000002
 
 #define IBND_FABRIC_CACHE_HEADER_LEN   (28)
 #define IBND_NODE_CACHE_HEADER_LEN     (15 + IB_SMP_DATA_SIZE*3)
@@ -236,7 +314,7 @@ static int _load_header_info(int fd, ibnd_fabric_cache_t * fabric_cache,
 
 	offset += _unmarshall32(buf + offset, &version);
 
-	if (version != IBND_FABRIC_CACHE_VERSION) {
+	if (version != IBND_FABRIC_CACHE_VERSION_1) {
 		IBND_DEBUG("invalid fabric cache version\n");
 		return -1;
 	}
@@ -289,19 +367,26 @@ static void _destroy_ibnd_fabric_cache(ibnd_fabric_cache_t * fabric_cache)
 		port_cache = port_cache_next;
 	}
 
+	ibnd_htbl_destroy(&fabric_cache->node_cache_tbl);
+	ibnd_htbl_destroy(&fabric_cache->port_cache_tbl);
 	free(fabric_cache);
 }
 
-static void store_node_cache(ibnd_node_cache_t * node_cache,
-			     ibnd_fabric_cache_t * fabric_cache)
+static int store_node_cache(ibnd_node_cache_t * node_cache,
+			    ibnd_fabric_cache_t * fabric_cache)
 {
-	int hash_indx = HASHGUID(node_cache->node->guid) % HTSZ;
+	void *old;
+
+	if (ibnd_htbl_insert(&fabric_cache->node_cache_tbl,
+			     node_cache->node->guid, node_cache, &old)) {
+		IBND_DEBUG("OOM: node cache table\n");
+		return -1;
+	}
+	node_cache->htnext = old;
 
 	node_cache->next = fabric_cache->nodes_cache;
 	fabric_cache->nodes_cache = node_cache;
-
-	node_cache->htnext = fabric_cache->nodescachetbl[hash_indx];
-	fabric_cache->nodescachetbl[hash_indx] = node_cache;
+	return 0;
 }
 
 static int _load_node(int fd, ibnd_fabric_cache_t * fabric_cache)
@@ -384,7 +469,8 @@ static int _load_node(int fd, ibnd_fabric_cache_t * fabric_cache)
 		}
 	}
 
-	store_node_cache(node_cache, fabric_cache);
+	if (store_node_cache(node_cache, fabric_cache) < 0)
+		goto cleanup;
 
 	return 0;
 
@@ -393,16 +479,21 @@ cleanup:
 	return -1;
 }
 
-static void store_port_cache(ibnd_port_cache_t * port_cache,
-			     ibnd_fabric_cache_t * fabric_cache)
+static int store_port_cache(ibnd_port_cache_t * port_cache,
+			    ibnd_fabric_cache_t * fabric_cache)
 {
-	int hash_indx = HASHGUID(port_cache->port->guid) % HTSZ;
+	void *old;
+
+	if (ibnd_htbl_insert(&fabric_cache->port_cache_tbl,
+			     port_cache->port->guid, port_cache, &old)) {
+		IBND_DEBUG("OOM: port cache table\n");
+		return -1;
+	}
+	port_cache->htnext = old;
 
 	port_cache->next = fabric_cache->ports_cache;
 	fabric_cache->ports_cache = port_cache;
-
-	port_cache->htnext = fabric_cache->portscachetbl[hash_indx];
-	fabric_cache->portscachetbl[hash_indx] = port_cache;
+	return 0;
 }
 
 static int _load_port(int fd, ibnd_fabric_cache_t * fabric_cache)
@@ -449,7 +540,8 @@ static int _load_port(int fd, ibnd_fabric_cache_t * fabric_cache)
 	    _unmarshall8(buf + offset,
 			 &port_cache->remoteport_cache_key.portnum);
 
-	store_port_cache(port_cache, fabric_cache);
+	if (store_port_cache(port_cache, fabric_cache) < 0)
+		goto cleanup;
 
 	return 0;
 
@@ -462,13 +554,13 @@ cleanup:
 static ibnd_port_cache_t *_find_port(ibnd_fabric_cache_t * fabric_cache,
 				     ibnd_port_cache_key_t * port_cache_key)
 {
-	int hash_indx = HASHGUID(port_cache_key->guid) % HTSZ;
 	ibnd_port_cache_t *port_cache;
 
-	for (port_cache = fabric_cache->portscachetbl[hash_indx];
+	/* the chain only holds ports sharing this guid, e.g. switch ports */
+	for (port_cache = ibnd_htbl_find(&fabric_cache->port_cache_tbl,
+					 port_cache_key->guid);
 	     port_cache; port_cache = port_cache->htnext) {
-		if (port_cache->port->guid == port_cache_key->guid
-		    && port_cache->port->portnum == port_cache_key->portnum)
+		if (port_cache->port->portnum == port_cache_key->portnum)
 			return port_cache;
 	}
 
@@ -478,16 +570,7 @@ static ibnd_port_cache_t *_find_port(ibnd_fabric_cache_t * fabric_cache,
 static ibnd_node_cache_t *_find_node(ibnd_fabric_cache_t * fabric_cache,
 				     uint64_t guid)
 {
-	int hash_indx = HASHGUID(guid) % HTSZ;
-	ibnd_node_cache_t *node_cache;
-
-	for (node_cache = fabric_cache->nodescachetbl[hash_indx];
-	     node_cache; node_cache = node_cache->htnext) {
-		if (node_cache->node->guid == guid)
-			return node_cache;
-	}
-
-	return NULL;
+	return ibnd_htbl_find(&fabric_cache->node_cache_tbl, guid);
 }
 
 static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
@@ -511,8 +594,7 @@ static int _fill_port(ibnd_fabric_cache_t * fabric_cache, ibnd_node_t * node,
 	/* achu: needed if user wishes to re-cache a loaded fabric.
 	 * Otherwise, mostly unnecessary to do this.
 	 */
-	int rc = add_to_portguid_hash(port_cache->port,
-				      fabric_cache->f_int->fabric.portstbl);
+	int rc = add_to_portguid_hash(port_cache->port, fabric_cache->f_int);
 	if (rc) {
 		IBND_DEBUG("Error Occurred when trying"
 			   " to insert new port guid 0x%016" PRIx64 " to DB\n",
@@ -541,9 +623,7 @@ static int _rebuild_nodes(ibnd_fabric_cache_t * fabric_cache)
 		fabric_cache->f_int->fabric.nodes = node;
 
 		int rc = add_to_nodeguid_hash(node_cache->node,
-					      fabric_cache->
-					      f_int->
-					      fabric.nodestbl);
+					      fabric_cache->f_int);
 		if (rc) {
 			IBND_DEBUG("Error Occurred when trying"
 				   " to insert new node guid 0x%016" PRIx64 " to DB\n",
@@ -617,40 +697,22 @@ static int _rebuild_ports(ibnd_fabric_cache_t * fabric_cache)
 	return 0;
 }
 
-ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
+static int _load_fabric_v1(int fd, f_internal_t * f_int)
 {
 	unsigned int node_count = 0;
 	unsigned int port_count = 0;
 	ibnd_fabric_cache_t *fabric_cache = NULL;
-	f_internal_t *f_int = NULL;
 	ibnd_node_cache_t *node_cache = NULL;
-	int fd = -1;
 	unsigned int i;
 
-	if (!file) {
-		IBND_DEBUG("file parameter NULL\n");
-		return NULL;
-	}
-
-	if ((fd = open(file, O_RDONLY)) < 0) {
-		IBND_DEBUG("open: %s\n", strerror(errno));
-		return NULL;
-	}
-
 	fabric_cache =
 	    (ibnd_fabric_cache_t *) malloc(sizeof(ibnd_fabric_cache_t));
 	if (!fabric_cache) {
 		IBND_DEBUG("OOM: fabric_cache\n");
-		goto cleanup;
+		return -1;
 	}
 	memset(fabric_cache, '\0', sizeof(ibnd_fabric_cache_t));
 
-	f_int = allocate_fabric_internal();
-	if (!f_int) {
-		IBND_DEBUG("OOM: fabric\n");
-		goto cleanup;
-	}
-
 	fabric_cache->f_int = f_int;
 
 	if (_load_header_info(fd, fabric_cache, &node_count, &port_count) < 0)
@@ -680,214 +742,446 @@ ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 	if (_rebuild_ports(fabric_cache) < 0)
 		goto cleanup;
 
-	if (group_nodes(&f_int->fabric))
-		goto cleanup;
-
 	_destroy_ibnd_fabric_cache(fabric_cache);
-	close(fd);
-	return (ibnd_fabric_t *)&f_int->fabric;
+	return 0;
 
 cleanup:
-	ibnd_destroy_fabric((ibnd_fabric_t *)f_int);
 	_destroy_ibnd_fabric_cache(fabric_cache);
-	close(fd);
-	return NULL;
+	return -1;
 }
 
-static ssize_t ibnd_write(int fd, const void *buf, size_t count)
+static int _check_section(const struct ibnd_cache_hdr *hdr, size_t size,
+			  uint64_t off, uint64_t count, size_t len)
 {
-	size_t count_done = 0;
-	ssize_t ret;
-
-	while ((count - count_done) > 0) {
-		ret = write(fd, ((char *) buf) + count_done, count - count_done);
-		if (ret < 0) {
-			if (errno == EINTR)
-				continue;
-			else {
-				IBND_DEBUG("write: %s\n", strerror(errno));
-				return -1;
-			}
-		}
-		count_done += ret;
+	/* counts are 32 bit, so count * len cannot overflow */
+	if (off < sizeof(*hdr) || off > size || count * len > size - off) {
+		IBND_DEBUG("Cache invalid: section outside of file\n");
+		return -1;
 	}
-	return count_done;
+	/* records hold 64 bit fields and are read in place */
+	if (off % sizeof(uint64_t)) {
+		IBND_DEBUG("Cache invalid: misaligned section\n");
+		return -1;
+	}
+	return 0;
 }
 
-static size_t _marshall8(uint8_t * outbuf, uint8_t num)
+static int _load_header_v2(const void *map, size_t size,
+			   struct ibnd_cache_hdr *hdr)
 {
-	outbuf[0] = num;
+	const struct ibnd_cache_hdr *raw = map;
 
-	return (sizeof(num));
-}
+	if (size < sizeof(*hdr)) {
+		IBND_DEBUG("Cache invalid: file too short\n");
+		return -1;
+	}
 
-static size_t _marshall16(uint8_t * outbuf, uint16_t num)
-{
-	outbuf[0] = num & 0x00FF;
-	outbuf[1] = (num & 0xFF00) >> 8;
+	hdr->node_count = le32toh(raw->node_count);
+	hdr->port_count = le32toh(raw->port_count);
+	hdr->from_node_guid = le64toh(raw->from_node_guid);
+	hdr->from_node = le32toh(raw->from_node);
+	hdr->maxhops = le32toh(raw->maxhops);
+	hdr->node_index_slots = le32toh(raw->node_index_slots);
+	hdr->port_index_slots = le32toh(raw->port_index_slots);
+	hdr->hash = le32toh(raw->hash);
+	hdr->node_rec_len = le16toh(raw->node_rec_len);
+	hdr->port_rec_len = le16toh(raw->port_rec_len);
+	hdr->node_off = le64toh(raw->node_off);
+	hdr->port_off = le64toh(raw->port_off);
+	hdr->node_index_off = le64toh(raw->node_index_off);
+	hdr->port_index_off = le64toh(raw->port_index_off);
+
+	if (hdr->node_rec_len != sizeof(struct ibnd_cache_node_rec) ||
+	    hdr->port_rec_len != sizeof(struct ibnd_cache_port_rec)) {
+		IBND_DEBUG("Cache invalid: unexpected record length\n");
+		return -1;
+	}
 
-	return (sizeof(num));
-}
+	if (hdr->from_node >= hdr->node_count) {
+		IBND_DEBUG("Cache invalid: cannot find from node\n");
+		return -1;
+	}
 
-static size_t _marshall32(uint8_t * outbuf, uint32_t num)
-{
-	outbuf[0] = num & 0x000000FF;
-	outbuf[1] = (num & 0x0000FF00) >> 8;
-	outbuf[2] = (num & 0x00FF0000) >> 16;
-	outbuf[3] = (num & 0xFF000000) >> 24;
+	/* a power of two with at least one free slot, as in ibnd_htbl_t */
+	if (hdr->node_index_slots & (hdr->node_index_slots - 1) ||
+	    hdr->node_index_slots <= hdr->node_count ||
+	    hdr->port_index_slots & (hdr->port_index_slots - 1) ||
+	    hdr->port_index_slots <= hdr->port_count) {
+		IBND_DEBUG("Cache invalid: bad index size\n");
+		return -1;
+	}
 
-	return (sizeof(num));
-}
+	if (_check_section(hdr, size, hdr->node_off, hdr->node_count,
+			   hdr->node_rec_len) ||
+	    _check_section(hdr, size, hdr->port_off, hdr->port_count,
+			   hdr->port_rec_len) ||
+	    _check_section(hdr, size, hdr->node_index_off,
+			   hdr->node_index_slots,
+			   sizeof(struct ibnd_cache_index_ent)) ||
+	    _check_section(hdr, size, hdr->port_index_off,
+			   hdr->port_index_slots,
+			   sizeof(struct ibnd_cache_index_ent)))
+		return -1;
 
-static size_t _marshall64(uint8_t * outbuf, uint64_t num)
-{
-	outbuf[0] = (uint8_t) num;
-	outbuf[1] = (uint8_t) (num >> 8);
-	outbuf[2] = (uint8_t) (num >> 16);
-	outbuf[3] = (uint8_t) (num >> 24);
-	outbuf[4] = (uint8_t) (num >> 32);
-	outbuf[5] = (uint8_t) (num >> 40);
-	outbuf[6] = (uint8_t) (num >> 48);
-	outbuf[7] = (uint8_t) (num >> 56);
-
-	return (sizeof(num));
+	return 0;
 }
 
-static size_t _marshall_buf(void *outbuf, const void *inbuf, unsigned int len)
+/* Fill tbl from a GUID index section; base/stride locate the object an
+ * index entry refers to and guid_of reads back its GUID for validation.
+ */
+static int _load_index_v2(ibnd_htbl_t *tbl, const struct ibnd_cache_hdr *hdr,
+			  const struct ibnd_cache_index_ent *ents,
+			  uint32_t slots, void *base, size_t stride,
+			  uint32_t count, size_t guid_offset)
 {
-	memcpy(outbuf, inbuf, len);
+	uint32_t i, idx;
+	uint64_t guid;
+	void *obj;
 
-	return len;
+	if (ibnd_htbl_init(tbl, slots)) {
+		IBND_DEBUG("OOM: guid index\n");
+		return -1;
+	}
+
+	for (i = 0; i < slots; i++) {
+		idx = le32toh(ents[i].idx);
+		if (idx == IBND_CACHE_NO_INDEX)
+			continue;
+
+		if (idx >= count)
+			goto bad_entry;
+
+		guid = le64toh(ents[i].guid);
+		obj = (char *)base + (size_t)idx * stride;
+		if (*(uint64_t *)((char *)obj + guid_offset) != guid)
+			goto bad_entry;
+
+		if (hdr->hash == IBND_CACHE_HASH_FIB) {
+			if (tbl->entries[i].val)
+				goto bad_slot;
+			tbl->entries[i].key = guid;
+			tbl->entries[i].val = obj;
+			tbl->count++;
+		} else if (ibnd_htbl_insert(tbl, guid, obj, NULL)) {
+			IBND_DEBUG("OOM: guid index\n");
+			return -1;
+		}
+	}
+
+	if (hdr->hash != IBND_CACHE_HASH_FIB)
+		return 0;
+
+	/* make sure every adopted entry is reachable from its home slot */
+	for (i = 0; i < slots; i++) {
+		if (tbl->entries[i].val &&
+		    ibnd_htbl_find(tbl, tbl->entries[i].key) !=
+		    tbl->entries[i].val)
+			goto bad_slot;
+	}
+	return 0;
+
+bad_entry:
+	IBND_DEBUG("Cache invalid: bad guid index entry\n");
+	return -1;
+bad_slot:
+	IBND_DEBUG("Cache invalid: guid index corrupted\n");
+	return -1;
 }
 
-static int _cache_header_info(int fd, ibnd_fabric_t * fabric)
+static int _load_fabric_v2(int fd, f_internal_t * f_int)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
-
-	/* Store magic number, version, and other important info */
-	/* For this caching lib, we always assume cached as little endian */
+	const struct ibnd_cache_node_rec *nrec;
+	const struct ibnd_cache_port_rec *prec;
+	struct ibnd_cache_hdr hdr;
+	ibnd_fabric_t *fabric = &f_int->fabric;
+	ibnd_node_t *nodes, *node;
+	ibnd_port_t *ports, *port;
+	ibnd_port_t **port_ptrs;
+	size_t nptrs = 0, size;
+	struct stat statbuf;
+	void *map;
+	uint32_t i, p, next_port = 0;
+	int hash_idx, ret = -1;
 
-	offset += _marshall32(buf + offset, IBND_FABRIC_CACHE_MAGIC);
-	offset += _marshall32(buf + offset, IBND_FABRIC_CACHE_VERSION);
-	/* save space for node count */
-	offset += _marshall32(buf + offset, 0);
-	/* save space for port count */
-	offset += _marshall32(buf + offset, 0);
-	offset += _marshall64(buf + offset, fabric->from_node->guid);
-	offset += _marshall32(buf + offset, fabric->maxhops_discovered);
+	if (fstat(fd, &statbuf) < 0) {
+		IBND_DEBUG("fstat: %s\n", strerror(errno));
+		return -1;
+	}
+	size = statbuf.st_size;
 
-	if (ibnd_write(fd, buf, offset) < 0)
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		IBND_DEBUG("mmap: %s\n", strerror(errno));
 		return -1;
+	}
 
-	return 0;
+	if (_load_header_v2(map, size, &hdr) < 0)
+		goto out;
+
+	nrec = (const void *)((const char *)map + hdr.node_off);
+	prec = (const void *)((const char *)map + hdr.port_off);
+
+	/* Ports of a node must be contiguous and in node order */
+	for (i = 0; i < hdr.node_count; i++) {
+		if (le32toh(nrec[i].first_port) != next_port ||
+		    nrec[i].ports_stored > hdr.port_count - next_port) {
+			IBND_DEBUG("Cache invalid: bad port range\n");
+			goto out;
+		}
+		next_port += nrec[i].ports_stored;
+		nptrs += nrec[i].numports + 1;
+	}
+	if (next_port != hdr.port_count) {
+		IBND_DEBUG("Cache invalid: orphan ports\n");
+		goto out;
+	}
+
+	/* One allocation for everything, released by ibnd_destroy_fabric() */
+	f_int->pool = calloc(1, hdr.node_count * sizeof(*nodes) +
+			     hdr.port_count * sizeof(*ports) +
+			     nptrs * sizeof(*port_ptrs));
+	if (!f_int->pool) {
+		IBND_DEBUG("OOM: fabric pool\n");
+		goto out;
+	}
+	nodes = f_int->pool;
+	ports = (ibnd_port_t *)(nodes + hdr.node_count);
+	port_ptrs = (ibnd_port_t **)(ports + hdr.port_count);
+
+	for (i = 0; i < hdr.node_count; i++) {
+		node = &nodes[i];
+		node->guid = le64toh(nrec[i].guid);
+		node->smalid = le16toh(nrec[i].smalid);
+		node->smalmc = nrec[i].smalmc;
+		node->smaenhsp0 = nrec[i].smaenhsp0;
+		node->type = nrec[i].type;
+		node->numports = nrec[i].numports;
+		memcpy(node->switchinfo, nrec[i].switchinfo, IB_SMP_DATA_SIZE);
+		memcpy(node->info, nrec[i].info, IB_SMP_DATA_SIZE);
+		memcpy(node->nodedesc, nrec[i].nodedesc, IB_SMP_DATA_SIZE);
+		node->ports = port_ptrs;
+		port_ptrs += node->numports + 1;
+		node->next = i + 1 < hdr.node_count ? &nodes[i + 1] : NULL;
+
+		hash_idx = HASHGUID(node->guid) % HTSZ;
+		node->htnext = fabric->nodestbl[hash_idx];
+		fabric->nodestbl[hash_idx] = node;
+	}
+	fabric->nodes = nodes;
+	/* type lists are built by prepending, keep them in node list order */
+	for (i = hdr.node_count; i--; )
+		add_to_type_list(&nodes[i], f_int);
+	fabric->from_node = &nodes[hdr.from_node];
+	fabric->maxhops_discovered = hdr.maxhops;
+
+	for (p = 0; p < hdr.port_count; p++) {
+		uint32_t n = le32toh(prec[p].node);
+		uint32_t r = le32toh(prec[p].remoteport);
+
+		if (n >= hdr.node_count ||
+		    (r != IBND_CACHE_NO_INDEX && r >= hdr.port_count) ||
+		    p < le32toh(nrec[n].first_port) ||
+		    p - le32toh(nrec[n].first_port) >= nrec[n].ports_stored ||
+		    prec[p].portnum > nodes[n].numports ||
+		    nodes[n].ports[prec[p].portnum]) {
+			IBND_DEBUG("Cache invalid: bad port record\n");
+			goto out;
+		}
+
+		port = &ports[p];
+		port->guid = le64toh(prec[p].guid);
+		port->portnum = prec[p].portnum;
+		port->ext_portnum = prec[p].ext_portnum;
+		port->base_lid = le16toh(prec[p].base_lid);
+		port->lmc = prec[p].lmc;
+		memcpy(port->info, prec[p].info, IB_SMP_DATA_SIZE);
+		memcpy(port->ext_info, prec[p].ext_info, IB_SMP_DATA_SIZE);
+		port->node = &nodes[n];
+		port->remoteport = r == IBND_CACHE_NO_INDEX ? NULL : &ports[r];
+		nodes[n].ports[port->portnum] = port;
+
+		hash_idx = HASHGUID(port->guid) % HTSZ;
+		port->htnext = fabric->portstbl[hash_idx];
+		fabric->portstbl[hash_idx] = port;
+		add_to_portlid_hash(port, f_int);
+	}
+
+	if (_load_index_v2(&f_int->nodeguid_tbl, &hdr,
+			   (const void *)((const char *)map +
+					  hdr.node_index_off),
+			   hdr.node_index_slots, nodes, sizeof(*nodes),
+			   hdr.node_count, offsetof(ibnd_node_t, guid)) ||
+	    _load_index_v2(&f_int->portguid_tbl, &hdr,
+			   (const void *)((const char *)map +
+					  hdr.port_index_off),
+			   hdr.port_index_slots, ports, sizeof(*ports),
+			   hdr.port_count, offsetof(ibnd_port_t, guid)))
+		goto out;
+
+	ret = 0;
+out:
+	munmap(map, size);
+	return ret;
 }
 
-static int _cache_header_counts(int fd, unsigned int node_count,
-				unsigned int port_count)
+ibnd_fabric_t *ibnd_load_fabric(const char *file, unsigned int flags)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
+	f_internal_t *f_int = NULL;
+	uint8_t buf[8];
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	int fd = -1;
+	int rc;
+
+	if (!file) {
+		IBND_DEBUG("file parameter NULL\n");
+		return NULL;
+	}
 
-	offset += _marshall32(buf + offset, node_count);
-	offset += _marshall32(buf + offset, port_count);
+	if ((fd = open(file, O_RDONLY)) < 0) {
+		IBND_DEBUG("open: %s\n", strerror(errno));
+		return NULL;
+	}
 
-	if (lseek(fd, IBND_FABRIC_CACHE_COUNT_OFFSET, SEEK_SET) < 0) {
-		IBND_DEBUG("lseek: %s\n", strerror(errno));
-		return -1;
+	f_int = allocate_fabric_internal();
+	if (!f_int) {
+		IBND_DEBUG("OOM: fabric\n");
+		goto cleanup;
 	}
 
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+	if (ibnd_read(fd, buf, sizeof(buf)) < 0)
+		goto cleanup;
 
-	return 0;
+	_unmarshall32(buf + _unmarshall32(buf, &magic), &version);
+	if (magic != IBND_FABRIC_CACHE_MAGIC) {
+		IBND_DEBUG("invalid fabric cache file\n");
+		goto cleanup;
+	}
+
+	if (version == IBND_FABRIC_CACHE_VERSION_2) {
+		rc = _load_fabric_v2(fd, f_int);
+	} else {
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			IBND_DEBUG("lseek: %s\n", strerror(errno));
+			goto cleanup;
+		}
+		rc = _load_fabric_v1(fd, f_int);
+	}
+	if (rc < 0)
+		goto cleanup;
+
+	if (group_nodes(&f_int->fabric))
+		goto cleanup;
+
+	close(fd);
+	return (ibnd_fabric_t *)&f_int->fabric;
+
+cleanup:
+	ibnd_destroy_fabric((ibnd_fabric_t *)f_int);
+	close(fd);
+	return NULL;
 }
 
-static int _cache_node(int fd, ibnd_node_t * node)
+static ssize_t ibnd_write(int fd, const void *buf, size_t count)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
-	size_t ports_stored_offset = 0;
-	uint8_t ports_stored_count = 0;
-	int i;
+	size_t count_done = 0;
+	ssize_t ret;
 
-	offset += _marshall16(buf + offset, node->smalid);
-	offset += _marshall8(buf + offset, node->smalmc);
-	offset += _marshall8(buf + offset, (uint8_t) node->smaenhsp0);
-	offset += _marshall_buf(buf + offset, node->switchinfo,
-				IB_SMP_DATA_SIZE);
-	offset += _marshall64(buf + offset, node->guid);
-	offset += _marshall8(buf + offset, (uint8_t) node->type);
-	offset += _marshall8(buf + offset, (uint8_t) node->numports);
-	offset += _marshall_buf(buf + offset, node->info, IB_SMP_DATA_SIZE);
-	offset += _marshall_buf(buf + offset, node->nodedesc, IB_SMP_DATA_SIZE);
-	/* need to come back later and store number of stored ports
-	 * because port entries can be NULL or (in the case of switches)
-	 * there is an additional port 0 not accounted for in numports.
-	 */
-	ports_stored_offset = offset;
-	offset += sizeof(uint8_t);
-
-	for (i = 0; i <= node->numports; i++) {
-		if (node->ports[i]) {
-			offset += _marshall64(buf + offset,
-					      node->ports[i]->guid);
-			offset += _marshall8(buf + offset,
-					     (uint8_t) node->ports[i]->portnum);
-			ports_stored_count++;
+	while ((count - count_done) > 0) {
+		ret = write(fd, ((char *) buf) + count_done, count - count_done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			else {
+				IBND_DEBUG("write: %s\n", strerror(errno));
+				return -1;
+			}
 		}
+		count_done += ret;
 	}
+	return count_done;
+}
 
-	/* go back and store number of port keys stored */
-	_marshall8(buf + ports_stored_offset, ports_stored_count);
-
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+/* Smallest table size keeping the load factor at or below 1/2 */
+static uint32_t _index_slots(uint32_t count)
+{
+	uint32_t slots = 64;
 
-	return 0;
+	while (slots < 2 * (uint64_t)count)
+		slots <<= 1;
+	return slots;
 }
 
-static int _cache_port(int fd, ibnd_port_t * port)
+/* Lay out a GUID index the way ibnd_htbl_t would.  guids maps the GUID
+ * of every record to its index + 1, the last record winning as in the
+ * live tables.  Where the live fabric table returns an object whose GUID
+ * is unchanged that object is kept, but GUIDs edited in place (e.g. by
+ * ibcacheedit) are indexed from the records themselves.
+ */
+static int _cache_index(struct ibnd_cache_index_ent *ents, uint32_t slots,
+			ibnd_htbl_t *guids, const ibnd_htbl_t *live,
+			const ibnd_htbl_t *to_idx, size_t guid_offset)
 {
-	uint8_t buf[IBND_FABRIC_CACHE_BUFLEN];
-	size_t offset = 0;
+	uint32_t i, j;
 
-	offset += _marshall64(buf + offset, port->guid);
-	offset += _marshall8(buf + offset, (uint8_t) port->portnum);
-	offset += _marshall8(buf + offset, (uint8_t) port->ext_portnum);
-	offset += _marshall16(buf + offset, port->base_lid);
-	offset += _marshall8(buf + offset, port->lmc);
-	offset += _marshall_buf(buf + offset, port->info, IB_SMP_DATA_SIZE);
-	offset += _marshall64(buf + offset, port->node->guid);
-	if (port->remoteport) {
-		offset += _marshall8(buf + offset, 1);
-		offset += _marshall64(buf + offset, port->remoteport->guid);
-		offset += _marshall8(buf + offset, (uint8_t) port->remoteport->portnum);
-	} else {
-		offset += _marshall8(buf + offset, 0);
-		offset += _marshall64(buf + offset, 0);
-		offset += _marshall8(buf + offset, 0);
+	for (i = 0; live->entries && i <= live->mask; i++) {
+		void *obj = live->entries[i].val;
+		uintptr_t idx;
+
+		if (!obj || *(uint64_t *)((char *)obj + guid_offset) !=
+			    live->entries[i].key)
+			continue;
+
+		idx = (uintptr_t)ibnd_htbl_find(to_idx, (uintptr_t)obj);
+		if (idx && ibnd_htbl_insert(guids, live->entries[i].key,
+					    (void *)idx, NULL))
+			return -1;
 	}
 
-	if (ibnd_write(fd, buf, offset) < 0)
-		return -1;
+	for (i = 0; i < slots; i++)
+		ents[i].idx = htole32(IBND_CACHE_NO_INDEX);
+
+	for (i = 0; guids->entries && i <= guids->mask; i++) {
+		if (!guids->entries[i].val)
+			continue;
 
+		for (j = ibnd_htbl_hash(guids->entries[i].key) & (slots - 1);
+		     ents[j].idx != htole32(IBND_CACHE_NO_INDEX);
+		     j = (j + 1) & (slots - 1))
+			;
+		ents[j].guid = htole64(guids->entries[i].key);
+		ents[j].idx = htole32((uintptr_t)guids->entries[i].val - 1);
+	}
 	return 0;
 }
 
 int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		      unsigned int flags)
 {
+	f_internal_t *f_int = (f_internal_t *)fabric;
+	struct ibnd_cache_hdr *hdr;
+	struct ibnd_cache_node_rec *nrec;
+	struct ibnd_cache_port_rec *prec;
+	ibnd_htbl_t node_idx = {}, port_idx = {};
+	ibnd_htbl_t node_guids = {}, port_guids = {};
 	struct stat statbuf;
-	ibnd_node_t *node = NULL;
-	ibnd_node_t *node_next = NULL;
-	unsigned int node_count = 0;
-	ibnd_port_t *port = NULL;
-	ibnd_port_t *port_next = NULL;
-	unsigned int port_count = 0;
-	int fd;
+	ibnd_node_t *node;
+	ibnd_port_t *port;
+	uint32_t node_count = 0, port_count = 0, n, p;
+	uint32_t node_slots, port_slots;
+	uint8_t *buf = NULL;
+	size_t size;
+	int fd = -1;
+	int ret = -1;
 	int i;
 
+	BUILD_ASSERT(sizeof(struct ibnd_cache_hdr) == 80);
+	BUILD_ASSERT(sizeof(struct ibnd_cache_node_rec) ==
+		     24 + 3 * IB_SMP_DATA_SIZE);
+	BUILD_ASSERT(sizeof(struct ibnd_cache_port_rec) ==
+		     24 + 2 * IB_SMP_DATA_SIZE);
+	BUILD_ASSERT(sizeof(struct ibnd_cache_index_ent) == 16);
+
 	if (!fabric) {
 		IBND_DEBUG("fabric parameter NULL\n");
 		return -1;
@@ -898,66 +1192,160 @@ int ibnd_cache_fabric(ibnd_fabric_t * fabric, const char *file,
 		return -1;
 	}
 
+	/* Number nodes and ports, mapping pointers and GUIDs to index + 1 */
+	for (node = fabric->nodes; node; node = node->next) {
+		if (ibnd_htbl_insert(&node_idx, (uintptr_t)node,
+				     (void *)(uintptr_t)++node_count, NULL) ||
+		    ibnd_htbl_insert(&node_guids, node->guid,
+				     (void *)(uintptr_t)node_count, NULL))
+			goto oom;
+		for (i = 0; i <= node->numports; i++) {
+			port = node->ports[i];
+			if (!port)
+				continue;
+			if (ibnd_htbl_insert(&port_idx, (uintptr_t)port,
+					     (void *)(uintptr_t)++port_count,
+					     NULL) ||
+			    ibnd_htbl_insert(&port_guids, port->guid,
+					     (void *)(uintptr_t)port_count,
+					     NULL))
+				goto oom;
+		}
+	}
+
+	if (!fabric->from_node ||
+	    !ibnd_htbl_find(&node_idx, (uintptr_t)fabric->from_node)) {
+		IBND_DEBUG("from node not in fabric\n");
+		goto out;
+	}
+
+	node_slots = _index_slots(node_count);
+	port_slots = _index_slots(port_count);
+	size = sizeof(*hdr) + node_count * sizeof(*nrec) +
+	    port_count * sizeof(*prec) +
+	    (node_slots + port_slots) * sizeof(struct ibnd_cache_index_ent);
+
+	buf = calloc(1, size);
+	if (!buf)
+		goto oom;
+
+	/* For this caching lib, we always cache little endian */
+	hdr = (struct ibnd_cache_hdr *)buf;
+	hdr->magic = htole32(IBND_FABRIC_CACHE_MAGIC);
+	hdr->version = htole32(IBND_FABRIC_CACHE_VERSION_2);
+	hdr->node_count = htole32(node_count);
+	hdr->port_count = htole32(port_count);
+	hdr->from_node_guid = htole64(fabric->from_node->guid);
+	hdr->from_node = htole32((uintptr_t)ibnd_htbl_find(&node_idx,
+				 (uintptr_t)fabric->from_node) - 1);
+	hdr->maxhops = htole32(fabric->maxhops_discovered);
+	hdr->node_index_slots = htole32(node_slots);
+	hdr->port_index_slots = htole32(port_slots);
+	hdr->hash = htole32(IBND_CACHE_HASH_FIB);
+	hdr->node_rec_len = htole16(sizeof(*nrec));
+	hdr->port_rec_len = htole16(sizeof(*prec));
+	hdr->node_off = htole64(sizeof(*hdr));
+	hdr->port_off = htole64(sizeof(*hdr) + node_count * sizeof(*nrec));
+	hdr->node_index_off = htole64(le64toh(hdr->port_off) +
+				      port_count * sizeof(*prec));
+	hdr->port_index_off = htole64(le64toh(hdr->node_index_off) +
+				      node_slots *
+				      sizeof(struct ibnd_cache_index_ent));
+
+	nrec = (void *)(buf + le64toh(hdr->node_off));
+	prec = (void *)(buf + le64toh(hdr->port_off));
+	for (n = 0, p = 0, node = fabric->nodes; node; node = node->next, n++) {
+		nrec[n].guid = htole64(node->guid);
+		nrec[n].first_port = htole32(p);
+		nrec[n].smalid = htole16(node->smalid);
+		nrec[n].smalmc = node->smalmc;
+		nrec[n].smaenhsp0 = node->smaenhsp0;
+		nrec[n].type = node->type;
+		nrec[n].numports = node->numports;
+		memcpy(nrec[n].switchinfo, node->switchinfo, IB_SMP_DATA_SIZE);
+		memcpy(nrec[n].info, node->info, IB_SMP_DATA_SIZE);
+		memcpy(nrec[n].nodedesc, node->nodedesc, IB_SMP_DATA_SIZE);
+
+		for (i = 0; i <= node->numports; i++) {
+			port = node->ports[i];
+			if (!port)
+				continue;
+
+			prec[p].guid = htole64(port->guid);
+			prec[p].node = htole32(n);
+			prec[p].remoteport = htole32(IBND_CACHE_NO_INDEX);
+			if (port->remoteport) {
+				uintptr_t r = (uintptr_t)ibnd_htbl_find(
+					&port_idx, (uintptr_t)port->remoteport);
+
+				if (r)
+					prec[p].remoteport = htole32(r - 1);
+			}
+			prec[p].base_lid = htole16(port->base_lid);
+			prec[p].portnum = port->portnum;
+			prec[p].ext_portnum = port->ext_portnum;
+			prec[p].lmc = port->lmc;
+			memcpy(prec[p].info, port->info, IB_SMP_DATA_SIZE);
+			memcpy(prec[p].ext_info, port->ext_info,
+			       IB_SMP_DATA_SIZE);
+			nrec[n].ports_stored++;
+			p++;
+		}
+	}
+
+	if (_cache_index((void *)(buf + le64toh(hdr->node_index_off)),
+			 node_slots, &node_guids, &f_int->nodeguid_tbl,
+			 &node_idx, offsetof(ibnd_node_t, guid)) ||
+	    _cache_index((void *)(buf + le64toh(hdr->port_index_off)),
+			 port_slots, &port_guids, &f_int->portguid_tbl,
+			 &port_idx, offsetof(ibnd_port_t, guid)))
+		goto oom;
+
 	if (!(flags & IBND_CACHE_FABRIC_FLAG_NO_OVERWRITE)) {
 		if (!stat(file, &statbuf)) {
 			if (unlink(file) < 0) {
 				IBND_DEBUG("error removing '%s': %s\n",
 					   file, strerror(errno));
-				return -1;
+				goto out;
 			}
 		}
 	}
 	else {
 		if (!stat(file, &statbuf)) {
 			IBND_DEBUG("file '%s' already exists\n", file);
-			return -1;
+			goto out;
 		}
 	}
 
 	if ((fd = open(file, O_CREAT | O_EXCL | O_WRONLY, 0644)) < 0) {
 		IBND_DEBUG("open: %s\n", strerror(errno));
-		return -1;
+		goto out;
 	}
 
-	if (_cache_header_info(fd, fabric) < 0)
-		goto cleanup;
-
-	node = fabric->nodes;
-	while (node) {
-		node_next = node->next;
-
-		if (_cache_node(fd, node) < 0)
-			goto cleanup;
-
-		node_count++;
-		node = node_next;
-	}
-
-	for (i = 0; i < HTSZ; i++) {
-		port = fabric->portstbl[i];
-		while (port) {
-			port_next = port->htnext;
-
-			if (_cache_port(fd, port) < 0)
-				goto cleanup;
-
-			port_count++;
-			port = port_next;
-		}
-	}
-
-	if (_cache_header_counts(fd, node_count, port_count) < 0)
+	if (ibnd_write(fd, buf, size) < 0)
 		goto cleanup;
 
 	if (close(fd) < 0) {
+		fd = -1;
 		IBND_DEBUG("close: %s\n", strerror(errno));
 		goto cleanup;
 	}
 
-	return 0;
+	ret = 0;
+	goto out;
 
+oom:
+	IBND_DEBUG("OOM: fabric cache\n");
+	goto out;
 cleanup:
 	unlink(file);
-	close(fd);
-	return -1;
+	if (fd >= 0)
+		close(fd);
+out:
+	free(buf);
+	ibnd_htbl_destroy(&node_idx);
+	ibnd_htbl_destroy(&port_idx);
+	ibnd_htbl_destroy(&node_guids);
+	ibnd_htbl_destroy(&port_guids);
+	return ret;
 }
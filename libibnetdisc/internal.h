@@ -54,16 +54,46 @@
 #define MAXHOPS         63
 
 #define DEFAULT_MAX_SMP_ON_WIRE 2
+#define DEFAULT_MAX_SMP_PER_DEST 4
 #define DEFAULT_TIMEOUT 1000
 #define DEFAULT_RETRIES 3
 
+/* Resizable open addressing hash table keyed by GUID or LID.
+ * A zero initialized table is valid and empty.
+ */
+typedef struct ibnd_htbl_entry {
+	uint64_t key;
+	void *val;		/* NULL marks an empty slot */
+} ibnd_htbl_entry_t;
+
+typedef struct ibnd_htbl {
+	ibnd_htbl_entry_t *entries;
+	uint32_t mask;
+	uint32_t count;
+} ibnd_htbl_t;
+
+static inline uint32_t ibnd_htbl_hash(uint64_t key)
+{
+	/* Fibonacci hashing spreads sequential GUIDs and LIDs evenly */
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+int ibnd_htbl_init(ibnd_htbl_t *tbl, uint32_t size);
+void *ibnd_htbl_find(const ibnd_htbl_t *tbl, uint64_t key);
+int ibnd_htbl_insert(ibnd_htbl_t *tbl, uint64_t key, void *val, void **old);
+void ibnd_htbl_destroy(ibnd_htbl_t *tbl);
+
 typedef struct f_internal {
 	ibnd_fabric_t fabric;
-	cl_qmap_t lid2guid;
+	ibnd_htbl_t nodeguid_tbl;
+	ibnd_htbl_t portguid_tbl;
+	ibnd_htbl_t lid_tbl;
+	/* single allocation backing all nodes and ports when loaded from an
+	 * indexed cache file, NULL if they were allocated one by one */
+	void *pool;
 } f_internal_t;
 f_internal_t *allocate_fabric_internal(void);
-void create_lid2guid(f_internal_t *f_int);
-void destroy_lid2guid(f_internal_t *f_int);
+void destroy_fabric_tables(f_internal_t *f_int);
 void add_to_portlid_hash(ibnd_port_t * port, f_internal_t *f_int);
 
 typedef struct ibnd_scan {
@@ -74,6 +104,7 @@ typedef struct ibnd_scan {
 } ibnd_scan_t;
 
 typedef struct ibnd_smp ibnd_smp_t;
+typedef struct ibnd_smp_dest ibnd_smp_dest_t;
 typedef struct smp_engine smp_engine_t;
 typedef int (*smp_comp_cb_t) (smp_engine_t * engine, ibnd_smp_t * smp,
 			      uint8_t * mad_resp, void *cb_data);
@@ -84,18 +115,82 @@ struct ibnd_smp {
 	void *cb_data;
 	ib_portid_t path;
 	ib_rpc_t rpc;
+	ibnd_smp_dest_t *dest;
+	uint64_t send_us;
+	unsigned seq;		/* engine send sequence of the last attempt */
+	unsigned attempts;
 };
 
+/* Everything addressed to one LID or directed route.  SMPs wait in the
+ * destination queue until the engine window, the per destination cap and
+ * the pacing interval all allow them on the wire.
+ */
+struct ibnd_smp_dest {
+	struct ibnd_smp_dest *hnext;	/* same hash key */
+	struct ibnd_smp_dest *lnext;	/* ready or paced list */
+	struct ibnd_smp_dest *all_next;
+	ibnd_smp_t *queue_head;
+	ibnd_smp_t *queue_tail;
+	uint16_t lid;
+	ib_dr_path_t drpath;
+	unsigned on_wire;
+	uint64_t next_send_us;
+	int listed;
+};
+
+#define SMP_RTT_BUCKETS 24	/* log2(us) */
+
+typedef struct smp_engine_stats {
+	uint64_t start_us;
+	uint64_t end_us;
+	unsigned sent;
+	unsigned completed;
+	unsigned timeouts;
+	unsigned retries;
+	unsigned late;
+	unsigned errors;
+	unsigned max_on_wire;
+	unsigned window_min;
+	unsigned window_max;
+	unsigned dest_cap_waits;
+	unsigned pace_waits;
+	unsigned dests;
+	uint64_t rtt_sum_us;
+	uint64_t rtt_min_us;
+	uint64_t rtt_max_us;
+	unsigned rtt_hist[SMP_RTT_BUCKETS];
+} smp_engine_stats_t;
+
 struct smp_engine {
 	int umad_fd;
 	int smi_agent;
 	int smi_dir_agent;
-	ibnd_smp_t *smp_queue_head;
-	ibnd_smp_t *smp_queue_tail;
 	void *user_data;
 	cl_qmap_t smps_on_wire;
 	struct ibnd_config *cfg;
 	unsigned total_smps;
+
+	/* destinations keyed by a hash of their address */
+	ibnd_htbl_t dest_tbl;
+	ibnd_smp_dest_t *dests;
+	/* destinations with queued SMPs that may send now */
+	ibnd_smp_dest_t *ready_head;
+	ibnd_smp_dest_t *ready_tail;
+	/* destinations waiting for their pacing interval, oldest first */
+	ibnd_smp_dest_t *paced_head;
+	ibnd_smp_dest_t *paced_tail;
+	unsigned queued;
+
+	/* adaptive window, grown on timely responses, halved on timeouts */
+	unsigned window;
+	unsigned window_limit;
+	unsigned ssthresh;
+	unsigned window_credit;
+	unsigned send_seq;
+	unsigned shrink_seq;
+	uint64_t late_us;
+
+	smp_engine_stats_t stats;
 };
 
 int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
@@ -104,10 +199,11 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	      unsigned attrid, unsigned mod, smp_comp_cb_t cb, void *cb_data);
 int process_mads(smp_engine_t * engine);
 void smp_engine_destroy(smp_engine_t * engine);
+void smp_engine_print_stats(smp_engine_t * engine);
 
-int add_to_nodeguid_hash(ibnd_node_t * node, ibnd_node_t * hash[]);
+int add_to_nodeguid_hash(ibnd_node_t * node, f_internal_t * f_int);
 
-int add_to_portguid_hash(ibnd_port_t * port, ibnd_port_t * hash[]);
+int add_to_portguid_hash(ibnd_port_t * port, f_internal_t * f_int);
 
 void add_to_type_list(ibnd_node_t * node, f_internal_t * fabric);
 
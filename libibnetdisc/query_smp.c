@@ -33,31 +33,163 @@
  */
 
 #include <errno.h>
+#include <time.h>
 #include <infiniband/ibnetdisc.h>
 #include <infiniband/umad.h>
 #include "internal.h"
 
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Destinations: SMPs are queued per LID or directed route so that one
+ * slow switch cannot hold up the rest of the scan.
+ */
+static uint64_t dest_key(ib_portid_t * portid)
+{
+	uint64_t key = 14695981039346656037ULL;	/* FNV-1a */
+	int i;
+
+	key = (key ^ portid->lid) * 1099511628211ULL;
+	key = (key ^ portid->drpath.drslid) * 1099511628211ULL;
+	key = (key ^ portid->drpath.drdlid) * 1099511628211ULL;
+	for (i = 0; i <= portid->drpath.cnt; i++)
+		key = (key ^ portid->drpath.p[i]) * 1099511628211ULL;
+	return key;
+}
+
+static int dest_match(ibnd_smp_dest_t * dest, ib_portid_t * portid)
+{
+	return dest->lid == portid->lid &&
+	       dest->drpath.cnt == portid->drpath.cnt &&
+	       dest->drpath.drslid == portid->drpath.drslid &&
+	       dest->drpath.drdlid == portid->drpath.drdlid &&
+	       !memcmp(dest->drpath.p, portid->drpath.p,
+		       portid->drpath.cnt + 1);
+}
+
+static ibnd_smp_dest_t *get_dest(smp_engine_t * engine, ib_portid_t * portid)
+{
+	uint64_t key = dest_key(portid);
+	ibnd_smp_dest_t *head, *dest;
+
+	head = ibnd_htbl_find(&engine->dest_tbl, key);
+	for (dest = head; dest; dest = dest->hnext)
+		if (dest_match(dest, portid))
+			return dest;
+
+	if (portid->drpath.cnt < 0 ||
+	    portid->drpath.cnt >= IB_SUBNET_PATH_HOPS_MAX) {
+		IBND_ERROR("Invalid DR path length %d\n", portid->drpath.cnt);
+		return NULL;
+	}
+
+	dest = calloc(1, sizeof(*dest));
+	if (!dest)
+		return NULL;
+	dest->lid = portid->lid;
+	dest->drpath = portid->drpath;
+
+	if (ibnd_htbl_insert(&engine->dest_tbl, key, dest, NULL)) {
+		free(dest);
+		return NULL;
+	}
+	dest->hnext = head;
+	dest->all_next = engine->dests;
+	engine->dests = dest;
+	engine->stats.dests++;
+	return dest;
+}
+
+static void list_dest(ibnd_smp_dest_t ** head, ibnd_smp_dest_t ** tail,
+		      ibnd_smp_dest_t * dest)
+{
+	dest->lnext = NULL;
+	if (*tail)
+		(*tail)->lnext = dest;
+	else
+		*head = dest;
+	*tail = dest;
+	dest->listed = 1;
+}
+
+static ibnd_smp_dest_t *unlist_dest(ibnd_smp_dest_t ** head,
+				    ibnd_smp_dest_t ** tail)
+{
+	ibnd_smp_dest_t *dest = *head;
+
+	if (dest) {
+		*head = dest->lnext;
+		if (!*head)
+			*tail = NULL;
+		dest->listed = 0;
+	}
+	return dest;
+}
+
+/* Put dest on the ready or paced list if it has work it may start */
+static void schedule_dest(smp_engine_t * engine, ibnd_smp_dest_t * dest,
+			  uint64_t now)
+{
+	if (dest->listed || !dest->queue_head)
+		return;
+
+	if (dest->on_wire >= engine->cfg->max_smps_per_dest) {
+		engine->stats.dest_cap_waits++;
+		return;
+	}
+
+	if (dest->next_send_us > now) {
+		engine->stats.pace_waits++;
+		list_dest(&engine->paced_head, &engine->paced_tail, dest);
+	} else
+		list_dest(&engine->ready_head, &engine->ready_tail, dest);
+}
+
+/* Move destinations whose pacing interval expired to the ready list.
+ * The paced list is only roughly ordered, an entry behind one that is
+ * not due yet waits at most one more interval.
+ */
+static void release_paced(smp_engine_t * engine, uint64_t now)
+{
+	ibnd_smp_dest_t *dest;
+
+	while (engine->paced_head && engine->paced_head->next_send_us <= now) {
+		dest = unlist_dest(&engine->paced_head, &engine->paced_tail);
+		list_dest(&engine->ready_head, &engine->ready_tail, dest);
+	}
+}
+
 static void queue_smp(smp_engine_t * engine, ibnd_smp_t * smp)
 {
+	ibnd_smp_dest_t *dest = smp->dest;
+
 	smp->qnext = NULL;
-	if (!engine->smp_queue_head) {
-		engine->smp_queue_head = smp;
-		engine->smp_queue_tail = smp;
+	if (!dest->queue_head) {
+		dest->queue_head = smp;
+		dest->queue_tail = smp;
 	} else {
-		engine->smp_queue_tail->qnext = smp;
-		engine->smp_queue_tail = smp;
+		dest->queue_tail->qnext = smp;
+		dest->queue_tail = smp;
 	}
+	engine->queued++;
+	schedule_dest(engine, dest, now_us());
 }
 
-static ibnd_smp_t *get_smp(smp_engine_t * engine)
+static ibnd_smp_t *get_smp(smp_engine_t * engine, ibnd_smp_dest_t * dest)
 {
-	ibnd_smp_t *head = engine->smp_queue_head;
-	ibnd_smp_t *tail = engine->smp_queue_tail;
+	ibnd_smp_t *head = dest->queue_head;
+	ibnd_smp_t *tail = dest->queue_tail;
 	ibnd_smp_t *rc = head;
 	if (head) {
 		if (tail == head)
-			engine->smp_queue_tail = NULL;
-		engine->smp_queue_head = head->qnext;
+			dest->queue_tail = NULL;
+		dest->queue_head = head->qnext;
+		engine->queued--;
 	}
 	return rc;
 }
@@ -86,8 +218,11 @@ static int send_smp(ibnd_smp_t * smp, smp_engine_t * engine)
 		return rc;
 	}
 
+	/* Retries are done by the engine so that the window sees every
+	 * lost SMP instead of only those that exhausted the kernel retries.
+	 */
 	if ((rc = umad_send(engine->umad_fd, agent, umad, IB_MAD_SIZE,
-			    engine->cfg->timeout_ms, engine->cfg->retries)) < 0) {
+			    engine->cfg->timeout_ms, 0)) < 0) {
 		IBND_ERROR("send failed; %d\n", rc);
 		return rc;
 	}
@@ -99,23 +234,105 @@ static int process_smp_queue(smp_engine_t * engine)
 {
 	int rc = 0;
 	ibnd_smp_t *smp;
-	while (cl_qmap_count(&engine->smps_on_wire)
-	       < engine->cfg->max_smps) {
-		smp = get_smp(engine);
-		if (!smp)
+	ibnd_smp_dest_t *dest;
+	uint64_t now = now_us();
+	unsigned on_wire;
+
+	release_paced(engine, now);
+	while ((on_wire = cl_qmap_count(&engine->smps_on_wire))
+	       < engine->window) {
+		dest = unlist_dest(&engine->ready_head, &engine->ready_tail);
+		if (!dest)
 			return 0;
 
+		smp = get_smp(engine, dest);
+		if (!smp)
+			continue;
+
 		if ((rc = send_smp(smp, engine)) != 0) {
 			free(smp);
 			return rc;
 		}
+		smp->send_us = now;
+		smp->seq = ++engine->send_seq;
+		smp->attempts++;
 		cl_qmap_insert(&engine->smps_on_wire, (uint32_t) smp->rpc.trid,
 			       (cl_map_item_t *) smp);
 		engine->total_smps++;
+		engine->stats.sent++;
+		if (on_wire + 1 > engine->stats.max_on_wire)
+			engine->stats.max_on_wire = on_wire + 1;
+
+		dest->on_wire++;
+		dest->next_send_us = now + engine->cfg->pace_us;
+		/* round robin: go to the back of the line */
+		schedule_dest(engine, dest, now);
 	}
 	return 0;
 }
 
+static void window_set(smp_engine_t * engine, unsigned window)
+{
+	engine->window = window;
+	if (window < engine->stats.window_min)
+		engine->stats.window_min = window;
+	if (window > engine->stats.window_max)
+		engine->stats.window_max = window;
+}
+
+/* Slow start up to ssthresh, then one more SMP per window of timely
+ * responses.  A late response holds the window where it is.
+ */
+static void window_grow(smp_engine_t * engine, uint64_t rtt)
+{
+	if (rtt > engine->late_us) {
+		engine->stats.late++;
+		return;
+	}
+
+	if (engine->window >= engine->window_limit)
+		return;
+
+	if (engine->window < engine->ssthresh) {
+		window_set(engine, engine->window + 1);
+	} else if (++engine->window_credit >= engine->window) {
+		engine->window_credit = 0;
+		window_set(engine, engine->window + 1);
+	}
+}
+
+/* Halve the window, at most once for the SMPs that were sent before the
+ * previous reduction.
+ */
+static void window_shrink(smp_engine_t * engine, ibnd_smp_t * smp)
+{
+	if ((int)(smp->seq - engine->shrink_seq) <= 0)
+		return;
+
+	engine->shrink_seq = engine->send_seq;
+	engine->ssthresh = engine->window / 2 ? engine->window / 2 : 1;
+	engine->window_credit = 0;
+	window_set(engine, engine->ssthresh);
+}
+
+static void account_rtt(smp_engine_t * engine, uint64_t rtt)
+{
+	smp_engine_stats_t *stats = &engine->stats;
+	unsigned bucket = 0;
+
+	stats->completed++;
+	stats->rtt_sum_us += rtt;
+	if (!stats->rtt_min_us || rtt < stats->rtt_min_us)
+		stats->rtt_min_us = rtt;
+	if (rtt > stats->rtt_max_us)
+		stats->rtt_max_us = rtt;
+	while (rtt >>= 1)
+		bucket++;
+	if (bucket >= SMP_RTT_BUCKETS)
+		bucket = SMP_RTT_BUCKETS - 1;
+	stats->rtt_hist[bucket]++;
+}
+
 int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	      unsigned attrid, unsigned mod, smp_comp_cb_t cb, void *cb_data)
 {
@@ -146,6 +363,13 @@ int issue_smp(smp_engine_t * engine, ib_portid_t * portid,
 	portid->sl = 0;
 	portid->qp = 0;
 
+	smp->dest = get_dest(engine, &smp->path);
+	if (!smp->dest) {
+		IBND_ERROR("OOM\n");
+		free(smp);
+		return -ENOMEM;
+	}
+
 	queue_smp(engine, smp);
 	return process_smp_queue(engine);
 }
@@ -159,12 +383,32 @@ static int process_one_recv(smp_engine_t * engine)
 	uint32_t trid;
 	uint8_t umad[sizeof(struct ib_user_mad) + IB_MAD_SIZE];
 	int length = umad_size() + IB_MAD_SIZE;
+	int timeout = -1;
+	uint64_t now, rtt;
 
 	memset(umad, 0, sizeof(umad));
 
+	/* don't sleep past the point a paced destination may send again */
+	if (engine->paced_head) {
+		now = now_us();
+		timeout = engine->paced_head->next_send_us > now ?
+			  (engine->paced_head->next_send_us - now + 999) / 1000 :
+			  0;
+		if (!cl_qmap_count(&engine->smps_on_wire)) {
+			/* nothing will arrive, just wait out the interval */
+			if (timeout)
+				usleep(engine->paced_head->next_send_us - now);
+			return process_smp_queue(engine);
+		}
+		if (!timeout)
+			return process_smp_queue(engine);
+	}
+
 	/* wait for the next message */
 	if ((rc = umad_recv(engine->umad_fd, umad, &length,
-			    -1)) < 0) {
+			    timeout)) < 0) {
+		if (rc == -ETIMEDOUT && timeout >= 0)
+			return process_smp_queue(engine);
 		IBND_ERROR("umad_recv failed: %d\n", rc);
 		return -1;
 	}
@@ -178,11 +422,33 @@ static int process_one_recv(smp_engine_t * engine)
 		return -1;
 	}
 
+	now = now_us();
+	rtt = now - smp->send_us;
+	status = umad_status(umad);
+	smp->dest->on_wire--;
+	schedule_dest(engine, smp->dest, now);
+
+	if (status == ETIMEDOUT) {
+		engine->stats.timeouts++;
+		window_shrink(engine, smp);
+		if (smp->attempts <= engine->cfg->retries) {
+			/* resend with a new TID, stale responses are dropped */
+			engine->stats.retries++;
+			smp->rpc.trid = mad_trid();
+			queue_smp(engine, smp);
+			return process_smp_queue(engine);
+		}
+	} else if (!status) {
+		account_rtt(engine, rtt);
+		window_grow(engine, rtt);
+	}
+
 	rc = process_smp_queue(engine);
 	if (rc)
 		goto error;
 
-	if ((status = umad_status(umad))) {
+	if (status) {
+		engine->stats.errors++;
 		IBND_ERROR("umad (%s Attr 0x%x:%u) bad status %d; %s\n",
 			   portid2str(&smp->path), smp->rpc.attr.id,
 			   smp->rpc.attr.mod, status, strerror(status));
@@ -190,6 +456,7 @@ static int process_one_recv(smp_engine_t * engine)
 			rc = mlnx_ext_port_info_err(engine, smp, mad,
 						    smp->cb_data);
 	} else if ((status = mad_get_field(mad, 0, IB_DRSMP_STATUS_F))) {
+		engine->stats.errors++;
 		IBND_ERROR("mad (%s Attr 0x%x:%u) bad status 0x%x\n",
 			   portid2str(&smp->path), smp->rpc.attr.id,
 			   smp->rpc.attr.mod, status);
@@ -237,6 +504,14 @@ int smp_engine_init(smp_engine_t * engine, char * ca_name, int ca_port,
 	engine->user_data = user_data;
 	cl_qmap_init(&engine->smps_on_wire);
 	engine->cfg = cfg;
+
+	engine->window_limit = cfg->max_smps_window;
+	engine->ssthresh = engine->window_limit;
+	/* a response is late once it takes more than half the timeout */
+	engine->late_us = cfg->timeout_ms * 1000ULL / 2;
+	engine->stats.window_min = cfg->max_smps;
+	window_set(engine, cfg->max_smps);
+	engine->stats.start_us = now_us();
 	return (0);
 
 eio_close:
@@ -247,14 +522,19 @@ eio_close:
 void smp_engine_destroy(smp_engine_t * engine)
 {
 	cl_map_item_t *item;
+	ibnd_smp_dest_t *dest;
 	ibnd_smp_t *smp;
 
 	/* remove queued smps */
-	smp = get_smp(engine);
-	if (smp)
+	if (engine->queued)
 		IBND_ERROR("outstanding SMP's\n");
-	for ( /* */ ; smp; smp = get_smp(engine))
-		free(smp);
+	while ((dest = engine->dests)) {
+		engine->dests = dest->all_next;
+		while ((smp = get_smp(engine, dest)))
+			free(smp);
+		free(dest);
+	}
+	ibnd_htbl_destroy(&engine->dest_tbl);
 
 	/* remove smps from the wire queue */
 	item = cl_qmap_head(&engine->smps_on_wire);
@@ -269,11 +549,48 @@ void smp_engine_destroy(smp_engine_t * engine)
 	umad_close_port(engine->umad_fd);
 }
 
+void smp_engine_print_stats(smp_engine_t * engine)
+{
+	smp_engine_stats_t *stats = &engine->stats;
+	uint64_t elapsed = (stats->end_us ? stats->end_us : now_us()) -
+			   stats->start_us;
+	unsigned i, last = 0;
+
+	printf("SMP engine: %u sent, %u responses, %u timeouts, %u retries, "
+	       "%u errors, %u late in %.3f s (%.0f SMPs/s)\n",
+	       stats->sent, stats->completed, stats->timeouts, stats->retries,
+	       stats->errors, stats->late, elapsed / 1e6,
+	       elapsed ? stats->sent * 1e6 / elapsed : 0.0);
+	printf("  window: initial %u min %u max %u final %u limit %u, "
+	       "max on wire %u\n",
+	       engine->cfg->max_smps, stats->window_min, stats->window_max,
+	       engine->window, engine->window_limit, stats->max_on_wire);
+	printf("  destinations: %u, waits on per destination cap (%u): %u, "
+	       "pacing (%u us): %u\n",
+	       stats->dests, engine->cfg->max_smps_per_dest,
+	       stats->dest_cap_waits, engine->cfg->pace_us,
+	       stats->pace_waits);
+	if (!stats->completed)
+		return;
+
+	printf("  rtt us: min %" PRIu64 " avg %" PRIu64 " max %" PRIu64 "\n",
+	       stats->rtt_min_us, stats->rtt_sum_us / stats->completed,
+	       stats->rtt_max_us);
+	for (i = 0; i < SMP_RTT_BUCKETS; i++)
+		if (stats->rtt_hist[i])
+			last = i;
+	printf("  rtt histogram:");
+	for (i = 0; i <= last; i++)
+		printf(" <%uus:%u", 2U << i, stats->rtt_hist[i]);
+	printf("\n");
+}
+
 int process_mads(smp_engine_t * engine)
 {
 	int rc;
-	while (!cl_is_qmap_empty(&engine->smps_on_wire))
+	while (!cl_is_qmap_empty(&engine->smps_on_wire) || engine->queued)
 		if ((rc = process_one_recv(engine)) != 0)
 			return rc;
+	engine->stats.end_us = now_us();
 	return 0;
 }
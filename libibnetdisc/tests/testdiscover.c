@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Run ibnd_discover_fabric() against a stand-in for libibumad that
+ * answers directed route SMPs from a recorded fabric, either a cache file
+ * written by "ibnetdiscover --cache" or a generated fat tree.  Every SMA
+ * serves one SMP at a time and drops SMPs when its queue is full, so the
+ * SMP engine window, per destination cap and pacing can be compared.
+ *
+ * The umad_* functions below take the place of the libibumad ones for
+ * libibnetdisc and libibmad, this executable is linked with
+ * --export-dynamic for that.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <infiniband/ibnetdisc.h>
+#include <infiniband/umad.h>
+
+/* Must match the version 1 layout documented in ibnetdisc_cache.c */
+#define CACHE_MAGIC		0x8FE7832B
+#define CACHE_VERSION		0x00000001
+#define NODE_HEADER_LEN		(15 + IB_SMP_DATA_SIZE * 3)
+#define PORT_LEN		(31 + IB_SMP_DATA_SIZE)
+
+#define SWITCH_GUID_BASE	0x0002c90300000000ULL
+#define HCA_GUID_BASE		0x0008f10400000000ULL
+
+#define FAKE_UMAD_FD		1000
+#define MAD_STATUS_UNSUP_ATTR	0x0c
+#define MAD_STATUS_BAD_ATTR_MOD	0x1c
+#define PORT_STATE_ACTIVE	4
+#define PORT_PHYS_STATE_LINKUP	5
+
+static const char *argv0 = "testdiscover";
+static unsigned leaves = 32;
+static unsigned hosts = 16;
+static unsigned uplinks = 16;
+static unsigned spines = 16;
+static unsigned hop_us = 1;
+static unsigned switch_us = 20;
+static unsigned ca_us = 10;
+static unsigned sma_queue = 16;
+static double loss;
+static int verbose;
+
+/* ---- recorded fabric ---- */
+
+struct sma {
+	ibnd_node_t *node;
+	uint64_t busy_until;
+};
+
+static ibnd_fabric_t *recorded;
+static struct sma *smas;
+static unsigned nsmas;
+static ibnd_port_t *self_port;
+
+static int sma_cmp(const void *a, const void *b)
+{
+	const struct sma *x = a, *y = b;
+
+	return x->node < y->node ? -1 : x->node > y->node;
+}
+
+static struct sma *find_sma(ibnd_node_t *node)
+{
+	struct sma key = { .node = node };
+
+	return bsearch(&key, smas, nsmas, sizeof(*smas), sma_cmp);
+}
+
+static int index_recorded(void)
+{
+	ibnd_node_t *node;
+	ibnd_port_t *port;
+	int p;
+
+	for (node = recorded->nodes; node; node = node->next)
+		nsmas++;
+	smas = calloc(nsmas, sizeof(*smas));
+	if (!smas)
+		return -1;
+
+	nsmas = 0;
+	for (node = recorded->nodes; node; node = node->next)
+		smas[nsmas++].node = node;
+	qsort(smas, nsmas, sizeof(*smas), sma_cmp);
+
+	/* the cache does not keep the port discovery started from */
+	for (p = 1; p <= recorded->from_node->numports; p++) {
+		port = recorded->from_node->ports[p];
+		if (port && port->remoteport) {
+			self_port = port;
+			return 0;
+		}
+	}
+	fprintf(stderr, "from node has no connected port\n");
+	return -1;
+}
+
+/* ---- fat tree generator, written as a version 1 cache ---- */
+
+static unsigned spine_ports(void)
+{
+	return leaves * uplinks / spines;
+}
+
+static uint64_t spine_guid(unsigned s)
+{
+	return SWITCH_GUID_BASE + s;
+}
+
+static uint64_t leaf_guid(unsigned l)
+{
+	return SWITCH_GUID_BASE + spines + l;
+}
+
+static uint64_t hca_node_guid(unsigned h)
+{
+	return HCA_GUID_BASE + 2 * h;
+}
+
+static uint64_t hca_port_guid(unsigned h)
+{
+	return HCA_GUID_BASE + 2 * h + 1;
+}
+
+static uint16_t switch_lid(uint64_t guid)
+{
+	return guid - SWITCH_GUID_BASE + 1;
+}
+
+static uint16_t hca_lid(unsigned h)
+{
+	return spines + leaves + h + 1;
+}
+
+static size_t put8(uint8_t *buf, uint8_t v)
+{
+	buf[0] = v;
+	return 1;
+}
+
+static size_t put16(uint8_t *buf, uint16_t v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+	return 2;
+}
+
+static size_t put32(uint8_t *buf, uint32_t v)
+{
+	put16(buf, v);
+	put16(buf + 2, v >> 16);
+	return 4;
+}
+
+static size_t put64(uint8_t *buf, uint64_t v)
+{
+	put32(buf, v);
+	put32(buf + 4, v >> 32);
+	return 8;
+}
+
+static int write_node(FILE *file, uint64_t guid, int type, unsigned nports,
+		      uint16_t lid, uint64_t port_guid, const char *desc)
+{
+	uint8_t buf[NODE_HEADER_LEN + 256 * 9] = {};
+	uint8_t *info;
+	size_t off = 0;
+	unsigned p, first = (type == IB_NODE_SWITCH) ? 0 : 1;
+
+	off += put16(buf + off, lid);
+	off += put8(buf + off, 0);
+	off += put8(buf + off, 0);
+	off += IB_SMP_DATA_SIZE;		/* switchinfo */
+	off += put64(buf + off, guid);
+	off += put8(buf + off, type);
+	off += put8(buf + off, nports);
+	info = buf + off;
+	mad_set_field(info, 0, IB_NODE_BASE_VERS_F, 1);
+	mad_set_field(info, 0, IB_NODE_CLASS_VERS_F, 1);
+	mad_set_field(info, 0, IB_NODE_TYPE_F, type);
+	mad_set_field(info, 0, IB_NODE_NPORTS_F, nports);
+	mad_set_field64(info, 0, IB_NODE_SYSTEM_GUID_F, guid);
+	mad_set_field64(info, 0, IB_NODE_GUID_F, guid);
+	mad_set_field64(info, 0, IB_NODE_PORT_GUID_F, port_guid);
+	mad_set_field(info, 0, IB_NODE_PARTITION_CAP_F, 8);
+	mad_set_field(info, 0, IB_NODE_DEVID_F, 0x1234);
+	mad_set_field(info, 0, IB_NODE_VENDORID_F, 0x1234);
+	off += IB_SMP_DATA_SIZE;
+	snprintf((char *)buf + off, IB_SMP_DATA_SIZE, "%s", desc);
+	off += IB_SMP_DATA_SIZE;
+	off += put8(buf + off, nports + 1 - first);
+	for (p = first; p <= nports; p++) {
+		off += put64(buf + off, port_guid);
+		off += put8(buf + off, p);
+	}
+
+	return fwrite(buf, off, 1, file) == 1 ? 0 : -1;
+}
+
+static int write_port(FILE *file, uint64_t guid, unsigned portnum,
+		      uint16_t lid, uint64_t node_guid, uint64_t rguid,
+		      unsigned rportnum)
+{
+	uint8_t buf[PORT_LEN] = {};
+	uint8_t *info;
+	size_t off = 0;
+
+	off += put64(buf + off, guid);
+	off += put8(buf + off, portnum);
+	off += put8(buf + off, 0);
+	off += put16(buf + off, lid);
+	off += put8(buf + off, 0);
+	info = buf + off;
+	mad_set_field(info, 0, IB_PORT_LID_F, lid);
+	mad_set_field(info, 0, IB_PORT_LOCAL_PORT_F, portnum);
+	mad_set_field(info, 0, IB_PORT_LINK_WIDTH_ENABLED_F, 2);
+	mad_set_field(info, 0, IB_PORT_LINK_WIDTH_SUPPORTED_F, 3);
+	mad_set_field(info, 0, IB_PORT_LINK_WIDTH_ACTIVE_F, 2);
+	mad_set_field(info, 0, IB_PORT_LINK_SPEED_SUPPORTED_F, 1);
+	mad_set_field(info, 0, IB_PORT_LINK_SPEED_ACTIVE_F, 1);
+	mad_set_field(info, 0, IB_PORT_LINK_SPEED_ENABLED_F, 1);
+	if (portnum || rguid) {
+		mad_set_field(info, 0, IB_PORT_STATE_F, PORT_STATE_ACTIVE);
+		mad_set_field(info, 0, IB_PORT_PHYS_STATE_F,
+			      PORT_PHYS_STATE_LINKUP);
+	}
+	off += IB_SMP_DATA_SIZE;
+	off += put64(buf + off, node_guid);
+	off += put8(buf + off, rguid != 0);
+	off += put64(buf + off, rguid);
+	off += put8(buf + off, rportnum);
+
+	return fwrite(buf, off, 1, file) == 1 ? 0 : -1;
+}
+
+/*
+ * Leaf l: ports 1..hosts go down to hcas, ports hosts+1..hosts+uplinks go
+ * up; uplink u of leaf l lands on spine (l + u) % spines so that every
+ * leaf shares spines with its neighbours.
+ */
+static int write_cache(const char *path)
+{
+	uint8_t hdr[28];
+	unsigned spine_next[spines];
+	unsigned l, s, h, u, p, idx, nodes, ports;
+	char desc[IB_SMP_DATA_SIZE];
+	FILE *file;
+	int ret = 0;
+
+	file = fopen(path, "w");
+	if (!file) {
+		perror("fopen");
+		return -1;
+	}
+
+	nodes = spines + leaves + leaves * hosts;
+	ports = spines * (spine_ports() + 1) +
+		leaves * (hosts + uplinks + 1) + leaves * hosts;
+
+	p = 0;
+	p += put32(hdr + p, CACHE_MAGIC);
+	p += put32(hdr + p, CACHE_VERSION);
+	p += put32(hdr + p, nodes);
+	p += put32(hdr + p, ports);
+	p += put64(hdr + p, hca_node_guid(0));
+	p += put32(hdr + p, 4);
+	ret |= fwrite(hdr, p, 1, file) != 1;
+
+	for (s = 0; s < spines; s++) {
+		snprintf(desc, sizeof desc, "spine%u", s);
+		ret |= write_node(file, spine_guid(s), IB_NODE_SWITCH,
+				  spine_ports(), switch_lid(spine_guid(s)),
+				  spine_guid(s), desc);
+	}
+	for (l = 0; l < leaves; l++) {
+		snprintf(desc, sizeof desc, "leaf%u", l);
+		ret |= write_node(file, leaf_guid(l), IB_NODE_SWITCH,
+				  hosts + uplinks, switch_lid(leaf_guid(l)),
+				  leaf_guid(l), desc);
+	}
+	for (h = 0; h < leaves * hosts; h++) {
+		snprintf(desc, sizeof desc, "host%u HCA-1", h);
+		ret |= write_node(file, hca_node_guid(h), IB_NODE_CA, 1,
+				  0, hca_port_guid(h), desc);
+	}
+
+	memset(spine_next, 0, sizeof spine_next);
+	for (l = 0; l < leaves; l++) {
+		uint64_t guid = leaf_guid(l);
+
+		ret |= write_port(file, guid, 0, switch_lid(guid), guid, 0, 0);
+		for (h = 0; h < hosts; h++) {
+			idx = l * hosts + h;
+			ret |= write_port(file, guid, h + 1, 0,
+					  guid, hca_port_guid(idx), 1);
+			ret |= write_port(file, hca_port_guid(idx), 1,
+					  hca_lid(idx), hca_node_guid(idx),
+					  guid, h + 1);
+		}
+		for (u = 0; u < uplinks; u++) {
+			s = (l + u) % spines;
+			p = ++spine_next[s];
+			ret |= write_port(file, guid, hosts + u + 1, 0, guid,
+					  spine_guid(s), p);
+			ret |= write_port(file, spine_guid(s), p, 0,
+					  spine_guid(s), guid, hosts + u + 1);
+		}
+	}
+	for (s = 0; s < spines; s++)
+		ret |= write_port(file, spine_guid(s), 0,
+				  switch_lid(spine_guid(s)), spine_guid(s),
+				  0, 0);
+
+	if (fclose(file))
+		ret = 1;
+	if (ret)
+		fprintf(stderr, "failed to write %s\n", path);
+	return ret ? -1 : 0;
+}
+
+/* ---- umad stand-in ---- */
+
+struct pending {
+	struct pending *next;
+	uint64_t due;
+	int agent;
+	uint32_t status;
+	uint8_t mad[IB_MAD_SIZE];
+};
+
+static struct pending *pending;
+static unsigned agents;
+static unsigned long smps_answered, smps_dropped;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t)
+{
+	uint64_t now = now_us();
+
+	if (t > now)
+		usleep(t - now);
+}
+
+int umad_init(void)
+{
+	return 0;
+}
+
+int umad_open_port(const char *ca_name, int portnum)
+{
+	return FAKE_UMAD_FD;
+}
+
+int umad_close_port(int portid)
+{
+	return 0;
+}
+
+int umad_register(int portid, int mgmt_class, int mgmt_version,
+		  uint8_t rmpp_version, long method_mask[16 / sizeof(long)])
+{
+	return agents++;
+}
+
+int umad_unregister(int portid, int agentid)
+{
+	return 0;
+}
+
+/* Walk the initial directed route from the local port */
+static ibnd_port_t *route(uint8_t *mad, unsigned *hops)
+{
+	uint8_t path[IB_SUBNET_PATH_HOPS_MAX];
+	ibnd_port_t *port = self_port, *out;
+	unsigned i, cnt;
+
+	if (mad_get_field(mad, 0, IB_MAD_MGMTCLASS_F) != IB_SMI_DIRECT_CLASS ||
+	    mad_get_field(mad, 0, IB_DRSMP_DRSLID_F) != 0xffff)
+		return NULL;	/* only plain directed route is replayed */
+
+	cnt = mad_get_field(mad, 0, IB_DRSMP_HOPCNT_F);
+	mad_get_array(mad, 0, IB_DRSMP_PATH_F, path);
+	for (i = 1; i <= cnt; i++) {
+		if (path[i] > port->node->numports)
+			return NULL;
+		out = port->node->ports[path[i]];
+		if (!out || !out->remoteport)
+			return NULL;
+		port = out->remoteport;
+	}
+	*hops = cnt;
+	return port;
+}
+
+static int answer(uint8_t *mad, ibnd_port_t *in)
+{
+	ibnd_node_t *node = in->node;
+	uint8_t *data = mad + IB_SMP_DATA_OFFS;
+	unsigned mod = mad_get_field(mad, 0, IB_MAD_ATTRMOD_F);
+	ibnd_port_t *port;
+
+	memset(data, 0, IB_SMP_DATA_SIZE);
+	switch (mad_get_field(mad, 0, IB_MAD_ATTRID_F)) {
+	case IB_ATTR_NODE_INFO:
+		memcpy(data, node->info, IB_SMP_DATA_SIZE);
+		mad_set_field64(data, 0, IB_NODE_PORT_GUID_F, in->guid);
+		mad_set_field(data, 0, IB_NODE_LOCAL_PORT_F, in->portnum);
+		return 0;
+	case IB_ATTR_NODE_DESC:
+		memcpy(data, node->nodedesc, IB_SMP_DATA_SIZE);
+		return 0;
+	case IB_ATTR_SWITCH_INFO:
+		if (node->type != IB_NODE_SWITCH)
+			return MAD_STATUS_UNSUP_ATTR;
+		memcpy(data, node->switchinfo, IB_SMP_DATA_SIZE);
+		return 0;
+	case IB_ATTR_PORT_INFO:
+	case IB_ATTR_MLNX_EXT_PORT_INFO:
+		/* end ports answer for the receiving port on modifier 0 */
+		if (!mod && node->type != IB_NODE_SWITCH)
+			mod = in->portnum;
+		if (mod > node->numports || !(port = node->ports[mod]))
+			return MAD_STATUS_BAD_ATTR_MOD;
+		if (mad_get_field(mad, 0, IB_MAD_ATTRID_F) ==
+		    IB_ATTR_MLNX_EXT_PORT_INFO) {
+			memcpy(data, port->ext_info, IB_SMP_DATA_SIZE);
+			return 0;
+		}
+		memcpy(data, port->info, IB_SMP_DATA_SIZE);
+		mad_set_field(data, 0, IB_PORT_LOCAL_PORT_F, in->portnum);
+		return 0;
+	default:
+		return MAD_STATUS_UNSUP_ATTR;
+	}
+}
+
+static void add_pending(struct pending *pe)
+{
+	struct pending **pp = &pending;
+
+	while (*pp && (*pp)->due <= pe->due)
+		pp = &(*pp)->next;
+	pe->next = *pp;
+	*pp = pe;
+}
+
+/* Like the kernel, resend on timeout and report ETIMEDOUT when every try
+ * was lost.  A try is lost at random or when the SMA queue is full.
+ */
+int umad_send(int portid, int agentid, void *umad, int length,
+	      int timeout_ms, int retries)
+{
+	struct pending *pe = calloc(1, sizeof(*pe));
+	uint64_t now = now_us(), t, arrive, start;
+	unsigned hops = 0, service;
+	ibnd_port_t *in;
+	struct sma *sma;
+	int try, status;
+
+	if (!pe)
+		return -ENOMEM;
+	pe->agent = agentid;
+	memcpy(pe->mad, umad_get_mad(umad), IB_MAD_SIZE);
+
+	in = route(pe->mad, &hops);
+	sma = in ? find_sma(in->node) : NULL;
+	service = in && in->node->type == IB_NODE_SWITCH ? switch_us : ca_us;
+
+	for (try = 0, t = now; try <= retries;
+	     try++, t = now + (uint64_t)try * timeout_ms * 1000) {
+		if (!sma || (loss && drand48() < loss))
+			continue;
+
+		arrive = t + hops * hop_us;
+		start = sma->busy_until > arrive ? sma->busy_until : arrive;
+		if (start - arrive > (uint64_t)sma_queue * service)
+			continue;
+
+		sma->busy_until = start + service;
+		status = answer(pe->mad, in);
+		mad_set_field(pe->mad, 0, IB_MAD_METHOD_F,
+			      IB_MAD_METHOD_GET_RESPONSE);
+		mad_set_field(pe->mad, 0, IB_DRSMP_DIRECTION_F, 1);
+		mad_set_field(pe->mad, 0, IB_DRSMP_STATUS_F, status);
+		pe->due = sma->busy_until + hops * hop_us;
+		smps_answered++;
+		add_pending(pe);
+		return 0;
+	}
+
+	smps_dropped++;
+	pe->status = ETIMEDOUT;
+	pe->due = now + (uint64_t)(retries + 1) * timeout_ms * 1000;
+	add_pending(pe);
+	return 0;
+}
+
+int umad_recv(int portid, void *umad, int *length, int timeout_ms)
+{
+	struct ib_user_mad *hdr = umad;
+	struct pending *pe = pending;
+	uint64_t now = now_us();
+	int agent;
+
+	if (!pe) {
+		if (timeout_ms < 0) {
+			fprintf(stderr, "umad_recv would block forever\n");
+			return -EIO;
+		}
+		sleep_until(now + timeout_ms * 1000ULL);
+		return -ETIMEDOUT;
+	}
+
+	if (timeout_ms >= 0 && pe->due > now + timeout_ms * 1000ULL) {
+		sleep_until(now + timeout_ms * 1000ULL);
+		return -ETIMEDOUT;
+	}
+
+	if (*length < IB_MAD_SIZE)
+		return -ENOSPC;
+
+	sleep_until(pe->due);
+	pending = pe->next;
+	hdr->agent_id = pe->agent;
+	hdr->status = pe->status;
+	hdr->length = umad_size() + IB_MAD_SIZE;
+	memcpy(umad_get_mad(umad), pe->mad, IB_MAD_SIZE);
+	*length = IB_MAD_SIZE;
+	agent = pe->agent;
+	free(pe);
+	return agent;
+}
+
+/* ---- checks ---- */
+
+static int compare(ibnd_fabric_t *fabric)
+{
+	ibnd_node_t *rnode, *node;
+	ibnd_port_t *rport, *port;
+	unsigned nodes = 0, links = 0, errors = 0;
+	int p;
+
+	for (rnode = recorded->nodes; rnode; rnode = rnode->next) {
+		nodes++;
+		node = ibnd_find_node_guid(fabric, rnode->guid);
+		if (!node || node->type != rnode->type ||
+		    node->numports != rnode->numports ||
+		    strncmp(node->nodedesc, rnode->nodedesc,
+			    IB_SMP_DATA_SIZE)) {
+			if (errors++ < 10)
+				fprintf(stderr, "node 0x%016" PRIx64
+					" missing or different\n", rnode->guid);
+			continue;
+		}
+
+		for (p = 1; p <= rnode->numports; p++) {
+			rport = rnode->ports[p];
+			if (!rport || !rport->remoteport)
+				continue;
+			links++;
+			port = node->ports[p];
+			if (!port || !port->remoteport ||
+			    port->remoteport->node->guid !=
+			    rport->remoteport->node->guid ||
+			    port->remoteport->portnum !=
+			    rport->remoteport->portnum) {
+				if (errors++ < 10)
+					fprintf(stderr, "link 0x%016" PRIx64
+						":%d missing or different\n",
+						rnode->guid, p);
+			}
+		}
+	}
+
+	for (node = fabric->nodes; node; node = node->next)
+		nodes--;
+	if (nodes) {
+		fprintf(stderr, "discovered node count differs\n");
+		errors++;
+	}
+
+	printf("checked %u links: %u errors\n", links / 2, errors);
+	return errors ? -1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"   Discover a recorded fabric through a umad stand-in\n"
+		"   -f <file> replay this cache file instead of a fat tree\n"
+		"   -l/-H/-u/-s <n> leaves, hosts per leaf, uplinks per leaf, spines (%u/%u/%u/%u)\n"
+		"   -L <us> link latency per hop (default %u)\n"
+		"   -S <us> switch SMA service time (default %u)\n"
+		"   -C <us> CA SMA service time (default %u)\n"
+		"   -Q <n> SMA queue depth before dropping (default %u)\n"
+		"   -x <p> probability an SMP is lost (default 0)\n"
+		"   -o <n> initial SMPs on the wire\n"
+		"   -w <n> adaptive window limit\n"
+		"   -c <n> SMPs on the wire per destination\n"
+		"   -p <us> pacing per destination\n"
+		"   -t <ms> timeout (default 100)\n"
+		"   -r <n> retries (default 3)\n"
+		"   -v print SMP engine statistics\n",
+		argv0, leaves, hosts, uplinks, spines, hop_us, switch_us,
+		ca_us, sma_queue);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct ibnd_config config = {
+		.timeout_ms = 100,
+		.retries = 3,
+	};
+	char tmpl[] = "/tmp/ibnd_discover_XXXXXX";
+	char *path = NULL;
+	ibnd_fabric_t *fabric;
+	ibnd_node_t *node;
+	unsigned nodes = 0;
+	double start, elapsed;
+	int fd, ch, rc;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "f:l:H:u:s:L:S:C:Q:x:o:w:c:p:t:r:vh"))
+	       != -1) {
+		switch (ch) {
+		case 'f':
+			path = optarg;
+			break;
+		case 'l':
+			leaves = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			hosts = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			uplinks = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			spines = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			hop_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			switch_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			ca_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			sma_queue = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			loss = strtod(optarg, NULL);
+			break;
+		case 'o':
+			config.max_smps = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			config.max_smps_window = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			config.max_smps_per_dest = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			config.pace_us = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			config.timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			config.retries = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (!path) {
+		if (!leaves || !spines || !hosts || uplinks < 2 ||
+		    hosts + uplinks > 254 || leaves % spines ||
+		    spine_ports() > 254) {
+			fprintf(stderr, "invalid topology: switches are "
+				"limited to 254 ports, leaves need 2 uplinks "
+				"and must be a multiple of spines\n");
+			exit(-1);
+		}
+
+		fd = mkstemp(tmpl);
+		if (fd < 0) {
+			perror("mkstemp");
+			exit(-1);
+		}
+		close(fd);
+		rc = write_cache(tmpl);
+		recorded = rc ? NULL : ibnd_load_fabric(tmpl, 0);
+		unlink(tmpl);
+	} else
+		recorded = ibnd_load_fabric(path, 0);
+
+	if (!recorded || index_recorded()) {
+		fprintf(stderr, "failed to load the recorded fabric\n");
+		exit(-1);
+	}
+
+	if (verbose)
+		config.flags |= IBND_CONFIG_SMP_STATS;
+	srand48(1);
+
+	start = now_us();
+	fabric = ibnd_discover_fabric(NULL, 0, NULL, &config);
+	if (!fabric) {
+		fprintf(stderr, "ibnd_discover_fabric failed\n");
+		exit(-1);
+	}
+	elapsed = (now_us() - start) / 1000.0;
+	for (node = fabric->nodes; node; node = node->next)
+		nodes++;
+	printf("discovered %u nodes with %u SMPs (%lu answered, %lu lost) "
+	       "in %.1f ms\n", nodes, fabric->total_mads_used, smps_answered,
+	       smps_dropped, elapsed);
+
+	rc = compare(fabric) ? 1 : 0;
+
+	ibnd_destroy_fabric(fabric);
+	ibnd_destroy_fabric(recorded);
+	free(smas);
+	exit(rc);
+}
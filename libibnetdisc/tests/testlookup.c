@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Build a synthetic two level fat tree as an ibnetdiscover cache file,
+ * load it with ibnd_load_fabric() and time the GUID and LID lookups that
+ * diag tools such as iblinkinfo and ibqueryerrors issue per port.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <limits.h>
+
+#include <infiniband/ibnetdisc.h>
+
+/* Must match the version 1 layout documented in ibnetdisc_cache.c */
+#define CACHE_MAGIC		0x8FE7832B
+#define CACHE_VERSION		0x00000001
+#define NODE_HEADER_LEN		(15 + IB_SMP_DATA_SIZE * 3)
+#define PORT_LEN		(31 + IB_SMP_DATA_SIZE)
+
+#define SWITCH_GUID_BASE	0x0002c90300000000ULL
+#define HCA_GUID_BASE		0x0008f10400000000ULL
+
+static const char *argv0 = "testlookup";
+static unsigned leaves = 512;
+static unsigned hosts = 24;
+static unsigned uplinks = 24;
+static unsigned spines = 64;
+static unsigned iters = 10;
+
+static unsigned spine_ports(void)
+{
+	return leaves * uplinks / spines;
+}
+
+static uint64_t spine_guid(unsigned s)
+{
+	return SWITCH_GUID_BASE + s;
+}
+
+static uint64_t leaf_guid(unsigned l)
+{
+	return SWITCH_GUID_BASE + spines + l;
+}
+
+static uint64_t hca_node_guid(unsigned h)
+{
+	return HCA_GUID_BASE + 2 * h;
+}
+
+static uint64_t hca_port_guid(unsigned h)
+{
+	return HCA_GUID_BASE + 2 * h + 1;
+}
+
+/* switches get lids 1..n, hcas follow */
+static uint16_t switch_lid(uint64_t guid)
+{
+	return guid - SWITCH_GUID_BASE + 1;
+}
+
+static uint16_t hca_lid(unsigned h)
+{
+	return spines + leaves + h + 1;
+}
+
+static size_t put8(uint8_t *buf, uint8_t v)
+{
+	buf[0] = v;
+	return 1;
+}
+
+static size_t put16(uint8_t *buf, uint16_t v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+	return 2;
+}
+
+static size_t put32(uint8_t *buf, uint32_t v)
+{
+	put16(buf, v);
+	put16(buf + 2, v >> 16);
+	return 4;
+}
+
+static size_t put64(uint8_t *buf, uint64_t v)
+{
+	put32(buf, v);
+	put32(buf + 4, v >> 32);
+	return 8;
+}
+
+static int write_node(FILE *file, uint64_t guid, int type, unsigned nports,
+		      uint16_t lid, uint64_t port_guid, const char *desc)
+{
+	uint8_t buf[NODE_HEADER_LEN + 256 * 9] = {};
+	size_t off = 0;
+	unsigned p, first = (type == IB_NODE_SWITCH) ? 0 : 1;
+
+	off += put16(buf + off, lid);
+	off += put8(buf + off, 0);
+	off += put8(buf + off, 0);
+	off += IB_SMP_DATA_SIZE;		/* switchinfo */
+	off += put64(buf + off, guid);
+	off += put8(buf + off, type);
+	off += put8(buf + off, nports);
+	off += IB_SMP_DATA_SIZE;		/* nodeinfo */
+	snprintf((char *)buf + off, IB_SMP_DATA_SIZE, "%s", desc);
+	off += IB_SMP_DATA_SIZE;
+	off += put8(buf + off, nports + 1 - first);
+	for (p = first; p <= nports; p++) {
+		off += put64(buf + off, port_guid);
+		off += put8(buf + off, p);
+	}
+
+	return fwrite(buf, off, 1, file) == 1 ? 0 : -1;
+}
+
+static int write_port(FILE *file, uint64_t guid, unsigned portnum,
+		      uint16_t lid, uint64_t node_guid, uint64_t rguid,
+		      unsigned rportnum)
+{
+	uint8_t buf[PORT_LEN] = {};
+	size_t off = 0;
+
+	off += put64(buf + off, guid);
+	off += put8(buf + off, portnum);
+	off += put8(buf + off, 0);
+	off += put16(buf + off, lid);
+	off += put8(buf + off, 0);
+	off += IB_SMP_DATA_SIZE;		/* portinfo */
+	off += put64(buf + off, node_guid);
+	off += put8(buf + off, rguid != 0);
+	off += put64(buf + off, rguid);
+	off += put8(buf + off, rportnum);
+
+	return fwrite(buf, off, 1, file) == 1 ? 0 : -1;
+}
+
+/*
+ * Leaf l: ports 1..hosts go down to hcas, ports hosts+1..hosts+uplinks go
+ * up; uplink u of leaf l lands on spine (l * uplinks + u) % spines.
+ */
+static int write_cache(const char *path, unsigned *nodes, unsigned *ports)
+{
+	uint8_t hdr[28];
+	unsigned spine_next[spines];
+	unsigned l, s, h, u, p, idx;
+	char desc[IB_SMP_DATA_SIZE];
+	FILE *file;
+	int ret = 0;
+
+	file = fopen(path, "w");
+	if (!file) {
+		perror("fopen");
+		return -1;
+	}
+
+	*nodes = spines + leaves + leaves * hosts;
+	*ports = spines * (spine_ports() + 1) +
+		 leaves * (hosts + uplinks + 1) + leaves * hosts;
+
+	p = 0;
+	p += put32(hdr + p, CACHE_MAGIC);
+	p += put32(hdr + p, CACHE_VERSION);
+	p += put32(hdr + p, *nodes);
+	p += put32(hdr + p, *ports);
+	p += put64(hdr + p, hca_node_guid(0));
+	p += put32(hdr + p, 4);
+	ret |= fwrite(hdr, p, 1, file) != 1;
+
+	for (s = 0; s < spines; s++) {
+		snprintf(desc, sizeof desc, "spine%u", s);
+		ret |= write_node(file, spine_guid(s), IB_NODE_SWITCH,
+				  spine_ports(), switch_lid(spine_guid(s)),
+				  spine_guid(s), desc);
+	}
+	for (l = 0; l < leaves; l++) {
+		snprintf(desc, sizeof desc, "leaf%u", l);
+		ret |= write_node(file, leaf_guid(l), IB_NODE_SWITCH,
+				  hosts + uplinks, switch_lid(leaf_guid(l)),
+				  leaf_guid(l), desc);
+	}
+	for (h = 0; h < leaves * hosts; h++) {
+		snprintf(desc, sizeof desc, "host%u HCA-1", h);
+		ret |= write_node(file, hca_node_guid(h), IB_NODE_CA, 1,
+				  0, hca_port_guid(h), desc);
+	}
+
+	memset(spine_next, 0, sizeof spine_next);
+	for (l = 0; l < leaves; l++) {
+		uint64_t guid = leaf_guid(l);
+
+		ret |= write_port(file, guid, 0, switch_lid(guid), guid, 0, 0);
+		for (h = 0; h < hosts; h++) {
+			idx = l * hosts + h;
+			ret |= write_port(file, guid, h + 1, switch_lid(guid),
+					  guid, hca_port_guid(idx), 1);
+			ret |= write_port(file, hca_port_guid(idx), 1,
+					  hca_lid(idx), hca_node_guid(idx),
+					  guid, h + 1);
+		}
+		for (u = 0; u < uplinks; u++) {
+			s = (l * uplinks + u) % spines;
+			p = ++spine_next[s];
+			ret |= write_port(file, guid, hosts + u + 1,
+					  switch_lid(guid), guid,
+					  spine_guid(s), p);
+			ret |= write_port(file, spine_guid(s), p,
+					  switch_lid(spine_guid(s)),
+					  spine_guid(s), guid, hosts + u + 1);
+		}
+	}
+	for (s = 0; s < spines; s++)
+		ret |= write_port(file, spine_guid(s), 0,
+				  switch_lid(spine_guid(s)), spine_guid(s),
+				  0, 0);
+
+	if (fclose(file))
+		ret = 1;
+	if (ret)
+		fprintf(stderr, "failed to write %s\n", path);
+	return ret ? -1 : 0;
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+struct walk_state {
+	ibnd_fabric_t *fabric;
+	unsigned long lookups;
+	unsigned long errors;
+};
+
+/* what iblinkinfo/ibqueryerrors do for every port */
+static void walk_port(ibnd_port_t *port, void *user_data)
+{
+	struct walk_state *ws = user_data;
+
+	if (ibnd_find_node_guid(ws->fabric, port->node->guid) != port->node)
+		ws->errors++;
+	if (!ibnd_find_port_guid(ws->fabric, port->guid))
+		ws->errors++;
+	ws->lookups += 2;
+	if (port->remoteport) {
+		ibnd_port_t *rport = ibnd_find_port_guid(ws->fabric,
+							 port->remoteport->guid);
+
+		if (!rport || rport->guid != port->remoteport->guid)
+			ws->errors++;
+		ws->lookups++;
+	}
+}
+
+static int run(ibnd_fabric_t *fabric, unsigned nodes)
+{
+	struct walk_state ws = { .fabric = fabric };
+	unsigned long lookups = 0, errors = 0;
+	double start, guid_us, lid_us, walk_us;
+	unsigned i, h, n;
+	ibnd_node_t *node;
+	ibnd_port_t *port;
+
+	start = now_us();
+	for (i = 0; i < iters; i++) {
+		for (n = 0; n < spines + leaves; n++) {
+			node = ibnd_find_node_guid(fabric, SWITCH_GUID_BASE + n);
+			if (!node || node->guid != SWITCH_GUID_BASE + n)
+				errors++;
+		}
+		for (h = 0; h < leaves * hosts; h++) {
+			node = ibnd_find_node_guid(fabric, hca_node_guid(h));
+			port = ibnd_find_port_guid(fabric, hca_port_guid(h));
+			if (!node || !port || port->node != node)
+				errors++;
+		}
+		lookups += spines + leaves + 2 * leaves * hosts;
+	}
+	guid_us = now_us() - start;
+
+	start = now_us();
+	for (i = 0; i < iters; i++) {
+		for (n = 1; n <= nodes; n++) {
+			port = ibnd_find_port_lid(fabric, n);
+			if (!port || port->base_lid != n)
+				errors++;
+		}
+	}
+	lid_us = now_us() - start;
+
+	start = now_us();
+	for (i = 0; i < iters; i++)
+		ibnd_iter_ports(fabric, walk_port, &ws);
+	walk_us = now_us() - start;
+
+	printf("guid lookups: %lu in %.0f us (%.1f ns/lookup)\n",
+	       lookups, guid_us, guid_us * 1000 / lookups);
+	printf("lid lookups:  %lu in %.0f us (%.1f ns/lookup)\n",
+	       (unsigned long)nodes * iters, lid_us,
+	       lid_us * 1000 / ((double)nodes * iters));
+	printf("port walk:    %lu in %.0f us (%.1f ns/lookup)\n",
+	       ws.lookups, walk_us, walk_us * 1000 / ws.lookups);
+
+	errors += ws.errors;
+	if (errors)
+		fprintf(stderr, "%lu lookups returned the wrong object\n",
+			errors);
+	return errors ? -1 : 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-l leaves -H hosts -u uplinks -s spines -i iters -f file -k]\n"
+		"   Build a synthetic fat tree cache file, load it and time lookups,\n"
+		"   then re-cache it in the indexed format and repeat\n"
+		"   -l <n> leaf switches (default %u)\n"
+		"   -H <n> hosts per leaf (default %u)\n"
+		"   -u <n> uplinks per leaf (default %u)\n"
+		"   -s <n> spine switches (default %u)\n"
+		"   -i <n> lookup iterations (default %u)\n"
+		"   -f <file> cache file to write (default a temporary file)\n"
+		"   -k keep the cache file\n",
+		argv0, leaves, hosts, uplinks, spines, iters);
+	exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+	char tmpl[] = "/tmp/ibnd_lookup_XXXXXX";
+	char *path = NULL;
+	char path2[PATH_MAX] = "";
+	unsigned nodes, ports;
+	ibnd_fabric_t *fabric, *fabric2;
+	double start;
+	int keep = 0, fd, ch, rc;
+
+	argv0 = argv[0];
+	while ((ch = getopt(argc, argv, "l:H:u:s:i:f:kh")) != -1) {
+		switch (ch) {
+		case 'l':
+			leaves = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			hosts = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			uplinks = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			spines = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'k':
+			keep = 1;
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (!leaves || !spines || !hosts || !iters ||
+	    hosts + uplinks > 254 || (leaves * uplinks) % spines ||
+	    spine_ports() > 254) {
+		fprintf(stderr, "invalid topology: switches are limited to "
+			"254 ports and uplinks must spread evenly on spines\n");
+		exit(-1);
+	}
+
+	if (!path) {
+		fd = mkstemp(tmpl);
+		if (fd < 0) {
+			perror("mkstemp");
+			exit(-1);
+		}
+		close(fd);
+		path = tmpl;
+	}
+
+	if (write_cache(path, &nodes, &ports)) {
+		rc = 1;
+		goto out;
+	}
+	printf("fabric: %u nodes, %u ports\n", nodes, ports);
+
+	start = now_us();
+	fabric = ibnd_load_fabric(path, 0);
+	if (!fabric) {
+		fprintf(stderr, "ibnd_load_fabric failed\n");
+		rc = 1;
+		goto out;
+	}
+	printf("load v1:      %.0f us\n", now_us() - start);
+
+	rc = run(fabric, nodes) ? 1 : 0;
+
+	/* Re-cache in the current (indexed) format and load that back */
+	snprintf(path2, sizeof(path2), "%s.v2", path);
+	start = now_us();
+	if (ibnd_cache_fabric(fabric, path2, 0)) {
+		fprintf(stderr, "ibnd_cache_fabric failed\n");
+		rc = 1;
+		goto destroy;
+	}
+	printf("cache v2:     %.0f us\n", now_us() - start);
+
+	start = now_us();
+	fabric2 = ibnd_load_fabric(path2, 0);
+	if (!fabric2) {
+		fprintf(stderr, "ibnd_load_fabric of v2 cache failed\n");
+		rc = 1;
+		goto destroy;
+	}
+	printf("load v2:      %.0f us\n", now_us() - start);
+
+	if (run(fabric2, nodes))
+		rc = 1;
+
+	start = now_us();
+	ibnd_destroy_fabric(fabric2);
+	printf("destroy v2:   %.0f us\n", now_us() - start);
+
+destroy:
+	start = now_us();
+	ibnd_destroy_fabric(fabric);
+	printf("destroy v1:   %.0f us\n", now_us() - start);
+
+out:
+	if (!keep) {
+		unlink(path);
+		if (path2[0])
+			unlink(path2);
+	}
+	exit(rc);
+}
@@ -369,6 +369,7 @@ LATEST_SYMVER_FUNC(ibv_open_device, 1_1, "IBVERBS_1.1",
 
 void verbs_uninit_context(struct verbs_context *context_ex)
 {
+	verbs_gid_cache_free(context_ex);
 	free(context_ex->priv);
 	close(context_ex->context.cmd_fd);
 	close(context_ex->context.async_fd);
@@ -421,6 +422,12 @@ LATEST_SYMVER_FUNC(ibv_get_async_event, 1_1, "IBVERBS_1.1",
 	case IBV_EVENT_WQ_FATAL:
 		event->element.wq = (void *) (uintptr_t) ev.element;
 		break;
+	case IBV_EVENT_GID_CHANGE:
+	case IBV_EVENT_PORT_ACTIVE:
+	case IBV_EVENT_PORT_ERR:
+		verbs_gid_cache_invalidate(context, ev.element);
+		event->element.port_num = ev.element;
+		break;
 	default:
 		event->element.port_num = ev.element;
 		break;
@@ -37,21 +37,44 @@
 #include <dlfcn.h>
 #include <stdio.h>
 #include <dirent.h>
+#include <fnmatch.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <ccan/list.h>
+#include <util/util.h>
 
 #include "ibverbs.h"
 
 struct ibv_driver_name {
 	struct list_node entry;
 	char *name;
+	bool loaded;
 };
 
 static LIST_HEAD(driver_name_list);
 
+struct ibv_provider_index {
+	const char *name;
+	uint32_t driver_id;
+	const char *modalias;
+};
+
+#define PROVIDER_DRIVER_ID(_name, _id)                                         \
+	{ .name = (_name), .driver_id = (_id) },
+#define PROVIDER_MODALIAS(_name, _modalias)                                    \
+	{                                                                      \
+		.name = (_name), .driver_id = RDMA_DRIVER_UNKNOWN,             \
+		.modalias = (_modalias),                                       \
+	},
+
+/* Generated at build time from the match tables of the providers */
+static const struct ibv_provider_index provider_index[] = {
+#include <infiniband/provider_index.h>
+	{}
+};
+
 static void read_config_file(const char *path)
 {
 	FILE *conf;
@@ -90,6 +113,7 @@ static void read_config_file(const char *path)
 				continue;
 			}
 
+			driver_name->loaded = false;
 			driver_name->name = strdup(field);
 			if (!driver_name->name) {
 				fprintf(stderr,
@@ -209,9 +233,109 @@ out_dlopen:
 	free(so_name);
 }
 
-void load_drivers(void)
+static void free_config(void)
 {
 	struct ibv_driver_name *name, *next_name;
+
+	list_for_each_safe (&driver_name_list, name, next_name, entry) {
+		list_del(&name->entry);
+		free(name->name);
+		free(name);
+	}
+}
+
+/* Return the name of the provider the index maps the device to, matching by
+ * driver_id first, then by device name and modalias like match_device().
+ */
+static const char *find_indexed_provider(struct verbs_sysfs_dev *sysfs_dev)
+{
+	const struct ibv_provider_index *ent;
+	const char *modalias;
+	char name_ma[100];
+
+	if (sysfs_dev->driver_id != RDMA_DRIVER_UNKNOWN) {
+		for (ent = provider_index; ent->name; ent++)
+			if (ent->driver_id == sysfs_dev->driver_id)
+				return ent->name;
+	}
+
+	if (!check_snprintf(name_ma, sizeof(name_ma), "rdma_device:N%s",
+			    sysfs_dev->ibdev_name))
+		name_ma[0] = 0;
+	modalias = ibverbs_get_modalias(sysfs_dev);
+
+	for (ent = provider_index; ent->name; ent++) {
+		if (!ent->modalias)
+			continue;
+		if ((name_ma[0] && fnmatch(ent->modalias, name_ma, 0) == 0) ||
+		    (modalias && fnmatch(ent->modalias, modalias, 0) == 0))
+			return ent->name;
+	}
+
+	return NULL;
+}
+
+/* The config file either names the provider or gives the path of its
+ * library without the suffix, eg /usr/lib/libmlx5.
+ */
+static bool driver_name_match(const char *config_name, const char *name)
+{
+	const char *base;
+
+	base = strrchr(config_name, '/');
+	if (!base)
+		return strcmp(config_name, name) == 0;
+
+	base++;
+	if (strncmp(base, "lib", 3) == 0)
+		base += 3;
+	return strcmp(base, name) == 0;
+}
+
+/* Load only the configured providers that the build time index maps the
+ * devices in sysfs_list to. Returns true if any provider was loaded, the
+ * caller must fall back to load_drivers() for devices that remain
+ * unmatched.
+ */
+bool load_indexed_drivers(struct list_head *sysfs_list)
+{
+	struct ibv_driver_name *driver_name;
+	struct verbs_sysfs_dev *sysfs_dev;
+	const char *name;
+	bool loaded = false;
+
+	/* Drivers named in the environment are loaded by load_drivers() */
+	if (getuid() == geteuid() &&
+	    (getenv("RDMAV_DRIVERS") || getenv("IBV_DRIVERS")))
+		return false;
+
+	read_config();
+
+	list_for_each (sysfs_list, sysfs_dev, entry) {
+		name = find_indexed_provider(sysfs_dev);
+		if (!name)
+			continue;
+
+		list_for_each (&driver_name_list, driver_name, entry) {
+			if (!driver_name_match(driver_name->name, name))
+				continue;
+
+			if (!driver_name->loaded) {
+				load_driver(driver_name->name);
+				driver_name->loaded = true;
+				loaded = true;
+			}
+			break;
+		}
+	}
+
+	free_config();
+	return loaded;
+}
+
+void load_drivers(void)
+{
+	struct ibv_driver_name *name;
 	const char *env;
 	char *list, *env_name;
 
@@ -232,10 +356,8 @@ void load_drivers(void)
 		}
 	}
 
-	list_for_each_safe (&driver_name_list, name, next_name, entry) {
+	list_for_each (&driver_name_list, name, entry)
 		load_driver(name->name);
-		free(name->name);
-		free(name);
-	}
+	free_config();
 }
 #endif
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <endian.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <util/compiler.h>
+#include <infiniband/verbs.h>
+#include <infiniband/driver.h>
+
+#define MAX_GIDS	256
+#define IB_NEXT_HDR	0x1b
+
+struct gid_ent {
+	union ibv_gid		gid;
+	enum ibv_gid_type	type;
+	int			index;
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Read the GID table and keep the first index of every distinct GID/type */
+static int read_gids(struct ibv_context *ctx, uint8_t port,
+		     struct gid_ent *gids)
+{
+	struct ibv_port_attr attr;
+	int i, j, num = 0;
+
+	if (ibv_query_port(ctx, port, &attr))
+		return -1;
+
+	for (i = 0; i < attr.gid_tbl_len && num < MAX_GIDS; i++) {
+		struct gid_ent *ent = &gids[num];
+
+		if (ibv_query_gid(ctx, port, i, &ent->gid) ||
+		    ibv_query_gid_type(ctx, port, i, &ent->type))
+			break;
+		if (!ent->gid.global.interface_id)
+			continue;
+
+		for (j = 0; j < num; j++)
+			if (gids[j].type == ent->type &&
+			    !memcmp(&gids[j].gid, &ent->gid, sizeof(ent->gid)))
+				break;
+		if (j == num) {
+			ent->index = i;
+			num++;
+		}
+	}
+	return num;
+}
+
+/* The per entry sysfs search ibv_init_ah_from_wc() used to do */
+static int sysfs_find(struct ibv_context *ctx, uint8_t port,
+		      struct gid_ent *ent)
+{
+	enum ibv_gid_type type;
+	union ibv_gid gid;
+	int i;
+
+	for (i = 0; ; i++) {
+		if (ibv_query_gid(ctx, port, i, &gid) ||
+		    ibv_query_gid_type(ctx, port, i, &type))
+			return -1;
+		if (type == ent->type && !memcmp(&gid, &ent->gid, sizeof(gid)))
+			return i;
+	}
+}
+
+/* A received GRH addressed to the GID, as seen on a UD QP */
+static void build_grh(struct gid_ent *ent, struct ibv_grh *grh)
+{
+	memset(grh, 0, sizeof(*grh));
+	grh->version_tclass_flow = htobe32(6 << 28);
+	grh->next_hdr = ent->type == IBV_GID_TYPE_ROCE_V2 ?
+			IPPROTO_UDP : IB_NEXT_HDR;
+	grh->hop_limit = 64;
+	grh->sgid.raw[0] = 0xfe;
+	grh->sgid.raw[1] = 0x80;
+	grh->sgid.raw[15] = 1;
+	grh->dgid = ent->gid;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            time GID to index resolution\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>     use IB device <dev> (default first device found)\n");
+	printf("  -i, --ib-port=<port>   use port <port> of IB device (default 1)\n");
+	printf("  -n, --iters=<iters>    number of lookups per GID (default 100000)\n");
+	printf("  -s, --sysfs-iters=<n>  number of sysfs searches per GID (default 100)\n");
+	printf("  -h, --help             print a help text and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_device **dev_list;
+	struct ibv_context *context;
+	struct gid_ent gids[MAX_GIDS];
+	struct ibv_ah_attr ah_attr;
+	struct ibv_wc wc = {};
+	struct ibv_grh grh;
+	char *ib_devname = NULL;
+	int iters = 100000, sysfs_iters = 100;
+	double start, sysfs_us, cached_us;
+	int ib_port = 1;
+	int i, g, num, ret = 0;
+
+	while (1) {
+		int c;
+		static struct option long_options[] = {
+			{ .name = "ib-dev",      .has_arg = 1, .val = 'd' },
+			{ .name = "ib-port",     .has_arg = 1, .val = 'i' },
+			{ .name = "iters",       .has_arg = 1, .val = 'n' },
+			{ .name = "sysfs-iters", .has_arg = 1, .val = 's' },
+			{ .name = "help",        .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:i:n:s:h", long_options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'd':
+			ib_devname = strdupa(optarg);
+			break;
+		case 'i':
+			ib_port = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			iters = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			sysfs_iters = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (ib_port < 1 || ib_port > 255 || iters <= 0 || sysfs_iters <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list) {
+		perror("Failed to get IB devices list");
+		return 1;
+	}
+
+	for (i = 0; dev_list[i]; ++i)
+		if (!ib_devname ||
+		    !strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+			break;
+	if (!dev_list[i]) {
+		fprintf(stderr, "IB device %s not found\n",
+			ib_devname ? ib_devname : "");
+		return 1;
+	}
+
+	context = ibv_open_device(dev_list[i]);
+	if (!context) {
+		fprintf(stderr, "Couldn't get context for %s\n",
+			ibv_get_device_name(dev_list[i]));
+		return 1;
+	}
+
+	num = read_gids(context, ib_port, gids);
+	if (num <= 0) {
+		fprintf(stderr, "No usable GIDs on %s port %d\n",
+			ibv_get_device_name(dev_list[i]), ib_port);
+		ret = 1;
+		goto out;
+	}
+
+	wc.wc_flags = IBV_WC_GRH;
+	printf("%-40s %5s %5s %14s %14s\n", "GID", "type", "index",
+	       "sysfs us/op", "cached us/op");
+
+	for (g = 0; g < num; g++) {
+		char str[INET6_ADDRSTRLEN];
+
+		build_grh(&gids[g], &grh);
+
+		start = now_us();
+		for (i = 0; i < sysfs_iters; i++) {
+			if (sysfs_find(context, ib_port, &gids[g]) !=
+			    gids[g].index) {
+				fprintf(stderr, "sysfs search failed\n");
+				ret = 1;
+				goto out;
+			}
+		}
+		sysfs_us = (now_us() - start) / sysfs_iters;
+
+		start = now_us();
+		for (i = 0; i < iters; i++) {
+			if (ibv_init_ah_from_wc(context, ib_port, &wc, &grh,
+						&ah_attr) ||
+			    ah_attr.grh.sgid_index != gids[g].index) {
+				fprintf(stderr, "ibv_init_ah_from_wc failed\n");
+				ret = 1;
+				goto out;
+			}
+		}
+		cached_us = (now_us() - start) / iters;
+
+		inet_ntop(AF_INET6, gids[g].gid.raw, str, sizeof(str));
+		printf("%-40s %5s %5d %14.3f %14.3f\n", str,
+		       gids[g].type == IBV_GID_TYPE_ROCE_V2 ? "v2" : "v1",
+		       gids[g].index, sysfs_us, cached_us);
+	}
+
+out:
+	ibv_close_device(context);
+	ibv_free_device_list(dev_list);
+	return ret;
+}
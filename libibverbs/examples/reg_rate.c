@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <infiniband/verbs.h>
+#include <infiniband/driver.h>
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Fragment the address space the way a large application does, alternating
+ * protections so the kernel can not merge neighbouring mappings.
+ */
+static int add_mappings(int num)
+{
+	long psize = sysconf(_SC_PAGESIZE);
+	char *area;
+	int i;
+
+	if (!num)
+		return 0;
+
+	area = mmap(NULL, num * psize, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		return -1;
+
+	for (i = 0; i < num; i += 2)
+		if (mprotect(area + i * psize, psize, PROT_READ))
+			return -1;
+	return 0;
+}
+
+struct worker {
+	pthread_t	thread;
+	struct ibv_pd	*pd;
+	void		*buf;
+	size_t		size;
+	int		iters;
+	int		err;
+};
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct ibv_mr *mr;
+	int i;
+
+	for (i = 0; i < w->iters; i++) {
+		if (!w->pd) {
+			if (ibv_dontfork_range(w->buf, w->size) ||
+			    ibv_dofork_range(w->buf, w->size)) {
+				perror("Couldn't track range");
+				w->err = 1;
+				break;
+			}
+			continue;
+		}
+
+		mr = ibv_reg_mr(w->pd, w->buf, w->size, IBV_ACCESS_LOCAL_WRITE);
+		if (!mr) {
+			perror("Couldn't register MR");
+			w->err = 1;
+			break;
+		}
+		if (ibv_dereg_mr(mr)) {
+			perror("Couldn't deregister MR");
+			w->err = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void *map_buf(size_t size, int hugetlb)
+{
+	void *buf;
+
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | (hugetlb ? MAP_HUGETLB : 0),
+		   -1, 0);
+	if (buf == MAP_FAILED) {
+		perror(hugetlb ? "Couldn't map huge pages" : "Couldn't map buffer");
+		return NULL;
+	}
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s            measure memory registration rate\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -d, --ib-dev=<dev>     use IB device <dev> (default first device found)\n");
+	printf("  -s, --size=<size>      size of each registration (default 65536)\n");
+	printf("  -n, --iters=<iters>    number of reg/dereg pairs per thread (default 10000)\n");
+	printf("  -t, --threads=<num>    number of registering threads (default 1)\n");
+	printf("  -S, --shared           all threads register the same buffer\n");
+	printf("  -m, --mappings=<num>   extra mappings to add to the process (default 0)\n");
+	printf("  -H, --hugetlb          register MAP_HUGETLB memory\n");
+	printf("  -F, --fork-only        only track the ranges for fork, do not use a device\n");
+	printf("  -h, --help             print a help text and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ibv_device **dev_list = NULL;
+	struct ibv_context *context = NULL;
+	struct ibv_pd *pd = NULL;
+	struct worker *workers;
+	char *ib_devname = NULL;
+	size_t size = 65536;
+	int iters = 10000, mappings = 0, threads = 1;
+	int hugetlb = 0, fork_only = 0, shared = 0;
+	double start, elapsed;
+	int i, started, ret = 1;
+
+	while (1) {
+		int c;
+		static struct option long_options[] = {
+			{ .name = "ib-dev",    .has_arg = 1, .val = 'd' },
+			{ .name = "size",      .has_arg = 1, .val = 's' },
+			{ .name = "iters",     .has_arg = 1, .val = 'n' },
+			{ .name = "threads",   .has_arg = 1, .val = 't' },
+			{ .name = "shared",    .has_arg = 0, .val = 'S' },
+			{ .name = "mappings",  .has_arg = 1, .val = 'm' },
+			{ .name = "hugetlb",   .has_arg = 0, .val = 'H' },
+			{ .name = "fork-only", .has_arg = 0, .val = 'F' },
+			{ .name = "help",      .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "d:s:n:t:Sm:HFh", long_options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'd':
+			ib_devname = strdupa(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iters = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			shared = 1;
+			break;
+		case 'm':
+			mappings = strtol(optarg, NULL, 0);
+			break;
+		case 'H':
+			hugetlb = 1;
+			break;
+		case 'F':
+			fork_only = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!size || iters <= 0 || threads <= 0 || mappings < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Read by ibv_fork_init() */
+	setenv("RDMAV_HUGEPAGES_SAFE", "1", 1);
+	if (ibv_fork_init()) {
+		fprintf(stderr, "Couldn't initialize fork support\n");
+		return 1;
+	}
+
+	if (add_mappings(mappings)) {
+		perror("Couldn't create mappings");
+		return 1;
+	}
+
+	workers = calloc(threads, sizeof(*workers));
+	if (!workers)
+		return 1;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].size = size;
+		workers[i].iters = iters;
+		workers[i].buf = shared && i ? workers[0].buf :
+			map_buf(size, hugetlb);
+		if (!workers[i].buf)
+			goto out;
+	}
+
+	if (!fork_only) {
+		dev_list = ibv_get_device_list(NULL);
+		if (!dev_list) {
+			perror("Failed to get IB devices list");
+			goto out;
+		}
+
+		for (i = 0; dev_list[i]; ++i)
+			if (!ib_devname ||
+			    !strcmp(ibv_get_device_name(dev_list[i]), ib_devname))
+				break;
+		if (!dev_list[i]) {
+			fprintf(stderr, "IB device %s not found\n",
+				ib_devname ? ib_devname : "");
+			goto out;
+		}
+
+		context = ibv_open_device(dev_list[i]);
+		if (!context) {
+			fprintf(stderr, "Couldn't get context for %s\n",
+				ibv_get_device_name(dev_list[i]));
+			goto out;
+		}
+
+		pd = ibv_alloc_pd(context);
+		if (!pd) {
+			fprintf(stderr, "Couldn't allocate PD\n");
+			goto out;
+		}
+	}
+
+	start = now_us();
+	for (started = 0; started < threads; started++) {
+		workers[started].pd = pd;
+		if (pthread_create(&workers[started].thread, NULL, run_worker,
+				   &workers[started])) {
+			fprintf(stderr, "Couldn't create thread\n");
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+	elapsed = now_us() - start;
+
+	if (started != threads)
+		goto out;
+	for (i = 0; i < threads; i++)
+		if (workers[i].err)
+			goto out;
+
+	printf("%d threads, %d %s of %zu bytes%s%s: %.3f us each, %.0f per second\n",
+	       threads, iters * threads,
+	       fork_only ? "dontfork/dofork pairs" : "reg/dereg pairs", size,
+	       hugetlb ? " (hugetlb)" : "", shared ? " (shared)" : "",
+	       elapsed / iters, (double)iters * threads / elapsed * 1e6);
+	ret = 0;
+
+out:
+	if (pd)
+		ibv_dealloc_pd(pd);
+	if (context)
+		ibv_close_device(context);
+	if (dev_list)
+		ibv_free_device_list(dev_list);
+	for (i = 0; i < threads; i++)
+		if (workers[i].buf && !(shared && i))
+			munmap(workers[i].buf, size);
+	free(workers);
+	return ret;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <infiniband/verbs.h>
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * What a short lived tool does before its real work: find the devices and
+ * open and query each of them, as ibv_devinfo does.
+ */
+static int get_devices(int open_devs)
+{
+	struct ibv_device **dev_list;
+	struct ibv_device_attr attr;
+	struct ibv_context *context;
+	int i, num_devices;
+
+	dev_list = ibv_get_device_list(&num_devices);
+	if (!dev_list)
+		return 1;
+
+	for (i = 0; open_devs && i < num_devices; i++) {
+		context = ibv_open_device(dev_list[i]);
+		if (!context)
+			continue;
+		ibv_query_device(context, &attr);
+		ibv_close_device(context);
+	}
+
+	ibv_free_device_list(dev_list);
+	return 0;
+}
+
+/* Run one child and return the time from fork() until it exited */
+static double run_child(char **cmd, int open_devs)
+{
+	double start;
+	pid_t pid;
+	int fd, status;
+
+	start = now_us();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (!pid) {
+		if (!cmd)
+			_exit(get_devices(open_devs));
+
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+		execvp(cmd[0], cmd);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		perror("waitpid");
+		return -1;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+		fprintf(stderr, "child failed to run\n");
+		return -1;
+	}
+
+	return now_us() - start;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage:\n");
+	printf("  %s [options]                 time ibv_get_device_list() in new processes\n", argv0);
+	printf("  %s [options] command [args]  time running command, eg ibv_devinfo\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -n, --iters=<iters>    number of processes to start (default 100)\n");
+	printf("  -l, --list-only        do not open and query the devices\n");
+	printf("  -h, --help             print a help text and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+	double elapsed, total = 0, min = 0, max = 0;
+	int iters = 100, open_devs = 1;
+	char **cmd = NULL;
+	int i;
+
+	while (1) {
+		int c;
+		static struct option long_options[] = {
+			{ .name = "iters",     .has_arg = 1, .val = 'n' },
+			{ .name = "list-only", .has_arg = 0, .val = 'l' },
+			{ .name = "help",      .has_arg = 0, .val = 'h' },
+			{}
+		};
+
+		c = getopt_long(argc, argv, "+n:lh", long_options, NULL);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'n':
+			iters = strtol(optarg, NULL, 0);
+			break;
+		case 'l':
+			open_devs = 0;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (iters <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (optind < argc)
+		cmd = &argv[optind];
+
+	for (i = 0; i < iters; i++) {
+		elapsed = run_child(cmd, open_devs);
+		if (elapsed < 0)
+			return 1;
+
+		total += elapsed;
+		if (!i || elapsed < min)
+			min = elapsed;
+		if (elapsed > max)
+			max = elapsed;
+	}
+
+	printf("%s: %d runs, min %.1f usec, avg %.1f usec, max %.1f usec\n",
+	       cmd ? cmd[0] : "ibv_get_device_list", iters, min,
+	       total / iters, max);
+	return 0;
+}
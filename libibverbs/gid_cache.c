@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Per context copy of the GID table, used to turn a GID back into its index
+ * without going through sysfs for every entry of the table.
+ *
+ * A port table is filled on first use and dropped when it may be stale:
+ * - on IBV_EVENT_GID_CHANGE and port state events read through
+ *   ibv_get_async_event(),
+ * - on any link or address change reported by rtnetlink, for ports with an
+ *   Ethernet link layer, whose RoCE GIDs follow the netdev addresses. The
+ *   kernel updates the GID table from a work queue after the address
+ *   event, so the table is only refilled once things had time to settle.
+ * A GID that is not found is always searched in sysfs, so an index missing
+ * from the cache is never reported as absent. A GID that is found is read
+ * back from its index before it is returned, and the table is dropped and
+ * searched in sysfs if it no longer matches.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <util/util.h>
+#include "ibverbs.h"
+
+/* Time given to the kernel to update the GID table after an rtnetlink event */
+#define GID_CACHE_SETTLE_NS	(100 * 1000 * 1000ULL)
+
+struct verbs_gid_entry {
+	union ibv_gid		gid;
+	enum ibv_gid_type	type;
+};
+
+struct verbs_gid_port {
+	bool			valid;
+	bool			roce;
+	uint64_t		settle_until;
+	int			num_entries;
+	struct verbs_gid_entry	*entries;
+	/* open addressing, holds entry index + 1, 0 marks an empty slot */
+	uint16_t		*hash;
+	uint32_t		hash_mask;
+};
+
+struct verbs_gid_cache {
+	pthread_rwlock_t	lock;
+	int			nl_fd;
+	unsigned int		num_ports;
+	struct verbs_gid_port	*ports;
+};
+
+static uint64_t gid_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t gid_cache_hash(const union ibv_gid *gid,
+			       enum ibv_gid_type type)
+{
+	uint64_t h = gid->global.subnet_prefix ^ type;
+
+	h = (h ^ gid->global.interface_id) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 32);
+}
+
+static int gid_cache_open_nl(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR |
+			     RTMGRP_IPV6_IFADDR,
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_ROUTE);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void gid_cache_port_clear(struct verbs_gid_port *port)
+{
+	free(port->entries);
+	free(port->hash);
+	port->entries = NULL;
+	port->hash = NULL;
+	port->num_entries = 0;
+	port->valid = false;
+}
+
+/*
+ * Read the port GID table the same way the linear search used to: stop at
+ * the first index whose GID or type cannot be read. Caller holds the lock
+ * for writing.
+ */
+static int gid_cache_port_fill(struct ibv_context *context,
+			       struct verbs_gid_cache *cache, uint8_t port_num)
+{
+	struct verbs_gid_port *port = &cache->ports[port_num];
+	struct ibv_port_attr port_attr;
+	struct verbs_gid_entry *ent;
+	uint32_t hash_size, slot;
+	int i, j;
+
+	gid_cache_port_clear(port);
+
+	if (ibv_query_port(context, port_num, &port_attr))
+		return -1;
+
+	port->roce = port_attr.link_layer == IBV_LINK_LAYER_ETHERNET;
+	if (port->roce && cache->nl_fd < 0) {
+		cache->nl_fd = gid_cache_open_nl();
+		/* Without address events we can not tell when RoCE GIDs move */
+		if (cache->nl_fd < 0)
+			return -1;
+	}
+
+	port->entries = calloc(port_attr.gid_tbl_len, sizeof(*port->entries));
+	for (hash_size = 16; hash_size < 2 * port_attr.gid_tbl_len;)
+		hash_size <<= 1;
+	port->hash = calloc(hash_size, sizeof(*port->hash));
+	if (!port->entries || !port->hash) {
+		gid_cache_port_clear(port);
+		errno = ENOMEM;
+		return -1;
+	}
+	port->hash_mask = hash_size - 1;
+
+	for (i = 0; i < port_attr.gid_tbl_len && i < UINT16_MAX; i++) {
+		ent = &port->entries[i];
+		if (ibv_query_gid(context, port_num, i, &ent->gid) ||
+		    ibv_query_gid_type(context, port_num, i, &ent->type))
+			break;
+
+		/* Keep the lowest index of duplicates, like a linear search */
+		slot = gid_cache_hash(&ent->gid, ent->type) & port->hash_mask;
+		for (; (j = port->hash[slot]); slot = (slot + 1) & port->hash_mask) {
+			if (port->entries[j - 1].type == ent->type &&
+			    !memcmp(&port->entries[j - 1].gid, &ent->gid,
+				    sizeof(ent->gid)))
+				break;
+		}
+		if (!j)
+			port->hash[slot] = i + 1;
+	}
+	port->num_entries = i;
+	port->valid = true;
+	return 0;
+}
+
+/* Drop every RoCE port table if rtnetlink reported a change */
+static void gid_cache_poll_nl(struct verbs_gid_cache *cache)
+{
+	char buf[4096];
+	bool changed = false;
+	unsigned int i;
+
+	pthread_rwlock_rdlock(&cache->lock);
+	if (cache->nl_fd >= 0) {
+		while (recv(cache->nl_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0 ||
+		       errno == ENOBUFS)
+			changed = true;
+	}
+	pthread_rwlock_unlock(&cache->lock);
+	if (!changed)
+		return;
+
+	pthread_rwlock_wrlock(&cache->lock);
+	for (i = 0; i < cache->num_ports; i++) {
+		if (!cache->ports[i].roce)
+			continue;
+		cache->ports[i].valid = false;
+		cache->ports[i].settle_until =
+			gid_cache_now() + GID_CACHE_SETTLE_NS;
+	}
+	pthread_rwlock_unlock(&cache->lock);
+}
+
+static struct verbs_gid_cache *gid_cache_get(struct ibv_context *context)
+{
+	struct verbs_ex_private *priv = get_priv(context);
+	struct verbs_gid_cache *cache;
+
+	cache = atomic_load_explicit(&priv->gid_cache, memory_order_acquire);
+	if (cache)
+		return cache;
+
+	pthread_mutex_lock(&context->mutex);
+	cache = atomic_load_explicit(&priv->gid_cache, memory_order_relaxed);
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (cache) {
+			pthread_rwlock_init(&cache->lock, NULL);
+			cache->nl_fd = -1;
+			atomic_store_explicit(&priv->gid_cache, cache,
+					      memory_order_release);
+		}
+	}
+	pthread_mutex_unlock(&context->mutex);
+	return cache;
+}
+
+static int gid_cache_lookup(struct verbs_gid_port *port,
+			    const union ibv_gid *gid, enum ibv_gid_type type)
+{
+	uint32_t slot = gid_cache_hash(gid, type) & port->hash_mask;
+	struct verbs_gid_entry *ent;
+	int j;
+
+	for (; (j = port->hash[slot]); slot = (slot + 1) & port->hash_mask) {
+		ent = &port->entries[j - 1];
+		if (ent->type == type && !memcmp(&ent->gid, gid, sizeof(*gid)))
+			return j - 1;
+	}
+	return -1;
+}
+
+/*
+ * Return the index of gid/type in the cached table of port_num, -1 if it is
+ * not there or the table can not be used right now.
+ */
+int verbs_gid_cache_find(struct ibv_context *context, uint8_t port_num,
+			 const union ibv_gid *gid, enum ibv_gid_type type)
+{
+	struct verbs_gid_cache *cache;
+	struct verbs_gid_port *ports;
+	int index = -1;
+
+	cache = gid_cache_get(context);
+	if (!cache)
+		return -1;
+
+	gid_cache_poll_nl(cache);
+
+	pthread_rwlock_rdlock(&cache->lock);
+	if (port_num < cache->num_ports && cache->ports[port_num].valid) {
+		index = gid_cache_lookup(&cache->ports[port_num], gid, type);
+		pthread_rwlock_unlock(&cache->lock);
+		return index;
+	}
+	pthread_rwlock_unlock(&cache->lock);
+
+	pthread_rwlock_wrlock(&cache->lock);
+	if (port_num >= cache->num_ports) {
+		ports = realloc(cache->ports, (port_num + 1) * sizeof(*ports));
+		if (!ports)
+			goto out;
+		memset(ports + cache->num_ports, 0,
+		       (port_num + 1 - cache->num_ports) * sizeof(*ports));
+		cache->ports = ports;
+		cache->num_ports = port_num + 1;
+	}
+
+	/* A table that can not be read is retried after the settle time */
+	if (!cache->ports[port_num].valid &&
+	    gid_cache_now() >= cache->ports[port_num].settle_until &&
+	    gid_cache_port_fill(context, cache, port_num))
+		cache->ports[port_num].settle_until =
+			gid_cache_now() + GID_CACHE_SETTLE_NS;
+
+	if (cache->ports[port_num].valid)
+		index = gid_cache_lookup(&cache->ports[port_num], gid, type);
+out:
+	pthread_rwlock_unlock(&cache->lock);
+	return index;
+}
+
+/* Drop the cached table of port_num, or of every port if port_num is 0 */
+void verbs_gid_cache_invalidate(struct ibv_context *context, uint8_t port_num)
+{
+	struct verbs_gid_cache *cache;
+	unsigned int i;
+
+	cache = atomic_load_explicit(&get_priv(context)->gid_cache,
+				     memory_order_acquire);
+	if (!cache)
+		return;
+
+	pthread_rwlock_wrlock(&cache->lock);
+	for (i = 0; i < cache->num_ports; i++) {
+		if (port_num && i != port_num)
+			continue;
+		cache->ports[i].valid = false;
+		cache->ports[i].settle_until = 0;
+	}
+	pthread_rwlock_unlock(&cache->lock);
+}
+
+void verbs_gid_cache_free(struct verbs_context *context_ex)
+{
+	struct verbs_gid_cache *cache = context_ex->priv->gid_cache;
+	unsigned int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->num_ports; i++)
+		gid_cache_port_clear(&cache->ports[i]);
+	if (cache->nl_fd >= 0)
+		close(cache->nl_fd);
+	pthread_rwlock_destroy(&cache->lock);
+	free(cache->ports);
+	free(cache);
+}
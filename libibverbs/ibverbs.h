@@ -35,6 +35,7 @@
 #define IB_VERBS_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include <infiniband/driver.h>
 #include <ccan/bitmap.h>
@@ -60,20 +61,29 @@ int __lib_query_port(struct ibv_context *context, uint8_t port_num,
 		     struct ibv_port_attr *port_attr, size_t port_attr_len);
 int setup_sysfs_uverbs(int uv_dirfd, const char *uverbs,
 		       struct verbs_sysfs_dev *sysfs_dev);
+const char *ibverbs_get_modalias(struct verbs_sysfs_dev *sysfs_dev);
 
 #ifdef _STATIC_LIBRARY_BUILD_
 static inline void load_drivers(void)
 {
 }
+static inline bool load_indexed_drivers(struct list_head *sysfs_list)
+{
+	return false;
+}
 #else
 void load_drivers(void);
+bool load_indexed_drivers(struct list_head *sysfs_list);
 #endif
 
+struct verbs_gid_cache;
+
 struct verbs_ex_private {
 	BITMAP_DECLARE(unsupported_ioctls, VERBS_OPS_NUM);
 	uint32_t driver_id;
 	bool use_ioctl_write;
 	struct verbs_context_ops ops;
+	_Atomic(struct verbs_gid_cache *) gid_cache;
 };
 
 static inline struct verbs_ex_private *get_priv(struct ibv_context *ctx)
@@ -90,4 +100,9 @@ enum ibv_node_type decode_knode_type(unsigned int knode_type);
 
 int find_sysfs_devs_nl(struct list_head *tmp_sysfs_dev_list);
 
+int verbs_gid_cache_find(struct ibv_context *context, uint8_t port_num,
+			 const union ibv_gid *gid, enum ibv_gid_type type);
+void verbs_gid_cache_invalidate(struct ibv_context *context, uint8_t port_num);
+void verbs_gid_cache_free(struct verbs_context *context_ex);
+
 #endif /* IB_VERBS_H */
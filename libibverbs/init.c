@@ -251,6 +251,22 @@ static bool match_modalias(const struct verbs_match_ent *ent, const char *value)
 	}
 }
 
+/* Return the modalias of the device the verbs sysfs device is bound to, or
+ * NULL if it has none. The value is read from sysfs once and cached.
+ */
+const char *ibverbs_get_modalias(struct verbs_sysfs_dev *sysfs_dev)
+{
+	if (!(sysfs_dev->flags & VSYSFS_READ_MODALIAS)) {
+		sysfs_dev->flags |= VSYSFS_READ_MODALIAS;
+		if (ibv_read_ibdev_sysfs_file(
+			    sysfs_dev->modalias, sizeof(sysfs_dev->modalias),
+			    sysfs_dev, "device/modalias") <= 0)
+			sysfs_dev->modalias[0] = 0;
+	}
+
+	return sysfs_dev->modalias[0] ? sysfs_dev->modalias : NULL;
+}
+
 /* Search a null terminated table of verbs_match_ent's and return the one
  * that matches the device the verbs sysfs device is bound to or NULL.
  */
@@ -260,15 +276,8 @@ match_modalias_device(const struct verbs_device_ops *ops,
 {
 	const struct verbs_match_ent *i;
 
-	if (!(sysfs_dev->flags & VSYSFS_READ_MODALIAS)) {
-		sysfs_dev->flags |= VSYSFS_READ_MODALIAS;
-		if (ibv_read_ibdev_sysfs_file(
-			    sysfs_dev->modalias, sizeof(sysfs_dev->modalias),
-			    sysfs_dev, "device/modalias") <= 0) {
-			sysfs_dev->modalias[0] = 0;
-			return NULL;
-		}
-	}
+	if (!ibverbs_get_modalias(sysfs_dev))
+		return NULL;
 
 	for (i = ops->match_table; i->kind != VERBS_MATCH_SENTINEL; i++)
 		if (match_modalias(i, sysfs_dev->modalias))
@@ -579,6 +588,15 @@ int ibverbs_get_device_list(struct list_head *device_list)
 	if (list_empty(&sysfs_list) || drivers_loaded)
 		goto out;
 
+	/* Try to load only the providers the remaining devices need before
+	 * falling back to loading every configured provider.
+	 */
+	if (load_indexed_drivers(&sysfs_list)) {
+		try_all_drivers(&sysfs_list, device_list, &num_devices);
+		if (list_empty(&sysfs_list))
+			goto out;
+	}
+
 	load_drivers();
 	drivers_loaded = 1;
 
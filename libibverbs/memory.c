@@ -33,7 +33,10 @@
 
 #include <config.h>
 
+#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -44,6 +47,8 @@
 #include <limits.h>
 #include <inttypes.h>
 
+#include <ccan/minmax.h>
+
 #include "ibverbs.h"
 
 struct ibv_mem_node {
@@ -57,12 +62,68 @@ struct ibv_mem_node {
 	int			refcnt;
 };
 
-static struct ibv_mem_node *mm_root;
-static pthread_mutex_t mm_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * The address space is cut in MM_SHARD_SIZE chunks, spread over the shards
+ * round robin. Each shard tree covers the whole address space but only
+ * counts references in its own chunks, so ranges in different chunks are
+ * tracked in parallel.
+ */
+#define MM_SHARD_SHIFT	26
+#define MM_SHARD_SIZE	(1ULL << MM_SHARD_SHIFT)
+#define MM_NUM_SHARDS	64
+
+static_assert(MM_NUM_SHARDS <= 64, "mm_lock_shards() uses a 64 bit mask");
+
+struct mm_shard {
+	pthread_mutex_t		mutex;
+	struct ibv_mem_node    *root;
+};
+
+static struct mm_shard mm_shards[MM_NUM_SHARDS];
+static bool mm_enabled;
 static int page_size;
 static int huge_page_enabled;
 static int too_late;
 
+#ifndef PROCMAP_QUERY
+struct procmap_query {
+	uint64_t size;
+	uint64_t query_flags;
+	uint64_t query_addr;
+	uint64_t vma_start;
+	uint64_t vma_end;
+	uint64_t vma_flags;
+	uint64_t vma_page_size;
+	uint64_t vma_offset;
+	uint64_t inode;
+	uint32_t dev_major;
+	uint32_t dev_minor;
+	uint32_t vma_name_size;
+	uint32_t build_id_size;
+	uint64_t vma_name_addr;
+	uint64_t build_id_addr;
+};
+#define PROCMAP_QUERY _IOWR('f', 17, struct procmap_query)
+#endif
+
+/* /proc/self/maps of this process, for PROCMAP_QUERY, -1 when unusable */
+static int maps_fd = -1;
+static int procmap_unsupported;
+static pthread_once_t page_size_atfork_once = PTHREAD_ONCE_INIT;
+
+static void page_size_atfork_child(void)
+{
+	/* The fd still describes the parent's address space */
+	if (maps_fd >= 0)
+		close(maps_fd);
+	maps_fd = -1;
+}
+
+static void page_size_register_atfork(void)
+{
+	pthread_atfork(NULL, NULL, page_size_atfork_child);
+}
+
 static unsigned long smaps_page_size(FILE *file)
 {
 	int n;
@@ -86,17 +147,13 @@ static unsigned long smaps_page_size(FILE *file)
 	return size;
 }
 
-static unsigned long get_page_size(void *base)
+static unsigned long smaps_get_page_size(void *base)
 {
 	unsigned long ret = page_size;
-	pid_t pid;
 	FILE *file;
 	char buf[1024];
 
-	pid = getpid();
-	snprintf(buf, sizeof(buf), "/proc/%d/smaps", pid);
-
-	file = fopen(buf, "r" STREAM_CLOEXEC);
+	file = fopen("/proc/self/smaps", "r" STREAM_CLOEXEC);
 	if (!file)
 		goto out;
 
@@ -121,16 +178,72 @@ out:
 	return ret;
 }
 
+static int procmap_get_page_size(void *base, unsigned long *size)
+{
+	struct procmap_query query = {
+		.size = sizeof(query),
+		.query_addr = (uintptr_t) base,
+	};
+	int fd;
+
+	if (procmap_unsupported)
+		return -1;
+
+	fd = __atomic_load_n(&maps_fd, __ATOMIC_RELAXED);
+	if (fd < 0) {
+		int expected = -1;
+
+		fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			procmap_unsupported = 1;
+			return -1;
+		}
+		if (!__atomic_compare_exchange_n(&maps_fd, &expected, fd, false,
+						 __ATOMIC_RELAXED,
+						 __ATOMIC_RELAXED)) {
+			close(fd);
+			fd = expected;
+		}
+	}
+
+	if (ioctl(fd, PROCMAP_QUERY, &query)) {
+		if (errno == ENOENT) {
+			*size = page_size;
+			return 0;
+		}
+		if (errno == ENOTTY || errno == EINVAL)
+			procmap_unsupported = 1;
+		return -1;
+	}
+
+	*size = query.vma_page_size;
+	return 0;
+}
+
+static unsigned long get_page_size(void *base)
+{
+	unsigned long ret;
+
+	if (!procmap_get_page_size(base, &ret))
+		return ret;
+
+	/*
+	 * Only smaps reports the page size of every kind of mapping, huge
+	 * pages are not limited to hugetlbfs.
+	 */
+	return smaps_get_page_size(base);
+}
+
 int ibv_fork_init(void)
 {
 	void *tmp, *tmp_aligned;
-	int ret;
+	int ret, i;
 	unsigned long size;
 
 	if (getenv("RDMAV_HUGEPAGES_SAFE"))
 		huge_page_enabled = 1;
 
-	if (mm_root)
+	if (mm_enabled)
 		return 0;
 
 	if (too_late)
@@ -144,6 +257,7 @@ int ibv_fork_init(void)
 		return ENOMEM;
 
 	if (huge_page_enabled) {
+		pthread_once(&page_size_atfork_once, page_size_register_atfork);
 		size = get_page_size(tmp);
 		tmp_aligned = (void *) ((uintptr_t) tmp & ~(size - 1));
 	} else {
@@ -159,18 +273,29 @@ int ibv_fork_init(void)
 	if (ret)
 		return ENOSYS;
 
-	mm_root = malloc(sizeof *mm_root);
-	if (!mm_root)
-		return ENOMEM;
+	for (i = 0; i < MM_NUM_SHARDS; i++) {
+		struct ibv_mem_node *root;
 
-	mm_root->parent = NULL;
-	mm_root->left   = NULL;
-	mm_root->right  = NULL;
-	mm_root->color  = IBV_BLACK;
-	mm_root->start  = 0;
-	mm_root->end    = UINTPTR_MAX;
-	mm_root->refcnt = 0;
+		root = malloc(sizeof *root);
+		if (!root) {
+			while (i--)
+				free(mm_shards[i].root);
+			return ENOMEM;
+		}
+
+		root->parent = NULL;
+		root->left   = NULL;
+		root->right  = NULL;
+		root->color  = IBV_BLACK;
+		root->start  = 0;
+		root->end    = UINTPTR_MAX;
+		root->refcnt = 0;
+
+		pthread_mutex_init(&mm_shards[i].mutex, NULL);
+		mm_shards[i].root = root;
+	}
 
+	mm_enabled = true;
 	return 0;
 }
 
@@ -206,7 +331,8 @@ static struct ibv_mem_node *__mm_next(struct ibv_mem_node *node)
 	return node;
 }
 
-static void __mm_rotate_right(struct ibv_mem_node *node)
+static void __mm_rotate_right(struct ibv_mem_node **root,
+			      struct ibv_mem_node *node)
 {
 	struct ibv_mem_node *tmp;
 
@@ -222,7 +348,7 @@ static void __mm_rotate_right(struct ibv_mem_node *node)
 		else
 			node->parent->left = tmp;
 	} else
-		mm_root = tmp;
+		*root = tmp;
 
 	tmp->parent = node->parent;
 
@@ -230,7 +356,8 @@ static void __mm_rotate_right(struct ibv_mem_node *node)
 	node->parent = tmp;
 }
 
-static void __mm_rotate_left(struct ibv_mem_node *node)
+static void __mm_rotate_left(struct ibv_mem_node **root,
+			     struct ibv_mem_node *node)
 {
 	struct ibv_mem_node *tmp;
 
@@ -246,7 +373,7 @@ static void __mm_rotate_left(struct ibv_mem_node *node)
 		else
 			node->parent->left = tmp;
 	} else
-		mm_root = tmp;
+		*root = tmp;
 
 	tmp->parent = node->parent;
 
@@ -282,7 +409,8 @@ static int verify(struct ibv_mem_node *node)
 }
 #endif
 
-static void __mm_add_rebalance(struct ibv_mem_node *node)
+static void __mm_add_rebalance(struct ibv_mem_node **root,
+			       struct ibv_mem_node *node)
 {
 	struct ibv_mem_node *parent, *gp, *uncle;
 
@@ -301,7 +429,7 @@ static void __mm_add_rebalance(struct ibv_mem_node *node)
 				node = gp;
 			} else {
 				if (node == parent->right) {
-					__mm_rotate_left(parent);
+					__mm_rotate_left(root, parent);
 					node   = parent;
 					parent = node->parent;
 				}
@@ -309,7 +437,7 @@ static void __mm_add_rebalance(struct ibv_mem_node *node)
 				parent->color = IBV_BLACK;
 				gp->color     = IBV_RED;
 
-				__mm_rotate_right(gp);
+				__mm_rotate_right(root, gp);
 			}
 		} else {
 			uncle = gp->left;
@@ -322,7 +450,7 @@ static void __mm_add_rebalance(struct ibv_mem_node *node)
 				node = gp;
 			} else {
 				if (node == parent->left) {
-					__mm_rotate_right(parent);
+					__mm_rotate_right(root, parent);
 					node   = parent;
 					parent = node->parent;
 				}
@@ -330,19 +458,19 @@ static void __mm_add_rebalance(struct ibv_mem_node *node)
 				parent->color = IBV_BLACK;
 				gp->color     = IBV_RED;
 
-				__mm_rotate_left(gp);
+				__mm_rotate_left(root, gp);
 			}
 		}
 	}
 
-	mm_root->color = IBV_BLACK;
+	(*root)->color = IBV_BLACK;
 }
 
-static void __mm_add(struct ibv_mem_node *new)
+static void __mm_add(struct ibv_mem_node **root, struct ibv_mem_node *new)
 {
 	struct ibv_mem_node *node, *parent = NULL;
 
-	node = mm_root;
+	node = *root;
 	while (node) {
 		parent = node;
 		if (node->start < new->start)
@@ -361,10 +489,10 @@ static void __mm_add(struct ibv_mem_node *new)
 	new->right  = NULL;
 
 	new->color = IBV_RED;
-	__mm_add_rebalance(new);
+	__mm_add_rebalance(root, new);
 }
 
-static void __mm_remove(struct ibv_mem_node *node)
+static void __mm_remove(struct ibv_mem_node **root, struct ibv_mem_node *node)
 {
 	struct ibv_mem_node *child, *parent, *sib, *tmp;
 	int nodecol;
@@ -399,7 +527,7 @@ static void __mm_remove(struct ibv_mem_node *node)
 			else
 				node->parent->right = tmp;
 		} else
-			mm_root = tmp;
+			*root = tmp;
 	} else {
 		nodecol = node->color;
 
@@ -414,7 +542,7 @@ static void __mm_remove(struct ibv_mem_node *node)
 			else
 				parent->right = child;
 		} else
-			mm_root = child;
+			*root = child;
 	}
 
 	free(node);
@@ -422,14 +550,14 @@ static void __mm_remove(struct ibv_mem_node *node)
 	if (nodecol == IBV_RED)
 		return;
 
-	while ((!child || child->color == IBV_BLACK) && child != mm_root) {
+	while ((!child || child->color == IBV_BLACK) && child != *root) {
 		if (parent->left == child) {
 			sib = parent->right;
 
 			if (sib->color == IBV_RED) {
 				parent->color = IBV_RED;
 				sib->color    = IBV_BLACK;
-				__mm_rotate_left(parent);
+				__mm_rotate_left(root, parent);
 				sib = parent->right;
 			}
 
@@ -443,7 +571,7 @@ static void __mm_remove(struct ibv_mem_node *node)
 					if (sib->left)
 						sib->left->color = IBV_BLACK;
 					sib->color = IBV_RED;
-					__mm_rotate_right(sib);
+					__mm_rotate_right(root, sib);
 					sib = parent->right;
 				}
 
@@ -451,8 +579,8 @@ static void __mm_remove(struct ibv_mem_node *node)
 				parent->color = IBV_BLACK;
 				if (sib->right)
 					sib->right->color = IBV_BLACK;
-				__mm_rotate_left(parent);
-				child = mm_root;
+				__mm_rotate_left(root, parent);
+				child = *root;
 				break;
 			}
 		} else {
@@ -461,7 +589,7 @@ static void __mm_remove(struct ibv_mem_node *node)
 			if (sib->color == IBV_RED) {
 				parent->color = IBV_RED;
 				sib->color    = IBV_BLACK;
-				__mm_rotate_right(parent);
+				__mm_rotate_right(root, parent);
 				sib = parent->left;
 			}
 
@@ -475,7 +603,7 @@ static void __mm_remove(struct ibv_mem_node *node)
 					if (sib->right)
 						sib->right->color = IBV_BLACK;
 					sib->color = IBV_RED;
-					__mm_rotate_left(sib);
+					__mm_rotate_left(root, sib);
 					sib = parent->left;
 				}
 
@@ -483,8 +611,8 @@ static void __mm_remove(struct ibv_mem_node *node)
 				parent->color = IBV_BLACK;
 				if (sib->left)
 					sib->left->color = IBV_BLACK;
-				__mm_rotate_right(parent);
-				child = mm_root;
+				__mm_rotate_right(root, parent);
+				child = *root;
 				break;
 			}
 		}
@@ -494,9 +622,10 @@ static void __mm_remove(struct ibv_mem_node *node)
 		child->color = IBV_BLACK;
 }
 
-static struct ibv_mem_node *__mm_find_start(uintptr_t start, uintptr_t end)
+static struct ibv_mem_node *__mm_find_start(struct ibv_mem_node **root,
+					    uintptr_t start)
 {
-	struct ibv_mem_node *node = mm_root;
+	struct ibv_mem_node *node = *root;
 
 	while (node) {
 		if (node->start <= start && node->end >= start)
@@ -511,17 +640,16 @@ static struct ibv_mem_node *__mm_find_start(uintptr_t start, uintptr_t end)
 	return node;
 }
 
-static struct ibv_mem_node *merge_ranges(struct ibv_mem_node *node,
-					 struct ibv_mem_node *prev)
+static void merge_ranges(struct ibv_mem_node **root, struct ibv_mem_node *node,
+			 struct ibv_mem_node *prev)
 {
 	prev->end = node->end;
 	prev->refcnt = node->refcnt;
-	__mm_remove(node);
-
-	return prev;
+	__mm_remove(root, node);
 }
 
-static struct ibv_mem_node *split_range(struct ibv_mem_node *node,
+static struct ibv_mem_node *split_range(struct ibv_mem_node **root,
+					struct ibv_mem_node *node,
 					uintptr_t cut_line)
 {
 	struct ibv_mem_node *new_node = NULL;
@@ -533,66 +661,181 @@ static struct ibv_mem_node *split_range(struct ibv_mem_node *node,
 	new_node->end    = node->end;
 	new_node->refcnt = node->refcnt;
 	node->end  = cut_line - 1;
-	__mm_add(new_node);
+	__mm_add(root, new_node);
 
 	return new_node;
 }
 
-static struct ibv_mem_node *get_start_node(uintptr_t start, uintptr_t end,
-					   int inc)
+/*
+ * The piece of a range that falls in one MM_SHARD_SIZE chunk of the address
+ * space, and the shard whose tree tracks that chunk.
+ */
+struct mm_piece {
+	struct mm_shard	*shard;
+	uintptr_t	start, end;
+};
+
+static void mm_first_piece(struct mm_piece *piece, uintptr_t start,
+			   uintptr_t end)
 {
-	struct ibv_mem_node *node, *tmp = NULL;
+	uintptr_t chunk = start >> MM_SHARD_SHIFT;
 
-	node = __mm_find_start(start, end);
-	if (node->start < start)
-		node = split_range(node, start);
-	else {
-		tmp = __mm_prev(node);
-		if (tmp && tmp->refcnt == node->refcnt + inc)
-			node = merge_ranges(node, tmp);
-	}
-	return node;
+	piece->shard = &mm_shards[chunk % MM_NUM_SHARDS];
+	piece->start = start;
+	piece->end = min(end, (chunk << MM_SHARD_SHIFT) +
+			      (uintptr_t) MM_SHARD_SIZE - 1);
+}
+
+static bool mm_next_piece(struct mm_piece *piece, uintptr_t end)
+{
+	if (piece->end >= end)
+		return false;
+	mm_first_piece(piece, piece->end + 1, end);
+	return true;
+}
+
+/* Make sure a node of the shard tree starts at addr */
+static int mm_split_at(struct mm_shard *shard, uintptr_t addr)
+{
+	struct ibv_mem_node *node;
+
+	node = __mm_find_start(&shard->root, addr);
+	if (node->start < addr && !split_range(&shard->root, node, addr))
+		return -1;
+
+	return 0;
+}
+
+/* Join the node starting at addr with the previous one if they match */
+static void mm_merge_at(struct mm_shard *shard, uintptr_t addr)
+{
+	struct ibv_mem_node *node, *prev;
+
+	node = __mm_find_start(&shard->root, addr);
+	if (node->start != addr)
+		return;
+
+	prev = __mm_prev(node);
+	if (prev && prev->refcnt == node->refcnt)
+		merge_ranges(&shard->root, node, prev);
+}
+
+static void mm_merge_pieces(uintptr_t start, uintptr_t end)
+{
+	struct mm_piece piece;
+
+	mm_first_piece(&piece, start, end);
+	do {
+		if (piece.start)
+			mm_merge_at(piece.shard, piece.start);
+		if (piece.end != UINTPTR_MAX)
+			mm_merge_at(piece.shard, piece.end + 1);
+	} while (mm_next_piece(&piece, end));
 }
 
 /*
- * This function is called if madvise() fails to undo merging/splitting
- * operations performed on the node.
+ * Collects the ranges whose fork advice has to change and issues one
+ * madvise() for each run of adjacent ranges, even when the run crosses
+ * nodes or shards. Only the first limit runs are issued if limit is not -1.
  */
-static struct ibv_mem_node *undo_node(struct ibv_mem_node *node,
-				      uintptr_t start, int inc)
+struct mm_batch {
+	int		advice;
+	int		limit;
+	int		done;
+	bool		pending;
+	uintptr_t	start, end;
+};
+
+static int mm_batch_flush(struct mm_batch *batch)
 {
-	struct ibv_mem_node *tmp = NULL;
+	if (!batch->pending)
+		return 0;
+	batch->pending = false;
 
-	/*
-	 * This condition can be true only if we merged this
-	 * node with the previous one, so we need to split them.
-	*/
-	if (start > node->start) {
-		tmp = split_range(node, start);
-		if (tmp) {
-			node->refcnt += inc;
-			node = tmp;
-		} else
-			return NULL;
+	if (batch->limit >= 0 && batch->done >= batch->limit)
+		return 0;
+	if (madvise((void *) batch->start, batch->end - batch->start + 1,
+		    batch->advice))
+		return -1;
+	batch->done++;
+
+	return 0;
+}
+
+static int mm_batch_add(struct mm_batch *batch, uintptr_t start, uintptr_t end)
+{
+	if (batch->pending && batch->end + 1 == start) {
+		batch->end = end;
+		return 0;
 	}
 
-	tmp  =  __mm_prev(node);
-	if (tmp && tmp->refcnt == node->refcnt)
-		node = merge_ranges(node, tmp);
+	if (mm_batch_flush(batch))
+		return -1;
 
-	tmp  =  __mm_next(node);
-	if (tmp && tmp->refcnt == node->refcnt)
-		node = merge_ranges(tmp, node);
+	batch->pending = true;
+	batch->start = start;
+	batch->end = end;
 
-	return node;
+	return 0;
+}
+
+/*
+ * madvise() every part of start ... end whose reference count is refcnt. The
+ * nodes must already be split at the piece boundaries.
+ */
+static int mm_advise_pieces(uintptr_t start, uintptr_t end, int refcnt,
+			    struct mm_batch *batch)
+{
+	struct ibv_mem_node *node;
+	struct mm_piece piece;
+
+	mm_first_piece(&piece, start, end);
+	do {
+		node = __mm_find_start(&piece.shard->root, piece.start);
+		for (; node && node->start <= piece.end; node = __mm_next(node)) {
+			if (node->refcnt != refcnt)
+				continue;
+			if (mm_batch_add(batch, node->start, node->end))
+				return -1;
+		}
+	} while (mm_next_piece(&piece, end));
+
+	return mm_batch_flush(batch);
+}
+
+static void mm_lock_shards(uintptr_t start, uintptr_t end, bool lock)
+{
+	uint64_t mask = 0;
+	struct mm_piece piece;
+	int i;
+
+	/* Always in index order, so overlapping ranges can not deadlock */
+	mm_first_piece(&piece, start, end);
+	do {
+		mask |= 1ULL << (piece.shard - mm_shards);
+	} while (mask != UINT64_MAX >> (64 - MM_NUM_SHARDS) &&
+		 mm_next_piece(&piece, end));
+
+	for (i = 0; i < MM_NUM_SHARDS; i++) {
+		if (!(mask & (1ULL << i)))
+			continue;
+		if (lock)
+			pthread_mutex_lock(&mm_shards[i].mutex);
+		else
+			pthread_mutex_unlock(&mm_shards[i].mutex);
+	}
 }
 
 static int ibv_madvise_range(void *base, size_t size, int advice)
 {
 	uintptr_t start, end;
-	struct ibv_mem_node *node, *tmp;
-	int inc;
-	int rolling_back = 0;
+	struct ibv_mem_node *node;
+	struct mm_piece piece;
+	struct mm_batch batch = {
+		.advice = advice,
+		.limit = -1,
+	};
+	int inc = advice == MADV_DONTFORK ? 1 : -1;
 	int ret = 0;
 	unsigned long range_page_size;
 
@@ -608,84 +851,54 @@ static int ibv_madvise_range(void *base, size_t size, int advice)
 	end   = ((uintptr_t) (base + size + range_page_size - 1) &
 		 ~(range_page_size - 1)) - 1;
 
-	pthread_mutex_lock(&mm_mutex);
-again:
-	inc = advice == MADV_DONTFORK ? 1 : -1;
-
-	node = get_start_node(start, end, inc);
-	if (!node) {
-		ret = -1;
-		goto out;
-	}
-
-	while (node && node->start <= end) {
-		if (node->end > end) {
-			if (!split_range(node, end + 1)) {
-				ret = -1;
-				goto out;
-			}
-		}
+	mm_lock_shards(start, end, true);
 
-		if ((inc == -1 && node->refcnt == 1) ||
-		    (inc ==  1 && node->refcnt == 0)) {
-			/*
-			 * If this is the first time through the loop,
-			 * and we merged this node with the previous
-			 * one, then we only want to do the madvise()
-			 * on start ... node->end (rather than
-			 * starting at node->start).
-			 *
-			 * Otherwise we end up doing madvise() on
-			 * bigger region than we're being asked to,
-			 * and that may lead to a spurious failure.
-			 */
-			if (start > node->start)
-				ret = madvise((void *) start, node->end - start + 1,
-					      advice);
-			else
-				ret = madvise((void *) node->start,
-					      node->end - node->start + 1,
-					      advice);
-			if (ret) {
-				node = undo_node(node, start, inc);
-
-				if (rolling_back || !node)
-					goto out;
-
-				/* madvise failed, roll back previous changes */
-				rolling_back = 1;
-				advice = advice == MADV_DONTFORK ?
-					MADV_DOFORK : MADV_DONTFORK;
-				tmp = __mm_prev(node);
-				if (!tmp || start > tmp->end)
-					goto out;
-				end = tmp->end;
-				goto again;
-			}
+	mm_first_piece(&piece, start, end);
+	do {
+		if (mm_split_at(piece.shard, piece.start) ||
+		    (piece.end != UINTPTR_MAX &&
+		     mm_split_at(piece.shard, piece.end + 1))) {
+			ret = -1;
+			goto out;
 		}
+	} while (mm_next_piece(&piece, end));
 
-		node->refcnt += inc;
-		node = __mm_next(node);
+	/*
+	 * Only the parts going from 0 to 1 references, or from 1 to 0, change
+	 * their advice. Nothing is counted until every madvise() succeeded,
+	 * so a failure is undone by re-issuing the runs that went through
+	 * with the opposite advice. That includes the failed run, as madvise()
+	 * may have applied to part of it.
+	 */
+	if (mm_advise_pieces(start, end, inc == 1 ? 0 : 1, &batch)) {
+		struct mm_batch undo = {
+			.advice = advice == MADV_DONTFORK ?
+				  MADV_DOFORK : MADV_DONTFORK,
+			.limit = batch.done + 1,
+		};
+
+		mm_advise_pieces(start, end, inc == 1 ? 0 : 1, &undo);
+		ret = -1;
+		goto out;
 	}
 
-	if (node) {
-		tmp = __mm_prev(node);
-		if (tmp && node->refcnt == tmp->refcnt)
-			node = merge_ranges(node, tmp);
-	}
+	mm_first_piece(&piece, start, end);
+	do {
+		node = __mm_find_start(&piece.shard->root, piece.start);
+		for (; node && node->start <= piece.end; node = __mm_next(node))
+			node->refcnt += inc;
+	} while (mm_next_piece(&piece, end));
 
 out:
-	if (rolling_back)
-		ret = -1;
-
-	pthread_mutex_unlock(&mm_mutex);
+	mm_merge_pieces(start, end);
+	mm_lock_shards(start, end, false);
 
 	return ret;
 }
 
 int ibv_dontfork_range(void *base, size_t size)
 {
-	if (mm_root)
+	if (mm_enabled)
 		return ibv_madvise_range(base, size, MADV_DONTFORK);
 	else {
 		too_late = 1;
@@ -695,7 +908,7 @@ int ibv_dontfork_range(void *base, size_t size)
 
 int ibv_dofork_range(void *base, size_t size)
 {
-	if (mm_root)
+	if (mm_enabled)
 		return ibv_madvise_range(base, size, MADV_DOFORK);
 	else {
 		too_late = 1;
@@ -751,6 +751,20 @@ static int ibv_find_gid_index(struct ibv_context *context, uint8_t port_num,
 	union ibv_gid sgid;
 	int i = 0, ret;
 
+	ret = verbs_gid_cache_find(context, port_num, gid, gid_type);
+	if (ret >= 0) {
+		/* The table may have changed before we heard about it */
+		i = ret;
+		if (!ibv_query_gid(context, port_num, i, &sgid) &&
+		    !ibv_query_gid_type(context, port_num, i, &sgid_type) &&
+		    !memcmp(&sgid, gid, sizeof(*gid)) && gid_type == sgid_type)
+			return i;
+
+		verbs_gid_cache_invalidate(context, port_num);
+		i = 0;
+	}
+
+	/* Not cached, maybe just added or moved: search the table itself */
 	do {
 		ret = ibv_query_gid(context, port_num, i, &sgid);
 		if (!ret) {
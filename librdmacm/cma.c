@@ -126,8 +126,13 @@ struct cma_event {
 	uint8_t			private_data[RDMA_MAX_PRIVATE_DATA];
 	struct cma_id_private	*id_priv;
 	struct cma_multicast	*mc;
+	struct cma_event	*next;
 };
 
+/* Events handled per batch, and kept for reuse once acked */
+#define CMA_EVENT_BATCH 64
+#define CMA_EVENT_CACHE_MAX 1024
+
 static struct cma_device *cma_dev_array;
 static int cma_dev_cnt;
 static int cma_init_cnt;
@@ -138,6 +143,9 @@ static dev_t dev_cdev;
 int af_ib_support;
 static struct index_map ucma_idm;
 static fastlock_t idm_lock;
+static pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cma_event *event_cache;
+static int event_cache_cnt;
 
 static int check_abi_version_nl_cb(struct nl_msg *msg, void *data)
 {
@@ -1946,23 +1954,79 @@ static void ucma_complete_mc_event(struct cma_multicast *mc)
 	pthread_mutex_unlock(&mc->id_priv->mut);
 }
 
-int rdma_ack_cm_event(struct rdma_cm_event *event)
+/*
+ * Take num events from the cache, allocating those it cannot provide.
+ * Returns the number of events obtained.
+ */
+static int ucma_alloc_events(struct cma_event **evts, int num)
 {
-	struct cma_event *evt;
+	int i;
 
-	if (!event)
+	pthread_mutex_lock(&event_lock);
+	for (i = 0; i < num && event_cache; i++) {
+		evts[i] = event_cache;
+		event_cache = event_cache->next;
+		event_cache_cnt--;
+	}
+	pthread_mutex_unlock(&event_lock);
+
+	for (; i < num; i++) {
+		evts[i] = malloc(sizeof(*evts[i]));
+		if (!evts[i])
+			break;
+	}
+	return i;
+}
+
+static void ucma_free_events(struct cma_event **evts, int num)
+{
+	int i;
+
+	pthread_mutex_lock(&event_lock);
+	for (i = 0; i < num && event_cache_cnt < CMA_EVENT_CACHE_MAX; i++) {
+		evts[i]->next = event_cache;
+		event_cache = evts[i];
+		event_cache_cnt++;
+	}
+	pthread_mutex_unlock(&event_lock);
+
+	for (; i < num; i++)
+		free(evts[i]);
+}
+
+int rdma_ack_cm_events(struct rdma_cm_event **events, int num)
+{
+	struct cma_event *evts[CMA_EVENT_BATCH];
+	int i, cnt;
+
+	if (!events || num < 0)
 		return ERR(EINVAL);
 
-	evt = container_of(event, struct cma_event, event);
+	for (i = 0; i < num; i++) {
+		if (!events[i])
+			return ERR(EINVAL);
+	}
 
-	if (evt->mc)
-		ucma_complete_mc_event(evt->mc);
-	else
-		ucma_complete_event(evt->id_priv);
-	free(evt);
+	for (; num; num -= cnt, events += cnt) {
+		cnt = min(num, CMA_EVENT_BATCH);
+		for (i = 0; i < cnt; i++) {
+			evts[i] = container_of(events[i], struct cma_event,
+					       event);
+			if (evts[i]->mc)
+				ucma_complete_mc_event(evts[i]->mc);
+			else
+				ucma_complete_event(evts[i]->id_priv);
+		}
+		ucma_free_events(evts, cnt);
+	}
 	return 0;
 }
 
+int rdma_ack_cm_event(struct rdma_cm_event *event)
+{
+	return rdma_ack_cm_events(&event, 1);
+}
+
 static void ucma_process_addr_resolved(struct cma_event *evt)
 {
 	if (af_ib_support) {
@@ -2149,33 +2213,36 @@ int rdma_establish(struct rdma_cm_id *id)
 						   id));
 }
 
-int rdma_get_cm_event(struct rdma_event_channel *channel,
-		      struct rdma_cm_event **event)
+static int ucma_event_ready(struct rdma_event_channel *channel)
+{
+	struct pollfd fds = {
+		.fd = channel->fd,
+		.events = POLLIN,
+	};
+
+	return poll(&fds, 1, 0) == 1;
+}
+
+/*
+ * With nowait set, an event is only read while the channel has one ready,
+ * including after events that are consumed internally.
+ */
+static int ucma_get_event(struct rdma_event_channel *channel,
+			  struct cma_event *evt, int nowait)
 {
 	struct ucma_abi_event_resp resp;
 	struct ucma_abi_get_event cmd;
-	struct cma_event *evt;
 	int ret;
 
-	ret = ucma_init();
-	if (ret)
-		return ret;
-
-	if (!event)
-		return ERR(EINVAL);
-
-	evt = malloc(sizeof(*evt));
-	if (!evt)
-		return ERR(ENOMEM);
-
 retry:
+	if (nowait && !ucma_event_ready(channel))
+		return ERR(EAGAIN);
+
 	memset(evt, 0, sizeof(*evt));
 	CMA_INIT_CMD_RESP(&cmd, sizeof cmd, GET_EVENT, &resp, sizeof resp);
 	ret = write(channel->fd, &cmd, sizeof cmd);
-	if (ret != sizeof cmd) {
-		free(evt);
+	if (ret != sizeof cmd)
 		return (ret >= 0) ? ERR(ENODATA) : -1;
-	}
 
 	VALGRIND_MAKE_MEM_DEFINED(&resp, sizeof resp);
 
@@ -2288,10 +2355,53 @@ retry:
 		break;
 	}
 
-	*event = &evt->event;
 	return 0;
 }
 
+/*
+ * The kernel hands out one event per GET_EVENT command.  Only the first
+ * event may wait, the others are read while the channel has events ready.
+ */
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int num)
+{
+	struct cma_event *evts[CMA_EVENT_BATCH];
+	int i, cnt, flags, nowait, ret;
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!events || num <= 0)
+		return ERR(EINVAL);
+
+	cnt = ucma_alloc_events(evts, min(num, CMA_EVENT_BATCH));
+	if (!cnt)
+		return ERR(ENOMEM);
+
+	/* a non-blocking channel reports EAGAIN once it is drained */
+	flags = cnt > 1 ? fcntl(channel->fd, F_GETFL) : 0;
+	nowait = !(flags > 0 && (flags & O_NONBLOCK));
+	for (i = 0; i < cnt; i++) {
+		ret = ucma_get_event(channel, evts[i], i && nowait);
+		if (ret)
+			break;
+		events[i] = &evts[i]->event;
+	}
+
+	ucma_free_events(evts + i, cnt - i);
+	return i ? i : ret;
+}
+
+int rdma_get_cm_event(struct rdma_event_channel *channel,
+		      struct rdma_cm_event **event)
+{
+	int ret;
+
+	ret = rdma_get_cm_events(channel, event, 1);
+	return ret < 0 ? ret : 0;
+}
+
 const char *rdma_event_str(enum rdma_cm_event_type event)
 {
 	switch (event) {
@@ -52,6 +52,7 @@ static char *dst_addr;
 static char *src_addr;
 static int timeout = 2000;
 static int retries = 2;
+static int batch = 1;
 
 enum step {
 	STEP_CREATE_ID,
@@ -188,6 +189,11 @@ static void show_perf(void)
 		printf("%-13s: %11.2f%11.2f%11.2f%11.2f\n", step_str[i], us / 1000.,
 			max[i] / 1000., min[i], us / connections);
 	}
+
+	us = diff_us(&times[STEP_CONNECT][1], &times[STEP_RESOLVE_ADDR][0]);
+	if (us > 0)
+		printf("setup rate   : %11.0f conn/s (%d events per call)\n",
+		       connections * 1000000. / us, batch);
 }
 
 static void addr_handler(struct node *n)
@@ -348,7 +354,6 @@ static void cma_handler(struct rdma_cm_id *id, struct rdma_cm_event *event)
 	default:
 		break;
 	}
-	rdma_ack_cm_event(event);
 }
 
 static int alloc_nodes(void)
@@ -405,6 +410,7 @@ static void *process_events(void *arg)
 		ret = rdma_get_cm_event(channel, &event);
 		if (!ret) {
 			cma_handler(event->id, event);
+			rdma_ack_cm_event(event);
 		} else {
 			perror("failure in rdma_get_cm_event in process_server_events");
 			ret = errno;
@@ -413,6 +419,32 @@ static void *process_events(void *arg)
 	return NULL;
 }
 
+static void *process_event_batches(void *arg)
+{
+	struct rdma_cm_event **events;
+	int i, ret;
+
+	events = calloc(batch, sizeof *events);
+	if (!events) {
+		perror("out of memory allocating event batch");
+		return NULL;
+	}
+
+	do {
+		ret = rdma_get_cm_events(channel, events, batch);
+		if (ret < 0) {
+			perror("failure in rdma_get_cm_events");
+			break;
+		}
+		for (i = 0; i < ret; i++)
+			cma_handler(events[i]->id, events[i]);
+		rdma_ack_cm_events(events, ret);
+	} while (1);
+
+	free(events);
+	return NULL;
+}
+
 static int run_server(void)
 {
 	pthread_t req_thread, disc_thread;
@@ -481,7 +513,10 @@ static int run_server(void)
 		goto out;
 	}
 
-	process_events(NULL);
+	if (batch > 1)
+		process_event_batches(NULL);
+	else
+		process_events(NULL);
  out:
 	rdma_destroy_id(listen_id);
 	return ret;
@@ -504,7 +539,8 @@ static int run_client(void)
 	conn_param.private_data = rai->ai_connect;
 	conn_param.private_data_len = rai->ai_connect_len;
 
-	ret = pthread_create(&event_thread, NULL, process_events, NULL);
+	ret = pthread_create(&event_thread, NULL, batch > 1 ?
+			     process_event_batches : process_events, NULL);
 	if (ret) {
 		perror("failure creating event thread");
 		return ret;
@@ -618,7 +654,7 @@ int main(int argc, char **argv)
 
 	hints.ai_port_space = RDMA_PS_TCP;
 	hints.ai_qp_type = IBV_QPT_RC;
-	while ((op = getopt(argc, argv, "s:b:c:p:r:t:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:c:p:r:t:n:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -638,6 +674,11 @@ int main(int argc, char **argv)
 		case 't':
 			timeout = atoi(optarg);
 			break;
+		case 'n':
+			batch = atoi(optarg);
+			if (batch < 1)
+				batch = 1;
+			break;
 		default:
 			printf("usage: %s\n", argv[0]);
 			printf("\t[-s server_address]\n");
@@ -646,6 +687,7 @@ int main(int argc, char **argv)
 			printf("\t[-p port_number]\n");
 			printf("\t[-r retries]\n");
 			printf("\t[-t timeout_ms]\n");
+			printf("\t[-n events_per_call]\n");
 			exit(1);
 		}
 	}
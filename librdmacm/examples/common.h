@@ -75,6 +75,10 @@ static inline int rs_socket(int f, int t, int p)
 	use_rs ? rrecvfrom(s,b,l,f,a,al) : recvfrom(s,b,l,f,a,al)
 #define rs_sendto(s,b,l,f,a,al) \
 	use_rs ? rsendto(s,b,l,f,a,al)   : sendto(s,b,l,f,a,al)
+#define rs_recvmmsg(s,v,n,f,t) \
+	use_rs ? rrecvmmsg(s,v,n,f,t) : recvmmsg(s,v,n,f,t)
+#define rs_sendmmsg(s,v,n,f) \
+	use_rs ? rsendmmsg(s,v,n,f) : sendmmsg(s,v,n,f)
 #define rs_poll(f,n,t)	  use_rs ? rpoll(f,n,t)	   : poll(f,n,t)
 #define rs_fcntl(s,c,p)   use_rs ? rfcntl(s,c,p)   : fcntl(s,c,p)
 #define rs_setsockopt(s,l,n,v,ol) \
@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under the OpenIB.org BSD license
+ * below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <rdma/rsocket.h>
+
+static const char *port = "7472";
+static char *dst_addr;
+static char *src_addr;
+static int connections = 1024;
+static int iterations = 10000;
+static struct pollfd *fds;
+
+static float time_us(struct timeval *start, struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000. +
+	       (end->tv_usec - start->tv_usec);
+}
+
+static int get_addr(int passive, struct addrinfo **res)
+{
+	struct addrinfo hints;
+	int ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_socktype = SOCK_STREAM;
+	if (passive)
+		hints.ai_flags = AI_PASSIVE;
+
+	ret = getaddrinfo(passive ? src_addr : dst_addr, port, &hints, res);
+	if (ret)
+		printf("getaddrinfo: %s\n", gai_strerror(ret));
+	return ret;
+}
+
+static int server(void)
+{
+	struct addrinfo *res;
+	int lrs, i, ret, open;
+	char c;
+
+	ret = get_addr(1, &res);
+	if (ret)
+		return ret;
+
+	lrs = rsocket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (lrs < 0) {
+		perror("rsocket");
+		ret = lrs;
+		goto free;
+	}
+
+	i = 1;
+	rsetsockopt(lrs, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
+	ret = rbind(lrs, res->ai_addr, res->ai_addrlen);
+	if (ret) {
+		perror("rbind");
+		goto close;
+	}
+
+	ret = rlisten(lrs, connections);
+	if (ret) {
+		perror("rlisten");
+		goto close;
+	}
+
+	printf("accepting %d connections\n", connections);
+	for (i = 0; i < connections; i++) {
+		fds[i].fd = raccept(lrs, NULL, NULL);
+		if (fds[i].fd < 0) {
+			perror("raccept");
+			ret = fds[i].fd;
+			goto close;
+		}
+		fds[i].events = POLLIN;
+	}
+
+	/* Echo every byte back to the client until all connections close */
+	for (open = connections; open; ) {
+		ret = rpoll(fds, open, -1);
+		if (ret < 0) {
+			perror("rpoll");
+			break;
+		}
+
+		for (i = 0; i < open; i++) {
+			if (!fds[i].revents)
+				continue;
+
+			if (!(fds[i].revents & POLLIN) ||
+			    rrecv(fds[i].fd, &c, sizeof c, 0) != sizeof c ||
+			    rsend(fds[i].fd, &c, sizeof c, 0) != sizeof c) {
+				rclose(fds[i].fd);
+				fds[i--] = fds[--open];
+			}
+		}
+	}
+	ret = 0;
+
+close:
+	rclose(lrs);
+free:
+	freeaddrinfo(res);
+	return ret;
+}
+
+static int wait_reply(int cnt, int index)
+{
+	char c;
+	int ret;
+
+	do {
+		ret = rpoll(fds, cnt, -1);
+		if (ret < 0) {
+			perror("rpoll");
+			return ret;
+		}
+	} while (!(fds[index].revents & POLLIN));
+
+	ret = rrecv(fds[index].fd, &c, sizeof c, 0);
+	return ret == sizeof c ? 0 : -1;
+}
+
+static int run_test(int cnt)
+{
+	struct timeval start, end;
+	float idle, rtt;
+	int i, ret;
+	char c = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		ret = rpoll(fds, cnt, 0);
+		if (ret) {
+			printf("unexpected rpoll result %d\n", ret);
+			return -1;
+		}
+	}
+	gettimeofday(&end, NULL);
+	idle = time_us(&start, &end) / iterations;
+
+	/* Only the last socket in the set is active */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		ret = rsend(fds[cnt - 1].fd, &c, sizeof c, 0);
+		if (ret != sizeof c) {
+			perror("rsend");
+			return -1;
+		}
+
+		ret = wait_reply(cnt, cnt - 1);
+		if (ret)
+			return ret;
+	}
+	gettimeofday(&end, NULL);
+	rtt = time_us(&start, &end) / iterations;
+
+	printf("%8d%14.2f%14.2f\n", cnt, idle, rtt);
+	return 0;
+}
+
+static int client(void)
+{
+	struct addrinfo *res;
+	int i, cnt, ret;
+
+	ret = get_addr(0, &res);
+	if (ret)
+		return ret;
+
+	printf("connecting %d sockets\n", connections);
+	for (i = 0; i < connections; i++) {
+		fds[i].fd = rsocket(res->ai_family, res->ai_socktype,
+				    res->ai_protocol);
+		if (fds[i].fd < 0) {
+			perror("rsocket");
+			ret = fds[i].fd;
+			goto close;
+		}
+		fds[i].events = POLLIN;
+
+		ret = rconnect(fds[i].fd, res->ai_addr, res->ai_addrlen);
+		if (ret) {
+			perror("rconnect");
+			rclose(fds[i].fd);
+			goto close;
+		}
+	}
+
+	printf(" sockets  idle us/call  rtt us/xfer\n");
+	for (cnt = 1; ; cnt <<= 1) {
+		if (cnt > connections)
+			cnt = connections;
+
+		ret = run_test(cnt);
+		if (ret || cnt == connections)
+			break;
+	}
+
+close:
+	while (i--) {
+		rshutdown(fds[i].fd, SHUT_RDWR);
+		rclose(fds[i].fd);
+	}
+	freeaddrinfo(res);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int op, ret;
+
+	while ((op = getopt(argc, argv, "s:b:c:i:p:")) != -1) {
+		switch (op) {
+		case 's':
+			dst_addr = optarg;
+			break;
+		case 'b':
+			src_addr = optarg;
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			printf("usage: %s\n", argv[0]);
+			printf("\t[-s server_address]\n");
+			printf("\t[-b bind_address]\n");
+			printf("\t[-c connections]\n");
+			printf("\t[-i iterations]\n");
+			printf("\t[-p port_number]\n");
+			exit(1);
+		}
+	}
+
+	if (connections <= 0 || iterations <= 0) {
+		printf("invalid connections or iterations\n");
+		exit(1);
+	}
+
+	fds = calloc(connections, sizeof(*fds));
+	if (!fds) {
+		perror("calloc");
+		exit(1);
+	}
+
+	ret = dst_addr ? client() : server();
+	free(fds);
+	return ret;
+}
@@ -37,6 +37,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -89,26 +90,40 @@ static int iterations = 1;
 static int transfer_size = 1000;
 static int transfer_count = 1000;
 static int buffer_size, inline_size = 64;
+static int zcopy_size;
+static int use_shared;
+static int use_borrow;
+static int conn_cnt = 1;
+static int *conns;
 static char test_name[10] = "custom";
 static const char *port = "7471";
 static int keepalive;
 static char *dst_addr;
 static char *src_addr;
 static struct timeval start, end;
+static struct rusage start_usage, end_usage;
 static void *buf;
 static struct rdma_addrinfo rai_hints;
 static struct addrinfo ai_hints;
 
+static float cpu_usec(struct rusage *usage)
+{
+	return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000. +
+	       usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
 static void show_perf(void)
 {
 	char str[32];
-	float usec;
+	float usec, cpu;
 	long long bytes;
 
 	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
-	bytes = (long long) iterations * transfer_count * transfer_size * 2;
+	bytes = (long long) iterations * transfer_count * transfer_size * 2 *
+		conn_cnt;
+	cpu = cpu_usec(&end_usage) - cpu_usec(&start_usage);
 
-	/* name size transfers iterations bytes seconds Gb/sec usec/xfer */
+	/* name size transfers iterations bytes seconds Gb/sec usec/xfer %cpu */
 	printf("%-10s", test_name);
 	size_str(str, sizeof str, transfer_size);
 	printf("%-8s", str);
@@ -118,9 +133,27 @@ static void show_perf(void)
 	printf("%-8s", str);
 	size_str(str, sizeof str, bytes);
 	printf("%-8s", str);
-	printf("%8.2fs%10.2f%11.2f\n",
+	printf("%8.2fs%10.2f%11.2f%8.1f\n",
 		usec / 1000000., (bytes * 8) / (1000. * usec),
-		(usec / iterations) / (transfer_count * 2));
+		(usec / iterations) / (transfer_count * 2 * conn_cnt),
+		100. * cpu / usec);
+}
+
+/* Resident and pinned memory of the process after connecting */
+static void show_mem(void)
+{
+	char line[128];
+	FILE *f;
+
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof line, f)) {
+		if (!strncmp(line, "VmRSS:", 6) || !strncmp(line, "VmPin:", 6))
+			printf("%s", line);
+	}
+	fclose(f);
 }
 
 static void init_latency_test(int size)
@@ -177,6 +210,21 @@ static int send_xfer(int size)
 	return 0;
 }
 
+/* Receive in place, only copying the data out when it is verified */
+static int recv_borrow(void *dst, int len)
+{
+	void *data;
+	int ret;
+
+	ret = rrecv_borrow(rs, &data, len, flags & MSG_DONTWAIT);
+	if (ret > 0) {
+		if (verify)
+			memcpy(dst, data, ret);
+		rrecv_release(rs, data);
+	}
+	return ret;
+}
+
 static int recv_xfer(int size)
 {
 	struct pollfd fds;
@@ -194,7 +242,8 @@ static int recv_xfer(int size)
 				return ret;
 		}
 
-		ret = rs_recv(rs, buf + offset, size - offset, flags);
+		ret = use_borrow ? recv_borrow(buf + offset, size - offset) :
+				   rs_recv(rs, buf + offset, size - offset, flags);
 		if (ret > 0) {
 			offset += ret;
 		} else if (errno != EWOULDBLOCK && errno != EAGAIN) {
@@ -214,40 +263,67 @@ static int recv_xfer(int size)
 
 static int sync_test(void)
 {
-	int ret;
+	int ret, c;
 
-	ret = dst_addr ? send_xfer(16) : recv_xfer(16);
-	if (ret)
-		return ret;
+	for (c = 0; c < conn_cnt; c++) {
+		if (conns)
+			rs = conns[c];
+
+		ret = dst_addr ? send_xfer(16) : recv_xfer(16);
+		if (ret)
+			return ret;
 
-	return dst_addr ? recv_xfer(16) : send_xfer(16);
+		ret = dst_addr ? recv_xfer(16) : send_xfer(16);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Every connection transfers in turn.  The client sends on all of them
+ * before receiving, and the server receives on all of them before
+ * sending, so neither side waits on a connection the other is not using.
+ */
+static int xfer_conns(int send)
+{
+	int ret, c, t;
+
+	for (c = 0; c < conn_cnt; c++) {
+		if (conns)
+			rs = conns[c];
+
+		for (t = 0; t < transfer_count; t++) {
+			ret = send ? send_xfer(transfer_size) :
+				     recv_xfer(transfer_size);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
 }
 
 static int run_test(void)
 {
-	int ret, i, t;
+	int ret, i;
 
 	ret = sync_test();
 	if (ret)
 		goto out;
 
+	getrusage(RUSAGE_SELF, &start_usage);
 	gettimeofday(&start, NULL);
 	for (i = 0; i < iterations; i++) {
-		for (t = 0; t < transfer_count; t++) {
-			ret = dst_addr ? send_xfer(transfer_size) :
-					 recv_xfer(transfer_size);
-			if (ret)
-				goto out;
-		}
+		ret = xfer_conns(dst_addr != NULL);
+		if (ret)
+			goto out;
 
-		for (t = 0; t < transfer_count; t++) {
-			ret = dst_addr ? recv_xfer(transfer_size) :
-					 send_xfer(transfer_size);
-			if (ret)
-				goto out;
-		}
+		ret = xfer_conns(dst_addr == NULL);
+		if (ret)
+			goto out;
 	}
 	gettimeofday(&end, NULL);
+	getrusage(RUSAGE_SELF, &end_usage);
 	show_perf();
 	ret = 0;
 
@@ -307,6 +383,14 @@ static void set_options(int fd)
 			val = 0;
 			rs_setsockopt(fd, SOL_RDMA, RDMA_INLINE, &val, sizeof val);
 		}
+
+		if (zcopy_size)
+			rs_setsockopt(fd, SOL_RDMA, RDMA_ZCOPY, &zcopy_size,
+				      sizeof zcopy_size);
+
+		if (use_shared)
+			rs_setsockopt(fd, SOL_RDMA, RDMA_SHARED, &use_shared,
+				      sizeof use_shared);
 	}
 
 	if (keepalive)
@@ -352,7 +436,7 @@ static int server_listen(void)
 		goto close;
 	}
 
-	ret = rs_listen(lrs, 1);
+	ret = rs_listen(lrs, conn_cnt);
 	if (ret)
 		perror("rlisten");
 
@@ -498,6 +582,58 @@ free:
 	return ret;
 }
 
+static void close_conns(void)
+{
+	int c;
+
+	for (c = 0; c < conn_cnt; c++) {
+		rs_shutdown(conns[c], SHUT_RDWR);
+		rs_close(conns[c]);
+	}
+	free(conns);
+}
+
+static int connect_conns(void)
+{
+	struct rlimit rlim;
+	float usec;
+	int ret = 0, c;
+
+	conns = calloc(conn_cnt, sizeof(*conns));
+	if (!conns) {
+		perror("calloc");
+		return -1;
+	}
+
+	/* Each rsocket uses a few file descriptors */
+	if (!getrlimit(RLIMIT_NOFILE, &rlim)) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	gettimeofday(&start, NULL);
+	for (c = 0; c < conn_cnt; c++) {
+		ret = dst_addr ? client_connect() : server_connect();
+		if (ret)
+			break;
+		conns[c] = rs;
+	}
+	gettimeofday(&end, NULL);
+
+	if (ret) {
+		printf("connected %d of %d\n", c, conn_cnt);
+		conn_cnt = c;
+		close_conns();
+		return ret;
+	}
+
+	usec = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	printf("%d connections in %.2fs%s\n", conn_cnt, usec / 1000000.,
+	       use_shared ? " (shared resources)" : "");
+	show_mem();
+	return 0;
+}
+
 static int run(void)
 {
 	int i, ret = 0;
@@ -514,8 +650,15 @@ static int run(void)
 			goto free;
 	}
 
-	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s\n",
-	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec", "usec/xfer");
+	if (conn_cnt > 1) {
+		ret = connect_conns();
+		if (ret)
+			goto free;
+	}
+
+	printf("%-10s%-8s%-8s%-8s%-8s%8s %10s%13s%8s\n",
+	       "name", "bytes", "xfers", "iters", "total", "time", "Gb/sec",
+	       "usec/xfer", "%cpu");
 	if (!custom) {
 		optimization = opt_latency;
 		ret = dst_addr ? client_connect() : server_connect();
@@ -547,6 +690,10 @@ static int run(void)
 			init_bandwidth_test(test_size[i].size);
 			run_test();
 		}
+	} else if (conns) {
+		ret = run_test();
+		close_conns();
+		goto free;
 	} else {
 		ret = dst_addr ? client_connect() : server_connect();
 		if (ret)
@@ -592,6 +739,9 @@ static int set_test_opt(const char *arg)
 		case 'v':
 			verify = 1;
 			break;
+		case 'z':
+			use_borrow = 1;
+			break;
 		default:
 			return -1;
 		}
@@ -608,6 +758,8 @@ static int set_test_opt(const char *arg)
 			use_rgai = 1;
 		} else if (!strncasecmp("verify", arg, 6)) {
 			verify = 1;
+		} else if (!strncasecmp("zrecv", arg, 5)) {
+			use_borrow = 1;
 		} else if (!strncasecmp("fork", arg, 4)) {
 			use_fork = 1;
 			use_rs = 0;
@@ -624,7 +776,7 @@ int main(int argc, char **argv)
 
 	ai_hints.ai_socktype = SOCK_STREAM;
 	rai_hints.ai_port_space = RDMA_PS_TCP;
-	while ((op = getopt(argc, argv, "s:b:f:B:i:I:C:S:p:k:T:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:f:B:i:I:C:S:p:k:T:z:c:m")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -671,6 +823,16 @@ int main(int argc, char **argv)
 		case 'k':
 			keepalive = atoi(optarg);
 			break;
+		case 'z':
+			zcopy_size = atoi(optarg);
+			break;
+		case 'c':
+			custom = 1;
+			conn_cnt = atoi(optarg);
+			break;
+		case 'm':
+			use_shared = 1;
+			break;
 		case 'T':
 			if (!set_test_opt(optarg))
 				break;
@@ -689,6 +851,9 @@ int main(int argc, char **argv)
 			printf("\t[-S transfer_size or all]\n");
 			printf("\t[-p port_number]\n");
 			printf("\t[-k keepalive_time]\n");
+			printf("\t[-z zero_copy_size]\n");
+			printf("\t[-c connections]\n");
+			printf("\t[-m use shared rsocket resources]\n");
 			printf("\t[-T test_option]\n");
 			printf("\t    s|sockets - use standard tcp/ip sockets\n");
 			printf("\t    a|async - asynchronous operation (use poll)\n");
@@ -697,10 +862,21 @@ int main(int argc, char **argv)
 			printf("\t    n|nonblocking - use nonblocking calls\n");
 			printf("\t    r|resolve - use rdma cm to resolve address\n");
 			printf("\t    v|verify - verify data\n");
+			printf("\t    z|zrecv - receive in place with rrecv_borrow\n");
 			exit(1);
 		}
 	}
 
+	if (conn_cnt < 1 || (conn_cnt > 1 && use_fork)) {
+		fprintf(stderr, "invalid number of connections\n");
+		exit(1);
+	}
+
+	if (use_borrow && !use_rs) {
+		fprintf(stderr, "zrecv requires rsockets\n");
+		exit(1);
+	}
+
 	if (!(flags & MSG_DONTWAIT))
 		poll_timeout = -1;
 
@@ -27,6 +27,7 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -100,6 +101,11 @@ static union socket_addr g_addr;
 static socklen_t g_addrlen;
 static struct timeval start, end;
 static struct message g_msg;
+static int batch;
+static struct mmsghdr *g_mmsg;
+static struct iovec *g_iov;
+static struct message *g_msgs;
+static union socket_addr *g_addrs;
 
 static void show_perf(void)
 {
@@ -220,6 +226,58 @@ static ssize_t svr_recv(struct message *msg, size_t size,
 	return ret;
 }
 
+static int alloc_batch(void)
+{
+	int i;
+
+	g_mmsg = calloc(batch, sizeof *g_mmsg);
+	g_iov = calloc(batch, sizeof *g_iov);
+	g_msgs = calloc(batch, sizeof *g_msgs);
+	g_addrs = calloc(batch, sizeof *g_addrs);
+	if (!g_mmsg || !g_iov || !g_msgs || !g_addrs) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < batch; i++) {
+		g_iov[i].iov_base = &g_msgs[i];
+		g_mmsg[i].msg_hdr.msg_iov = &g_iov[i];
+		g_mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+	return 0;
+}
+
+static int svr_recv_batch(void)
+{
+	struct pollfd fds;
+	int i, ret;
+
+	if (use_async) {
+		fds.fd = rs;
+		fds.events = POLLIN;
+	}
+
+	do {
+		if (use_async) {
+			ret = do_poll(&fds, poll_timeout);
+			if (ret)
+				return ret;
+		}
+
+		for (i = 0; i < batch; i++) {
+			g_iov[i].iov_len = sizeof g_msgs[i];
+			g_mmsg[i].msg_hdr.msg_name = &g_addrs[i];
+			g_mmsg[i].msg_hdr.msg_namelen = sizeof g_addrs[i];
+		}
+		ret = rs_recvmmsg(rs, g_mmsg, batch, flags, NULL);
+	} while (ret < 0 && (errno == EWOULDBLOCK || errno == EAGAIN));
+
+	if (ret < 0)
+		perror("rrecvmmsg");
+
+	return ret;
+}
+
 static int svr_process(struct message *msg, size_t size,
 		       union socket_addr *addr, socklen_t addrlen)
 {
@@ -291,9 +349,18 @@ out:
 static int svr_run(void)
 {
 	ssize_t len;
-	int ret;
+	int i, cnt, ret;
 
 	ret = svr_bind();
+	while (!ret && batch) {
+		cnt = svr_recv_batch();
+		if (cnt < 0)
+			return cnt;
+
+		for (i = 0; i < cnt && !ret; i++)
+			ret = svr_process(&g_msgs[i], g_mmsg[i].msg_len, &g_addrs[i],
+					  g_mmsg[i].msg_hdr.msg_namelen);
+	}
 	while (!ret) {
 		g_addrlen = sizeof g_addr;
 		len = svr_recv(&g_msg, sizeof g_msg, &g_addr, &g_addrlen);
@@ -331,6 +398,39 @@ static ssize_t client_send(struct message *msg, size_t size)
 	return ret;
 }
 
+static int client_send_batch(struct message *msg, size_t size, int cnt)
+{
+	struct pollfd fds;
+	int i, ret;
+
+	for (i = 0; i < cnt; i++) {
+		g_iov[i].iov_base = msg;
+		g_iov[i].iov_len = size;
+		g_mmsg[i].msg_hdr.msg_name = NULL;
+		g_mmsg[i].msg_hdr.msg_namelen = 0;
+	}
+
+	if (use_async) {
+		fds.fd = rs;
+		fds.events = POLLOUT;
+	}
+
+	do {
+		if (use_async) {
+			ret = do_poll(&fds, poll_timeout);
+			if (ret)
+				return ret;
+		}
+
+		ret = rs_sendmmsg(rs, g_mmsg, cnt, flags);
+	} while (ret < 0 && (errno == EWOULDBLOCK || errno == EAGAIN));
+
+	if (ret < 0)
+		perror("rsendmmsg");
+
+	return ret;
+}
+
 static ssize_t client_recv(struct message *msg, size_t size, int timeout)
 {
 	struct pollfd fds;
@@ -372,7 +472,7 @@ static int client_send_recv(struct message *msg, size_t size, int timeout)
 
 static int run_test(void)
 {
-	int ret, i;
+	int ret, i, cnt;
 
 	g_msg.op = msg_op_start;
 	ret = client_send_recv(&g_msg, CTRL_MSG_SIZE, 1000);
@@ -381,11 +481,21 @@ static int run_test(void)
 
 	g_msg.op = echo ? msg_op_echo : msg_op_data;
 	gettimeofday(&start, NULL);
-	for (i = 0; i < transfer_count; i++) {
-		ret = echo ? client_send_recv(&g_msg, transfer_size, 1) :
-			     client_send(&g_msg, transfer_size);
-		if (ret != transfer_size)
-			goto out;
+	if (batch && !echo) {
+		for (i = 0; i < transfer_count; i += ret) {
+			cnt = transfer_count - i;
+			ret = client_send_batch(&g_msg, transfer_size,
+						cnt < batch ? cnt : batch);
+			if (ret <= 0)
+				goto out;
+		}
+	} else {
+		for (i = 0; i < transfer_count; i++) {
+			ret = echo ? client_send_recv(&g_msg, transfer_size, 1) :
+				     client_send(&g_msg, transfer_size);
+			if (ret != transfer_size)
+				goto out;
+		}
 	}
 
 	g_msg.op = msg_op_end;
@@ -513,7 +623,7 @@ int main(int argc, char **argv)
 {
 	int op, ret;
 
-	while ((op = getopt(argc, argv, "s:b:B:C:S:p:T:")) != -1) {
+	while ((op = getopt(argc, argv, "s:b:B:C:S:p:M:T:")) != -1) {
 		switch (op) {
 		case 's':
 			dst_addr = optarg;
@@ -540,6 +650,13 @@ int main(int argc, char **argv)
 		case 'p':
 			port = optarg;
 			break;
+		case 'M':
+			batch = atoi(optarg);
+			if (batch <= 0) {
+				printf("batch size must be positive\n");
+				exit(1);
+			}
+			break;
 		case 'T':
 			if (!set_test_opt(optarg))
 				break;
@@ -553,6 +670,7 @@ int main(int argc, char **argv)
 			printf("\t[-C transfer_count]\n");
 			printf("\t[-S transfer_size]\n");
 			printf("\t[-p port_number]\n");
+			printf("\t[-M messages_per_call]\n");
 			printf("\t[-T test_option]\n");
 			printf("\t    s|sockets - use standard tcp/ip sockets\n");
 			printf("\t    a|async - asynchronous operation (use poll)\n");
@@ -566,6 +684,9 @@ int main(int argc, char **argv)
 	if (flags)
 		poll_timeout = -1;
 
+	if (batch && alloc_batch())
+		exit(1);
+
 	ret = dst_addr ? client_run() : svr_run();
 	return ret;
 }
@@ -38,6 +38,8 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <stdarg.h>
 #include <dlfcn.h>
 #include <netdb.h>
@@ -50,12 +52,15 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#include <signal.h>
 
 #include <sys/uio.h>
 
 #include <rdma/rdma_cma.h>
 #include <rdma/rdma_verbs.h>
 #include <rdma/rsocket.h>
+#include <ccan/list.h>
 #include "cma.h"
 #include "indexer.h"
 
@@ -75,6 +80,10 @@ struct socket_calls {
 	ssize_t (*sendto)(int socket, const void *buf, size_t len, int flags,
 			  const struct sockaddr *dest_addr, socklen_t addrlen);
 	ssize_t (*sendmsg)(int socket, const struct msghdr *msg, int flags);
+	int (*recvmmsg)(int socket, struct mmsghdr *msgvec, unsigned int vlen,
+			int flags, struct timespec *timeout);
+	int (*sendmmsg)(int socket, struct mmsghdr *msgvec, unsigned int vlen,
+			int flags);
 	ssize_t (*write)(int socket, const void *buf, size_t count);
 	ssize_t (*writev)(int socket, const struct iovec *iov, int iovcnt);
 	int (*poll)(struct pollfd *fds, nfds_t nfds, int timeout);
@@ -90,6 +99,10 @@ struct socket_calls {
 	int (*dup2)(int oldfd, int newfd);
 	ssize_t (*sendfile)(int out_fd, int in_fd, off_t *offset, size_t count);
 	int (*fxstat)(int ver, int fd, struct stat *buf);
+	int (*epoll_create1)(int flags);
+	int (*epoll_ctl)(int epfd, int op, int fd, struct epoll_event *event);
+	int (*epoll_wait)(int epfd, struct epoll_event *events,
+			  int maxevents, int timeout);
 };
 
 static struct socket_calls real;
@@ -105,7 +118,8 @@ static int fork_support;
 
 enum fd_type {
 	fd_normal,
-	fd_rsocket
+	fd_rsocket,
+	fd_epoll
 };
 
 enum fd_fork_state {
@@ -116,12 +130,16 @@ enum fd_fork_state {
 	fd_fork_passive
 };
 
+struct ep_set;
+
 struct fd_info {
 	enum fd_type type;
 	enum fd_fork_state state;
 	int fd;
 	int dupfd;
 	_Atomic(int) refcnt;
+	_Atomic(unsigned int) io_seq;	/* see ep_item */
+	struct ep_set *eps;		/* fd_epoll only */
 };
 
 struct config_entry {
@@ -333,6 +351,19 @@ static inline enum fd_type fd_gett(int index)
 	return fdi ? fdi->type : fd_normal;
 }
 
+/*
+ * Record that the application performed I/O on an rsocket.  Used to
+ * emulate EPOLLET, see ep_item.  Lost updates are harmless, since we only
+ * check whether the value has changed.
+ */
+static inline void fd_io_done(struct fd_info *fdi)
+{
+	atomic_store_explicit(&fdi->io_seq,
+			      atomic_load_explicit(&fdi->io_seq,
+						   memory_order_relaxed) + 1,
+			      memory_order_relaxed);
+}
+
 static enum fd_type fd_close(int index, int *fd)
 {
 	struct fd_info *fdi;
@@ -398,6 +429,8 @@ static void init_preload(void)
 	real.send = dlsym(RTLD_NEXT, "send");
 	real.sendto = dlsym(RTLD_NEXT, "sendto");
 	real.sendmsg = dlsym(RTLD_NEXT, "sendmsg");
+	real.recvmmsg = dlsym(RTLD_NEXT, "recvmmsg");
+	real.sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
 	real.write = dlsym(RTLD_NEXT, "write");
 	real.writev = dlsym(RTLD_NEXT, "writev");
 	real.poll = dlsym(RTLD_NEXT, "poll");
@@ -411,6 +444,9 @@ static void init_preload(void)
 	real.dup2 = dlsym(RTLD_NEXT, "dup2");
 	real.sendfile = dlsym(RTLD_NEXT, "sendfile");
 	real.fxstat = dlsym(RTLD_NEXT, "__fxstat");
+	real.epoll_create1 = dlsym(RTLD_NEXT, "epoll_create1");
+	real.epoll_ctl = dlsym(RTLD_NEXT, "epoll_ctl");
+	real.epoll_wait = dlsym(RTLD_NEXT, "epoll_wait");
 
 	rs.socket = dlsym(RTLD_DEFAULT, "rsocket");
 	rs.bind = dlsym(RTLD_DEFAULT, "rbind");
@@ -425,6 +461,8 @@ static void init_preload(void)
 	rs.send = dlsym(RTLD_DEFAULT, "rsend");
 	rs.sendto = dlsym(RTLD_DEFAULT, "rsendto");
 	rs.sendmsg = dlsym(RTLD_DEFAULT, "rsendmsg");
+	rs.recvmmsg = dlsym(RTLD_DEFAULT, "rrecvmmsg");
+	rs.sendmmsg = dlsym(RTLD_DEFAULT, "rsendmmsg");
 	rs.write = dlsym(RTLD_DEFAULT, "rwrite");
 	rs.writev = dlsym(RTLD_DEFAULT, "rwritev");
 	rs.poll = dlsym(RTLD_DEFAULT, "rpoll");
@@ -600,6 +638,7 @@ int accept(int socket, struct sockaddr *addr, socklen_t *addrlen)
 			return ret;
 		}
 
+		fd_io_done(idm_lookup(&idm, socket));
 		fd_store(index, ret, fd_rsocket, fd_ready);
 		return index;
 	} else if (fd_gets(socket) == fd_fork_listen) {
@@ -755,6 +794,8 @@ static inline enum fd_type fd_fork_get(int index, int *fd)
 			fork_passive(index);
 		else if (fdi->state == fd_fork_active)
 			fork_active(index);
+		if (fdi->type == fd_rsocket)
+			fd_io_done(fdi);
 		*fd = fdi->fd;
 		return fdi->type;
 
@@ -809,6 +850,15 @@ ssize_t recvmsg(int socket, struct msghdr *msg, int flags)
 		rrecvmsg(fd, msg, flags) : real.recvmsg(fd, msg, flags);
 }
 
+int recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen,
+	     int flags, struct timespec *timeout)
+{
+	int fd;
+	return (fd_fork_get(socket, &fd) == fd_rsocket) ?
+		rrecvmmsg(fd, msgvec, vlen, flags, timeout) :
+		real.recvmmsg(fd, msgvec, vlen, flags, timeout);
+}
+
 ssize_t read(int socket, void *buf, size_t count)
 {
 	int fd;
@@ -848,6 +898,14 @@ ssize_t sendmsg(int socket, const struct msghdr *msg, int flags)
 		rsendmsg(fd, msg, flags) : real.sendmsg(fd, msg, flags);
 }
 
+int sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	int fd;
+	return (fd_fork_get(socket, &fd) == fd_rsocket) ?
+		rsendmmsg(fd, msgvec, vlen, flags) :
+		real.sendmmsg(fd, msgvec, vlen, flags);
+}
+
 ssize_t write(int socket, const void *buf, size_t count)
 {
 	int fd;
@@ -992,6 +1050,537 @@ int select(int nfds, fd_set *readfds, fd_set *writefds,
 	return ret;
 }
 
+/*
+ * epoll support
+ *
+ * The kernel cannot report events on rsockets, so each epoll set tracks
+ * its rsockets in user space, while normal fd's are handed to the kernel
+ * epoll fd as usual.  epoll_wait() passes the rsockets, together with the
+ * kernel epoll fd, to rpoll(), which arms the rsocket CQ channels and
+ * checks rsocket readiness.  If the kernel epoll fd is reported readable,
+ * the kernel events are collected without blocking.  Sets which do not
+ * contain any rsockets go directly to the kernel.
+ *
+ * Each set owns an eventfd that is registered with the kernel epoll fd.
+ * It is signaled when the rsocket membership changes, so that threads
+ * blocked in epoll_wait() pick up the change.  Its events are never
+ * returned to the user.
+ *
+ * Edge triggered rsockets are reported once when they become ready.  They
+ * are not reported again until the application performs I/O on the
+ * rsocket, which is what EPOLLET requires of the application before it
+ * waits again.  Nesting epoll sets that contain rsockets is not supported.
+ *
+ * All sets are kept on a global list, protected by mut, so that closing
+ * an rsocket removes it from every set, as the kernel does for normal fd's.
+ */
+struct ep_item {
+	int fd;				/* user fd */
+	int pos;			/* index into ep_set items */
+	struct epoll_event event;
+	int disabled;			/* EPOLLONESHOT has fired */
+	int reported;			/* EPOLLET events are latched */
+	unsigned int io_seq;		/* fd_info io_seq when latched */
+};
+
+struct ep_set {
+	struct list_node entry;		/* on ep_sets */
+	pthread_mutex_t lock;
+	struct index_map item_map;
+	struct ep_item **items;
+	int cnt;
+	int size;
+	int next;
+	int waiters;
+	int sigfd;
+};
+
+static LIST_HEAD(ep_sets);
+
+/*
+ * Tag reported for the set's eventfd.  It is mixed with the set address,
+ * so that it is unlikely to match the data of any user registration.
+ */
+#define EP_SIG_TAG 0x727370656673696eULL
+
+static uint64_t ep_sig_data(struct ep_set *eps)
+{
+	return EP_SIG_TAG ^ (uintptr_t) eps;
+}
+
+static void ep_free(struct ep_set *eps)
+{
+	int i;
+
+	if (!eps)
+		return;
+
+	for (i = 0; i < eps->cnt; i++)
+		free(eps->items[i]);
+	for (i = 0; i < IDX_ARRAY_SIZE; i++)
+		free(eps->item_map.array[i]);
+	if (eps->sigfd >= 0)
+		real.close(eps->sigfd);
+	pthread_mutex_destroy(&eps->lock);
+	free(eps->items);
+	free(eps);
+}
+
+static struct ep_set *ep_alloc(int epfd)
+{
+	struct epoll_event event;
+	struct ep_set *eps;
+
+	eps = calloc(1, sizeof(*eps));
+	if (!eps)
+		return NULL;
+
+	pthread_mutex_init(&eps->lock, NULL);
+	eps->sigfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (eps->sigfd < 0)
+		goto err;
+
+	event.events = EPOLLIN;
+	event.data.u64 = ep_sig_data(eps);
+	if (real.epoll_ctl(epfd, EPOLL_CTL_ADD, eps->sigfd, &event))
+		goto err;
+
+	return eps;
+
+err:
+	ep_free(eps);
+	return NULL;
+}
+
+/* Caller must hold eps->lock */
+static void ep_signal(struct ep_set *eps)
+{
+	uint64_t c = 1;
+	ssize_t __attribute__((unused)) ret;
+
+	if (eps->waiters)
+		ret = real.write(eps->sigfd, &c, sizeof c);
+}
+
+static int ep_insert(struct ep_set *eps, int fd, struct epoll_event *event)
+{
+	struct ep_item *item, **items;
+	int size;
+
+	if (eps->cnt == eps->size) {
+		size = eps->size ? eps->size * 2 : 16;
+		items = realloc(eps->items, size * sizeof(*items));
+		if (!items)
+			return ERR(ENOMEM);
+		eps->items = items;
+		eps->size = size;
+	}
+
+	item = calloc(1, sizeof(*item));
+	if (!item)
+		return ERR(ENOMEM);
+
+	if (idm_set(&eps->item_map, fd, item) < 0) {
+		free(item);
+		return -1;
+	}
+
+	item->fd = fd;
+	item->event = *event;
+	item->pos = eps->cnt;
+	eps->items[eps->cnt++] = item;
+	ep_signal(eps);
+	return 0;
+}
+
+static void ep_remove(struct ep_set *eps, struct ep_item *item)
+{
+	idm_clear(&eps->item_map, item->fd);
+	eps->items[item->pos] = eps->items[--eps->cnt];
+	eps->items[item->pos]->pos = item->pos;
+	free(item);
+}
+
+/* Caller must hold mut */
+static void ep_forget(int fd)
+{
+	struct ep_item *item;
+	struct ep_set *eps;
+
+	list_for_each(&ep_sets, eps, entry) {
+		pthread_mutex_lock(&eps->lock);
+		item = idm_lookup(&eps->item_map, fd);
+		if (item) {
+			ep_remove(eps, item);
+			ep_signal(eps);
+		}
+		pthread_mutex_unlock(&eps->lock);
+	}
+}
+
+static int ep_ctl(struct ep_set *eps, int op, int fd, struct epoll_event *event)
+{
+	struct ep_item *item;
+	int ret = 0;
+
+	if (op != EPOLL_CTL_DEL && !event)
+		return ERR(EFAULT);
+
+	pthread_mutex_lock(&eps->lock);
+	item = idm_lookup(&eps->item_map, fd);
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		ret = item ? ERR(EEXIST) : ep_insert(eps, fd, event);
+		break;
+	case EPOLL_CTL_MOD:
+		if (!item) {
+			ret = ERR(ENOENT);
+			break;
+		}
+		item->event = *event;
+		item->disabled = 0;
+		item->reported = 0;
+		ep_signal(eps);
+		break;
+	case EPOLL_CTL_DEL:
+		if (item)
+			ep_remove(eps, item);
+		else
+			ret = ERR(ENOENT);
+		break;
+	default:
+		ret = ERR(EINVAL);
+		break;
+	}
+	pthread_mutex_unlock(&eps->lock);
+	return ret;
+}
+
+/*
+ * An rsocket may have been closed, or converted to a normal socket
+ * (e.g. after rconnect falls back to TCP), since it was added.  Move
+ * converted sockets into the kernel set.
+ */
+static int ep_item_valid(struct ep_set *eps, int epfd, struct ep_item *item)
+{
+	struct fd_info *fdi;
+
+	fdi = idm_lookup(&idm, item->fd);
+	if (fdi && fdi->type == fd_rsocket)
+		return 1;
+
+	if (fdi && fdi->type == fd_normal)
+		real.epoll_ctl(epfd, EPOLL_CTL_ADD, fdi->fd, &item->event);
+	ep_remove(eps, item);
+	return 0;
+}
+
+static int ep_item_latched(struct ep_item *item)
+{
+	struct fd_info *fdi;
+
+	if (!item->reported)
+		return 0;
+
+	fdi = idm_lookup(&idm, item->fd);
+	if (fdi && atomic_load_explicit(&fdi->io_seq, memory_order_relaxed) ==
+		   item->io_seq)
+		return 1;
+
+	item->reported = 0;
+	return 0;
+}
+
+static int *ep_fds_alloc(int nfds)
+{
+	static __thread int *efds;
+	static __thread int enfds;
+
+	if (nfds > enfds) {
+		if (efds)
+			free(efds);
+
+		efds = malloc(sizeof(*efds) * nfds);
+		enfds = efds ? nfds : 0;
+	}
+
+	return efds;
+}
+
+/* Remove the set's eventfd from the kernel results */
+static int ep_filter(struct ep_set *eps, struct epoll_event *events, int cnt)
+{
+	uint64_t c;
+	ssize_t __attribute__((unused)) ret;
+	int i, j;
+
+	for (i = j = 0; i < cnt; i++) {
+		if (events[i].data.u64 == ep_sig_data(eps)) {
+			ret = real.read(eps->sigfd, &c, sizeof c);
+			continue;
+		}
+		if (i != j)
+			events[j] = events[i];
+		j++;
+	}
+	return j;
+}
+
+static int ep_wait_kernel(struct ep_set *eps, int epfd,
+			  struct epoll_event *events, int maxevents, int timeout)
+{
+	int ret;
+
+	ret = real.epoll_wait(epfd, events, maxevents, timeout);
+	if (ret <= 0)
+		return ret;
+
+	return ep_filter(eps, events, ret);
+}
+
+static int ep_wait_rs(struct ep_set *eps, int epfd, struct epoll_event *events,
+		      int maxevents, int timeout)
+{
+	struct ep_item *item;
+	struct fd_info *fdi;
+	struct pollfd *fds;
+	uint32_t revents;
+	int *efds;
+	int i, n, cnt, ret;
+
+	pthread_mutex_lock(&eps->lock);
+	fds = fds_alloc(eps->cnt + 1);
+	efds = ep_fds_alloc(eps->cnt);
+	if (!fds || !efds) {
+		pthread_mutex_unlock(&eps->lock);
+		return ERR(ENOMEM);
+	}
+
+	for (i = eps->cnt - 1; i >= 0; i--)
+		ep_item_valid(eps, epfd, eps->items[i]);
+
+	/* Rotate the starting item, so that all rsockets get reported */
+	if (eps->next >= eps->cnt)
+		eps->next = 0;
+	for (i = eps->next++, n = 0, cnt = eps->cnt; cnt; cnt--) {
+		item = eps->items[i];
+		if (!item->disabled && !ep_item_latched(item)) {
+			efds[n] = item->fd;
+			fds[n].fd = fd_getd(item->fd);
+			fds[n].events = item->event.events &
+					(EPOLLIN | EPOLLOUT | EPOLLPRI);
+			fds[n++].revents = 0;
+		}
+		if (++i == eps->cnt)
+			i = 0;
+	}
+	fds[n].fd = epfd;
+	fds[n].events = POLLIN;
+	fds[n].revents = 0;
+	eps->waiters++;
+	pthread_mutex_unlock(&eps->lock);
+
+	ret = rpoll(fds, n + 1, timeout);
+
+	pthread_mutex_lock(&eps->lock);
+	eps->waiters--;
+	if (ret <= 0)
+		goto out;
+
+	for (i = 0, cnt = 0; i < n && cnt < maxevents; i++) {
+		if (!fds[i].revents)
+			continue;
+
+		/* The item may have been changed while we were polling */
+		item = idm_lookup(&eps->item_map, efds[i]);
+		if (!item || item->disabled || item->reported)
+			continue;
+
+		revents = fds[i].revents &
+			  (item->event.events | EPOLLERR | EPOLLHUP);
+		if (!revents)
+			continue;
+
+		events[cnt].events = revents;
+		events[cnt++].data = item->event.data;
+
+		if (item->event.events & EPOLLONESHOT) {
+			item->disabled = 1;
+		} else if (item->event.events & EPOLLET) {
+			fdi = idm_lookup(&idm, item->fd);
+			if (fdi) {
+				item->reported = 1;
+				item->io_seq = atomic_load_explicit(
+					&fdi->io_seq, memory_order_relaxed);
+			}
+		}
+	}
+	pthread_mutex_unlock(&eps->lock);
+
+	if ((fds[n].revents & POLLIN) && cnt < maxevents) {
+		ret = ep_wait_kernel(eps, epfd, events + cnt, maxevents - cnt, 0);
+		if (ret > 0)
+			cnt += ret;
+	}
+	return cnt;
+
+out:
+	pthread_mutex_unlock(&eps->lock);
+	return ret;
+}
+
+/*
+ * Sets without rsockets wait in the kernel.  The waiter is counted while
+ * it blocks, so that adding the first rsocket signals it to switch to
+ * rpoll.
+ */
+static int ep_wait(struct ep_set *eps, int epfd, struct epoll_event *events,
+		   int maxevents, int timeout)
+{
+	int ret;
+
+	pthread_mutex_lock(&eps->lock);
+	if (eps->cnt) {
+		pthread_mutex_unlock(&eps->lock);
+		return ep_wait_rs(eps, epfd, events, maxevents, timeout);
+	}
+	eps->waiters++;
+	pthread_mutex_unlock(&eps->lock);
+
+	ret = ep_wait_kernel(eps, epfd, events, maxevents, timeout);
+
+	pthread_mutex_lock(&eps->lock);
+	eps->waiters--;
+	pthread_mutex_unlock(&eps->lock);
+	return ret;
+}
+
+static uint64_t ep_time_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int epoll_create1(int flags)
+{
+	struct fd_info *fdi;
+	int epfd, ret;
+
+	init_preload();
+	epfd = real.epoll_create1(flags);
+	if (epfd < 0)
+		return epfd;
+
+	fdi = calloc(1, sizeof(*fdi));
+	if (!fdi)
+		goto err1;
+
+	fdi->eps = ep_alloc(epfd);
+	if (!fdi->eps)
+		goto err2;
+
+	fdi->fd = epfd;
+	fdi->type = fd_epoll;
+	fdi->dupfd = -1;
+	atomic_store(&fdi->refcnt, 1);
+	pthread_mutex_lock(&mut);
+	ret = idm_set(&idm, epfd, fdi);
+	if (ret >= 0)
+		list_add_tail(&ep_sets, &fdi->eps->entry);
+	pthread_mutex_unlock(&mut);
+	if (ret < 0)
+		goto err3;
+
+	return epfd;
+
+err3:
+	ep_free(fdi->eps);
+err2:
+	free(fdi);
+err1:
+	real.close(epfd);
+	return ERR(ENOMEM);
+}
+
+int epoll_create(int size)
+{
+	if (size <= 0)
+		return ERR(EINVAL);
+
+	return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	struct fd_info *fdi;
+	int rfd;
+
+	init_preload();
+	fdi = idm_lookup(&idm, epfd);
+	if (!fdi || fdi->type != fd_epoll)
+		return real.epoll_ctl(epfd, op, fd_getd(fd), event);
+
+	if (fd_get(fd, &rfd) == fd_rsocket)
+		return ep_ctl(fdi->eps, op, fd, event);
+
+	return real.epoll_ctl(fdi->fd, op, rfd, event);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct fd_info *fdi;
+	uint64_t start_time = 0;
+	int ret, wait;
+
+	init_preload();
+	fdi = idm_lookup(&idm, epfd);
+	if (!fdi || fdi->type != fd_epoll)
+		return real.epoll_wait(epfd, events, maxevents, timeout);
+
+	if (maxevents <= 0)
+		return ERR(EINVAL);
+
+	if (timeout > 0)
+		start_time = ep_time_ms();
+
+	/*
+	 * Wakeups caused by changes to the set, or by rsocket events that
+	 * are not reported to the user, return 0.  Keep waiting until the
+	 * timeout expires.
+	 */
+	for (wait = timeout;;) {
+		ret = ep_wait(fdi->eps, fdi->fd, events, maxevents, wait);
+		if (ret || !timeout)
+			return ret;
+
+		if (timeout > 0) {
+			wait = timeout - (int) (ep_time_ms() - start_time);
+			if (wait <= 0)
+				return 0;
+		}
+	}
+}
+
+int epoll_pwait(int epfd, struct epoll_event *events, int maxevents,
+		int timeout, const sigset_t *sigmask)
+{
+	sigset_t origmask;
+	int ret;
+
+	/*
+	 * rpoll does not support a signal mask, so this is not atomic with
+	 * respect to signal delivery.
+	 */
+	if (sigmask)
+		pthread_sigmask(SIG_SETMASK, sigmask, &origmask);
+	ret = epoll_wait(epfd, events, maxevents, timeout);
+	if (sigmask)
+		pthread_sigmask(SIG_SETMASK, &origmask, NULL);
+	return ret;
+}
+
 int shutdown(int socket, int how)
 {
 	int fd;
@@ -1019,6 +1608,25 @@ int close(int socket)
 		return 0;
 
 	idm_clear(&idm, socket);
+	if (fdi->type == fd_epoll) {
+		/* The epoll fd is used directly as the index */
+		if (fdi->dupfd == -1) {
+			pthread_mutex_lock(&mut);
+			list_del(&fdi->eps->entry);
+			pthread_mutex_unlock(&mut);
+			ep_free(fdi->eps);
+		}
+		free(fdi);
+		return real.close(socket);
+	}
+
+	/* The fd number may be reused once it is closed */
+	if (fdi->type == fd_rsocket) {
+		pthread_mutex_lock(&mut);
+		ep_forget(socket);
+		pthread_mutex_unlock(&mut);
+	}
+
 	real.close(socket);
 	ret = (fdi->type == fd_rsocket) ? rclose(fdi->fd) : real.close(fdi->fd);
 	free(fdi);
@@ -1141,6 +1749,7 @@ int dup2(int oldfd, int newfd)
 
 	newfdi->fd = oldfdi->fd;
 	newfdi->type = oldfdi->type;
+	newfdi->eps = oldfdi->eps;
 	if (oldfdi->dupfd != -1) {
 		newfdi->dupfd = oldfdi->dupfd;
 		oldfdi = idm_lookup(&idm, oldfdi->dupfd);
@@ -650,6 +650,36 @@ int rdma_get_cm_event(struct rdma_event_channel *channel,
  */
 int rdma_ack_cm_event(struct rdma_cm_event *event);
 
+/**
+ * rdma_get_cm_events - Retrieves a batch of pending communication events.
+ * @channel: Event channel to check for events.
+ * @events: Array receiving up to num events.
+ * @num: Maximum number of events to retrieve.
+ * Description:
+ *   Retrieves communication events the same way as rdma_get_cm_event.  Only
+ *   the first event is waited for, further events are returned only if they
+ *   are already pending.  Returns the number of events retrieved, or -1 on
+ *   error.
+ * Notes:
+ *   Each returned event must be acknowledged by calling rdma_ack_cm_event or
+ *   rdma_ack_cm_events.
+ * See also:
+ *   rdma_get_cm_event, rdma_ack_cm_events
+ */
+int rdma_get_cm_events(struct rdma_event_channel *channel,
+		       struct rdma_cm_event **events, int num);
+
+/**
+ * rdma_ack_cm_events - Free a batch of communication events.
+ * @events: Events to be released.
+ * @num: Number of events in the array.
+ * Description:
+ *   Releases each event as rdma_ack_cm_event would.
+ * See also:
+ *   rdma_get_cm_events, rdma_ack_cm_event
+ */
+int rdma_ack_cm_events(struct rdma_cm_event **events, int num);
+
 __be16 rdma_get_src_port(struct rdma_cm_id *id);
 __be16 rdma_get_dst_port(struct rdma_cm_id *id);
 
@@ -43,11 +43,12 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <netinet/tcp.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <sys/eventfd.h>
-#include <search.h>
 #include <time.h>
 #include <byteswap.h>
 #include <util/compiler.h>
@@ -68,6 +69,14 @@
 #define RS_QP_CTRL_SIZE 4	/* must be power of 2 */
 #define RS_CONN_RETRIES 6
 #define RS_SGL_SIZE 2
+#define RS_ZCOPY_MR_CNT 8
+#define RS_SHARED_SLAB_SIZE (1 << 22)
+#define RS_SHARED_CQ_SIZE (1 << 16)
+#define RS_SHARED_SRQ_SIZE 4096
+#define RS_SHARED_HASH_SIZE 1024
+#define RS_SHARED_POLL_BATCH 16
+#define DS_MMSG_BATCH 32
+#define DS_DEST_TABLE_SIZE 64
 static struct index_map idm;
 static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t svc_mut = PTHREAD_MUTEX_INITIALIZER;
@@ -127,6 +136,7 @@ static struct rs_svc connect_svc = {
 static uint32_t pollcnt;
 static bool suspendpoll;
 static int pollsignal = -1;
+static _Atomic(uint32_t) poll_id;
 
 static uint16_t def_iomap_size = 0;
 static uint16_t def_inline = 64;
@@ -135,6 +145,8 @@ static uint16_t def_rqsize = 384;
 static uint32_t def_mem = (1 << 17);
 static uint32_t def_wmem = (1 << 17);
 static uint32_t polling_time = 10;
+static int def_shared;
+static uint32_t def_ah_cache = 4096;
 static int wake_up_interval = 5000;
 
 /*
@@ -169,10 +181,12 @@ enum {
 
 #define RS_WR_ID_FLAG_RECV (((uint64_t) 1) << 63)
 #define RS_WR_ID_FLAG_MSG_SEND (((uint64_t) 1) << 62) /* See RS_OPT_MSG_SEND */
+#define RS_WR_ID_FLAG_ZCOPY (((uint64_t) 1) << 61) /* sent from user buffer */
 #define rs_send_wr_id(data) ((uint64_t) data)
 #define rs_recv_wr_id(data) (RS_WR_ID_FLAG_RECV | (uint64_t) data)
 #define rs_wr_is_recv(wr_id) (wr_id & RS_WR_ID_FLAG_RECV)
 #define rs_wr_is_msg_send(wr_id) (wr_id & RS_WR_ID_FLAG_MSG_SEND)
+#define rs_wr_is_zcopy(wr_id) (wr_id & RS_WR_ID_FLAG_ZCOPY)
 #define rs_wr_data(wr_id) ((uint32_t) wr_id)
 
 enum {
@@ -296,10 +310,25 @@ struct ds_header {
 #define DS_IPV6_HDR_LEN 24
 
 struct ds_dest {
-	union socket_addr addr;	/* must be first */
+	union socket_addr addr;
 	struct ds_qp	  *qp;
 	struct ibv_ah	  *ah;
 	uint32_t	   qpn;
+	_Atomic(struct ds_dest *) next;	/* hash chain */
+	dlist_entry	   lru;		/* AH cache, protected by slock */
+};
+
+/*
+ * Destinations are looked up without locks.  Entries are only added,
+ * under map_lock, until the rsocket is closed.  When the table grows,
+ * entries move to the new table and the old one is kept around, so a
+ * reader may miss an entry, but never follows a freed pointer.  A miss
+ * is always retried under map_lock.
+ */
+struct ds_dest_table {
+	struct ds_dest_table	  *retired;
+	uint32_t		  mask;
+	_Atomic(struct ds_dest *) bucket[];
 };
 
 struct ds_qp {
@@ -316,6 +345,85 @@ struct ds_qp {
 	int		  cq_armed;
 };
 
+/*
+ * Resources shared by the stream rsockets on one device when RDMA_SHARED
+ * is set.  Buffers are carved from large slabs and returned to per size
+ * free lists when a socket closes.  Slabs are only registered for local
+ * access; buffers the peer writes to get an MR of their own.  Completions
+ * for all of the sockets are read from a few shared CQs and queued to the
+ * owning socket, which is found from the QP number.  Receive credits are
+ * backed by a single SRQ of zero length receives, which is divided
+ * between the sockets.
+ */
+struct rs_slab {
+	struct rs_slab	  *next;
+	struct ibv_mr	  *mr;
+	uint8_t		  *buf;
+	size_t		  size;
+	size_t		  used;
+	int		  bufs; /* buffers handed out */
+};
+
+/* Stored at the start of a free buffer */
+struct rs_free_buf {
+	struct rs_free_buf *next;
+	struct rs_slab	  *slab;
+};
+
+struct rs_buf_list {
+	struct rs_buf_list *next;
+	size_t		  size;
+	struct rs_free_buf *head;
+};
+
+/*
+ * Receive buffer space handed out by rrecv_borrow, in ring order.  Space
+ * is only returned to the peer once everything before it was released.
+ */
+struct rs_borrow {
+	int		  offset; /* -1 for data copied out by rrecv */
+	uint32_t	  length;
+	int		  released;
+};
+
+/* Completion as queued to the owning rsocket */
+struct rs_wc {
+	uint64_t	  wr_id;
+	__be32		  imm_data;
+	uint8_t		  status;
+	uint8_t		  with_imm;
+};
+
+struct rs_shared_dev;
+
+struct rs_shared_cq {
+	struct rs_shared_cq *next;
+	struct rs_shared_dev *dev;
+	struct ibv_cq	  *cq;
+	pthread_mutex_t	  lock; /* serializes polling and qp_hash */
+	int		  cqe_avail;
+	struct rsocket	  *qp_hash[RS_SHARED_HASH_SIZE];
+};
+
+struct rs_shared_dev {
+	struct rs_shared_dev *next;
+	struct ibv_context *verbs;
+	struct ibv_pd	  *pd;
+	struct ibv_comp_channel *channel;
+	struct ibv_srq	  *srq;
+	int		  srq_size;
+	int		  srq_avail; /* receives not backing any socket's credits */
+	int		  max_cqe;
+	pthread_t	  thread;
+	pthread_mutex_t	  lock; /* protects the lists below */
+	struct rs_shared_cq *cq_list;
+	struct rs_slab	  *slab_list;
+	struct rs_buf_list *buf_list;
+};
+
+static struct rs_shared_dev *shared_dev_list;
+static pthread_mutex_t shared_mut = PTHREAD_MUTEX_INITIALIZER;
+
 struct rsocket {
 	int		  type;
 	int		  index;
@@ -357,16 +465,36 @@ struct rsocket {
 			int		  rbuf_offset;
 			struct ibv_mr	  *rmr;
 			uint8_t		  *rbuf;
+			struct rs_borrow  *borrow;
+			int		  borrow_head;
+			int		  borrow_tail;
 
 			int		  sbuf_bytes_avail;
 			struct ibv_mr	  *smr;
 			struct ibv_sge	  ssgl[2];
+
+			uint32_t	  zcopy_size;
+			int		  zcopy_pending;
+			struct ibv_mr	  *zcopy_mr[RS_ZCOPY_MR_CNT];
+
+			int		  shared;
+			struct rs_shared_cq *scq;
+			struct rsocket	  *shared_next;
+			int		  shared_fd;
+			_Atomic(int)	  shared_armed;
+			struct rs_wc	  *wcq;
+			unsigned int	  wcq_size;
+			_Atomic(unsigned int) wcq_head;
+			_Atomic(unsigned int) wcq_tail;
 		};
 		/* datagram */
 		struct {
 			struct ds_qp	  *qp_list;
-			void		  *dest_map;
+			_Atomic(struct ds_dest_table *) dest_table;
+			uint32_t	  dest_cnt;
 			struct ds_dest    *conn_dest;
+			dlist_entry	  ah_lru;
+			uint32_t	  ah_cnt;
 
 			int		  udp_sock;
 			int		  epfd;
@@ -375,6 +503,9 @@ struct rsocket {
 		};
 	};
 
+	uint32_t	  poll_id;
+	_Atomic(uint32_t) poll_seq;
+
 	int		  opts;
 	int		  fd_flags;
 	uint64_t	  so_opts;
@@ -450,6 +581,28 @@ static uint64_t rs_time_us(void)
 	return now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
+/*
+ * The epoll sets used internally are private to rsockets.  Issue the
+ * system calls directly, so that they do not reach the epoll emulation
+ * when the preload library interposes on the libc wrappers.
+ */
+static int rs_epoll_create1(int flags)
+{
+	return syscall(SYS_epoll_create1, flags);
+}
+
+static int rs_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+static int rs_epoll_wait(int epfd, struct epoll_event *events,
+			 int maxevents, int timeout)
+{
+	return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout,
+		       NULL, 0);
+}
+
 static void ds_insert_qp(struct rsocket *rs, struct ds_qp *qp)
 {
 	if (!rs->qp_list)
@@ -518,6 +671,168 @@ static int ds_compare_addr(const void *dst1, const void *dst2)
 	return memcmp(dst1, dst2, len);
 }
 
+/* Only hash fields that ds_compare_addr() also compares */
+static uint32_t ds_hash_addr(const struct sockaddr *addr)
+{
+	const union socket_addr *sa = (const union socket_addr *) addr;
+	uint32_t hash;
+
+	if (addr->sa_family == AF_INET6) {
+		hash = sa->sin6.sin6_addr.s6_addr32[0] ^
+		       sa->sin6.sin6_addr.s6_addr32[1] ^
+		       sa->sin6.sin6_addr.s6_addr32[2] ^
+		       sa->sin6.sin6_addr.s6_addr32[3];
+		hash ^= (uint32_t) sa->sin6.sin6_port << 16;
+	} else {
+		hash = sa->sin.sin_addr.s_addr ^
+		       ((uint32_t) sa->sin.sin_port << 16);
+	}
+	hash *= 0x9E3779B1;
+	return hash ^ (hash >> 16);
+}
+
+static struct ds_dest *ds_find_dest(struct rsocket *rs,
+				    const struct sockaddr *addr)
+{
+	struct ds_dest_table *table;
+	struct ds_dest *dest;
+
+	table = atomic_load_explicit(&rs->dest_table, memory_order_acquire);
+	if (!table)
+		return NULL;
+
+	dest = atomic_load_explicit(&table->bucket[ds_hash_addr(addr) & table->mask],
+				    memory_order_acquire);
+	for (; dest; dest = atomic_load_explicit(&dest->next, memory_order_acquire)) {
+		if (!ds_compare_addr(addr, &dest->addr))
+			return dest;
+	}
+	return NULL;
+}
+
+static int ds_grow_dest_table(struct rsocket *rs)
+{
+	struct ds_dest_table *old, *table;
+	struct ds_dest *dest, *next;
+	uint32_t i, size, idx;
+
+	old = atomic_load_explicit(&rs->dest_table, memory_order_relaxed);
+	size = old ? (old->mask + 1) << 1 : DS_DEST_TABLE_SIZE;
+	table = calloc(1, sizeof(*table) + sizeof(table->bucket[0]) * size);
+	if (!table)
+		return ERR(ENOMEM);
+
+	table->mask = size - 1;
+	table->retired = old;
+	for (i = 0; old && i <= old->mask; i++) {
+		dest = atomic_load_explicit(&old->bucket[i], memory_order_relaxed);
+		for (; dest; dest = next) {
+			next = atomic_load_explicit(&dest->next, memory_order_relaxed);
+			idx = ds_hash_addr(&dest->addr.sa) & table->mask;
+			atomic_store_explicit(&dest->next,
+				atomic_load_explicit(&table->bucket[idx],
+						     memory_order_relaxed),
+				memory_order_release);
+			atomic_store_explicit(&table->bucket[idx], dest,
+					      memory_order_relaxed);
+		}
+	}
+
+	atomic_store_explicit(&rs->dest_table, table, memory_order_release);
+	return 0;
+}
+
+/* map_lock must be held */
+static int ds_insert_dest(struct rsocket *rs, struct ds_dest *dest)
+{
+	struct ds_dest_table *table;
+	uint32_t idx;
+
+	table = atomic_load_explicit(&rs->dest_table, memory_order_relaxed);
+	if (!table || rs->dest_cnt > table->mask) {
+		if (ds_grow_dest_table(rs) && !table)
+			return -1;
+		table = atomic_load_explicit(&rs->dest_table, memory_order_relaxed);
+	}
+
+	idx = ds_hash_addr(&dest->addr.sa) & table->mask;
+	atomic_store_explicit(&dest->next,
+			      atomic_load_explicit(&table->bucket[idx],
+						   memory_order_relaxed),
+			      memory_order_relaxed);
+	atomic_store_explicit(&table->bucket[idx], dest, memory_order_release);
+	rs->dest_cnt++;
+	return 0;
+}
+
+/*
+ * Called on close, before the QPs are freed.  Destinations embedded in
+ * a QP are released with the QP.
+ */
+static void ds_free_dests(struct rsocket *rs)
+{
+	struct ds_dest_table *table, *retired;
+	struct ds_dest *dest, *next;
+	uint32_t i;
+
+	table = atomic_load_explicit(&rs->dest_table, memory_order_relaxed);
+	for (i = 0; table && i <= table->mask; i++) {
+		dest = atomic_load_explicit(&table->bucket[i], memory_order_relaxed);
+		for (; dest; dest = next) {
+			next = atomic_load_explicit(&dest->next, memory_order_relaxed);
+			if (dest == &dest->qp->dest)
+				continue;
+
+			if (dest->ah)
+				ibv_destroy_ah(dest->ah);
+			free(dest);
+		}
+	}
+
+	for (; table; table = retired) {
+		retired = table->retired;
+		free(table);
+	}
+}
+
+/* slock must be held */
+static void ds_release_ah(struct rsocket *rs, struct ds_dest *dest)
+{
+	ibv_destroy_ah(dest->ah);
+	dest->ah = NULL;
+	if (dest->lru.next) {
+		dlist_remove(&dest->lru);
+		dest->lru.next = NULL;
+		rs->ah_cnt--;
+	}
+}
+
+/*
+ * Address handles of remote destinations are cached, and the least
+ * recently used ones are destroyed once more than ah_cache_size exist.
+ * Every send moves its destination to the head of the LRU list, so the
+ * tail cannot be referenced by an outstanding send as long as more
+ * destinations than send queue entries are cached.  Sends to an evicted
+ * destination take the UDP path, which recreates its address handle.
+ */
+static void ds_evict_ahs(struct rsocket *rs)
+{
+	uint32_t max_ah = max_t(uint32_t, def_ah_cache, rs->sq_size + 1);
+
+	while (rs->ah_cnt > max_ah)
+		ds_release_ah(rs, container_of(rs->ah_lru.prev,
+					       struct ds_dest, lru));
+}
+
+/* slock must be held */
+static inline void ds_touch_dest(struct rsocket *rs, struct ds_dest *dest)
+{
+	if (dest->lru.next && rs->ah_lru.next != &dest->lru) {
+		dlist_remove(&dest->lru);
+		dlist_insert_head(&dest->lru, &rs->ah_lru);
+	}
+}
+
 static int rs_value_to_scale(int value, int bits)
 {
 	return value <= (1 << (bits - 1)) ?
@@ -603,6 +918,16 @@ static void rs_configure(void)
 		def_iomap_size = (uint8_t) rs_value_to_scale(
 			(uint16_t) rs_scale_to_value(def_iomap_size, 8), 8);
 	}
+
+	if ((f = fopen(RS_CONF_DIR "/shared_default", "r"))) {
+		failable_fscanf(f, "%d", &def_shared);
+		fclose(f);
+	}
+
+	if ((f = fopen(RS_CONF_DIR "/ah_cache_size", "r"))) {
+		failable_fscanf(f, "%u", &def_ah_cache);
+		fclose(f);
+	}
 	init = 1;
 out:
 	pthread_mutex_unlock(&mut);
@@ -634,9 +959,11 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 
 	rs->type = type;
 	rs->index = -1;
+	rs->poll_id = atomic_fetch_add(&poll_id, 1) + 1;
 	if (type == SOCK_DGRAM) {
 		rs->udp_sock = -1;
 		rs->epfd = -1;
+		dlist_init(&rs->ah_lru);
 	}
 
 	if (inherited_rs) {
@@ -648,6 +975,8 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 		if (type == SOCK_STREAM) {
 			rs->ctrl_max_seqno = inherited_rs->ctrl_max_seqno;
 			rs->target_iomap_size = inherited_rs->target_iomap_size;
+			rs->zcopy_size = inherited_rs->zcopy_size;
+			rs->shared = inherited_rs->shared;
 		}
 	} else {
 		rs->sbuf_size = def_wmem;
@@ -658,6 +987,7 @@ static struct rsocket *rs_alloc(struct rsocket *inherited_rs, int type)
 		if (type == SOCK_STREAM) {
 			rs->ctrl_max_seqno = RS_QP_CTRL_SIZE;
 			rs->target_iomap_size = def_iomap_size;
+			rs->shared = def_shared;
 		}
 	}
 	fastlock_init(&rs->slock);
@@ -676,7 +1006,9 @@ static int rs_set_nonblocking(struct rsocket *rs, int arg)
 	int ret = 0;
 
 	if (rs->type == SOCK_STREAM) {
-		if (rs->cm_id->recv_cq_channel)
+		if (rs->scq)
+			ret = fcntl(rs->shared_fd, F_SETFL, arg);
+		else if (rs->cm_id->recv_cq_channel)
 			ret = fcntl(rs->cm_id->recv_cq_channel->fd, F_SETFL, arg);
 
 		if (rs->state == rs_listening)
@@ -737,18 +1069,604 @@ static void ds_set_qp_size(struct rsocket *rs)
 		rs->sbuf_size = rs->sq_size * RS_SNDLOWAT;
 }
 
-static int rs_init_bufs(struct rsocket *rs)
+static size_t rs_sbuf_total(struct rsocket *rs)
+{
+	size_t len = rs->sbuf_size;
+
+	if (rs->sq_inline < RS_MAX_CTRL_MSG)
+		len += RS_MAX_CTRL_MSG * RS_QP_CTRL_SIZE;
+	return len;
+}
+
+static size_t rs_rbuf_total(struct rsocket *rs)
+{
+	size_t len = rs->rbuf_size;
+
+	if (rs->opts & RS_OPT_MSG_SEND)
+		len += rs->rq_size * RS_MSG_SIZE;
+	return len;
+}
+
+static size_t rs_target_len(struct rsocket *rs)
+{
+	return sizeof(*rs->target_sgl) * RS_SGL_SIZE +
+	       sizeof(*rs->target_iomap) * rs->target_iomap_size;
+}
+
+static struct rs_slab *rs_shared_alloc_slab(struct rs_shared_dev *dev,
+					    size_t size)
+{
+	struct rs_slab *slab;
+
+	slab = calloc(1, sizeof(*slab));
+	if (!slab)
+		return NULL;
+
+	slab->buf = calloc(size, 1);
+	if (!slab->buf)
+		goto err1;
+
+	slab->mr = ibv_reg_mr(dev->pd, slab->buf, size, IBV_ACCESS_LOCAL_WRITE);
+	if (!slab->mr)
+		goto err2;
+
+	slab->size = size;
+	slab->next = dev->slab_list;
+	dev->slab_list = slab;
+	return slab;
+
+err2:
+	free(slab->buf);
+err1:
+	free(slab);
+	return NULL;
+}
+
+/* Must be called with the device lock held */
+static void rs_shared_free_slab(struct rs_shared_dev *dev, struct rs_slab *slab)
+{
+	struct rs_free_buf **pfbuf;
+	struct rs_buf_list *list;
+	struct rs_slab **pslab;
+
+	for (list = dev->buf_list; list; list = list->next) {
+		for (pfbuf = &list->head; *pfbuf; ) {
+			if ((*pfbuf)->slab == slab)
+				*pfbuf = (*pfbuf)->next;
+			else
+				pfbuf = &(*pfbuf)->next;
+		}
+	}
+
+	for (pslab = &dev->slab_list; *pslab != slab; pslab = &(*pslab)->next)
+		;
+	*pslab = slab->next;
+
+	ibv_dereg_mr(slab->mr);
+	free(slab->buf);
+	free(slab);
+}
+
+/*
+ * Buffers of a given size are reused before a slab is carved, so the
+ * pool only grows while more connections are open than ever before.
+ */
+static void *rs_shared_alloc_buf(struct rs_shared_dev *dev, size_t size,
+				 struct rs_slab **pslab)
+{
+	struct rs_buf_list *list;
+	struct rs_free_buf *fbuf;
+	struct rs_slab *slab;
+	void *buf = NULL;
+
+	size = align(size, 64);
+	pthread_mutex_lock(&dev->lock);
+	for (list = dev->buf_list; list; list = list->next) {
+		if (list->size == size && list->head) {
+			fbuf = list->head;
+			list->head = fbuf->next;
+			slab = fbuf->slab;
+			buf = memset(fbuf, 0, size);
+			goto found;
+		}
+	}
+
+	slab = dev->slab_list;
+	if (!slab || slab->size - slab->used < size) {
+		slab = rs_shared_alloc_slab(dev, max_t(size_t, size,
+						       RS_SHARED_SLAB_SIZE));
+		if (!slab)
+			goto unlock;
+
+		if (slab->next && !slab->next->bufs)
+			rs_shared_free_slab(dev, slab->next);
+	}
+
+	buf = slab->buf + slab->used;
+	slab->used += size;
+found:
+	slab->bufs++;
+	*pslab = slab;
+unlock:
+	pthread_mutex_unlock(&dev->lock);
+	return buf;
+}
+
+/*
+ * Slabs are released once none of their buffers are in use, except for
+ * the one still being carved.
+ */
+static void rs_shared_free_buf(struct rs_shared_dev *dev, void *buf,
+			       size_t size)
+{
+	struct rs_buf_list *list;
+	struct rs_free_buf *fbuf;
+	struct rs_slab *slab;
+
+	size = align(size, 64);
+	pthread_mutex_lock(&dev->lock);
+	for (slab = dev->slab_list; slab; slab = slab->next) {
+		if ((uint8_t *) buf >= slab->buf &&
+		    (uint8_t *) buf < slab->buf + slab->size)
+			break;
+	}
+
+	if (--slab->bufs == 0 && slab != dev->slab_list) {
+		rs_shared_free_slab(dev, slab);
+		goto unlock;
+	}
+
+	for (list = dev->buf_list; list; list = list->next) {
+		if (list->size == size)
+			break;
+	}
+
+	if (!list) {
+		list = calloc(1, sizeof(*list));
+		if (!list)
+			goto unlock;
+
+		list->size = size;
+		list->next = dev->buf_list;
+		dev->buf_list = list;
+	}
+
+	fbuf = buf;
+	fbuf->slab = slab;
+	fbuf->next = list->head;
+	list->head = fbuf;
+unlock:
+	pthread_mutex_unlock(&dev->lock);
+}
+
+static int rs_shared_post_srq(struct rs_shared_dev *dev, int cnt)
+{
+	struct ibv_recv_wr wr[RS_SHARED_POLL_BATCH], *bad;
+	int i, n, ret = 0;
+
+	while (cnt && !ret) {
+		n = min(cnt, RS_SHARED_POLL_BATCH);
+		for (i = 0; i < n; i++) {
+			wr[i].wr_id = rs_recv_wr_id(0);
+			wr[i].next = (i + 1 < n) ? &wr[i + 1] : NULL;
+			wr[i].sg_list = NULL;
+			wr[i].num_sge = 0;
+		}
+		ret = ibv_post_srq_recv(dev->srq, wr, &bad);
+		cnt -= n;
+	}
+
+	return rdma_seterrno(ret);
+}
+
+static void rs_shared_wake(struct rsocket *rs)
+{
+	uint64_t cnt = 1;
+
+	if (atomic_exchange_explicit(&rs->shared_armed, 0, memory_order_relaxed))
+		write_all(rs->shared_fd, &cnt, sizeof cnt);
+}
+
+/*
+ * The owner of the queue holds its cq_lock while removing completions,
+ * and completions are only added with the CQ lock held, so the queue
+ * needs no further locking.  The fence pairs with the one in
+ * rs_shared_arm, so that either the owner sees the completion or we see
+ * that it is waiting for one.
+ */
+static void rs_shared_queue(struct rsocket *rs, struct ibv_wc *wc)
+{
+	unsigned int tail, next;
+	struct rs_wc *rwc;
+
+	tail = atomic_load_explicit(&rs->wcq_tail, memory_order_relaxed);
+	next = (tail + 1 == rs->wcq_size) ? 0 : tail + 1;
+	/* Cannot happen, the queue has room for every posted work request */
+	if (next == atomic_load_explicit(&rs->wcq_head, memory_order_acquire))
+		return;
+
+	rwc = &rs->wcq[tail];
+	rwc->wr_id = wc->wr_id;
+	rwc->status = wc->status;
+	rwc->with_imm = !!(wc->wc_flags & IBV_WC_WITH_IMM);
+	rwc->imm_data = wc->imm_data;
+	atomic_store_explicit(&rs->wcq_tail, next, memory_order_release);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	rs_shared_wake(rs);
+}
+
+static void rs_shared_arm(struct rsocket *rs)
+{
+	atomic_store_explicit(&rs->shared_armed, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static struct rsocket *rs_shared_lookup(struct rs_shared_cq *scq, uint32_t qpn)
+{
+	struct rsocket *rs;
+
+	for (rs = scq->qp_hash[qpn % RS_SHARED_HASH_SIZE]; rs;
+	     rs = rs->shared_next) {
+		if (rs->cm_id->qp->qp_num == qpn)
+			return rs;
+	}
+	return NULL;
+}
+
+/* Must be called with the CQ lock held */
+static void rs_shared_drain(struct rs_shared_cq *scq)
+{
+	struct ibv_wc wc[RS_SHARED_POLL_BATCH];
+	struct rsocket *rs;
+	int i, cnt, rcnt;
+
+	do {
+		cnt = ibv_poll_cq(scq->cq, RS_SHARED_POLL_BATCH, wc);
+		for (i = 0, rcnt = 0; i < cnt; i++) {
+			if (rs_wr_is_recv(wc[i].wr_id))
+				rcnt++;
+
+			rs = rs_shared_lookup(scq, wc[i].qp_num);
+			if (rs)
+				rs_shared_queue(rs, &wc[i]);
+		}
+
+		if (rcnt)
+			rs_shared_post_srq(scq->dev, rcnt);
+	} while (cnt == RS_SHARED_POLL_BATCH);
+}
+
+/*
+ * Sockets drain their CQ while polling.  This thread drains it when every
+ * socket is waiting, waking up those with new completions.
+ */
+static void *rs_shared_run(void *arg)
+{
+	struct rs_shared_dev *dev = arg;
+	struct rs_shared_cq *scq;
+	struct ibv_cq *cq;
+	void *context;
+
+	for (;;) {
+		if (ibv_get_cq_event(dev->channel, &cq, &context)) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		ibv_ack_cq_events(cq, 1);
+		scq = context;
+		ibv_req_notify_cq(cq, 0);
+
+		pthread_mutex_lock(&scq->lock);
+		rs_shared_drain(scq);
+		pthread_mutex_unlock(&scq->lock);
+	}
+
+	return NULL;
+}
+
+static struct rs_shared_dev *rs_shared_alloc_dev(struct ibv_context *verbs)
+{
+	struct ibv_srq_init_attr srq_attr;
+	struct ibv_device_attr attr;
+	struct rs_shared_dev *dev;
+	int ret;
+
+	ret = ibv_query_device(verbs, &attr);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+
+	if (!attr.max_srq_wr) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+
+	dev->verbs = verbs;
+	dev->max_cqe = attr.max_cqe;
+	dev->srq_size = min(RS_SHARED_SRQ_SIZE, attr.max_srq_wr);
+	dev->srq_avail = dev->srq_size;
+	pthread_mutex_init(&dev->lock, NULL);
+
+	/* Our own PD, as ucma releases its PD with the last rdma_cm_id */
+	dev->pd = ibv_alloc_pd(verbs);
+	if (!dev->pd)
+		goto err1;
+
+	dev->channel = ibv_create_comp_channel(verbs);
+	if (!dev->channel)
+		goto err2;
+
+	memset(&srq_attr, 0, sizeof srq_attr);
+	srq_attr.attr.max_wr = dev->srq_size;
+	srq_attr.attr.max_sge = 1;
+	dev->srq = ibv_create_srq(dev->pd, &srq_attr);
+	if (!dev->srq)
+		goto err3;
+
+	if (rs_shared_post_srq(dev, dev->srq_size))
+		goto err4;
+
+	ret = pthread_create(&dev->thread, NULL, rs_shared_run, dev);
+	if (ret) {
+		errno = ret;
+		goto err4;
+	}
+	pthread_detach(dev->thread);
+	return dev;
+
+err4:
+	ibv_destroy_srq(dev->srq);
+err3:
+	ibv_destroy_comp_channel(dev->channel);
+err2:
+	ibv_dealloc_pd(dev->pd);
+err1:
+	pthread_mutex_destroy(&dev->lock);
+	free(dev);
+	return NULL;
+}
+
+/* Devices stay allocated until the process exits */
+static struct rs_shared_dev *rs_shared_get_dev(struct ibv_context *verbs)
+{
+	struct rs_shared_dev *dev;
+
+	pthread_mutex_lock(&shared_mut);
+	for (dev = shared_dev_list; dev; dev = dev->next) {
+		if (dev->verbs == verbs)
+			goto unlock;
+	}
+
+	dev = rs_shared_alloc_dev(verbs);
+	if (dev) {
+		dev->next = shared_dev_list;
+		shared_dev_list = dev;
+	}
+unlock:
+	pthread_mutex_unlock(&shared_mut);
+	return dev;
+}
+
+/*
+ * Each CQ keeps room for a completion on every SRQ receive, plus
+ * every send its sockets may post.
+ */
+static struct rs_shared_cq *rs_shared_get_cq(struct rs_shared_dev *dev,
+					     int cqe)
+{
+	struct rs_shared_cq *scq;
+
+	pthread_mutex_lock(&dev->lock);
+	for (scq = dev->cq_list; scq; scq = scq->next) {
+		if (scq->cqe_avail >= cqe)
+			goto found;
+	}
+
+	scq = calloc(1, sizeof(*scq));
+	if (!scq)
+		goto unlock;
+
+	scq->cq = ibv_create_cq(dev->verbs, min(RS_SHARED_CQ_SIZE, dev->max_cqe),
+				scq, dev->channel, 0);
+	if (!scq->cq)
+		goto err;
+
+	scq->cqe_avail = scq->cq->cqe - dev->srq_size;
+	if (scq->cqe_avail < cqe) {
+		ibv_destroy_cq(scq->cq);
+		errno = ENOMEM;
+		goto err;
+	}
+
+	scq->dev = dev;
+	pthread_mutex_init(&scq->lock, NULL);
+	ibv_req_notify_cq(scq->cq, 0);
+	scq->next = dev->cq_list;
+	dev->cq_list = scq;
+found:
+	scq->cqe_avail -= cqe;
+unlock:
+	pthread_mutex_unlock(&dev->lock);
+	return scq;
+
+err:
+	free(scq);
+	pthread_mutex_unlock(&dev->lock);
+	return NULL;
+}
+
+/*
+ * Every credit granted to the peer must be backed by a posted SRQ
+ * receive, so the receive queue size of each socket is taken from the
+ * SRQ entries left over by the others.
+ */
+static int rs_shared_reserve_srq(struct rs_shared_dev *dev, struct rsocket *rs)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&dev->lock);
+	if (dev->srq_avail < RS_QP_MIN_SIZE) {
+		ret = ERR(ENOMEM);
+	} else {
+		if (rs->rq_size > dev->srq_avail)
+			rs->rq_size = dev->srq_avail;
+		dev->srq_avail -= rs->rq_size;
+	}
+	pthread_mutex_unlock(&dev->lock);
+	return ret;
+}
+
+static void rs_shared_release_srq(struct rs_shared_dev *dev, struct rsocket *rs)
+{
+	pthread_mutex_lock(&dev->lock);
+	dev->srq_avail += rs->rq_size;
+	pthread_mutex_unlock(&dev->lock);
+}
+
+static int rs_shared_attach(struct rsocket *rs)
+{
+	struct rs_shared_dev *dev;
+
+	dev = rs_shared_get_dev(rs->cm_id->verbs);
+	if (!dev)
+		return -1;
+
+	if (rs_shared_reserve_srq(dev, rs))
+		return -1;
+
+	rs->wcq_size = rs->sq_size + rs->rq_size + RS_QP_CTRL_SIZE + 1;
+	rs->wcq = calloc(rs->wcq_size, sizeof(*rs->wcq));
+	if (!rs->wcq) {
+		errno = ENOMEM;
+		goto err0;
+	}
+
+	rs->shared_fd = eventfd(0, (rs->fd_flags & O_NONBLOCK) ?
+				EFD_NONBLOCK : 0);
+	if (rs->shared_fd < 0)
+		goto err1;
+
+	rs->scq = rs_shared_get_cq(dev, rs->sq_size);
+	if (!rs->scq)
+		goto err2;
+
+	return 0;
+
+err2:
+	close(rs->shared_fd);
+err1:
+	free(rs->wcq);
+	rs->wcq = NULL;
+err0:
+	rs_shared_release_srq(dev, rs);
+	return -1;
+}
+
+static void rs_shared_insert(struct rsocket *rs)
+{
+	struct rs_shared_cq *scq = rs->scq;
+	int i;
+
+	i = rs->cm_id->qp->qp_num % RS_SHARED_HASH_SIZE;
+	pthread_mutex_lock(&scq->lock);
+	rs->shared_next = scq->qp_hash[i];
+	scq->qp_hash[i] = rs;
+	pthread_mutex_unlock(&scq->lock);
+}
+
+/*
+ * The QP is destroyed with the CQ lock held, so that its completions are
+ * gone before a new QP can reuse its number.
+ */
+static void rs_shared_destroy_qp(struct rsocket *rs)
+{
+	struct rs_shared_cq *scq = rs->scq;
+	struct rsocket **prs;
+
+	pthread_mutex_lock(&scq->lock);
+	prs = &scq->qp_hash[rs->cm_id->qp->qp_num % RS_SHARED_HASH_SIZE];
+	for (; *prs; prs = &(*prs)->shared_next) {
+		if (*prs == rs) {
+			*prs = rs->shared_next;
+			break;
+		}
+	}
+
+	rdma_destroy_qp(rs->cm_id);
+	rs_shared_drain(scq);
+	pthread_mutex_unlock(&scq->lock);
+}
+
+static void rs_shared_detach(struct rsocket *rs)
+{
+	struct rs_shared_dev *dev = rs->scq->dev;
+
+	if (rs->sbuf)
+		rs_shared_free_buf(dev, rs->sbuf, rs_sbuf_total(rs));
+	if (rs->rbuf) {
+		if (rs->rmr)
+			ibv_dereg_mr(rs->rmr);
+		rs_shared_free_buf(dev, rs->rbuf, rs_rbuf_total(rs));
+	}
+	if (rs->target_buffer_list) {
+		if (rs->target_mr)
+			ibv_dereg_mr(rs->target_mr);
+		rs_shared_free_buf(dev, rs->target_buffer_list,
+				   rs_target_len(rs));
+	}
+
+	pthread_mutex_lock(&dev->lock);
+	rs->scq->cqe_avail += rs->sq_size;
+	dev->srq_avail += rs->rq_size;
+	pthread_mutex_unlock(&dev->lock);
+
+	close(rs->shared_fd);
+	free(rs->wcq);
+}
+
+/* Remove a completion queued to this rsocket, see rs_shared_queue */
+static int rs_shared_poll(struct rsocket *rs, struct ibv_wc *wc)
+{
+	struct rs_wc *rwc;
+	unsigned int head;
+
+	head = atomic_load_explicit(&rs->wcq_head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&rs->wcq_tail, memory_order_acquire)) {
+		/* Someone else is already draining the CQ */
+		if (pthread_mutex_trylock(&rs->scq->lock))
+			return 0;
+		rs_shared_drain(rs->scq);
+		pthread_mutex_unlock(&rs->scq->lock);
+
+		if (head == atomic_load_explicit(&rs->wcq_tail,
+						 memory_order_acquire))
+			return 0;
+	}
+
+	rwc = &rs->wcq[head];
+	wc->wr_id = rwc->wr_id;
+	wc->status = rwc->status;
+	wc->wc_flags = rwc->with_imm ? IBV_WC_WITH_IMM : 0;
+	wc->imm_data = rwc->imm_data;
+	atomic_store_explicit(&rs->wcq_head, (head + 1 == rs->wcq_size) ?
+			      0 : head + 1, memory_order_release);
+	return 1;
+}
+
+static int rs_alloc_bufs(struct rsocket *rs)
 {
 	uint32_t total_rbuf_size, total_sbuf_size;
 	size_t len;
 
-	rs->rmsg = calloc(rs->rq_size + 1, sizeof(*rs->rmsg));
-	if (!rs->rmsg)
-		return ERR(ENOMEM);
-
-	total_sbuf_size = rs->sbuf_size;
-	if (rs->sq_inline < RS_MAX_CTRL_MSG)
-		total_sbuf_size += RS_MAX_CTRL_MSG * RS_QP_CTRL_SIZE;
+	total_sbuf_size = rs_sbuf_total(rs);
 	rs->sbuf = calloc(total_sbuf_size, 1);
 	if (!rs->sbuf)
 		return ERR(ENOMEM);
@@ -757,8 +1675,7 @@ static int rs_init_bufs(struct rsocket *rs)
 	if (!rs->smr)
 		return -1;
 
-	len = sizeof(*rs->target_sgl) * RS_SGL_SIZE +
-	      sizeof(*rs->target_iomap) * rs->target_iomap_size;
+	len = rs_target_len(rs);
 	rs->target_buffer_list = malloc(len);
 	if (!rs->target_buffer_list)
 		return ERR(ENOMEM);
@@ -767,14 +1684,7 @@ static int rs_init_bufs(struct rsocket *rs)
 	if (!rs->target_mr)
 		return -1;
 
-	memset(rs->target_buffer_list, 0, len);
-	rs->target_sgl = rs->target_buffer_list;
-	if (rs->target_iomap_size)
-		rs->target_iomap = (struct rs_iomap *) (rs->target_sgl + RS_SGL_SIZE);
-
-	total_rbuf_size = rs->rbuf_size;
-	if (rs->opts & RS_OPT_MSG_SEND)
-		total_rbuf_size += rs->rq_size * RS_MSG_SIZE;
+	total_rbuf_size = rs_rbuf_total(rs);
 	rs->rbuf = calloc(total_rbuf_size, 1);
 	if (!rs->rbuf)
 		return ERR(ENOMEM);
@@ -783,6 +1693,66 @@ static int rs_init_bufs(struct rsocket *rs)
 	if (!rs->rmr)
 		return -1;
 
+	return 0;
+}
+
+/*
+ * The send buffer is covered by the local only MR of its slab.  The
+ * buffers the peer writes to are registered on their own, so that its
+ * keys give no access to the buffers of other sockets.
+ */
+static int rs_shared_alloc_bufs(struct rsocket *rs)
+{
+	struct rs_shared_dev *dev = rs->scq->dev;
+	struct rs_slab *slab;
+	size_t len;
+
+	rs->sbuf = rs_shared_alloc_buf(dev, rs_sbuf_total(rs), &slab);
+	if (!rs->sbuf)
+		return -1;
+	rs->smr = slab->mr;
+
+	len = rs_target_len(rs);
+	rs->target_buffer_list = rs_shared_alloc_buf(dev, len, &slab);
+	if (!rs->target_buffer_list)
+		return -1;
+
+	rs->target_mr = ibv_reg_mr(dev->pd, rs->target_buffer_list, len,
+				   IBV_ACCESS_LOCAL_WRITE |
+				   IBV_ACCESS_REMOTE_WRITE);
+	if (!rs->target_mr)
+		return -1;
+
+	len = rs_rbuf_total(rs);
+	rs->rbuf = rs_shared_alloc_buf(dev, len, &slab);
+	if (!rs->rbuf)
+		return -1;
+
+	rs->rmr = ibv_reg_mr(dev->pd, rs->rbuf, len, IBV_ACCESS_LOCAL_WRITE |
+			     IBV_ACCESS_REMOTE_WRITE);
+	if (!rs->rmr)
+		return -1;
+
+	return 0;
+}
+
+static int rs_init_bufs(struct rsocket *rs)
+{
+	int ret;
+
+	rs->rmsg = calloc(rs->rq_size + 1, sizeof(*rs->rmsg));
+	if (!rs->rmsg)
+		return ERR(ENOMEM);
+
+	ret = rs->scq ? rs_shared_alloc_bufs(rs) : rs_alloc_bufs(rs);
+	if (ret)
+		return ret;
+
+	memset(rs->target_buffer_list, 0, rs_target_len(rs));
+	rs->target_sgl = rs->target_buffer_list;
+	if (rs->target_iomap_size)
+		rs->target_iomap = (struct rs_iomap *) (rs->target_sgl + RS_SGL_SIZE);
+
 	rs->ssgl[0].addr = rs->ssgl[1].addr = (uintptr_t) rs->sbuf;
 	rs->sbuf_bytes_avail = rs->sbuf_size;
 	rs->ssgl[0].lkey = rs->ssgl[1].lkey = rs->smr->lkey;
@@ -873,11 +1843,10 @@ static inline int rs_post_recv(struct rsocket *rs)
 	return rdma_seterrno(ibv_post_recv(rs->cm_id->qp, &wr, &bad));
 }
 
-static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t offset)
+static inline void ds_init_recv_wr(struct rsocket *rs, struct ds_qp *qp,
+				   uint32_t offset, struct ibv_recv_wr *wr,
+				   struct ibv_sge *sge)
 {
-	struct ibv_recv_wr wr, *bad;
-	struct ibv_sge sge[2];
-
 	sge[0].addr = (uintptr_t) qp->rbuf + rs->rbuf_size;
 	sge[0].length = sizeof(struct ibv_grh);
 	sge[0].lkey = qp->rmr->lkey;
@@ -885,11 +1854,18 @@ static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t of
 	sge[1].length = RS_SNDLOWAT;
 	sge[1].lkey = qp->rmr->lkey;
 
-	wr.wr_id = rs_recv_wr_id(offset);
-	wr.next = NULL;
-	wr.sg_list = sge;
-	wr.num_sge = 2;
+	wr->wr_id = rs_recv_wr_id(offset);
+	wr->next = NULL;
+	wr->sg_list = sge;
+	wr->num_sge = 2;
+}
 
+static inline int ds_post_recv(struct rsocket *rs, struct ds_qp *qp, uint32_t offset)
+{
+	struct ibv_recv_wr wr, *bad;
+	struct ibv_sge sge[2];
+
+	ds_init_recv_wr(rs, qp, offset, &wr, sge);
 	return rdma_seterrno(ibv_post_recv(qp->cm_id->qp, &wr, &bad));
 }
 
@@ -901,26 +1877,41 @@ static int rs_create_ep(struct rsocket *rs)
 	rs_set_qp_size(rs);
 	if (rs->cm_id->verbs->device->transport_type == IBV_TRANSPORT_IWARP)
 		rs->opts |= RS_OPT_MSG_SEND;
-	ret = rs_create_cq(rs, rs->cm_id);
-	if (ret)
-		return ret;
+
+	/* Fall back to private resources if shared ones are unavailable */
+	if (rs->shared && !(rs->opts & RS_OPT_MSG_SEND))
+		rs_shared_attach(rs);
 
 	memset(&qp_attr, 0, sizeof qp_attr);
+	if (rs->scq) {
+		qp_attr.send_cq = rs->scq->cq;
+		qp_attr.recv_cq = rs->scq->cq;
+		qp_attr.srq = rs->scq->dev->srq;
+	} else {
+		ret = rs_create_cq(rs, rs->cm_id);
+		if (ret)
+			return ret;
+
+		qp_attr.send_cq = rs->cm_id->send_cq;
+		qp_attr.recv_cq = rs->cm_id->recv_cq;
+		qp_attr.cap.max_recv_wr = rs->rq_size;
+	}
 	qp_attr.qp_context = rs;
-	qp_attr.send_cq = rs->cm_id->send_cq;
-	qp_attr.recv_cq = rs->cm_id->recv_cq;
 	qp_attr.qp_type = IBV_QPT_RC;
 	qp_attr.sq_sig_all = 1;
 	qp_attr.cap.max_send_wr = rs->sq_size;
-	qp_attr.cap.max_recv_wr = rs->rq_size;
 	qp_attr.cap.max_send_sge = 2;
 	qp_attr.cap.max_recv_sge = 1;
 	qp_attr.cap.max_inline_data = rs->sq_inline;
 
-	ret = rdma_create_qp(rs->cm_id, NULL, &qp_attr);
+	ret = rdma_create_qp(rs->cm_id, rs->scq ? rs->scq->dev->pd : NULL,
+			     &qp_attr);
 	if (ret)
 		return ret;
 
+	if (rs->scq)
+		rs_shared_insert(rs);
+
 	rs->sq_inline = qp_attr.cap.max_inline_data;
 	if ((rs->opts & RS_OPT_MSG_SEND) && (rs->sq_inline < RS_MSG_SIZE))
 		return ERR(ENOTSUP);
@@ -929,7 +1920,7 @@ static int rs_create_ep(struct rsocket *rs)
 	if (ret)
 		return ret;
 
-	for (i = 0; i < rs->rq_size; i++) {
+	for (i = 0; !rs->scq && i < rs->rq_size; i++) {
 		ret = rs_post_recv(rs);
 		if (ret)
 			return ret;
@@ -966,6 +1957,16 @@ static void rs_free_iomappings(struct rsocket *rs)
 	}
 }
 
+static void rs_free_zcopy_mrs(struct rsocket *rs)
+{
+	int i;
+
+	for (i = 0; i < RS_ZCOPY_MR_CNT && rs->zcopy_mr[i]; i++) {
+		ibv_dereg_mr(rs->zcopy_mr[i]);
+		rs->zcopy_mr[i] = NULL;
+	}
+}
+
 static void ds_free_qp(struct ds_qp *qp)
 {
 	if (qp->smr)
@@ -979,8 +1980,7 @@ static void ds_free_qp(struct ds_qp *qp)
 
 	if (qp->cm_id) {
 		if (qp->cm_id->qp) {
-			tdelete(&qp->dest.addr, &qp->rs->dest_map, ds_compare_addr);
-			epoll_ctl(qp->rs->epfd, EPOLL_CTL_DEL,
+			rs_epoll_ctl(qp->rs->epfd, EPOLL_CTL_DEL,
 				  qp->cm_id->recv_cq_channel->fd, NULL);
 			rdma_destroy_qp(qp->cm_id);
 		}
@@ -1003,6 +2003,7 @@ static void ds_free(struct rsocket *rs)
 	if (rs->dmsg)
 		free(rs->dmsg);
 
+	ds_free_dests(rs);
 	while ((qp = rs->qp_list)) {
 		ds_remove_qp(rs, qp);
 		ds_free_qp(qp);
@@ -1014,7 +2015,6 @@ static void ds_free(struct rsocket *rs)
 	if (rs->sbuf)
 		free(rs->sbuf);
 
-	tdestroy(rs->dest_map, free);
 	fastlock_destroy(&rs->map_lock);
 	fastlock_destroy(&rs->cq_wait_lock);
 	fastlock_destroy(&rs->cq_lock);
@@ -1033,36 +2033,49 @@ static void rs_free(struct rsocket *rs)
 	if (rs->rmsg)
 		free(rs->rmsg);
 
-	if (rs->sbuf) {
-		if (rs->smr)
-			rdma_dereg_mr(rs->smr);
-		free(rs->sbuf);
-	}
+	if (rs->borrow)
+		free(rs->borrow);
+
+	if (!rs->scq) {
+		if (rs->sbuf) {
+			if (rs->smr)
+				rdma_dereg_mr(rs->smr);
+			free(rs->sbuf);
+		}
+
+		if (rs->rbuf) {
+			if (rs->rmr)
+				rdma_dereg_mr(rs->rmr);
+			free(rs->rbuf);
+		}
 
-	if (rs->rbuf) {
-		if (rs->rmr)
-			rdma_dereg_mr(rs->rmr);
-		free(rs->rbuf);
+		if (rs->target_buffer_list) {
+			if (rs->target_mr)
+				rdma_dereg_mr(rs->target_mr);
+			free(rs->target_buffer_list);
+		}
 	}
 
-	if (rs->target_buffer_list) {
-		if (rs->target_mr)
-			rdma_dereg_mr(rs->target_mr);
-		free(rs->target_buffer_list);
-	}
+	rs_free_zcopy_mrs(rs);
 
 	if (rs->index >= 0)
 		rs_remove(rs);
 
 	if (rs->cm_id) {
 		rs_free_iomappings(rs);
-		if (rs->cm_id->qp) {
+		if (rs->cm_id->qp && rs->scq) {
+			rs_shared_destroy_qp(rs);
+		} else if (rs->cm_id->qp) {
 			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
 			rdma_destroy_qp(rs->cm_id);
 		}
 		rdma_destroy_id(rs->cm_id);
 	}
 
+	/* Shared buffers may only be reused once the QP is gone */
+	if (rs->scq)
+		rs_shared_detach(rs);
+
 	if (rs->accept_queue[0] > 0 || rs->accept_queue[1] > 0) {
 		close(rs->accept_queue[0]);
 		close(rs->accept_queue[1]);
@@ -1130,7 +2143,7 @@ static int ds_init(struct rsocket *rs, int domain)
 	if (rs->udp_sock < 0)
 		return rs->udp_sock;
 
-	rs->epfd = epoll_create(2);
+	rs->epfd = rs_epoll_create1(0);
 	if (rs->epfd < 0)
 		return rs->epfd;
 
@@ -1554,7 +2567,6 @@ static int ds_add_qp_dest(struct ds_qp *qp, union socket_addr *addr,
 	if (!qp->dest.ah)
 		return ERR(ENOMEM);
 
-	tsearch(&qp->dest.addr, &qp->rs->dest_map, ds_compare_addr);
 	return 0;
 }
 
@@ -1610,7 +2622,7 @@ static int ds_create_qp(struct rsocket *rs, union socket_addr *src_addr,
 
 	event.events = EPOLLIN;
 	event.data.ptr = qp;
-	ret = epoll_ctl(rs->epfd,  EPOLL_CTL_ADD,
+	ret = rs_epoll_ctl(rs->epfd,  EPOLL_CTL_ADD,
 			qp->cm_id->recv_cq_channel->fd, &event);
 	if (ret)
 		goto err;
@@ -1621,6 +2633,10 @@ static int ds_create_qp(struct rsocket *rs, union socket_addr *src_addr,
 			goto err;
 	}
 
+	ret = ds_insert_dest(rs, &qp->dest);
+	if (ret)
+		goto err;
+
 	ds_insert_qp(rs, qp);
 	*new_qp = qp;
 	return 0;
@@ -1652,12 +2668,18 @@ static int ds_get_dest(struct rsocket *rs, const struct sockaddr *addr,
 	union socket_addr src_addr;
 	socklen_t src_len;
 	struct ds_qp *qp;
-	struct ds_dest **tdest, *new_dest;
+	struct ds_dest *new_dest;
 	int ret = 0;
 
+	new_dest = ds_find_dest(rs, addr);
+	if (new_dest) {
+		*dest = new_dest;
+		return 0;
+	}
+
 	fastlock_acquire(&rs->map_lock);
-	tdest = tfind(addr, &rs->dest_map, ds_compare_addr);
-	if (tdest)
+	new_dest = ds_find_dest(rs, addr);
+	if (new_dest)
 		goto found;
 
 	ret = ds_get_src_addr(rs, addr, addrlen, &src_addr, &src_len);
@@ -1668,8 +2690,8 @@ static int ds_get_dest(struct rsocket *rs, const struct sockaddr *addr,
 	if (ret)
 		goto out;
 
-	tdest = tfind(addr, &rs->dest_map, ds_compare_addr);
-	if (!tdest) {
+	new_dest = ds_find_dest(rs, addr);
+	if (!new_dest) {
 		new_dest = calloc(1, sizeof(*new_dest));
 		if (!new_dest) {
 			ret = ERR(ENOMEM);
@@ -1678,11 +2700,15 @@ static int ds_get_dest(struct rsocket *rs, const struct sockaddr *addr,
 
 		memcpy(&new_dest->addr, addr, addrlen);
 		new_dest->qp = qp;
-		tdest = tsearch(&new_dest->addr, &rs->dest_map, ds_compare_addr);
+		ret = ds_insert_dest(rs, new_dest);
+		if (ret) {
+			free(new_dest);
+			goto out;
+		}
 	}
 
 found:
-	*dest = *tdest;
+	*dest = new_dest;
 out:
 	fastlock_release(&rs->map_lock);
 	return ret;
@@ -1834,6 +2860,21 @@ static int ds_post_send(struct rsocket *rs, struct ibv_sge *sge,
  * Update target SGE before sending data.  Otherwise the remote side may
  * update the entry before we do.
  */
+static void rs_get_target(struct rsocket *rs, uint32_t length,
+			  uint64_t *addr, uint32_t *rkey)
+{
+	*addr = rs->target_sgl[rs->target_sge].addr;
+	*rkey = rs->target_sgl[rs->target_sge].key;
+
+	rs->target_sgl[rs->target_sge].addr += length;
+	rs->target_sgl[rs->target_sge].length -= length;
+
+	if (!rs->target_sgl[rs->target_sge].length) {
+		if (++rs->target_sge == RS_SGL_SIZE)
+			rs->target_sge = 0;
+	}
+}
+
 static int rs_write_data(struct rsocket *rs,
 			 struct ibv_sge *sgl, int nsge,
 			 uint32_t length, int flags)
@@ -1847,19 +2888,37 @@ static int rs_write_data(struct rsocket *rs,
 		rs->sqe_avail--;
 	rs->sbuf_bytes_avail -= length;
 
-	addr = rs->target_sgl[rs->target_sge].addr;
-	rkey = rs->target_sgl[rs->target_sge].key;
+	rs_get_target(rs, length, &addr, &rkey);
+	return rs_post_write_msg(rs, sgl, nsge, rs_msg_set(RS_OP_DATA, length),
+				 flags, addr, rkey);
+}
 
-	rs->target_sgl[rs->target_sge].addr += length;
-	rs->target_sgl[rs->target_sge].length -= length;
+/*
+ * Zero-copy writes do not consume space in the send buffer.  They are
+ * tracked separately, so that rsend can wait for them to complete before
+ * returning the user's buffer.
+ */
+static int rs_write_zcopy(struct rsocket *rs, struct ibv_sge *sge)
+{
+	struct ibv_send_wr wr, *bad;
+	uint32_t msg;
 
-	if (!rs->target_sgl[rs->target_sge].length) {
-		if (++rs->target_sge == RS_SGL_SIZE)
-			rs->target_sge = 0;
-	}
+	rs->sseq_no++;
+	rs->sqe_avail--;
+	rs->zcopy_pending++;
 
-	return rs_post_write_msg(rs, sgl, nsge, rs_msg_set(RS_OP_DATA, length),
-				 flags, addr, rkey);
+	msg = rs_msg_set(RS_OP_DATA, sge->length);
+	wr.wr_id = rs_send_wr_id(msg) | RS_WR_ID_FLAG_ZCOPY;
+	wr.next = NULL;
+	wr.sg_list = sge;
+	wr.num_sge = 1;
+	wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+	wr.send_flags = 0;
+	wr.imm_data = htobe32(msg);
+	rs_get_target(rs, sge->length, &wr.wr.rdma.remote_addr,
+		      &wr.wr.rdma.rkey);
+
+	return rdma_seterrno(ibv_post_send(rs->cm_id->qp, &wr, &bad));
 }
 
 static int rs_write_direct(struct rsocket *rs, struct rs_iomap *iom, uint64_t offset,
@@ -1978,17 +3037,37 @@ static void rs_update_credits(struct rsocket *rs)
 		rs_send_credits(rs);
 }
 
+/*
+ * Record that the rsocket state, as seen by rpoll, may have changed.
+ * See rs_poll_idle.
+ */
+static inline void rs_poll_update(struct rsocket *rs)
+{
+	atomic_fetch_add_explicit(&rs->poll_seq, 1, memory_order_release);
+}
+
+static inline int rs_next_wc(struct rsocket *rs, struct ibv_wc *wc)
+{
+	if (rs->scq)
+		return rs_shared_poll(rs, wc);
+
+	return ibv_poll_cq(rs->cm_id->recv_cq, 1, wc);
+}
+
 static int rs_poll_cq(struct rsocket *rs)
 {
 	struct ibv_wc wc;
 	uint32_t msg;
 	int ret, rcnt = 0;
 
-	while ((ret = ibv_poll_cq(rs->cm_id->recv_cq, 1, &wc)) > 0) {
+	while ((ret = rs_next_wc(rs, &wc)) > 0) {
+		rs_poll_update(rs);
 		if (rs_wr_is_recv(wc.wr_id)) {
 			if (wc.status != IBV_WC_SUCCESS)
 				continue;
-			rcnt++;
+			/* The shared CQ reposts SRQ receives as it is drained */
+			if (!rs->scq)
+				rcnt++;
 
 			if (wc.wc_flags & IBV_WC_WITH_IMM) {
 				msg = be32toh(wc.imm_data);
@@ -2044,7 +3123,10 @@ static int rs_poll_cq(struct rsocket *rs)
 				break;
 			default:
 				rs->sqe_avail++;
-				rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc.wr_id));
+				if (rs_wr_is_zcopy(wc.wr_id))
+					rs->zcopy_pending--;
+				else
+					rs->sbuf_bytes_avail += rs_msg_data(rs_wr_data(wc.wr_id));
 				break;
 			}
 			if (wc.status != IBV_WC_SUCCESS && (rs->state & rs_connected)) {
@@ -2070,14 +3152,19 @@ static int rs_get_cq_event(struct rsocket *rs)
 {
 	struct ibv_cq *cq;
 	void *context;
+	uint64_t cnt;
 	int ret;
 
 	if (!rs->cq_armed)
 		return 0;
 
-	ret = ibv_get_cq_event(rs->cm_id->recv_cq_channel, &cq, &context);
+	if (rs->scq)
+		ret = (read(rs->shared_fd, &cnt, sizeof cnt) == sizeof cnt) ? 0 : -1;
+	else
+		ret = ibv_get_cq_event(rs->cm_id->recv_cq_channel, &cq, &context);
+	rs_poll_update(rs);
 	if (!ret) {
-		if (++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
+		if (!rs->scq && ++rs->unack_cqe >= rs->sq_size + rs->rq_size) {
 			ibv_ack_cq_events(rs->cm_id->recv_cq, rs->unack_cqe);
 			rs->unack_cqe = 0;
 		}
@@ -2119,7 +3206,10 @@ static int rs_process_cq(struct rsocket *rs, int nonblock, int (*test)(struct rs
 		} else if (nonblock) {
 			ret = ERR(EWOULDBLOCK);
 		} else if (!rs->cq_armed) {
-			ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
+			if (rs->scq)
+				rs_shared_arm(rs);
+			else
+				ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
 			rs->cq_armed = 1;
 		} else {
 			rs_update_credits(rs);
@@ -2252,7 +3342,7 @@ static int ds_get_cq_event(struct rsocket *rs)
 	if (!rs->cq_armed)
 		return 0;
 
-	ret = epoll_wait(rs->epfd, &event, 1, -1);
+	ret = rs_epoll_wait(rs->epfd, &event, 1, -1);
 	if (ret <= 0)
 		return ret;
 
@@ -2369,6 +3459,11 @@ static int rs_conn_can_send(struct rsocket *rs)
 	return rs_can_send(rs) || !(rs->state & rs_writable);
 }
 
+static int rs_zcopy_done(struct rsocket *rs)
+{
+	return !rs->zcopy_pending;
+}
+
 static int rs_conn_can_send_ctrl(struct rsocket *rs)
 {
 	return rs_ctrl_avail(rs) || !(rs->state & rs_connected);
@@ -2486,6 +3581,36 @@ static ssize_t rs_peek(struct rsocket *rs, void *buf, size_t len)
 	return len - left;
 }
 
+static inline int rs_borrow_next(struct rsocket *rs, int index)
+{
+	return (index + 1 == rs->rq_size + 1) ? 0 : index + 1;
+}
+
+/*
+ * Account for receive buffer space the user is done with.  While borrowed
+ * space is outstanding, the space is queued behind it.
+ */
+static void rs_rbuf_consumed(struct rsocket *rs, uint32_t len)
+{
+	struct rs_borrow *last;
+
+	if (!rs->borrow || rs->borrow_head == rs->borrow_tail) {
+		rs->rbuf_bytes_avail += len;
+		return;
+	}
+
+	last = &rs->borrow[rs->borrow_tail ? rs->borrow_tail - 1 : rs->rq_size];
+	if (last->released) {
+		last->length += len;
+	} else {
+		/* The queue always has room for a copy after a borrow */
+		rs->borrow[rs->borrow_tail].offset = -1;
+		rs->borrow[rs->borrow_tail].length = len;
+		rs->borrow[rs->borrow_tail].released = 1;
+		rs->borrow_tail = rs_borrow_next(rs, rs->borrow_tail);
+	}
+}
+
 /*
  * Continue to receive any queued data even if the remote side has disconnected.
  */
@@ -2546,12 +3671,12 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 				buf += end_size;
 				rsize -= end_size;
 				left -= end_size;
-				rs->rbuf_bytes_avail += end_size;
+				rs_rbuf_consumed(rs, end_size);
 			}
 			memcpy(buf, &rs->rbuf[rs->rbuf_offset], rsize);
 			rs->rbuf_offset += rsize;
 			buf += rsize;
-			rs->rbuf_bytes_avail += rsize;
+			rs_rbuf_consumed(rs, rsize);
 		}
 
 	} while (left && (flags & MSG_WAITALL) && (rs->state & rs_readable));
@@ -2560,6 +3685,126 @@ ssize_t rrecv(int socket, void *buf, size_t len, int flags)
 	return (ret && left == len) ? ret : len - left;
 }
 
+/*
+ * Hand out the next received data in place.  Data that wraps around the
+ * end of the receive buffer is returned by two calls.
+ */
+ssize_t rrecv_borrow(int socket, void **buf, size_t len, int flags)
+{
+	struct rsocket *rs;
+	struct rs_borrow *borrow;
+	uint32_t end_size, rsize;
+	int next, ret = 0;
+
+	rs = idm_at(&idm, socket);
+	if (!rs)
+		return ERR(EBADF);
+	if (rs->type != SOCK_STREAM || (flags & (MSG_PEEK | MSG_WAITALL)))
+		return ERR(EOPNOTSUPP);
+
+	if (rs->state & rs_opening) {
+		ret = rs_do_connect(rs);
+		if (ret) {
+			if (errno == EINPROGRESS)
+				errno = EAGAIN;
+			return ret;
+		}
+	}
+	fastlock_acquire(&rs->rlock);
+	if (!rs->borrow) {
+		rs->borrow = calloc(rs->rq_size + 1, sizeof(*rs->borrow));
+		if (!rs->borrow) {
+			ret = ERR(ENOMEM);
+			goto out;
+		}
+	}
+
+	/* Keep one entry free for data copied by rrecv, see rs_rbuf_consumed */
+	next = rs_borrow_next(rs, rs->borrow_tail);
+	if (next == rs->borrow_head ||
+	    rs_borrow_next(rs, next) == rs->borrow_head) {
+		ret = ERR(ENOBUFS);
+		goto out;
+	}
+
+	if (!rs_have_rdata(rs)) {
+		ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
+				  rs_conn_have_rdata);
+		if (ret || !rs_have_rdata(rs))
+			goto out;
+	}
+
+	if (rs->rbuf_offset == rs->rbuf_size)
+		rs->rbuf_offset = 0;
+	end_size = rs->rbuf_size - rs->rbuf_offset;
+	rsize = min_t(size_t, len, min(end_size, rs->rmsg[rs->rmsg_head].data));
+	if (rsize < rs->rmsg[rs->rmsg_head].data) {
+		rs->rmsg[rs->rmsg_head].data -= rsize;
+	} else {
+		rs->rseq_no++;
+		if (++rs->rmsg_head == rs->rq_size + 1)
+			rs->rmsg_head = 0;
+	}
+
+	borrow = &rs->borrow[rs->borrow_tail];
+	borrow->offset = rs->rbuf_offset;
+	borrow->length = rsize;
+	borrow->released = 0;
+	rs->borrow_tail = next;
+
+	*buf = &rs->rbuf[rs->rbuf_offset];
+	rs->rbuf_offset += rsize;
+	ret = rsize;
+out:
+	fastlock_release(&rs->rlock);
+	return ret;
+}
+
+int rrecv_release(int socket, void *buf)
+{
+	struct rsocket *rs;
+	struct rs_borrow *borrow;
+	int i, offset, ret = 0;
+
+	rs = idm_at(&idm, socket);
+	if (!rs)
+		return ERR(EBADF);
+	if (rs->type != SOCK_STREAM)
+		return ERR(EOPNOTSUPP);
+
+	fastlock_acquire(&rs->rlock);
+	offset = rs->borrow ? (int) ((uint8_t *) buf - rs->rbuf) : -1;
+	for (i = rs->borrow_head; i != rs->borrow_tail; i = rs_borrow_next(rs, i)) {
+		if (rs->borrow[i].offset == offset && !rs->borrow[i].released)
+			break;
+	}
+
+	if (offset < 0 || i == rs->borrow_tail) {
+		ret = ERR(EINVAL);
+		goto out;
+	}
+
+	rs->borrow[i].released = 1;
+	while (rs->borrow_head != rs->borrow_tail) {
+		borrow = &rs->borrow[rs->borrow_head];
+		if (!borrow->released)
+			break;
+
+		rs->rbuf_bytes_avail += borrow->length;
+		rs->borrow_head = rs_borrow_next(rs, rs->borrow_head);
+	}
+out:
+	fastlock_release(&rs->rlock);
+	if (ret)
+		return ret;
+
+	/* Return the space to the peer now, rather than on the next call */
+	fastlock_acquire(&rs->cq_lock);
+	rs_update_credits(rs);
+	fastlock_release(&rs->cq_lock);
+	return 0;
+}
+
 ssize_t rrecvfrom(int socket, void *buf, size_t len, int flags,
 		  struct sockaddr *src_addr, socklen_t *addrlen)
 {
@@ -2600,6 +3845,112 @@ ssize_t rrecvmsg(int socket, struct msghdr *msg, int flags)
 	return rrecvv(socket, msg->msg_iov, (int) msg->msg_iovlen, msg->msg_flags);
 }
 
+static size_t ds_copy_to_iov(const struct iovec *iov, size_t iovcnt,
+			     const void *src, size_t len)
+{
+	size_t i, size, copied = 0;
+
+	for (i = 0; i < iovcnt && copied < len; i++) {
+		size = min_t(size_t, iov[i].iov_len, len - copied);
+		memcpy(iov[i].iov_base, src + copied, size);
+		copied += size;
+	}
+	return copied;
+}
+
+static void ds_flush_recvs(struct ds_qp *qp, struct ibv_recv_wr *wr, int cnt)
+{
+	struct ibv_recv_wr *bad;
+
+	if (cnt) {
+		wr[cnt - 1].next = NULL;
+		ibv_post_recv(qp->cm_id->qp, wr, &bad);
+	}
+}
+
+/*
+ * Receive up to vlen datagrams while holding the receive lock once.  We
+ * wait only for the first message, as if MSG_WAITFORONE were set, and
+ * repost the consumed receive buffers as a single chain per QP.
+ */
+int rrecvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen,
+	      int flags, struct timespec *timeout)
+{
+	struct ibv_recv_wr wr[DS_MMSG_BATCH];
+	struct ibv_sge sge[DS_MMSG_BATCH][2];
+	struct rsocket *rs;
+	struct ds_qp *qp = NULL;
+	struct ds_rmsg *rmsg;
+	struct ds_header *hdr;
+	struct msghdr *msg;
+	size_t len;
+	unsigned int i = 0;
+	int cnt = 0, ret = 0;
+
+	rs = idm_at(&idm, socket);
+	if (!rs)
+		return ERR(EBADF);
+	if (flags & (MSG_PEEK | MSG_WAITALL))
+		return ERR(EOPNOTSUPP);
+
+	if (rs->type == SOCK_STREAM) {
+		for (i = 0; i < vlen; i++) {
+			msg = &msgvec[i].msg_hdr;
+			ret = rrecvv(socket, msg->msg_iov, (int) msg->msg_iovlen,
+				     i ? flags | MSG_DONTWAIT : flags);
+			if (ret < 0)
+				break;
+			msgvec[i].msg_len = ret;
+		}
+		return i ? (int) i : ret;
+	}
+
+	fastlock_acquire(&rs->rlock);
+	if (!(rs->state & rs_readable)) {
+		ret = ERR(EINVAL);
+		goto out;
+	}
+
+	for (i = 0; i < vlen; i++) {
+		if (!rs_have_rdata(rs)) {
+			ret = ds_get_comp(rs, i || rs_nonblocking(rs, flags),
+					  rs_have_rdata);
+			if (ret)
+				break;
+		}
+
+		rmsg = &rs->dmsg[rs->rmsg_head];
+		hdr = (struct ds_header *) (rmsg->qp->rbuf + rmsg->offset);
+		len = rmsg->length - hdr->length;
+
+		msg = &msgvec[i].msg_hdr;
+		msgvec[i].msg_len = ds_copy_to_iov(msg->msg_iov, msg->msg_iovlen,
+						   (void *) hdr + hdr->length, len);
+		msg->msg_flags = (msgvec[i].msg_len < len) ? MSG_TRUNC : 0;
+		msg->msg_controllen = 0;
+		if (msg->msg_name)
+			ds_set_src(msg->msg_name, &msg->msg_namelen, hdr);
+
+		if (cnt && (rmsg->qp != qp || cnt == DS_MMSG_BATCH)) {
+			ds_flush_recvs(qp, wr, cnt);
+			cnt = 0;
+		}
+		qp = rmsg->qp;
+		ds_init_recv_wr(rs, qp, rmsg->offset, &wr[cnt], sge[cnt]);
+		if (cnt)
+			wr[cnt - 1].next = &wr[cnt];
+		cnt++;
+
+		if (++rs->rmsg_head == rs->rq_size + 1)
+			rs->rmsg_head = 0;
+		rs->rqe_avail++;
+	}
+	ds_flush_recvs(qp, wr, cnt);
+out:
+	fastlock_release(&rs->rlock);
+	return i ? (int) i : ret;
+}
+
 ssize_t rread(int socket, void *buf, size_t count)
 {
 	return rrecv(socket, buf, count, 0);
@@ -2685,7 +4036,8 @@ static ssize_t ds_sendv_udp(struct rsocket *rs, const struct iovec *iov,
 	struct iovec miov[8];
 	ssize_t ret;
 
-	if (iovcnt > 8)
+	/* miov[0] carries the header */
+	if (iovcnt < 0 || iovcnt > 7)
 		return ERR(ENOTSUP);
 
 	hdr.tag = htobe32(DS_UDP_TAG);
@@ -2732,31 +4084,167 @@ static ssize_t dsend(struct rsocket *rs, const void *buf, size_t len, int flags)
 {
 	struct ds_smsg *msg;
 	struct ibv_sge sge;
-	uint64_t offset;
+	uint64_t offset;
+	int ret = 0;
+
+	if (!rs->conn_dest->ah)
+		return ds_send_udp(rs, buf, len, flags, RS_OP_DATA);
+
+	ds_touch_dest(rs, rs->conn_dest);
+	if (!ds_can_send(rs)) {
+		ret = ds_get_comp(rs, rs_nonblocking(rs, flags), ds_can_send);
+		if (ret)
+			return ret;
+	}
+
+	msg = rs->smsg_free;
+	rs->smsg_free = msg->next;
+	rs->sqe_avail--;
+
+	memcpy((void *) msg, &rs->conn_dest->qp->hdr, rs->conn_dest->qp->hdr.length);
+	memcpy((void *) msg + rs->conn_dest->qp->hdr.length, buf, len);
+	sge.addr = (uintptr_t) msg;
+	sge.length = rs->conn_dest->qp->hdr.length + len;
+	sge.lkey = rs->conn_dest->qp->smr->lkey;
+	offset = (uint8_t *) msg - rs->sbuf;
+
+	ret = ds_post_send(rs, &sge, offset);
+	return ret ? ret : len;
+}
+
+/*
+ * Buffers used for zero-copy sends are registered on demand.  The
+ * registrations cover the pages of the entire user buffer and are cached,
+ * most recently used first, until the socket is closed or zero-copy is
+ * disabled.
+ */
+static struct ibv_mr *rs_get_zcopy_mr(struct rsocket *rs, void *buf, size_t len)
+{
+	struct ibv_mr *mr;
+	uintptr_t start, end;
+	long page_size;
+	int i;
+
+	start = (uintptr_t) buf;
+	end = start + len;
+	for (i = 0; i < RS_ZCOPY_MR_CNT && rs->zcopy_mr[i]; i++) {
+		mr = rs->zcopy_mr[i];
+		if (start >= (uintptr_t) mr->addr &&
+		    end <= (uintptr_t) mr->addr + mr->length)
+			goto found;
+	}
+
+	if (i == RS_ZCOPY_MR_CNT) {
+		/* The evicted MR may be in use by the current send */
+		if (rs->zcopy_pending && rs_get_comp(rs, 0, rs_zcopy_done))
+			return NULL;
+		ibv_dereg_mr(rs->zcopy_mr[--i]);
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	start &= ~((uintptr_t) page_size - 1);
+	end = (end + page_size - 1) & ~((uintptr_t) page_size - 1);
+	mr = ibv_reg_mr(rs->cm_id->pd, (void *) start, end - start, 0);
+	if (!mr) {
+		/* keep the cache dense */
+		memmove(&rs->zcopy_mr[i], &rs->zcopy_mr[i + 1],
+			(RS_ZCOPY_MR_CNT - i - 1) * sizeof(mr));
+		rs->zcopy_mr[RS_ZCOPY_MR_CNT - 1] = NULL;
+		return NULL;
+	}
+
+found:
+	memmove(&rs->zcopy_mr[1], &rs->zcopy_mr[0], i * sizeof(mr));
+	rs->zcopy_mr[0] = mr;
+	return mr;
+}
+
+/*
+ * The user's buffer may only be returned once the writes from it have
+ * completed, so nonblocking sends always copy.
+ */
+static int rs_use_zcopy(struct rsocket *rs, int flags)
+{
+	return rs->zcopy_size && !(rs->opts & RS_OPT_MSG_SEND) &&
+	       !rs_nonblocking(rs, flags);
+}
+
+/* Number of bytes before the next iovec large enough to send zero-copy */
+static size_t rs_copy_run(struct rsocket *rs, const struct iovec *iov,
+			  size_t offset, size_t left)
+{
+	size_t run = 0;
+
+	for (; run < left; iov++, offset = 0) {
+		if (iov->iov_len >= rs->zcopy_size && iov->iov_len > offset)
+			break;
+		run += iov->iov_len - offset;
+	}
+	return min(run, left);
+}
+
+/*
+ * Transfer data with RDMA writes directly from the user's buffers into
+ * the remote receive buffer, then wait for the writes to complete before
+ * returning.  We stop at the first buffer below the zero-copy size, or
+ * one that cannot be registered, and leave the data from there on for
+ * the caller to copy through the send buffer.
+ */
+static int rs_send_zcopy(struct rsocket *rs, const struct iovec **iov,
+			 size_t *offset, size_t *left, int flags)
+{
+	struct ibv_sge sge;
+	struct ibv_mr *mr;
+	size_t xfer_size;
 	int ret = 0;
 
-	if (!rs->conn_dest->ah)
-		return ds_send_udp(rs, buf, len, flags, RS_OP_DATA);
+	while (*left) {
+		if (!rs_can_send(rs)) {
+			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
+					  rs_conn_can_send);
+			if (ret)
+				break;
+			if (!(rs->state & rs_writable)) {
+				ret = ERR(ECONNRESET);
+				break;
+			}
+		}
 
-	if (!ds_can_send(rs)) {
-		ret = ds_get_comp(rs, rs_nonblocking(rs, flags), ds_can_send);
-		if (ret)
-			return ret;
-	}
+		if (*offset == (*iov)->iov_len) {
+			(*iov)++;
+			*offset = 0;
+			continue;
+		}
 
-	msg = rs->smsg_free;
-	rs->smsg_free = msg->next;
-	rs->sqe_avail--;
+		if ((*iov)->iov_len < rs->zcopy_size)
+			break;
 
-	memcpy((void *) msg, &rs->conn_dest->qp->hdr, rs->conn_dest->qp->hdr.length);
-	memcpy((void *) msg + rs->conn_dest->qp->hdr.length, buf, len);
-	sge.addr = (uintptr_t) msg;
-	sge.length = rs->conn_dest->qp->hdr.length + len;
-	sge.lkey = rs->conn_dest->qp->smr->lkey;
-	offset = (uint8_t *) msg - rs->sbuf;
+		mr = rs_get_zcopy_mr(rs, (*iov)->iov_base, (*iov)->iov_len);
+		if (!mr)
+			break;
 
-	ret = ds_post_send(rs, &sge, offset);
-	return ret ? ret : len;
+		xfer_size = (*iov)->iov_len - *offset;
+		if (xfer_size > rs->target_sgl[rs->target_sge].length)
+			xfer_size = rs->target_sgl[rs->target_sge].length;
+
+		sge.addr = (uintptr_t) (*iov)->iov_base + *offset;
+		sge.length = (uint32_t) xfer_size;
+		sge.lkey = mr->lkey;
+		ret = rs_write_zcopy(rs, &sge);
+		if (ret)
+			break;
+
+		*offset += xfer_size;
+		*left -= xfer_size;
+	}
+
+	/* Only blocking sends get here, see rs_use_zcopy */
+	if (rs->zcopy_pending) {
+		rs_get_comp(rs, 0, rs_zcopy_done);
+		if (!ret && rs->state == rs_error)
+			ret = ERR(rs->err);
+	}
+	return ret;
 }
 
 /*
@@ -2767,7 +4255,9 @@ ssize_t rsend(int socket, const void *buf, size_t len, int flags)
 {
 	struct rsocket *rs;
 	struct ibv_sge sge;
-	size_t left = len;
+	struct iovec iov;
+	const struct iovec *cur_iov;
+	size_t left = len, offset = 0;
 	uint32_t xfer_size, olen = RS_OLAP_START_SIZE;
 	int ret = 0;
 
@@ -2796,6 +4286,15 @@ ssize_t rsend(int socket, const void *buf, size_t len, int flags)
 		if (ret)
 			goto out;
 	}
+	if (rs_use_zcopy(rs, flags) && len >= rs->zcopy_size) {
+		iov.iov_base = (void *) buf;
+		iov.iov_len = len;
+		cur_iov = &iov;
+		ret = rs_send_zcopy(rs, &cur_iov, &offset, &left, flags);
+		if (ret)
+			goto out;
+		buf += len - left;
+	}
 	for (; left; left -= xfer_size, buf += xfer_size) {
 		if (!rs_can_send(rs)) {
 			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
@@ -2911,9 +4410,9 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 {
 	struct rsocket *rs;
 	const struct iovec *cur_iov;
-	size_t left, len, offset = 0;
+	size_t left, len, run, offset = 0;
 	uint32_t xfer_size, olen = RS_OLAP_START_SIZE;
-	int i, ret = 0;
+	int i, zcopy, ret = 0;
 
 	rs = idm_at(&idm, socket);
 	if (!rs)
@@ -2939,7 +4438,22 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 		if (ret)
 			goto out;
 	}
+	/* Large iovecs are sent zero-copy, the ones in between are copied */
+	zcopy = rs_use_zcopy(rs, flags);
 	for (; left; left -= xfer_size) {
+		run = zcopy ? rs_copy_run(rs, cur_iov, offset, left) : left;
+		if (!run) {
+			run = left;
+			ret = rs_send_zcopy(rs, &cur_iov, &offset, &left, flags);
+			if (ret)
+				break;
+			/* Registration failed, copy the rest */
+			if (run == left)
+				zcopy = 0;
+			xfer_size = 0;
+			continue;
+		}
+
 		if (!rs_can_send(rs)) {
 			ret = rs_get_comp(rs, rs_nonblocking(rs, flags),
 					  rs_conn_can_send);
@@ -2951,12 +4465,12 @@ static ssize_t rsendv(int socket, const struct iovec *iov, int iovcnt, int flags
 			}
 		}
 
-		if (olen < left) {
+		if (olen < run) {
 			xfer_size = olen;
 			if (olen < RS_MAX_TRANSFER)
 				olen <<= 1;
 		} else {
-			xfer_size = left;
+			xfer_size = run;
 		}
 
 		if (xfer_size > rs->sbuf_bytes_avail)
@@ -3001,6 +4515,190 @@ ssize_t rsendmsg(int socket, const struct msghdr *msg, int flags)
 	return rsendv(socket, msg->msg_iov, (int) msg->msg_iovlen, flags);
 }
 
+/*
+ * Post a chain of datagram sends.  On failure, the buffers of the work
+ * requests that were not posted are returned to the free list.  Returns
+ * the number of work requests posted.
+ */
+static int ds_flush_sends(struct rsocket *rs, struct ds_qp *qp,
+			  struct ibv_send_wr *wr, int cnt)
+{
+	struct ibv_send_wr *bad;
+	struct ds_smsg *msg;
+	int i, ret;
+
+	if (!cnt)
+		return 0;
+
+	wr[cnt - 1].next = NULL;
+	ret = ibv_post_send(qp->cm_id->qp, wr, &bad);
+	if (!ret)
+		return cnt;
+
+	for (i = bad - wr; i < cnt; i++) {
+		msg = (struct ds_smsg *) (rs->sbuf + rs_wr_data(wr[i].wr_id));
+		msg->next = rs->smsg_free;
+		rs->smsg_free = msg;
+		rs->sqe_avail++;
+	}
+	rdma_seterrno(ret);
+	return bad - wr;
+}
+
+/*
+ * Send up to vlen datagrams while holding the send lock once.  Messages
+ * to the same QP are posted as a single chain of work requests, which
+ * lets the provider ring the doorbell once per chain.  Message order is
+ * preserved across destinations and the UDP fallback path.
+ */
+int rsendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+	struct ibv_send_wr wr[DS_MMSG_BATCH];
+	struct ibv_sge sge[DS_MMSG_BATCH];
+	const struct iovec *iov;
+	struct rsocket *rs;
+	struct ds_qp *qp = NULL;
+	struct ds_dest *dest;
+	struct ds_smsg *smsg;
+	struct msghdr *msg;
+	size_t len, offset;
+	unsigned int i, done = 0;
+	int cnt = 0, posted, ret = 0;
+
+	rs = idm_at(&idm, socket);
+	if (!rs)
+		return ERR(EBADF);
+	if (rs->type == SOCK_STREAM) {
+		for (i = 0; i < vlen; i++) {
+			ret = rsendmsg(socket, &msgvec[i].msg_hdr, flags);
+			if (ret < 0)
+				break;
+			msgvec[i].msg_len = ret;
+		}
+		return i ? (int) i : ret;
+	}
+
+	if (rs->state == rs_init) {
+		ret = ds_init_ep(rs);
+		if (ret)
+			return ret;
+	}
+
+	fastlock_acquire(&rs->slock);
+	for (i = 0; i < vlen; i++) {
+		msg = &msgvec[i].msg_hdr;
+		if (msg->msg_control && msg->msg_controllen) {
+			ret = ERR(ENOTSUP);
+			break;
+		}
+
+		if (msg->msg_name) {
+			if (!rs->conn_dest ||
+			    ds_compare_addr(msg->msg_name, &rs->conn_dest->addr)) {
+				ret = ds_get_dest(rs, msg->msg_name,
+						  msg->msg_namelen, &rs->conn_dest);
+				if (ret)
+					break;
+			}
+		} else if (!rs->conn_dest) {
+			ret = ERR(EDESTADDRREQ);
+			break;
+		}
+		dest = rs->conn_dest;
+
+		if (msg->msg_iovlen > IOV_MAX) {
+			ret = ERR(EMSGSIZE);
+			break;
+		}
+
+		for (len = 0, offset = 0; offset < msg->msg_iovlen; offset++) {
+			if (msg->msg_iov[offset].iov_len > RS_SNDLOWAT)
+				break;
+			len += msg->msg_iov[offset].iov_len;
+		}
+		if (offset < msg->msg_iovlen ||
+		    len + dest->qp->hdr.length > RS_SNDLOWAT) {
+			ret = ERR(EMSGSIZE);
+			break;
+		}
+
+		if (cnt && (dest->qp != qp || !dest->ah || !ds_can_send(rs))) {
+			posted = ds_flush_sends(rs, qp, wr, cnt);
+			done += posted;
+			if (posted < cnt) {
+				ret = -1;
+				cnt = 0;
+				break;
+			}
+			cnt = 0;
+		}
+
+		if (!dest->ah) {
+			ret = ds_sendv_udp(rs, msg->msg_iov, (int) msg->msg_iovlen,
+					   flags, RS_OP_DATA);
+			if (ret < 0)
+				break;
+			msgvec[i].msg_len = ret;
+			done++;
+			continue;
+		}
+
+		if (!ds_can_send(rs)) {
+			ret = ds_get_comp(rs, rs_nonblocking(rs, flags),
+					  ds_can_send);
+			if (ret)
+				break;
+		}
+
+		ds_touch_dest(rs, dest);
+		smsg = rs->smsg_free;
+		rs->smsg_free = smsg->next;
+		rs->sqe_avail--;
+
+		memcpy((void *) smsg, &dest->qp->hdr, dest->qp->hdr.length);
+		iov = msg->msg_iov;
+		offset = 0;
+		rs_copy_iov((void *) smsg + dest->qp->hdr.length, &iov, &offset, len);
+
+		sge[cnt].addr = (uintptr_t) smsg;
+		sge[cnt].length = dest->qp->hdr.length + len;
+		sge[cnt].lkey = dest->qp->smr->lkey;
+
+		offset = (uint8_t *) smsg - rs->sbuf;
+		wr[cnt].wr_id = rs_send_wr_id(offset);
+		wr[cnt].next = &wr[cnt + 1];
+		wr[cnt].sg_list = &sge[cnt];
+		wr[cnt].num_sge = 1;
+		wr[cnt].opcode = IBV_WR_SEND;
+		wr[cnt].send_flags = (sge[cnt].length <= rs->sq_inline) ?
+				     IBV_SEND_INLINE : 0;
+		wr[cnt].wr.ud.ah = dest->ah;
+		wr[cnt].wr.ud.remote_qpn = dest->qpn;
+		wr[cnt].wr.ud.remote_qkey = RDMA_UDP_QKEY;
+		msgvec[i].msg_len = len;
+		qp = dest->qp;
+
+		if (++cnt == DS_MMSG_BATCH) {
+			posted = ds_flush_sends(rs, qp, wr, cnt);
+			done += posted;
+			cnt = 0;
+			if (posted < DS_MMSG_BATCH) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (cnt) {
+		posted = ds_flush_sends(rs, qp, wr, cnt);
+		done += posted;
+		if (posted < cnt)
+			ret = -1;
+	}
+	fastlock_release(&rs->slock);
+	return done ? (int) done : ret;
+}
+
 ssize_t rwrite(int socket, const void *buf, size_t count)
 {
 	return rsend(socket, buf, count, 0);
@@ -3137,31 +4835,229 @@ static int rs_poll_signal(void)
 	return ret;
 }
 
+/*
+ * Each thread that blocks in rpoll keeps a persistent epoll set of the fds
+ * used to wait for events on rsockets.  An rsocket is registered once, and
+ * stays armed across calls.  A connected rsocket that was found idle after
+ * arming its CQ is not checked again until an event is reported for it, or
+ * its state is updated (e.g. by another thread processing its CQ).  Once
+ * rpoll has spun without finding any events, this limits the cost of
+ * arming and waiting on large numbers of idle rsockets to a memory check.
+ *
+ * rsockets that are no longer polled by the thread are removed from its
+ * set when an event is reported for them.
+ */
+#define RS_POLL_EVENTS 64
+
+struct rs_poll_entry {
+	uint32_t	id;	/* rsocket poll_id, 0 if not registered */
+	uint32_t	gen;	/* rs_pollset gen when last polled */
+	uint32_t	seq;	/* rsocket poll_seq when found idle */
+	int		fd;
+	short		events;
+	bool		idle;
+};
+
+struct rs_pollset {
+	int		  epfd;
+	uint32_t	  gen;
+	struct index_map  entries;
+};
+
+static __thread struct rs_pollset *pollset;
+static pthread_key_t pollset_key;
+static pthread_once_t pollset_once = PTHREAD_ONCE_INIT;
+
+static void rs_pollset_free(void *arg)
+{
+	struct rs_pollset *set = arg;
+	int i, j;
+
+	for (i = 0; i < IDX_ARRAY_SIZE; i++) {
+		if (!set->entries.array[i])
+			continue;
+		for (j = 0; j < IDX_ENTRY_SIZE; j++)
+			free(set->entries.array[i][j]);
+		free(set->entries.array[i]);
+	}
+	close(set->epfd);
+	free(set);
+}
+
+static void rs_pollset_init(void)
+{
+	pthread_key_create(&pollset_key, rs_pollset_free);
+}
+
+static struct rs_pollset *rs_pollset_alloc(void)
+{
+	struct rs_pollset *set;
+
+	pthread_once(&pollset_once, rs_pollset_init);
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+
+	set->epfd = rs_epoll_create1(EPOLL_CLOEXEC);
+	if (set->epfd < 0) {
+		free(set);
+		return NULL;
+	}
+
+	pthread_setspecific(pollset_key, set);
+	return set;
+}
+
 /* We always add the pollsignal read fd to the poll fd set, so
- * that we can signal any blocked threads.
+ * that we can signal any blocked threads.  The poll fd set holds the
+ * normal fd's being polled, followed by the thread's rsocket epoll fd
+ * and the pollsignal fd.
  */
 static struct pollfd *rs_fds_alloc(nfds_t nfds)
 {
 	static __thread struct pollfd *rfds;
 	static __thread nfds_t rnfds;
 
-	if (nfds + 1 > rnfds) {
-		if (rfds)
-			free(rfds);
-		else if (rs_pollinit())
+	if (!pollset) {
+		if (rs_pollinit())
 			return NULL;
 
-		rfds = malloc(sizeof(*rfds) * nfds + 1);
-		rnfds = rfds ? nfds + 1 : 0;
+		pollset = rs_pollset_alloc();
+		if (!pollset)
+			return NULL;
 	}
 
-	if (rfds) {
-		rfds[nfds].fd = pollsignal;
-		rfds[nfds].events = POLLIN;
+	if (nfds + 2 > rnfds) {
+		if (rfds)
+			free(rfds);
+
+		rfds = malloc(sizeof(*rfds) * (nfds + 2));
+		rnfds = rfds ? nfds + 2 : 0;
 	}
+
 	return rfds;
 }
 
+static struct rs_poll_entry *rs_poll_entry(struct rsocket *rs)
+{
+	return pollset ? idm_lookup(&pollset->entries, rs->index) : NULL;
+}
+
+/*
+ * An idle rsocket was armed and had none of the requested events.  Any
+ * completion on its CQ will generate an event on the thread's epoll set,
+ * and anything else that could change its state updates its poll_seq.
+ */
+static int rs_poll_idle(struct rsocket *rs, short events)
+{
+	struct rs_poll_entry *entry;
+
+	entry = rs_poll_entry(rs);
+	if (!entry || !entry->idle || entry->id != rs->poll_id)
+		return 0;
+
+	entry->gen = pollset->gen;
+	return !(events & ~entry->events) && rs->cq_armed &&
+	       entry->seq == atomic_load_explicit(&rs->poll_seq,
+						  memory_order_acquire);
+}
+
+static int rs_poll_fd(struct rsocket *rs)
+{
+	if (rs->type == SOCK_STREAM) {
+		if (rs->state >= rs_connected)
+			return rs->scq ? rs->shared_fd :
+			       rs->cm_id->recv_cq_channel->fd;
+		else
+			return rs->cm_id->channel->fd;
+	}
+	return rs->epfd;
+}
+
+static int rs_poll_register(struct rsocket *rs, short events, uint32_t seq)
+{
+	struct rs_poll_entry *entry;
+	struct epoll_event event;
+	int fd, ret;
+
+	entry = rs_poll_entry(rs);
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry)
+			return ERR(ENOMEM);
+
+		if (idm_set(&pollset->entries, rs->index, entry) < 0) {
+			free(entry);
+			return -1;
+		}
+	}
+
+	fd = rs_poll_fd(rs);
+	if (entry->id != rs->poll_id || entry->fd != fd) {
+		if (entry->id == rs->poll_id)
+			rs_epoll_ctl(pollset->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+
+		event.events = EPOLLIN;
+		event.data.u64 = ((uint64_t) rs->poll_id << 32) | rs->index;
+		ret = rs_epoll_ctl(pollset->epfd, EPOLL_CTL_ADD, fd, &event);
+		if (ret && errno == EEXIST)
+			ret = rs_epoll_ctl(pollset->epfd, EPOLL_CTL_MOD, fd, &event);
+		if (ret) {
+			entry->id = 0;
+			return ret;
+		}
+
+		entry->id = rs->poll_id;
+		entry->fd = fd;
+	}
+
+	entry->gen = pollset->gen;
+	entry->events = events;
+	entry->seq = seq;
+	entry->idle = (rs->type == SOCK_STREAM) && (rs->state & rs_connected) &&
+		      rs->cq_armed;
+	return 0;
+}
+
+/*
+ * Retrieve the CQ events reported by the epoll set, so that the
+ * corresponding rsockets will be checked.
+ */
+static void rs_poll_get_events(void)
+{
+	struct epoll_event events[RS_POLL_EVENTS];
+	struct rs_poll_entry *entry;
+	struct rsocket *rs;
+	int i, cnt, index;
+
+	do {
+		cnt = rs_epoll_wait(pollset->epfd, events, RS_POLL_EVENTS, 0);
+		for (i = 0; i < cnt; i++) {
+			index = (int) (uint32_t) events[i].data.u64;
+			entry = idm_lookup(&pollset->entries, index);
+			if (!entry || entry->id != (uint32_t) (events[i].data.u64 >> 32))
+				continue;
+
+			entry->idle = false;
+			rs = idm_lookup(&idm, index);
+			if (!rs || rs->poll_id != entry->id ||
+			    entry->gen != pollset->gen) {
+				rs_epoll_ctl(pollset->epfd, EPOLL_CTL_DEL,
+					  entry->fd, NULL);
+				entry->id = 0;
+				continue;
+			}
+
+			fastlock_acquire(&rs->cq_wait_lock);
+			if (rs->type == SOCK_STREAM)
+				rs_get_cq_event(rs);
+			else
+				ds_get_cq_event(rs);
+			fastlock_release(&rs->cq_wait_lock);
+		}
+	} while (cnt == RS_POLL_EVENTS);
+}
+
 static int rs_poll_rs(struct rsocket *rs, int events,
 		      int nonblock, int (*test)(struct rsocket *rs))
 {
@@ -3229,6 +5125,12 @@ check_cq:
 	return 0;
 }
 
+/*
+ * The spin phase checks every rsocket, including those found idle by an
+ * earlier call.  Their CQ events are only retrieved once we block, so an
+ * idle rsocket that has become ready would otherwise not be seen until
+ * then.
+ */
 static int rs_poll_check(struct pollfd *fds, nfds_t nfds)
 {
 	struct rsocket *rs;
@@ -3236,10 +5138,12 @@ static int rs_poll_check(struct pollfd *fds, nfds_t nfds)
 
 	for (i = 0; i < nfds; i++) {
 		rs = idm_lookup(&idm, fds[i].fd);
-		if (rs)
-			fds[i].revents = rs_poll_rs(rs, fds[i].events, 1, rs_poll_all);
-		else
+		if (rs) {
+			fds[i].revents = rs_poll_rs(rs, fds[i].events,
+						    1, rs_poll_all);
+		} else {
 			poll(&fds[i], 1, 0);
+		}
 
 		if (fds[i].revents)
 			cnt++;
@@ -3247,55 +5151,64 @@ static int rs_poll_check(struct pollfd *fds, nfds_t nfds)
 	return cnt;
 }
 
-static int rs_poll_arm(struct pollfd *rfds, struct pollfd *fds, nfds_t nfds)
+static int rs_poll_arm(struct pollfd *rfds, nfds_t *rnfds,
+		       struct pollfd *fds, nfds_t nfds)
 {
 	struct rsocket *rs;
-	int i;
+	uint32_t seq;
+	int i, n = 0;
 
+	pollset->gen++;
 	for (i = 0; i < nfds; i++) {
 		rs = idm_lookup(&idm, fds[i].fd);
 		if (rs) {
+			if (rs_poll_idle(rs, fds[i].events))
+				continue;
+
+			seq = atomic_load_explicit(&rs->poll_seq,
+						   memory_order_acquire);
 			fds[i].revents = rs_poll_rs(rs, fds[i].events, 0, rs_is_cq_armed);
 			if (fds[i].revents)
 				return 1;
 
-			if (rs->type == SOCK_STREAM) {
-				if (rs->state >= rs_connected)
-					rfds[i].fd = rs->cm_id->recv_cq_channel->fd;
-				else
-					rfds[i].fd = rs->cm_id->channel->fd;
-			} else {
-				rfds[i].fd = rs->epfd;
-			}
-			rfds[i].events = POLLIN;
+			if (rs_poll_register(rs, fds[i].events, seq))
+				return -1;
 		} else {
-			rfds[i].fd = fds[i].fd;
-			rfds[i].events = fds[i].events;
+			rfds[n].fd = fds[i].fd;
+			rfds[n].events = fds[i].events;
+			rfds[n++].revents = 0;
 		}
-		rfds[i].revents = 0;
 	}
+
+	rfds[n].fd = pollset->epfd;
+	rfds[n].events = POLLIN;
+	rfds[n++].revents = 0;
+	rfds[n].fd = pollsignal;
+	rfds[n].events = POLLIN;
+	rfds[n++].revents = 0;
+	*rnfds = n;
 	return 0;
 }
 
-static int rs_poll_events(struct pollfd *rfds, struct pollfd *fds, nfds_t nfds)
+static int rs_poll_events(struct pollfd *rfds, nfds_t rnfds,
+			  struct pollfd *fds, nfds_t nfds)
 {
 	struct rsocket *rs;
-	int i, cnt = 0;
+	int i, n = 0, cnt = 0;
+
+	if (rfds[rnfds - 2].revents)
+		rs_poll_get_events();
 
 	for (i = 0; i < nfds; i++) {
 		rs = idm_lookup(&idm, fds[i].fd);
 		if (rs) {
-			if (rfds[i].revents) {
-				fastlock_acquire(&rs->cq_wait_lock);
-				if (rs->type == SOCK_STREAM)
-					rs_get_cq_event(rs);
-				else
-					ds_get_cq_event(rs);
-				fastlock_release(&rs->cq_wait_lock);
-			}
-			fds[i].revents = rs_poll_rs(rs, fds[i].events, 1, rs_poll_all);
+			if (rs_poll_idle(rs, fds[i].events))
+				fds[i].revents = 0;
+			else
+				fds[i].revents = rs_poll_rs(rs, fds[i].events,
+							    1, rs_poll_all);
 		} else {
-			fds[i].revents = rfds[i].revents;
+			fds[i].revents = rfds[n++].revents;
 		}
 		if (fds[i].revents)
 			cnt++;
@@ -3312,6 +5225,7 @@ static int rs_poll_events(struct pollfd *rfds, struct pollfd *fds, nfds_t nfds)
 int rpoll(struct pollfd *fds, nfds_t nfds, int timeout)
 {
 	struct pollfd *rfds;
+	nfds_t rnfds;
 	uint64_t start_time = 0;
 	uint32_t poll_time;
 	int pollsleep, ret;
@@ -3332,7 +5246,7 @@ int rpoll(struct pollfd *fds, nfds_t nfds, int timeout)
 		return ERR(ENOMEM);
 
 	do {
-		ret = rs_poll_arm(rfds, fds, nfds);
+		ret = rs_poll_arm(rfds, &rnfds, fds, nfds);
 		if (ret)
 			break;
 
@@ -3348,13 +5262,13 @@ int rpoll(struct pollfd *fds, nfds_t nfds, int timeout)
 			pollsleep = wake_up_interval;
 		}
 
-		ret = poll(rfds, nfds + 1, pollsleep);
+		ret = poll(rfds, rnfds, pollsleep);
 		if (ret < 0) {
 			rs_poll_exit();
 			break;
 		}
 
-		ret = rs_poll_events(rfds, fds, nfds);
+		ret = rs_poll_events(rfds, rnfds, fds, nfds);
 		rs_poll_stop();
 	} while (!ret);
 
@@ -3499,12 +5413,16 @@ int rshutdown(int socket, int how)
 		rs_process_cq(rs, 0, rs_conn_all_sends_done);
 
 out:
+	rs_poll_update(rs);
 	if ((rs->fd_flags & O_NONBLOCK) && (rs->state & rs_connected))
 		rs_set_nonblocking(rs, rs->fd_flags);
 
 	if (rs->state & rs_disconnected) {
 		/* Generate event by flushing receives to unblock rpoll */
-		ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
+		if (rs->scq)
+			rs_shared_wake(rs);
+		else
+			ibv_req_notify_cq(rs->cm_id->recv_cq, 0);
 		ucma_shutdown(rs->cm_id);
 	}
 
@@ -3621,6 +5539,19 @@ static int rs_set_keepalive(struct rsocket *rs, int on)
 	return ret;
 }
 
+static int rs_set_zcopy(struct rsocket *rs, int size)
+{
+	if (rs->type != SOCK_STREAM || size < 0)
+		return ERR(EINVAL);
+
+	fastlock_acquire(&rs->slock);
+	rs->zcopy_size = size;
+	if (!size)
+		rs_free_zcopy_mrs(rs);
+	fastlock_release(&rs->slock);
+	return 0;
+}
+
 int rsetsockopt(int socket, int level, int optname,
 		const void *optval, socklen_t optlen)
 {
@@ -3727,6 +5658,11 @@ int rsetsockopt(int socket, int level, int optname,
 		}
 		break;
 	case SOL_RDMA:
+		if (optname == RDMA_ZCOPY) {
+			ret = rs_set_zcopy(rs, *(int *) optval);
+			break;
+		}
+
 		if (rs->state >= rs_opening) {
 			ret = ERR(EINVAL);
 			break;
@@ -3753,6 +5689,11 @@ int rsetsockopt(int socket, int level, int optname,
 				(uint8_t) rs_value_to_scale(*(int *) optval, 8), 8);
 			ret = 0;
 			break;
+		case RDMA_SHARED:
+			if (rs->type == SOCK_STREAM)
+				rs->shared = !!*(int *) optval;
+			ret = 0;
+			break;
 		case RDMA_ROUTE:
 			if ((rs->optval = malloc(optlen))) {
 				memcpy(rs->optval, optval, optlen);
@@ -3904,6 +5845,16 @@ int rgetsockopt(int socket, int level, int optname,
 			*((int *) optval) = rs->target_iomap_size;
 			*optlen = sizeof(int);
 			break;
+		case RDMA_ZCOPY:
+			*((int *) optval) = rs->type == SOCK_STREAM ?
+					    rs->zcopy_size : 0;
+			*optlen = sizeof(int);
+			break;
+		case RDMA_SHARED:
+			*((int *) optval) = rs->type == SOCK_STREAM ?
+					    rs->shared : 0;
+			*optlen = sizeof(int);
+			break;
 		case RDMA_ROUTE:
 			if (rs->optval) {
 				if (*optlen < rs->optlen) {
@@ -4314,8 +6265,7 @@ static void udp_svc_create_ah(struct rsocket *rs, struct ds_dest *dest, uint32_t
 
 	if (dest->ah) {
 		fastlock_acquire(&rs->slock);
-		ibv_destroy_ah(dest->ah);
-		dest->ah = NULL;
+		ds_release_ah(rs, dest);
 		fastlock_release(&rs->slock);
 	}
 
@@ -4355,6 +6305,11 @@ static void udp_svc_create_ah(struct rsocket *rs, struct ds_dest *dest, uint32_t
 	fastlock_acquire(&rs->slock);
 	dest->qpn = qpn;
 	dest->ah = ibv_create_ah(dest->qp->cm_id->pd, &attr);
+	if (dest->ah && dest != &dest->qp->dest) {
+		dlist_insert_head(&dest->lru, &rs->ah_lru);
+		rs->ah_cnt++;
+		ds_evict_ahs(rs);
+	}
 	fastlock_release(&rs->slock);
 out:
 	rdma_destroy_id(id);
@@ -4595,6 +6550,7 @@ static void rs_handle_cm_event(struct rsocket *rs)
 			rs->state = rs_disconnected;
 	}
 
+	rs_poll_update(rs);
 	if (!(rs->state & rs_opening))
 		rs_poll_signal();
 }
@@ -79,7 +79,9 @@ enum {
 	RDMA_RQSIZE,
 	RDMA_INLINE,
 	RDMA_IOMAPSIZE,
-	RDMA_ROUTE
+	RDMA_ROUTE,
+	RDMA_ZCOPY,
+	RDMA_SHARED
 };
 
 int rsetsockopt(int socket, int level, int optname,
@@ -92,6 +94,15 @@ off_t riomap(int socket, void *buf, size_t len, int prot, int flags, off_t offse
 int riounmap(int socket, void *buf, size_t len);
 size_t riowrite(int socket, const void *buf, size_t count, off_t offset, int flags);
 
+ssize_t rrecv_borrow(int socket, void **buf, size_t len, int flags);
+int rrecv_release(int socket, void *buf);
+
+struct mmsghdr;
+struct timespec;
+int rsendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+int rrecvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen,
+	      int flags, struct timespec *timeout);
+
 #ifdef __cplusplus
 }
 #endif
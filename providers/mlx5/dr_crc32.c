@@ -54,18 +54,126 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include "mlx5dv_dr.h"
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #define DR_STE_CRC_POLY		0xEDB88320L
 
 static uint32_t dr_ste_crc_tab32[8][256];
 
+typedef uint32_t (*dr_crc32_calc_fn_t)(const void *input_data, size_t length);
+static dr_crc32_calc_fn_t dr_crc32_calc_fn = dr_crc32_slice8_calc;
+
 static void dr_crc32_calc_lookup_entry(uint32_t (*tbl)[256], uint8_t i,
 				       uint8_t j)
 {
 	tbl[i][j] = (tbl[i-1][j] >> 8) ^ tbl[0][tbl[i-1][j] & 0xff];
 }
 
+/*
+ * The implementations below give the same result as dr_crc32_slice8_calc()
+ * below.
+ * SSE4.2 crc32 uses the Castagnoli polynomial, so x86 folds the data with
+ * carry-less multiplication instead, using the reflected 0xEDB88320
+ * constants from Intel's "Fast CRC Computation Using PCLMULQDQ".
+ */
+#if defined(__x86_64__)
+static bool dr_crc32_have_pclmul(void)
+{
+	unsigned int ax, bx, cx, dx;
+
+	if (!__get_cpuid(1, &ax, &bx, &cx, &dx))
+		return false;
+	return (cx & bit_PCLMUL) && (cx & bit_SSE4_1);
+}
+
+static uint32_t __attribute__((target("pclmul,sse4.1")))
+dr_crc32_pclmul_calc(const void *input_data, size_t length)
+{
+	const uint8_t *current_char = input_data;
+	__m128i x0, x1, x2, x3;
+	uint32_t crc;
+
+	if (length < 16)
+		return dr_crc32_slice8_calc(input_data, length);
+
+	/* Fold 128 bits at a time, x^(128+64) and x^128 mod P */
+	x0 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	x1 = _mm_loadu_si128((const __m128i *)current_char);
+	current_char += 16;
+	length -= 16;
+	while (length >= 16) {
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(x1, x2);
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128(
+					(const __m128i *)current_char));
+		current_char += 16;
+		length -= 16;
+	}
+
+	/* Fold 128 to 64 bits, then 64 to 32 bits with x^64 mod P */
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_set_epi64x(0, 0x0163cd6124);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits, P' and P */
+	x0 = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_extract_epi32(x1, 1);
+
+	while (length-- != 0)
+		crc = (crc >> 8) ^ dr_ste_crc_tab32[0][(crc & 0xff)
+			^ *current_char++];
+
+	return __builtin_bswap32(crc);
+}
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* The ARMv8 crc32 instructions use the same polynomial as the table */
+static uint32_t __attribute__((target("+crc")))
+dr_crc32_armv8_calc(const void *input_data, size_t length)
+{
+	const uint8_t *current_char = input_data;
+	uint32_t crc = 0;
+	uint64_t data;
+
+	if (!input_data)
+		return 0;
+
+	while (length >= 8) {
+		memcpy(&data, current_char, sizeof(data));
+		asm("crc32x %w0, %w0, %x1" : "+r"(crc) : "r"(data));
+		current_char += 8;
+		length -= 8;
+	}
+
+	while (length-- != 0)
+		asm("crc32b %w0, %w0, %w1" : "+r"(crc)
+		    : "r"((uint32_t)*current_char++));
+
+	return __builtin_bswap32(crc);
+}
+#endif
+
 void dr_crc32_init_table(void)
 {
 	uint32_t crc, i, j;
@@ -91,6 +199,15 @@ void dr_crc32_init_table(void)
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 6, i);
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 7, i);
 	}
+
+	/* Use the CPU's CRC support if it has any, the table is kept for tails */
+#if defined(__x86_64__)
+	if (dr_crc32_have_pclmul())
+		dr_crc32_calc_fn = dr_crc32_pclmul_calc;
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		dr_crc32_calc_fn = dr_crc32_armv8_calc;
+#endif
 }
 
 /* Compute CRC32 (Slicing-by-8 algorithm) */
@@ -129,3 +246,8 @@ uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length)
 	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
 		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
 }
+
+uint32_t dr_crc32_calc(const void *input_data, size_t length)
+{
+	return dr_crc32_calc_fn(input_data, length);
+}
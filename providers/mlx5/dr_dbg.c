@@ -238,11 +238,11 @@ int mlx5dv_dump_dr_rule(FILE *fout, struct mlx5dv_dr_rule *rule)
 	if (!fout || !rule)
 		return -EINVAL;
 
-	pthread_mutex_lock(&rule->matcher->tbl->dmn->mutex);
+	dr_matcher_lock(rule->matcher);
 
 	ret = dr_dump_rule(fout, rule);
 
-	pthread_mutex_unlock(&rule->matcher->tbl->dmn->mutex);
+	dr_matcher_unlock(rule->matcher);
 
 	return ret;
 }
@@ -423,11 +423,11 @@ int mlx5dv_dump_dr_matcher(FILE *fout, struct mlx5dv_dr_matcher *matcher)
 	if (!fout || !matcher)
 		return -EINVAL;
 
-	pthread_mutex_lock(&matcher->tbl->dmn->mutex);
+	dr_matcher_lock(matcher);
 
 	ret = dr_dump_matcher_all(fout, matcher);
 
-	pthread_mutex_unlock(&matcher->tbl->dmn->mutex);
+	dr_matcher_unlock(matcher);
 
 	return ret;
 }
@@ -513,11 +513,11 @@ int mlx5dv_dump_dr_table(FILE *fout, struct mlx5dv_dr_table *tbl)
 	if (!fout || !tbl)
 		return -EINVAL;
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_domain_lock(tbl->dmn);
 
 	ret = dr_dump_table_all(fout, tbl);
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
 
 	return ret;
 }
@@ -639,7 +639,7 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	enum mlx5dv_dr_domain_type dmn_type = dmn->type;
 	char *dev_name = dmn->ctx->device->dev_name;
 	uint64_t domain_id;
-	int ret;
+	int ret, i;
 
 	domain_id = dr_domain_id_calc(dmn_type);
 
@@ -658,8 +658,11 @@ static int dr_dump_domain(FILE *f, struct mlx5dv_dr_domain *dmn)
 	if (ret < 0)
 		return ret;
 
-	if (dmn->info.supp_sw_steering) {
-		ret = dr_dump_send_ring(f, dmn->send_ring, domain_id);
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		if (!dmn->send_ring[i])
+			continue;
+
+		ret = dr_dump_send_ring(f, dmn->send_ring[i], domain_id);
 		if (ret < 0)
 			return ret;
 	}
@@ -692,11 +695,11 @@ int mlx5dv_dump_dr_domain(FILE *fout, struct mlx5dv_dr_domain *dmn)
 	if (!fout || !dmn)
 		return -EINVAL;
 
-	pthread_mutex_lock(&dmn->mutex);
+	dr_domain_lock(dmn);
 
 	ret = dr_dump_domain_all(fout, dmn);
 
-	pthread_mutex_unlock(&dmn->mutex);
+	dr_domain_unlock(dmn);
 
 	return ret;
 }
@@ -40,6 +40,27 @@ enum {
 		 MLX5DV_DR_DOMAIN_SYNC_FLAGS_HW),
 };
 
+/*
+ * Take the domain for a table or matcher change. Rules may be in flight on
+ * any send ring, and rules written after the change must not overtake it,
+ * so all the rings are drained on both sides of the change.
+ */
+void dr_domain_lock(struct mlx5dv_dr_domain *dmn)
+{
+	pthread_mutex_lock(&dmn->mutex);
+	pthread_rwlock_wrlock(&dmn->rule_rwlock);
+	if (dmn->info.supp_sw_steering)
+		dr_send_ring_force_drain(dmn);
+}
+
+void dr_domain_unlock(struct mlx5dv_dr_domain *dmn)
+{
+	if (dmn->info.supp_sw_steering)
+		dr_send_ring_force_drain(dmn);
+	pthread_rwlock_unlock(&dmn->rule_rwlock);
+	pthread_mutex_unlock(&dmn->mutex);
+}
+
 static int dr_domain_init_resources(struct mlx5dv_dr_domain *dmn)
 {
 	int ret = -1;
@@ -93,7 +114,7 @@ clean_pd:
 
 static void dr_free_resources(struct mlx5dv_dr_domain *dmn)
 {
-	dr_send_ring_free(dmn->send_ring);
+	dr_send_ring_free(dmn);
 	dr_icm_pool_destroy(dmn->action_icm_pool);
 	dr_icm_pool_destroy(dmn->ste_icm_pool);
 	mlx5dv_devx_free_uar(dmn->uar);
@@ -280,6 +301,8 @@ mlx5dv_dr_domain_create(struct ibv_context *ctx,
 	dmn->type = type;
 	atomic_init(&dmn->refcount, 1);
 	list_head_init(&dmn->tbl_list);
+	pthread_mutex_init(&dmn->mutex, NULL);
+	pthread_rwlock_init(&dmn->rule_rwlock, NULL);
 
 	if (dr_domain_caps_init(ctx, dmn)) {
 		dr_dbg(dmn, "Failed init domain, no caps\n");
@@ -328,20 +351,15 @@ int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *dmn, uint32_t flags)
 	if (flags & MLX5DV_DR_DOMAIN_SYNC_FLAGS_SW) {
 		pthread_mutex_lock(&dmn->mutex);
 		ret = dr_send_ring_force_drain(dmn);
-		if (ret)
-			goto out_unlock;
-
 		pthread_mutex_unlock(&dmn->mutex);
+		if (ret)
+			return ret;
 	}
 
 	if (flags & MLX5DV_DR_DOMAIN_SYNC_FLAGS_HW)
 		ret = dr_devx_sync_steering(dmn->ctx);
 
 	return ret;
-
-out_unlock:
-	pthread_mutex_unlock(&dmn->mutex);
-	return ret;
 }
 
 void mlx5dv_dr_domain_set_reclaim_device_memory(struct mlx5dv_dr_domain *dmn,
@@ -368,6 +386,8 @@ int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *dmn)
 
 	dr_domain_caps_uninit(dmn);
 
+	pthread_rwlock_destroy(&dmn->rule_rwlock);
+	pthread_mutex_destroy(&dmn->mutex);
 	free(dmn);
 	return 0;
 }
@@ -319,6 +319,16 @@ static int dr_icm_pool_sync_all_buddy_pools(struct dr_icm_pool *pool)
 	struct dr_icm_buddy_mem *buddy, *tmp_buddy;
 	int err;
 
+	/*
+	 * Rules are written on several send rings, make sure no write that
+	 * unlinked a hot chunk is still in flight before releasing it.
+	 */
+	err = dr_send_ring_force_drain(pool->dmn);
+	if (err) {
+		dr_dbg(pool->dmn, "Failed draining send rings\n");
+		return err;
+	}
+
 	err = dr_devx_sync_steering(pool->dmn->ctx);
 	if (err) {
 		dr_dbg(pool->dmn, "Failed devx sync hw\n");
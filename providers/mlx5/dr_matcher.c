@@ -462,7 +462,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 		info.type = CONNECT_MISS;
 		info.miss_icm_addr = nic_dmn->default_icm_addr;
 	}
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
 					    curr_nic_matcher->e_anchor,
 					    &info, info.type == CONNECT_HIT);
 	if (ret)
@@ -471,7 +471,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	/* Connect start hash table to end anchor */
 	info.type = CONNECT_MISS;
 	info.miss_icm_addr = curr_nic_matcher->e_anchor->chunk->icm_addr;
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
 					    curr_nic_matcher->s_htbl,
 					    &info, false);
 	if (ret)
@@ -485,7 +485,8 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 
 	info.type = CONNECT_HIT;
 	info.hit_next_htbl = curr_nic_matcher->s_htbl;
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_htbl,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0],
+					    nic_dmn, prev_htbl,
 					    &info, true);
 	if (ret)
 		return ret;
@@ -756,8 +757,12 @@ mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *tbl,
 	atomic_init(&matcher->refcount, 1);
 	list_node_init(&matcher->matcher_list);
 	list_head_init(&matcher->rule_list);
+	pthread_mutex_init(&matcher->mutex, NULL);
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_domain_lock(tbl->dmn);
+
+	if (!dr_is_root_table(tbl) && tbl->dmn->info.supp_sw_steering)
+		matcher->send_ring = dr_send_ring_select(tbl->dmn);
 
 	ret = dr_matcher_init(matcher, mask);
 	if (ret)
@@ -767,14 +772,15 @@ mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *tbl,
 	if (ret)
 		goto matcher_uninit;
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
 
 	return matcher;
 
 matcher_uninit:
 	dr_matcher_uninit(matcher);
 free_matcher:
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 dec_ref:
 	atomic_fetch_sub(&tbl->refcount, 1);
@@ -807,8 +813,8 @@ static int dr_matcher_disconnect(struct mlx5dv_dr_domain *dmn,
 		prev_anchor->ste_arr[0].next_htbl = NULL;
 	}
 
-	return dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_anchor,
-					     &info, true);
+	return dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
+					     prev_anchor, &info, true);
 }
 
 static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
@@ -854,13 +860,14 @@ int mlx5dv_dr_matcher_destroy(struct mlx5dv_dr_matcher *matcher)
 	if (atomic_load(&matcher->refcount) > 1)
 		return EBUSY;
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_domain_lock(tbl->dmn);
 
 	dr_matcher_remove_from_tbl(matcher);
 	dr_matcher_uninit(matcher);
 	atomic_fetch_sub(&matcher->tbl->refcount, 1);
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 
 	return 0;
@@ -123,12 +123,13 @@ free_tbl:
 }
 
 static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
-						 struct mlx5dv_dr_domain *dmn)
+						 struct mlx5dv_dr_domain *dmn,
+						 struct dr_send_ring *send_ring)
 {
 	int ret;
 
 	list_del(&ste_info->send_list);
-	ret = dr_send_postsend_ste(dmn, ste_info->ste, ste_info->data,
+	ret = dr_send_postsend_ste(dmn, send_ring, ste_info->ste, ste_info->data,
 				   ste_info->size, ste_info->offset);
 	if (ret)
 		goto out;
@@ -144,6 +145,7 @@ out:
 
 static int dr_rule_send_update_list(struct list_head *send_ste_list,
 				    struct mlx5dv_dr_domain *dmn,
+				    struct dr_send_ring *send_ring,
 				    bool is_reverse)
 {
 	struct dr_ste_send_info *ste_info, *tmp_ste_info;
@@ -153,7 +155,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_rev_safe(send_ste_list, ste_info, tmp_ste_info,
 				       send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    send_ring);
 			if (ret)
 				return ret;
 		}
@@ -161,7 +164,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_safe(send_ste_list, ste_info, tmp_ste_info,
 				   send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    send_ring);
 			if (ret)
 				return ret;
 		}
@@ -419,7 +423,7 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 	if (err)
 		goto free_new_htbl;
 
-	if (dr_send_postsend_htbl(dmn, new_htbl, formated_ste,
+	if (dr_send_postsend_htbl(dmn, matcher->send_ring, new_htbl, formated_ste,
 				  nic_matcher->ste_builder[ste_location - 1].bit_mask)) {
 		dr_dbg(dmn, "Failed writing table to HW\n");
 		goto free_new_htbl;
@@ -430,7 +434,8 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 	 * in order to have the origin data written before the miss address of
 	 * collision entries, if exists.
 	 */
-	if (dr_rule_send_update_list(&rehash_table_send_list, dmn, false)) {
+	if (dr_rule_send_update_list(&rehash_table_send_list, dmn,
+				     matcher->send_ring, false)) {
 		dr_dbg(dmn, "Failed updating table to HW\n");
 		goto free_ste_list;
 	}
@@ -1109,7 +1114,8 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 		dr_dbg(dmn, "Failed apply actions\n");
 		goto free_rule;
 	}
-	ret = dr_rule_send_update_list(&send_ste_list, dmn, true);
+	ret = dr_rule_send_update_list(&send_ste_list, dmn,
+				       matcher->send_ring, true);
 	if (ret) {
 		dr_dbg(dmn, "Failed sending ste!\n");
 		goto free_rule;
@@ -1301,7 +1307,7 @@ struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 {
 	struct mlx5dv_dr_rule *rule;
 
-	pthread_mutex_lock(&matcher->tbl->dmn->mutex);
+	dr_matcher_lock(matcher);
 	atomic_fetch_add(&matcher->refcount, 1);
 
 	if (dr_is_root_table(matcher->tbl))
@@ -1312,7 +1318,7 @@ struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 	if (!rule)
 		atomic_fetch_sub(&matcher->refcount, 1);
 
-	pthread_mutex_unlock(&matcher->tbl->dmn->mutex);
+	dr_matcher_unlock(matcher);
 
 	return rule;
 }
@@ -1323,14 +1329,14 @@ int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
 	struct mlx5dv_dr_table *tbl = rule->matcher->tbl;
 	int ret;
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_matcher_lock(matcher);
 
 	if (dr_is_root_table(tbl))
 		ret = dr_rule_destroy_rule_root(rule);
 	else
 		ret = dr_rule_destroy_rule(rule);
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_matcher_unlock(matcher);
 
 	if (!ret)
 		atomic_fetch_sub(&matcher->refcount, 1);
@@ -558,7 +558,7 @@ static int dr_handle_pending_wc(struct mlx5dv_dr_domain *dmn,
 
 	if (send_ring->pending_wqe >= send_ring->signal_th) {
 		/* Queue is full start drain it */
-		if (send_ring->pending_wqe >= dmn->send_ring->signal_th * TH_NUMS_TO_DRAIN)
+		if (send_ring->pending_wqe >= send_ring->signal_th * TH_NUMS_TO_DRAIN)
 			is_drain = true;
 
 		do {
@@ -616,10 +616,11 @@ static void dr_fill_data_segs(struct dr_send_ring *send_ring,
 		send_info->read.send_flags = 0;
 }
 
+/* Caller must hold the send ring mutex */
 static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
+				struct dr_send_ring *send_ring,
 				struct postsend_info *send_info)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
 	uint32_t buff_offset;
 	int ret;
 
@@ -628,7 +629,7 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 		return ret;
 
 	if (send_info->write.length > dmn->info.max_inline_size) {
-		buff_offset = (send_ring->tx_head & (dmn->send_ring->signal_th - 1)) *
+		buff_offset = (send_ring->tx_head & (send_ring->signal_th - 1)) *
 			send_ring->max_post_send_size;
 		/* Copy to ring mr */
 		memcpy(send_ring->buf + buff_offset,
@@ -645,7 +646,7 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 	return 0;
 }
 
-static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
+static int dr_get_tbl_copy_details(struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t **data,
 				   uint32_t *byte_size,
@@ -654,9 +655,9 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
 {
 	int alloc_size;
 
-	if (htbl->chunk->byte_size > dmn->send_ring->max_post_send_size) {
-		*iterations = htbl->chunk->byte_size / dmn->send_ring->max_post_send_size;
-		*byte_size = dmn->send_ring->max_post_send_size;
+	if (htbl->chunk->byte_size > send_ring->max_post_send_size) {
+		*iterations = htbl->chunk->byte_size / send_ring->max_post_send_size;
+		*byte_size = send_ring->max_post_send_size;
 		alloc_size = *byte_size;
 		*num_stes = *byte_size / DR_STE_SIZE;
 	} else {
@@ -678,7 +679,8 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
  * dr_postsend_ste: write size bytes into offset from the hw icm.
  *
  * Input:
- *     dmn     - Domain
+ *     dmn       - Domain
+ *     send_ring - The ring to post on, all writes to one matcher use one ring
  *     ste     - The ste struct that contains the data (at least part of it)
  *     data    - The real data to send
  *     size    - data size for writing.
@@ -687,10 +689,12 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
  *
  * Return: 0 on success.
  */
-int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset)
 {
 	struct postsend_info send_info = {};
+	int ret;
 
 	send_info.write.addr    = (uintptr_t) data;
 	send_info.write.length  = size;
@@ -698,10 +702,16 @@ int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 	send_info.remote_addr   = dr_ste_get_mr_addr(ste) + offset;
 	send_info.rkey          = ste->htbl->chunk->rkey;
 
-	return dr_postsend_icm_data(dmn, &send_info);
+	pthread_mutex_lock(&send_ring->mutex);
+	ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
+	pthread_mutex_unlock(&send_ring->mutex);
+
+	return ret;
 }
 
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
 			  uint8_t *formated_ste, uint8_t *mask)
 {
 	uint32_t byte_size = htbl->chunk->byte_size;
@@ -709,11 +719,13 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 	uint8_t *data;
 	int ret;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
+	ret = dr_get_tbl_copy_details(send_ring, htbl, &data, &byte_size,
 				      &iterations, &num_stes_per_iter);
 	if (ret)
 		return ret;
 
+	pthread_mutex_lock(&send_ring->mutex);
+
 	/* Send the data iteration times */
 	for (i = 0; i < iterations; i++) {
 		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
@@ -740,18 +752,20 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
 			goto out_free;
 	}
 
 out_free:
+	pthread_mutex_unlock(&send_ring->mutex);
 	free(data);
 	return ret;
 }
 
 /* Initialize htble with default STEs */
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
 				   bool update_hw_ste)
@@ -760,7 +774,7 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 	int i, num_stes, iterations, ret;
 	uint8_t *data;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
+	ret = dr_get_tbl_copy_details(send_ring, htbl, &data, &byte_size,
 				      &iterations, &num_stes);
 	if (ret)
 		return ret;
@@ -779,6 +793,7 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 		}
 	}
 
+	pthread_mutex_lock(&send_ring->mutex);
 	/* Send the data iteration times */
 	for (i = 0; i < iterations; i++) {
 		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
@@ -790,19 +805,24 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
 			goto out_free;
 	}
 
 out_free:
+	pthread_mutex_unlock(&send_ring->mutex);
 	free(data);
 	return ret;
 }
 
+static int dr_send_ring_drain(struct mlx5dv_dr_domain *dmn,
+			      struct dr_send_ring *send_ring);
+
 int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 			    struct mlx5dv_dr_action *action)
 {
+	struct dr_send_ring *send_ring = dmn->send_ring[0];
 	struct postsend_info send_info = {};
 	int ret;
 
@@ -813,18 +833,25 @@ int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 	send_info.remote_addr	= action->rewrite.chunk->mr_addr;
 	send_info.rkey		= action->rewrite.chunk->rkey;
 
-	pthread_mutex_lock(&dmn->mutex);
-	ret = dr_postsend_icm_data(dmn, &send_info);
-	pthread_mutex_unlock(&dmn->mutex);
+	/*
+	 * Rules referencing the action may be posted on another ring right
+	 * after we return, make sure the action data already reached ICM.
+	 */
+	pthread_mutex_lock(&send_ring->mutex);
+	ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
+	if (!ret)
+		ret = dr_send_ring_drain(dmn, send_ring);
+	pthread_mutex_unlock(&send_ring->mutex);
 
 	return ret;
 }
 
-static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
+static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn,
+				struct dr_send_ring *send_ring)
 {
 	struct dr_devx_qp_rts_attr rts_attr = {};
 	struct dr_devx_qp_rtr_attr rtr_attr = {};
-	struct dr_qp *dr_qp = dmn->send_ring->qp;
+	struct dr_qp *dr_qp = send_ring->qp;
 	enum ibv_mtu mtu = IBV_MTU_1024;
 	uint16_t gid_index = 0;
 	int port = 1;
@@ -870,10 +897,11 @@ static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
 	return 0;
 }
 
-/* Each domain has its own ib resources */
-int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
+static int dr_send_ring_create(struct mlx5dv_dr_domain *dmn,
+			       struct dr_send_ring **ring)
 {
 	struct dr_qp_init_attr init_attr = {};
+	struct dr_send_ring *send_ring;
 	struct mlx5dv_pd mlx5_pd = {};
 	struct mlx5dv_cq mlx5_cq = {};
 	int cq_size, page_size;
@@ -883,33 +911,33 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 			   IBV_ACCESS_REMOTE_READ;
 	int ret;
 
-	dmn->send_ring = calloc(1, sizeof(*dmn->send_ring));
-	if (!dmn->send_ring) {
+	send_ring = calloc(1, sizeof(*send_ring));
+	if (!send_ring) {
 		dr_dbg(dmn, "Couldn't allocate send-ring\n");
 		errno = ENOMEM;
 		return errno;
 	}
 
 	cq_size = QUEUE_SIZE + 1;
-	dmn->send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
-	if (!dmn->send_ring->cq.ibv_cq) {
+	send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
+	if (!send_ring->cq.ibv_cq) {
 		dr_dbg(dmn, "Failed to create CQ with %u entries\n", cq_size);
 		ret = ENODEV;
 		errno = ENODEV;
 		goto free_send_ring;
 	}
 
-	obj.cq.in = dmn->send_ring->cq.ibv_cq;
+	obj.cq.in = send_ring->cq.ibv_cq;
 	obj.cq.out = &mlx5_cq;
 
 	ret = mlx5dv_init_obj(&obj, MLX5DV_OBJ_CQ);
 	if (ret)
 		goto clean_cq;
 
-	dmn->send_ring->cq.buf = mlx5_cq.buf;
-	dmn->send_ring->cq.db = mlx5_cq.dbrec;
-	dmn->send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
-	dmn->send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
+	send_ring->cq.buf = mlx5_cq.buf;
+	send_ring->cq.db = mlx5_cq.dbrec;
+	send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
+	send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
 
 	obj.pd.in = dmn->pd;
 	obj.pd.out = &mlx5_pd;
@@ -927,91 +955,162 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 	init_attr.cap.max_recv_sge	= 1;
 	init_attr.cap.max_inline_data	= DR_STE_SIZE;
 
-	dmn->send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
-	if (!dmn->send_ring->qp)  {
+	send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
+	if (!send_ring->qp)  {
 		dr_dbg(dmn, "Couldn't create QP\n");
 		ret = errno;
 		goto clean_cq;
 	}
-	dmn->send_ring->cq.qp = dmn->send_ring->qp;
+	send_ring->cq.qp = send_ring->qp;
 
-	dmn->info.max_send_wr = QUEUE_SIZE;
-	dmn->info.max_inline_size = min(dmn->send_ring->qp->max_inline_data,
-					DR_STE_SIZE);
+	/* The domain limits are set by the first ring, see dr_send_ring_alloc */
+	if (send_ring->qp->max_inline_data < dmn->info.max_inline_size) {
+		dr_dbg(dmn, "Send-ring QP inline size too small\n");
+		ret = EINVAL;
+		errno = EINVAL;
+		goto clean_qp;
+	}
 
-	dmn->send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
+	send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
 
 	/* Prepare qp to be used */
-	ret = dr_prepare_qp_to_rts(dmn);
+	ret = dr_prepare_qp_to_rts(dmn, send_ring);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't prepare QP\n");
 		goto clean_qp;
 	}
 
-	dmn->send_ring->max_post_send_size =
+	send_ring->max_post_send_size =
 		dr_icm_pool_chunk_size_to_byte(DR_CHUNK_SIZE_1K, DR_ICM_TYPE_STE);
 
 	/* Allocating the max size as a buffer for writing */
-	size = dmn->send_ring->signal_th * dmn->send_ring->max_post_send_size;
+	size = send_ring->signal_th * send_ring->max_post_send_size;
 	page_size = sysconf(_SC_PAGESIZE);
-	ret = posix_memalign(&dmn->send_ring->buf, page_size, size);
+	ret = posix_memalign(&send_ring->buf, page_size, size);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't allocate send-ring buf.\n");
 		errno = ret;
 		goto clean_qp;
 	}
 
-	memset(dmn->send_ring->buf, 0, size);
-	dmn->send_ring->buf_size = size;
+	memset(send_ring->buf, 0, size);
+	send_ring->buf_size = size;
 
-	dmn->send_ring->mr = ibv_reg_mr(dmn->pd, dmn->send_ring->buf, size,
-					access_flags);
-	if (!dmn->send_ring->mr) {
+	send_ring->mr = ibv_reg_mr(dmn->pd, send_ring->buf, size, access_flags);
+	if (!send_ring->mr) {
 		dr_dbg(dmn, "Couldn't register send-ring MR\n");
 		ret = errno;
 		goto free_mem;
 	}
 
-	dmn->send_ring->sync_mr = ibv_reg_mr(dmn->pd, dmn->send_ring->sync_buff,
-					     MIN_READ_SYNC,
-					     IBV_ACCESS_LOCAL_WRITE |
-					     IBV_ACCESS_REMOTE_READ |
-					     IBV_ACCESS_REMOTE_WRITE);
-	if (!dmn->send_ring->sync_mr) {
+	send_ring->sync_mr = ibv_reg_mr(dmn->pd, send_ring->sync_buff,
+					MIN_READ_SYNC,
+					IBV_ACCESS_LOCAL_WRITE |
+					IBV_ACCESS_REMOTE_READ |
+					IBV_ACCESS_REMOTE_WRITE);
+	if (!send_ring->sync_mr) {
 		dr_dbg(dmn, "Couldn't register sync mr\n");
 		ret = errno;
 		goto clean_mr;
 	}
 
+	pthread_mutex_init(&send_ring->mutex, NULL);
+	*ring = send_ring;
+
 	return 0;
 
 clean_mr:
-	ibv_dereg_mr(dmn->send_ring->mr);
+	ibv_dereg_mr(send_ring->mr);
 free_mem:
-	free(dmn->send_ring->buf);
+	free(send_ring->buf);
 clean_qp:
-	dr_destroy_qp(dmn->send_ring->qp);
+	dr_destroy_qp(send_ring->qp);
 clean_cq:
-	ibv_destroy_cq(dmn->send_ring->cq.ibv_cq);
+	ibv_destroy_cq(send_ring->cq.ibv_cq);
 free_send_ring:
-	free(dmn->send_ring);
+	free(send_ring);
 
 	return ret;
 }
 
-void dr_send_ring_free(struct dr_send_ring *send_ring)
+static void dr_send_ring_destroy(struct dr_send_ring *send_ring)
 {
 	dr_destroy_qp(send_ring->qp);
 	ibv_destroy_cq(send_ring->cq.ibv_cq);
 	ibv_dereg_mr(send_ring->sync_mr);
 	ibv_dereg_mr(send_ring->mr);
+	pthread_mutex_destroy(&send_ring->mutex);
 	free(send_ring->buf);
 	free(send_ring);
 }
 
-int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+/*
+ * Each domain has its own ib resources. Only the first send ring is
+ * created up front, the rest are created on demand by dr_send_ring_select.
+ * The send limits of the domain are taken from the first ring, as the
+ * rings are used concurrently once there is more than one.
+ */
+int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_send_ring *send_ring;
+	int ret;
+
+	dmn->info.max_send_wr = QUEUE_SIZE;
+	dmn->info.max_inline_size = 0;
+	ret = dr_send_ring_create(dmn, &send_ring);
+	if (ret)
+		return ret;
+
+	dmn->info.max_inline_size = min(send_ring->qp->max_inline_data,
+					DR_STE_SIZE);
+	atomic_store_explicit(&dmn->send_ring[0], send_ring,
+			      memory_order_release);
+	return 0;
+}
+
+/*
+ * Pick the send ring a new matcher will post its STEs on. Rings are handed
+ * out round robin so rule insertion into different matchers does not
+ * serialize on a single QP, while all writes of one matcher keep their order.
+ * Caller must hold the domain lock.
+ */
+struct dr_send_ring *dr_send_ring_select(struct mlx5dv_dr_domain *dmn)
+{
+	uint32_t idx = dmn->next_send_ring++ % DR_MAX_SEND_RINGS;
+	struct dr_send_ring *send_ring;
+
+	send_ring = atomic_load_explicit(&dmn->send_ring[idx],
+					 memory_order_relaxed);
+	if (send_ring)
+		return send_ring;
+
+	if (dr_send_ring_create(dmn, &send_ring)) {
+		dr_dbg(dmn, "Couldn't allocate send-ring %u, using ring 0\n", idx);
+		return dmn->send_ring[0];
+	}
+
+	/* dr_send_ring_force_drain may look at the ring without our lock */
+	atomic_store_explicit(&dmn->send_ring[idx], send_ring,
+			      memory_order_release);
+	return send_ring;
+}
+
+void dr_send_ring_free(struct mlx5dv_dr_domain *dmn)
+{
+	int i;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		if (!dmn->send_ring[i])
+			continue;
+		dr_send_ring_destroy(dmn->send_ring[i]);
+		dmn->send_ring[i] = NULL;
+	}
+}
+
+/* Caller must hold the send ring mutex */
+static int dr_send_ring_drain(struct mlx5dv_dr_domain *dmn,
+			      struct dr_send_ring *send_ring)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
 	struct postsend_info send_info = {};
 	uint8_t data[DR_STE_SIZE];
 	int i, num_of_sends_req;
@@ -1030,7 +1129,7 @@ int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
 
 
 	for (i = 0; i < num_of_sends_req; i++) {
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
 			return ret;
 	}
@@ -1039,3 +1138,24 @@ int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
 
 	return ret;
 }
+
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_send_ring *send_ring;
+	int i, ret;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		send_ring = atomic_load_explicit(&dmn->send_ring[i],
+						 memory_order_acquire);
+		if (!send_ring)
+			continue;
+
+		pthread_mutex_lock(&send_ring->mutex);
+		ret = dr_send_ring_drain(dmn, send_ring);
+		pthread_mutex_unlock(&send_ring->mutex);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
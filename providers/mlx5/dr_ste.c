@@ -170,7 +170,7 @@ uint32_t dr_ste_calc_hash_index(uint8_t *hw_ste_p,
 		bit = bit >> 1;
 	}
 
-	crc32 = dr_crc32_slice8_calc(masked, DR_STE_SIZE_TAG);
+	crc32 = dr_crc32_calc(masked, DR_STE_SIZE_TAG);
 	index = crc32 % htbl->chunk->num_of_entries;
 
 	return index;
@@ -503,7 +503,7 @@ void dr_ste_free(struct dr_ste *ste,
 	/* Update HW */
 	list_for_each_safe(&send_ste_list, cur_ste_info, tmp_ste_info, send_list) {
 		list_del(&cur_ste_info->send_list);
-		dr_send_postsend_ste(dmn, cur_ste_info->ste,
+		dr_send_postsend_ste(dmn, matcher->send_ring, cur_ste_info->ste,
 				     cur_ste_info->data, cur_ste_info->size,
 				     cur_ste_info->offset);
 	}
@@ -585,6 +585,7 @@ void dr_ste_set_formated_ste(uint16_t gvmi,
 }
 
 int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
+				  struct dr_send_ring *send_ring,
 				  struct dr_domain_rx_tx *nic_dmn,
 				  struct dr_ste_htbl *htbl,
 				  struct dr_htbl_connect_info *connect_info,
@@ -598,7 +599,8 @@ int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
 				formated_ste,
 				connect_info);
 
-	return dr_send_postsend_formated_htbl(dmn, htbl, formated_ste, update_hw_ste);
+	return dr_send_postsend_formated_htbl(dmn, send_ring, htbl,
+					      formated_ste, update_hw_ste);
 }
 
 int dr_ste_create_next_htbl(struct mlx5dv_dr_matcher *matcher,
@@ -632,7 +634,8 @@ int dr_ste_create_next_htbl(struct mlx5dv_dr_matcher *matcher,
 		/* Write new table to HW */
 		info.type = CONNECT_MISS;
 		info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
-		if (dr_ste_htbl_init_and_postsend(dmn, nic_dmn, next_htbl,
+		if (dr_ste_htbl_init_and_postsend(dmn, matcher->send_ring,
+						  nic_dmn, next_htbl,
 						  &info, false)) {
 			dr_dbg(dmn, "Failed writing table to HW\n");
 			goto free_table;
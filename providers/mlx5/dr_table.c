@@ -46,7 +46,7 @@ static void dr_table_uninit_fdb(struct mlx5dv_dr_table *tbl)
 
 static void dr_table_uninit(struct mlx5dv_dr_table *tbl)
 {
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_domain_lock(tbl->dmn);
 
 	switch (tbl->dmn->type) {
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
@@ -62,7 +62,7 @@ static void dr_table_uninit(struct mlx5dv_dr_table *tbl)
 		break;
 	}
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
 }
 
 static int dr_table_init_nic(struct mlx5dv_dr_domain *dmn,
@@ -81,7 +81,8 @@ static int dr_table_init_nic(struct mlx5dv_dr_domain *dmn,
 
 	info.type = CONNECT_MISS;
 	info.miss_icm_addr = nic_dmn->default_icm_addr;
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, nic_tbl->s_anchor,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0],
+					    nic_dmn, nic_tbl->s_anchor,
 					    &info, true);
 	if (ret)
 		goto free_s_anchor;
@@ -120,7 +121,7 @@ static int dr_table_init(struct mlx5dv_dr_table *tbl)
 
 	list_head_init(&tbl->matcher_list);
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
+	dr_domain_lock(tbl->dmn);
 
 	switch (tbl->dmn->type) {
 	case MLX5DV_DR_DOMAIN_TYPE_NIC_RX:
@@ -144,7 +145,7 @@ static int dr_table_init(struct mlx5dv_dr_table *tbl)
 		break;
 	}
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
+	dr_domain_unlock(tbl->dmn);
 
 	return ret;
 }
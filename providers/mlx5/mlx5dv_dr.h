@@ -619,6 +619,15 @@ enum dr_domain_flags {
 	 DR_DOMAIN_FLAG_MEMORY_RECLAIM = 1 << 0,
 };
 
+#define DR_MAX_SEND_RINGS	4
+
+/*
+ * Locking: table and matcher changes hold dmn->mutex plus rule_rwlock for
+ * writing (dr_domain_lock). Rule insertion and deletion hold rule_rwlock
+ * for reading plus the matcher's own mutex (dr_matcher_lock), so rules of
+ * different matchers are inserted in parallel. Each send ring and ICM pool
+ * has its own mutex, which is taken last.
+ */
 struct mlx5dv_dr_domain {
 	struct ibv_context		*ctx;
 	struct ibv_pd			*pd;
@@ -626,9 +635,12 @@ struct mlx5dv_dr_domain {
 	enum mlx5dv_dr_domain_type	type;
 	atomic_int			refcount;
 	pthread_mutex_t			mutex;
+	pthread_rwlock_t		rule_rwlock;
 	struct dr_icm_pool		*ste_icm_pool;
 	struct dr_icm_pool		*action_icm_pool;
-	struct dr_send_ring		*send_ring;
+	/* published by dr_send_ring_select, read without the domain lock */
+	_Atomic(struct dr_send_ring *)	send_ring[DR_MAX_SEND_RINGS];
+	uint32_t			next_send_ring;
 	struct dr_domain_info		info;
 	struct list_head		tbl_list;
 	uint32_t			flags;
@@ -671,8 +683,26 @@ struct mlx5dv_dr_matcher {
 	atomic_int			refcount;
 	struct mlx5dv_flow_matcher	*dv_matcher;
 	struct list_head		rule_list;
+	pthread_mutex_t			mutex;
+	/* All STE writes of this matcher are ordered on one ring */
+	struct dr_send_ring		*send_ring;
 };
 
+void dr_domain_lock(struct mlx5dv_dr_domain *dmn);
+void dr_domain_unlock(struct mlx5dv_dr_domain *dmn);
+
+static inline void dr_matcher_lock(struct mlx5dv_dr_matcher *matcher)
+{
+	pthread_rwlock_rdlock(&matcher->tbl->dmn->rule_rwlock);
+	pthread_mutex_lock(&matcher->mutex);
+}
+
+static inline void dr_matcher_unlock(struct mlx5dv_dr_matcher *matcher)
+{
+	pthread_mutex_unlock(&matcher->mutex);
+	pthread_rwlock_unlock(&matcher->tbl->dmn->rule_rwlock);
+}
+
 struct dr_rule_member {
 	struct dr_ste		*ste;
 	/* attached to dr_rule via this */
@@ -944,6 +974,7 @@ struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 void dr_icm_free_chunk(struct dr_icm_chunk *chunk);
 bool dr_ste_is_not_valid_entry(uint8_t *p_hw_ste);
 int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
+				  struct dr_send_ring *send_ring,
 				  struct dr_domain_rx_tx *nic_dmn,
 				  struct dr_ste_htbl *htbl,
 				  struct dr_htbl_connect_info *connect_info,
@@ -959,6 +990,8 @@ void dr_ste_copy_param(uint8_t match_criteria,
 
 void dr_crc32_init_table(void);
 uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length);
+/* Same result as dr_crc32_slice8_calc(), using CRC instructions if present */
+uint32_t dr_crc32_calc(const void *input_data, size_t length);
 
 struct dr_wq {
 	unsigned	*wqe_head;
@@ -1002,6 +1035,7 @@ struct dr_cq {
 #define MIN_READ_SYNC		64
 
 struct dr_send_ring {
+	pthread_mutex_t		mutex;
 	struct dr_cq		cq;
 	struct dr_qp		*qp;
 	struct ibv_mr		*mr;
@@ -1021,13 +1055,18 @@ struct dr_send_ring {
 };
 
 int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn);
-void dr_send_ring_free(struct dr_send_ring *send_ring);
+void dr_send_ring_free(struct mlx5dv_dr_domain *dmn);
+struct dr_send_ring *dr_send_ring_select(struct mlx5dv_dr_domain *dmn);
 int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn);
-int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset);
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
 			  uint8_t *formated_ste, uint8_t *mask);
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
 				   bool update_hw_ste);
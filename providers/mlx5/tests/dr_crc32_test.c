@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Device-free test of the STE hash CRC: every implementation this CPU
+ * supports is checked against a bit at a time CRC over all lengths and
+ * alignments up to a few blocks, then timed hashing STE sized tags.
+ */
+
+#include <stdio.h>
+#include <getopt.h>
+#include <time.h>
+
+/* Built in, so the test can reach each implementation directly */
+#include "../dr_crc32.c"
+
+#define TEST_MAX_LEN	256
+#define TEST_MAX_OFFSET	16
+
+struct crc_impl {
+	const char		*name;
+	dr_crc32_calc_fn_t	calc;
+	bool			supported;
+};
+
+static struct crc_impl impls[] = {
+	{ "slice8", dr_crc32_slice8_calc, true },
+#if defined(__x86_64__)
+	{ "pclmul", dr_crc32_pclmul_calc, false },
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	{ "armv8", dr_crc32_armv8_calc, false },
+#endif
+	{ "selected", dr_crc32_calc, true },
+};
+
+#define NUM_IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/* Keeps the benchmark loop from being optimized away */
+static volatile uint32_t crc_sink;
+
+static void detect_impls(void)
+{
+	unsigned int i;
+
+	for (i = 1; i < NUM_IMPLS - 1; i++) {
+#if defined(__x86_64__)
+		impls[i].supported = dr_crc32_have_pclmul();
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		impls[i].supported = !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+#endif
+	}
+}
+
+/* The STE hash bit by bit: reflected CRC32, no inversion, byte swapped */
+static uint32_t ref_crc32(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0;
+	int bit;
+
+	while (length--) {
+		crc ^= *data++;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (crc & 1 ? DR_STE_CRC_POLY : 0);
+	}
+	return __builtin_bswap32(crc);
+}
+
+static int check_buf(const uint8_t *buf, size_t length, const char *what)
+{
+	uint32_t expected = ref_crc32(buf, length), crc;
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < NUM_IMPLS; i++) {
+		if (!impls[i].supported)
+			continue;
+
+		crc = impls[i].calc(buf, length);
+		if (crc != expected) {
+			fprintf(stderr,
+				"%s: %s data length %zu: 0x%08x expected 0x%08x\n",
+				impls[i].name, what, length, crc, expected);
+			err++;
+		}
+	}
+	return err;
+}
+
+static int test_correctness(void)
+{
+	static uint8_t data[TEST_MAX_LEN + TEST_MAX_OFFSET];
+	size_t length, offset;
+	unsigned int i;
+	int err = 0;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	for (length = 0; length <= TEST_MAX_LEN; length++)
+		for (offset = 0; offset < TEST_MAX_OFFSET; offset++)
+			err += check_buf(data + offset, length, "random");
+
+	memset(data, 0, sizeof(data));
+	err += check_buf(data, DR_STE_SIZE_TAG, "zero");
+	memset(data, 0xff, sizeof(data));
+	err += check_buf(data, DR_STE_SIZE_TAG, "ones");
+
+	/* A tag masked by a partial byte mask, as dr_ste_calc_hash_index() does */
+	for (i = 0; i < DR_STE_SIZE_TAG; i++)
+		data[i] = (i & 3) ? 0 : i * 0x11;
+	err += check_buf(data, DR_STE_SIZE_TAG, "masked");
+
+	printf("correctness: %s\n", err ? "FAIL" : "ok");
+	return err;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(unsigned int iterations, size_t length)
+{
+	uint8_t *tags;
+	uint32_t sum;
+	double start, elapsed, base = 0;
+	unsigned int i, n, ntags = 1024;
+
+	tags = malloc(ntags * length);
+	if (!tags)
+		return;
+	for (i = 0; i < ntags * length; i++)
+		tags[i] = rand();
+
+	printf("%-10s %12s %12s %8s\n", "impl", "ns/hash", "Mhash/s", "speedup");
+	for (i = 0; i < NUM_IMPLS; i++) {
+		if (!impls[i].supported)
+			continue;
+
+		sum = 0;
+		start = now_ns();
+		for (n = 0; n < iterations; n++)
+			sum += impls[i].calc(tags + (n % ntags) * length,
+					     length);
+		elapsed = now_ns() - start;
+		crc_sink = sum;
+		if (!base)
+			base = elapsed;
+
+		printf("%-10s %12.2f %12.2f %7.2fx\n", impls[i].name,
+		       elapsed / iterations, iterations * 1e3 / elapsed,
+		       base / elapsed);
+	}
+	free(tags);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int iterations = 10000000;
+	size_t length = DR_STE_SIZE_TAG;
+	int op, err;
+
+	while ((op = getopt(argc, argv, "n:l:")) != -1) {
+		switch (op) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'l':
+			length = atoi(optarg);
+			break;
+		default:
+			printf("usage: %s [-n iterations] [-l length]\n",
+			       argv[0]);
+			exit(1);
+		}
+	}
+	if (!iterations || !length) {
+		fprintf(stderr, "invalid number of iterations or length\n");
+		exit(1);
+	}
+
+	dr_crc32_init_table();
+	detect_impls();
+
+	err = test_correctness();
+	bench(iterations, length);
+
+	printf("%s\n", err ? "FAIL" : "PASS");
+	return err ? 1 : 0;
+}
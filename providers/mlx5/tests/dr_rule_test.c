@@ -0,0 +1,638 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Device-free test of the software steering hash logic: dr_rule.c and
+ * dr_ste.c are linked against a fake ICM allocator and fake send rings
+ * that copy every posted write into host memory standing in for ICM.
+ * Rules are inserted until the matcher hash tables rehash, checked
+ * against the emulated ICM image, and removed again, from one thread and
+ * from several threads each driving its own matcher.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../mlx5dv_dr.h"
+
+#define TEST_MAX_THREADS	64
+
+static atomic_int live_chunks;
+static __thread struct dr_send_ring *expected_ring;
+static atomic_int wrong_ring;
+
+/* Fake ICM: each chunk is plain host memory, its address is the ICM address */
+struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
+					enum dr_icm_chunk_size chunk_size)
+{
+	struct dr_icm_chunk *chunk;
+	uint32_t entries = dr_icm_pool_chunk_size_to_entries(chunk_size);
+	void *icm;
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (!chunk)
+		return NULL;
+
+	chunk->num_of_entries = entries;
+	chunk->byte_size = entries * DR_STE_SIZE;
+	chunk->ste_arr = calloc(entries, sizeof(struct dr_ste));
+	chunk->hw_ste_arr = calloc(entries, DR_STE_SIZE_REDUCED);
+	chunk->miss_list = calloc(entries, sizeof(struct list_head));
+	if (!chunk->ste_arr || !chunk->hw_ste_arr || !chunk->miss_list ||
+	    posix_memalign(&icm, chunk->byte_size < 4096 ?
+			   chunk->byte_size : 4096, chunk->byte_size))
+		goto err;
+
+	memset(icm, 0, chunk->byte_size);
+	chunk->icm_addr = (uintptr_t) icm;
+	chunk->mr_addr = (uintptr_t) icm;
+	atomic_fetch_add(&live_chunks, 1);
+	return chunk;
+
+err:
+	free(chunk->miss_list);
+	free(chunk->hw_ste_arr);
+	free(chunk->ste_arr);
+	free(chunk);
+	errno = ENOMEM;
+	return NULL;
+}
+
+void dr_icm_free_chunk(struct dr_icm_chunk *chunk)
+{
+	atomic_fetch_sub(&live_chunks, 1);
+	free((void *) (uintptr_t) chunk->icm_addr);
+	free(chunk->miss_list);
+	free(chunk->hw_ste_arr);
+	free(chunk->ste_arr);
+	free(chunk);
+}
+
+/* Fake send rings: writes land in the fake ICM right away */
+static void test_check_ring(struct dr_send_ring *send_ring)
+{
+	if (expected_ring && send_ring != expected_ring)
+		atomic_fetch_add(&wrong_ring, 1);
+}
+
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
+			 uint8_t *data, uint16_t size, uint16_t offset)
+{
+	test_check_ring(send_ring);
+	pthread_mutex_lock(&send_ring->mutex);
+	memcpy((void *) (uintptr_t) (dr_ste_get_mr_addr(ste) + offset),
+	       data, size);
+	pthread_mutex_unlock(&send_ring->mutex);
+	return 0;
+}
+
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
+			  uint8_t *formated_ste, uint8_t *mask)
+{
+	uint8_t *icm = (uint8_t *) (uintptr_t) htbl->chunk->mr_addr;
+	int i;
+
+	test_check_ring(send_ring);
+	pthread_mutex_lock(&send_ring->mutex);
+	for (i = 0; i < htbl->chunk->num_of_entries; i++) {
+		uint8_t *dst = icm + i * DR_STE_SIZE;
+
+		if (dr_ste_is_not_valid_entry(htbl->hw_ste_arr +
+					      i * DR_STE_SIZE_REDUCED))
+			memcpy(dst, formated_ste, DR_STE_SIZE);
+		else
+			memcpy(dst, htbl->hw_ste_arr + i * DR_STE_SIZE_REDUCED,
+			       DR_STE_SIZE_REDUCED);
+		memcpy(dst + DR_STE_SIZE_REDUCED, mask, DR_STE_SIZE_MASK);
+	}
+	pthread_mutex_unlock(&send_ring->mutex);
+	return 0;
+}
+
+int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
+				   struct dr_ste_htbl *htbl,
+				   uint8_t *ste_init_data,
+				   bool update_hw_ste)
+{
+	uint8_t *icm = (uint8_t *) (uintptr_t) htbl->chunk->mr_addr;
+	int i;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	for (i = 0; i < htbl->chunk->num_of_entries; i++) {
+		memcpy(icm + i * DR_STE_SIZE, ste_init_data, DR_STE_SIZE);
+		if (update_hw_ste)
+			memcpy(htbl->hw_ste_arr + i * DR_STE_SIZE_REDUCED,
+			       ste_init_data, DR_STE_SIZE_REDUCED);
+	}
+	pthread_mutex_unlock(&send_ring->mutex);
+	return 0;
+}
+
+void dr_send_fill_and_append_ste_send_info(struct dr_ste *ste, uint16_t size,
+					   uint16_t offset, uint8_t *data,
+					   struct dr_ste_send_info *ste_info,
+					   struct list_head *send_list,
+					   bool copy_data)
+{
+	ste_info->size		= size;
+	ste_info->ste		= ste;
+	ste_info->offset	= offset;
+
+	if (copy_data) {
+		memcpy(ste_info->data_cont, data, size);
+		ste_info->data = ste_info->data_cont;
+	} else {
+		ste_info->data = data;
+	}
+
+	list_add_tail(send_list, &ste_info->send_list);
+}
+
+/* Rules are created without actions, the last STE just misses */
+int dr_actions_build_ste_arr(struct mlx5dv_dr_matcher *matcher,
+			     struct dr_matcher_rx_tx *nic_matcher,
+			     struct mlx5dv_dr_action *actions[],
+			     uint32_t num_actions,
+			     uint8_t *ste_arr,
+			     uint32_t *new_hw_ste_arr_sz)
+{
+	*new_hw_ste_arr_sz = nic_matcher->num_of_builders;
+	return 0;
+}
+
+int dr_actions_build_attr(struct mlx5dv_dr_matcher *matcher,
+			  struct mlx5dv_dr_action *actions[],
+			  size_t num_actions,
+			  struct mlx5dv_flow_action_attr *attr,
+			  struct mlx5_flow_action_attr_aux *attr_aux)
+{
+	errno = EOPNOTSUPP;
+	return errno;
+}
+
+struct ibv_flow *
+__mlx5dv_create_flow(struct mlx5dv_flow_matcher *flow_matcher,
+		     struct mlx5dv_flow_match_parameters *match_value,
+		     size_t num_actions,
+		     struct mlx5dv_flow_action_attr actions_attr[],
+		     struct mlx5_flow_action_attr_aux actions_attr_aux[])
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+struct test_matcher {
+	struct mlx5dv_dr_table		tbl;
+	struct mlx5dv_dr_matcher	matcher;
+	unsigned int			id;
+};
+
+/* One inserting thread, owning rules [first, first + num_rules) */
+struct test_worker {
+	struct test_matcher		*tm;
+	struct mlx5dv_dr_rule		**rules;
+	unsigned int			first;
+	unsigned int			num_rules;
+	int				failed;
+};
+
+static struct mlx5_context test_mctx;
+static struct mlx5dv_dr_domain test_dmn;
+static struct dr_send_ring test_rings[DR_MAX_SEND_RINGS];
+static struct mlx5dv_flow_match_parameters *test_mask;
+
+static struct mlx5dv_flow_match_parameters *test_alloc_param(void)
+{
+	struct mlx5dv_flow_match_parameters *param;
+	size_t size = DEVX_ST_SZ_BYTES(dr_match_param);
+
+	param = calloc(1, sizeof(*param) + size);
+	if (param)
+		param->match_sz = size;
+	return param;
+}
+
+static void test_set_dmac(struct mlx5dv_flow_match_parameters *param,
+			  uint64_t dmac)
+{
+	DEVX_SET(dr_match_spec, param->match_buf, dmac_47_16, dmac >> 16);
+	DEVX_SET(dr_match_spec, param->match_buf, dmac_15_0, dmac & 0xffff);
+}
+
+static int test_domain_init(void)
+{
+	int i;
+
+	test_mask = test_alloc_param();
+	if (!test_mask)
+		return ENOMEM;
+	test_set_dmac(test_mask, 0xffffffffffffULL);
+
+	dr_crc32_init_table();
+
+	test_dmn.ctx = &test_mctx.ibv_ctx.context;
+	test_dmn.type = MLX5DV_DR_DOMAIN_TYPE_NIC_RX;
+	pthread_mutex_init(&test_dmn.mutex, NULL);
+	pthread_rwlock_init(&test_dmn.rule_rwlock, NULL);
+	test_dmn.info.supp_sw_steering = true;
+	test_dmn.info.max_log_sw_icm_sz = DR_CHUNK_SIZE_1024K;
+	test_dmn.info.rx.ste_type = DR_STE_TYPE_RX;
+	test_dmn.info.rx.default_icm_addr = 0xdef000;
+	test_dmn.info.rx.drop_icm_addr = 0xd0f000;
+
+	for (i = 0; i < DR_MAX_SEND_RINGS; i++) {
+		pthread_mutex_init(&test_rings[i].mutex, NULL);
+		test_dmn.send_ring[i] = &test_rings[i];
+	}
+	return 0;
+}
+
+/* Same layout dr_matcher_init and dr_matcher_connect build on a device */
+static int test_matcher_init(struct test_matcher *tm, unsigned int id)
+{
+	struct mlx5dv_dr_matcher *matcher = &tm->matcher;
+	struct dr_matcher_rx_tx *nic_matcher = &matcher->rx;
+	struct dr_domain_rx_tx *nic_dmn = &test_dmn.info.rx;
+	struct dr_htbl_connect_info info;
+	struct dr_match_param mask;
+	struct dr_ste_build *sb;
+	int ret;
+
+	tm->id = id;
+	tm->tbl.dmn = &test_dmn;
+	tm->tbl.level = 1;
+	tm->tbl.rx.nic_dmn = nic_dmn;
+	atomic_init(&tm->tbl.refcount, 1);
+
+	matcher->tbl = &tm->tbl;
+	matcher->match_criteria = DR_MATCHER_CRITERIA_OUTER;
+	atomic_init(&matcher->refcount, 1);
+	list_head_init(&matcher->rule_list);
+	pthread_mutex_init(&matcher->mutex, NULL);
+	matcher->send_ring = test_dmn.send_ring[id % DR_MAX_SEND_RINGS];
+	dr_ste_copy_param(matcher->match_criteria, &matcher->mask, test_mask);
+
+	/* Builders consume the mask they are given */
+	mask = matcher->mask;
+	sb = &nic_matcher->ste_builder[0];
+	dr_ste_build_eth_l2_dst(sb, &mask, false, true);
+	nic_matcher->num_of_builders = 1;
+	nic_matcher->nic_tbl = &tm->tbl.rx;
+
+	tm->tbl.rx.s_anchor = dr_ste_htbl_alloc(NULL, DR_CHUNK_SIZE_1,
+						DR_STE_LU_TYPE_DONT_CARE, 0);
+	nic_matcher->e_anchor = dr_ste_htbl_alloc(NULL, DR_CHUNK_SIZE_1,
+						  DR_STE_LU_TYPE_DONT_CARE, 0);
+	nic_matcher->s_htbl = dr_ste_htbl_alloc(NULL, DR_CHUNK_SIZE_1,
+						sb->lu_type, sb->byte_mask);
+	if (!tm->tbl.rx.s_anchor || !nic_matcher->e_anchor ||
+	    !nic_matcher->s_htbl)
+		return ENOMEM;
+	dr_htbl_get(tm->tbl.rx.s_anchor);
+	dr_htbl_get(nic_matcher->e_anchor);
+	dr_htbl_get(nic_matcher->s_htbl);
+
+	info.type = CONNECT_MISS;
+	info.miss_icm_addr = nic_dmn->default_icm_addr;
+	ret = dr_ste_htbl_init_and_postsend(&test_dmn, test_dmn.send_ring[0],
+					    nic_dmn, nic_matcher->e_anchor,
+					    &info, false);
+	if (ret)
+		return ret;
+
+	info.miss_icm_addr = nic_matcher->e_anchor->chunk->icm_addr;
+	ret = dr_ste_htbl_init_and_postsend(&test_dmn, test_dmn.send_ring[0],
+					    nic_dmn, nic_matcher->s_htbl,
+					    &info, false);
+	if (ret)
+		return ret;
+
+	info.type = CONNECT_HIT;
+	info.hit_next_htbl = nic_matcher->s_htbl;
+	ret = dr_ste_htbl_init_and_postsend(&test_dmn, test_dmn.send_ring[0],
+					    nic_dmn, tm->tbl.rx.s_anchor,
+					    &info, true);
+	if (ret)
+		return ret;
+
+	nic_matcher->s_htbl->pointing_ste = tm->tbl.rx.s_anchor->ste_arr;
+	tm->tbl.rx.s_anchor->ste_arr[0].next_htbl = nic_matcher->s_htbl;
+	return 0;
+}
+
+static void test_matcher_uninit(struct test_matcher *tm)
+{
+	dr_htbl_put(tm->matcher.rx.s_htbl);
+	dr_htbl_put(tm->matcher.rx.e_anchor);
+	dr_htbl_put(tm->tbl.rx.s_anchor);
+	pthread_mutex_destroy(&tm->matcher.mutex);
+}
+
+static uint64_t test_dmac(struct test_matcher *tm, unsigned int i)
+{
+	/* Spread the keys, but keep them unique within the matcher */
+	return ((uint64_t) tm->id << 32 | (i * 2654435761U)) & 0xffffffffffffULL;
+}
+
+/* Every STE in use must be in the emulated ICM exactly as software sees it */
+static int test_check_icm(struct dr_ste_htbl *htbl)
+{
+	struct list_head *miss_list;
+	struct dr_ste *ste;
+	int i, err = 0;
+
+	for (i = 0; i < htbl->chunk->num_of_entries; i++) {
+		if (dr_ste_not_used_ste(&htbl->ste_arr[i]))
+			continue;
+
+		miss_list = dr_ste_get_miss_list(&htbl->ste_arr[i]);
+		list_for_each(miss_list, ste, miss_list_node) {
+			if (memcmp((void *) (uintptr_t) dr_ste_get_mr_addr(ste),
+				   ste->hw_ste, DR_STE_SIZE_REDUCED)) {
+				fprintf(stderr, "STE %d of table %p differs from ICM\n",
+					i, htbl);
+				err++;
+			}
+		}
+	}
+	return err;
+}
+
+static int test_insert(struct test_worker *w)
+{
+	struct mlx5dv_flow_match_parameters *value;
+	struct test_matcher *tm = w->tm;
+	unsigned int i;
+
+	value = test_alloc_param();
+	if (!value)
+		return ENOMEM;
+
+	expected_ring = tm->matcher.send_ring;
+	for (i = w->first; i < w->first + w->num_rules; i++) {
+		test_set_dmac(value, test_dmac(tm, i));
+		w->rules[i] = mlx5dv_dr_rule_create(&tm->matcher, value, 0, NULL);
+		if (!w->rules[i]) {
+			fprintf(stderr, "matcher %u: rule %u failed: %s\n",
+				tm->id, i, strerror(errno));
+			w->failed++;
+			break;
+		}
+	}
+	expected_ring = NULL;
+	free(value);
+	return w->failed;
+}
+
+static int test_remove(struct test_worker *w)
+{
+	unsigned int i;
+
+	expected_ring = w->tm->matcher.send_ring;
+	for (i = w->first; i < w->first + w->num_rules; i++) {
+		if (!w->rules[i])
+			continue;
+		if (mlx5dv_dr_rule_destroy(w->rules[i])) {
+			fprintf(stderr, "matcher %u: destroy rule %u failed\n",
+				w->tm->id, i);
+			w->failed++;
+		}
+		w->rules[i] = NULL;
+	}
+	expected_ring = NULL;
+	return w->failed;
+}
+
+static void *test_insert_thread(void *arg)
+{
+	test_insert(arg);
+	return NULL;
+}
+
+static void *test_remove_thread(void *arg)
+{
+	test_remove(arg);
+	return NULL;
+}
+
+static double test_elapsed(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) +
+	       (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int test_run_threads(struct test_worker *workers, int nthreads,
+			    void *(*func)(void *))
+{
+	pthread_t threads[TEST_MAX_THREADS];
+	int i, failed = 0;
+
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&threads[i], NULL, func, &workers[i]))
+			return -1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		failed += workers[i].failed;
+	}
+	return failed;
+}
+
+static int test_single(unsigned int num_rules)
+{
+	struct test_worker w = {};
+	struct test_matcher tm = {};
+	struct dr_ste_htbl *s_htbl;
+	int chunks, err = 0;
+
+	chunks = atomic_load(&live_chunks);
+	w.tm = &tm;
+	w.num_rules = num_rules;
+	w.rules = calloc(num_rules, sizeof(*w.rules));
+	if (!w.rules || test_matcher_init(&tm, 0))
+		return 1;
+
+	err += test_insert(&w);
+	s_htbl = tm.matcher.rx.s_htbl;
+	if (s_htbl->chunk_size == DR_CHUNK_SIZE_1) {
+		fprintf(stderr, "hash table never grew\n");
+		err++;
+	}
+	if (s_htbl->ctrl.num_of_valid_entries != num_rules) {
+		fprintf(stderr, "%d valid entries, expected %u\n",
+			s_htbl->ctrl.num_of_valid_entries, num_rules);
+		err++;
+	}
+	if (tm.matcher.tbl->rx.s_anchor->ste_arr[0].next_htbl != s_htbl ||
+	    s_htbl->pointing_ste != tm.matcher.tbl->rx.s_anchor->ste_arr) {
+		fprintf(stderr, "anchor does not point to the rehashed table\n");
+		err++;
+	}
+	err += test_check_icm(s_htbl);
+	printf("single: %u rules, table of %u entries, %d collisions\n",
+	       num_rules, s_htbl->chunk->num_of_entries,
+	       s_htbl->ctrl.num_of_collisions);
+
+	err += test_remove(&w);
+	if (s_htbl->ctrl.num_of_valid_entries || s_htbl->ctrl.num_of_collisions) {
+		fprintf(stderr, "%d entries left after removing all rules\n",
+			s_htbl->ctrl.num_of_valid_entries);
+		err++;
+	}
+
+	test_matcher_uninit(&tm);
+	if (atomic_load(&live_chunks) != chunks) {
+		fprintf(stderr, "%d ICM chunks leaked\n",
+			atomic_load(&live_chunks) - chunks);
+		err++;
+	}
+	free(w.rules);
+	return err;
+}
+
+/*
+ * Each thread drives its own matcher. With shared == true all the threads
+ * insert disjoint keys into one matcher instead, exercising the matcher lock.
+ */
+static int test_threads(int nthreads, unsigned int num_rules, bool shared)
+{
+	struct test_worker workers[TEST_MAX_THREADS] = {};
+	struct test_matcher tms[TEST_MAX_THREADS] = {};
+	int i, chunks, nmatchers, err = 0;
+	struct mlx5dv_dr_rule **rules;
+	struct timespec start;
+	double secs;
+
+	chunks = atomic_load(&live_chunks);
+	nmatchers = shared ? 1 : nthreads;
+	rules = calloc((size_t) nthreads * num_rules, sizeof(*rules));
+	if (!rules)
+		return 1;
+
+	for (i = 0; i < nmatchers; i++)
+		if (test_matcher_init(&tms[i], i))
+			return 1;
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].tm = &tms[shared ? 0 : i];
+		workers[i].rules = rules + (size_t) i * num_rules;
+		workers[i].num_rules = num_rules;
+		if (shared) {
+			workers[i].rules = rules;
+			workers[i].first = i * num_rules;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err += test_run_threads(workers, nthreads, test_insert_thread);
+	secs = test_elapsed(&start);
+	printf("%s: %d threads inserted %u rules in %.3f s, %.0f rules/s\n",
+	       shared ? "shared matcher" : "matcher per thread", nthreads,
+	       nthreads * num_rules, secs, nthreads * num_rules / secs);
+
+	for (i = 0; i < nmatchers; i++) {
+		struct dr_ste_htbl *s_htbl = tms[i].matcher.rx.s_htbl;
+		unsigned int expected = shared ? nthreads * num_rules : num_rules;
+
+		if (s_htbl->ctrl.num_of_valid_entries != expected) {
+			fprintf(stderr, "matcher %d: %d valid entries, expected %u\n",
+				i, s_htbl->ctrl.num_of_valid_entries, expected);
+			err++;
+		}
+		err += test_check_icm(s_htbl);
+	}
+
+	err += test_run_threads(workers, nthreads, test_remove_thread);
+
+	for (i = 0; i < nmatchers; i++)
+		test_matcher_uninit(&tms[i]);
+	if (atomic_load(&live_chunks) != chunks) {
+		fprintf(stderr, "%d ICM chunks leaked\n",
+			atomic_load(&live_chunks) - chunks);
+		err++;
+	}
+	free(rules);
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int num_rules = 20000;
+	int nthreads = 4;
+	int op, err = 0;
+
+	while ((op = getopt(argc, argv, "n:t:")) != -1) {
+		switch (op) {
+		case 'n':
+			num_rules = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			printf("usage: %s [-n rules] [-t threads]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (!num_rules || nthreads <= 0 || nthreads > TEST_MAX_THREADS) {
+		fprintf(stderr, "invalid number of rules or threads\n");
+		exit(1);
+	}
+
+	if (test_domain_init())
+		exit(1);
+
+	err += test_single(num_rules);
+	err += test_threads(1, num_rules, false);
+	err += test_threads(nthreads, num_rules, false);
+	err += test_threads(nthreads, num_rules / nthreads + 1, true);
+	if (atomic_load(&wrong_ring)) {
+		fprintf(stderr, "%d STE writes went to another matcher's ring\n",
+			atomic_load(&wrong_ring));
+		err++;
+	}
+
+	free(test_mask);
+	printf("%s\n", err ? "FAIL" : "PASS");
+	return err ? 1 : 0;
+}
@@ -188,11 +188,250 @@ static struct ibv_cq *rxe_create_cq(struct ibv_context *context, int cqe,
 	}
 
 	cq->mmap_info = resp.mi;
+	cq->flags = 0;
 	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
 
 	return &cq->ibv_cq;
 }
 
+/*
+ * Extended CQ polling.  start_poll samples the producer index once with
+ * acquire semantics; next_poll only reloads it after the sampled entries
+ * have been consumed, and end_poll publishes the consumer index once for
+ * the whole batch.  The read_* callbacks return fields straight from the
+ * current queue slot instead of copying out a full work completion.
+ */
+static inline int rxe_cq_next_wc(struct rxe_cq *cq)
+{
+	struct rxe_queue *q = cq->queue;
+
+	if (cq->cur_index == cq->prod_index) {
+		cq->prod_index = load_producer_index(q);
+		if (cq->cur_index == cq->prod_index)
+			return ENOENT;
+	}
+
+	cq->wc = addr_from_index(q, cq->cur_index);
+	cq->cur_index = next_index(q, cq->cur_index);
+	cq->ibv_cq_ex.wr_id = cq->wc->wr_id;
+	cq->ibv_cq_ex.status = cq->wc->status;
+	return 0;
+}
+
+static inline int _rxe_start_poll(struct ibv_cq_ex *ibcq,
+				  struct ibv_poll_cq_attr *attr,
+				  int lock)
+				  ALWAYS_INLINE;
+static inline int _rxe_start_poll(struct ibv_cq_ex *ibcq,
+				  struct ibv_poll_cq_attr *attr,
+				  int lock)
+{
+	struct rxe_cq *cq = to_rcq_ex(ibcq);
+	int err;
+
+	if (attr->comp_mask)
+		return EINVAL;
+
+	if (lock)
+		pthread_spin_lock(&cq->lock);
+
+	cq->cur_index = load_consumer_index(cq->queue);
+	cq->prod_index = cq->cur_index;
+
+	err = rxe_cq_next_wc(cq);
+	if (err && lock)
+		pthread_spin_unlock(&cq->lock);
+
+	return err;
+}
+
+static inline void _rxe_end_poll(struct ibv_cq_ex *ibcq, int lock)
+{
+	struct rxe_cq *cq = to_rcq_ex(ibcq);
+
+	store_consumer_index(cq->queue, cq->cur_index);
+	cq->wc = NULL;
+
+	if (lock)
+		pthread_spin_unlock(&cq->lock);
+}
+
+static int rxe_start_poll(struct ibv_cq_ex *ibcq,
+			  struct ibv_poll_cq_attr *attr)
+{
+	return _rxe_start_poll(ibcq, attr, 0);
+}
+
+static int rxe_start_poll_lock(struct ibv_cq_ex *ibcq,
+			       struct ibv_poll_cq_attr *attr)
+{
+	return _rxe_start_poll(ibcq, attr, 1);
+}
+
+static int rxe_next_poll(struct ibv_cq_ex *ibcq)
+{
+	return rxe_cq_next_wc(to_rcq_ex(ibcq));
+}
+
+static void rxe_end_poll(struct ibv_cq_ex *ibcq)
+{
+	_rxe_end_poll(ibcq, 0);
+}
+
+static void rxe_end_poll_lock(struct ibv_cq_ex *ibcq)
+{
+	_rxe_end_poll(ibcq, 1);
+}
+
+static enum ibv_wc_opcode rxe_wc_read_opcode(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->opcode;
+}
+
+static uint32_t rxe_wc_read_vendor_err(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->vendor_err;
+}
+
+static uint32_t rxe_wc_read_byte_len(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->byte_len;
+}
+
+static __be32 rxe_wc_read_imm_data(struct ibv_cq_ex *ibcq)
+{
+	/* Also carries invalidated_rkey, see ibv_wc_read_invalidated_rkey */
+	return to_rcq_ex(ibcq)->wc->ex.imm_data;
+}
+
+static uint32_t rxe_wc_read_qp_num(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->qp_num;
+}
+
+static uint32_t rxe_wc_read_src_qp(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->src_qp;
+}
+
+static unsigned int rxe_wc_read_wc_flags(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->wc_flags;
+}
+
+static uint32_t rxe_wc_read_slid(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->slid;
+}
+
+static uint8_t rxe_wc_read_sl(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->sl;
+}
+
+static uint8_t rxe_wc_read_dlid_path_bits(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->dlid_path_bits;
+}
+
+static void rxe_cq_fill_pfns(struct rxe_cq *cq,
+			     const struct ibv_cq_init_attr_ex *attr)
+{
+	struct ibv_cq_ex *ibcq = &cq->ibv_cq_ex;
+
+	if (cq->flags & RXE_CQ_FLAGS_SINGLE_THREADED) {
+		ibcq->start_poll = rxe_start_poll;
+		ibcq->end_poll = rxe_end_poll;
+	} else {
+		ibcq->start_poll = rxe_start_poll_lock;
+		ibcq->end_poll = rxe_end_poll_lock;
+	}
+	ibcq->next_poll = rxe_next_poll;
+
+	ibcq->read_opcode = rxe_wc_read_opcode;
+	ibcq->read_vendor_err = rxe_wc_read_vendor_err;
+	ibcq->read_wc_flags = rxe_wc_read_wc_flags;
+	if (attr->wc_flags & IBV_WC_EX_WITH_BYTE_LEN)
+		ibcq->read_byte_len = rxe_wc_read_byte_len;
+	if (attr->wc_flags & IBV_WC_EX_WITH_IMM)
+		ibcq->read_imm_data = rxe_wc_read_imm_data;
+	if (attr->wc_flags & IBV_WC_EX_WITH_QP_NUM)
+		ibcq->read_qp_num = rxe_wc_read_qp_num;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SRC_QP)
+		ibcq->read_src_qp = rxe_wc_read_src_qp;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SLID)
+		ibcq->read_slid = rxe_wc_read_slid;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SL)
+		ibcq->read_sl = rxe_wc_read_sl;
+	if (attr->wc_flags & IBV_WC_EX_WITH_DLID_PATH_BITS)
+		ibcq->read_dlid_path_bits = rxe_wc_read_dlid_path_bits;
+}
+
+enum {
+	RXE_CREATE_CQ_SUPPORTED_WC_FLAGS = IBV_WC_STANDARD_FLAGS,
+	RXE_CREATE_CQ_SUPPORTED_FLAGS = IBV_CREATE_CQ_ATTR_SINGLE_THREADED,
+};
+
+static struct ibv_cq_ex *rxe_create_cq_ex(struct ibv_context *context,
+					  struct ibv_cq_init_attr_ex *attr)
+{
+	struct ibv_cq_init_attr_ex attr_c;
+	struct urxe_create_cq_ex cmd = {};
+	struct urxe_create_cq_ex_resp resp = {};
+	struct rxe_cq *cq;
+	int ret;
+
+	if (!check_comp_mask(attr->comp_mask, IBV_CQ_INIT_ATTR_MASK_FLAGS)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (attr->wc_flags & ~RXE_CREATE_CQ_SUPPORTED_WC_FLAGS ||
+	    (attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+	     attr->flags & ~RXE_CREATE_CQ_SUPPORTED_FLAGS)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return NULL;
+
+	cq->flags = RXE_CQ_FLAGS_EXTENDED;
+	if (attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+	    attr->flags & IBV_CREATE_CQ_ATTR_SINGLE_THREADED)
+		cq->flags |= RXE_CQ_FLAGS_SINGLE_THREADED;
+
+	/* The single threaded hint is a userspace only property */
+	attr_c = *attr;
+	attr_c.flags &= ~IBV_CREATE_CQ_ATTR_SINGLE_THREADED;
+
+	ret = ibv_cmd_create_cq_ex(context, &attr_c, &cq->ibv_cq_ex,
+				   &cmd.ibv_cmd, sizeof(cmd),
+				   &resp.ibv_resp, sizeof(resp));
+	if (ret) {
+		errno = ret;
+		goto err_free;
+	}
+
+	cq->queue = mmap(NULL, resp.mi.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 context->cmd_fd, resp.mi.offset);
+	if ((void *)cq->queue == MAP_FAILED)
+		goto err_destroy;
+
+	cq->mmap_info = resp.mi;
+	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	rxe_cq_fill_pfns(cq, attr);
+
+	return &cq->ibv_cq_ex;
+
+err_destroy:
+	ibv_cmd_destroy_cq(&cq->ibv_cq);
+err_free:
+	free(cq);
+	return NULL;
+}
+
 static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 {
 	struct rxe_cq *cq = to_rcq(ibcq);
@@ -248,24 +487,29 @@ static int rxe_destroy_cq(struct ibv_cq *ibcq)
 static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 {
 	struct rxe_cq *cq = to_rcq(ibcq);
+	int lock = !(cq->flags & RXE_CQ_FLAGS_SINGLE_THREADED);
 	struct rxe_queue *q;
+	uint32_t cons, prod;
 	int npolled;
-	uint8_t *src;
 
-	pthread_spin_lock(&cq->lock);
+	if (lock)
+		pthread_spin_lock(&cq->lock);
 	q = cq->queue;
 
-	for (npolled = 0; npolled < ne; ++npolled, ++wc) {
-		if (queue_empty(q))
-			break;
+	/* One acquire load covers every entry below the sampled producer */
+	cons = load_consumer_index(q);
+	prod = load_producer_index(q);
 
-		atomic_thread_fence(memory_order_acquire);
-		src = consumer_addr(q);
-		memcpy(wc, src, sizeof(*wc));
-		advance_consumer(q);
+	for (npolled = 0; npolled < ne && cons != prod; ++npolled, ++wc) {
+		memcpy(wc, addr_from_index(q, cons), sizeof(*wc));
+		cons = next_index(q, cons);
 	}
 
-	pthread_spin_unlock(&cq->lock);
+	if (npolled)
+		store_consumer_index(q, cons);
+
+	if (lock)
+		pthread_spin_unlock(&cq->lock);
 	return npolled;
 }
 
@@ -436,23 +680,89 @@ static int rxe_post_srq_recv(struct ibv_srq *ibvsrq,
 	return rc;
 }
 
-static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
-				    struct ibv_qp_init_attr *attr)
+static void rxe_qp_fill_wr_pfns(struct rxe_qp *qp,
+				struct ibv_qp_init_attr_ex *attr);
+
+enum {
+	RXE_SUPPORTED_SEND_OPS_FLAGS_RC =
+		IBV_QP_EX_WITH_SEND |
+		IBV_QP_EX_WITH_SEND_WITH_INV |
+		IBV_QP_EX_WITH_SEND_WITH_IMM |
+		IBV_QP_EX_WITH_RDMA_WRITE |
+		IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM |
+		IBV_QP_EX_WITH_RDMA_READ |
+		IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP |
+		IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD |
+		IBV_QP_EX_WITH_LOCAL_INV,
+	RXE_SUPPORTED_SEND_OPS_FLAGS_UC =
+		IBV_QP_EX_WITH_SEND |
+		IBV_QP_EX_WITH_SEND_WITH_IMM |
+		IBV_QP_EX_WITH_RDMA_WRITE |
+		IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM,
+	RXE_SUPPORTED_SEND_OPS_FLAGS_UD =
+		IBV_QP_EX_WITH_SEND |
+		IBV_QP_EX_WITH_SEND_WITH_IMM,
+};
+
+static int rxe_check_send_ops_flags(struct ibv_qp_init_attr_ex *attr)
+{
+	uint64_t supported;
+
+	if (!(attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS))
+		return 0;
+
+	switch (attr->qp_type) {
+	case IBV_QPT_RC:
+		supported = RXE_SUPPORTED_SEND_OPS_FLAGS_RC;
+		break;
+	case IBV_QPT_UC:
+		supported = RXE_SUPPORTED_SEND_OPS_FLAGS_UC;
+		break;
+	case IBV_QPT_UD:
+		supported = RXE_SUPPORTED_SEND_OPS_FLAGS_UD;
+		break;
+	default:
+		return EOPNOTSUPP;
+	}
+
+	if (attr->send_ops_flags & ~supported)
+		return EOPNOTSUPP;
+
+	return 0;
+}
+
+static struct ibv_qp *create_qp(struct ibv_context *context,
+				struct ibv_qp_init_attr_ex *attr)
 {
 	struct ibv_create_qp cmd;
 	struct urxe_create_qp_resp resp;
 	struct rxe_qp *qp;
 	int ret;
 
-	qp = malloc(sizeof *qp);
+	if (!check_comp_mask(attr->comp_mask,
+			     IBV_QP_INIT_ATTR_PD |
+			     IBV_QP_INIT_ATTR_SEND_OPS_FLAGS)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	ret = rxe_check_send_ops_flags(attr);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+
+	qp = calloc(1, sizeof *qp);
 	if (!qp) {
 		return NULL;
 	}
 
-	ret = ibv_cmd_create_qp(pd, &qp->ibv_qp, attr, &cmd, sizeof cmd,
-				&resp.ibv_resp, sizeof resp);
+	ret = ibv_cmd_create_qp_ex(context, &qp->vqp, sizeof(qp->vqp), attr,
+				   &cmd, sizeof cmd,
+				   &resp.ibv_resp, sizeof resp);
 	if (ret) {
 		free(qp);
+		errno = ret;
 		return NULL;
 	}
 
@@ -464,7 +774,7 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 		qp->rq.max_sge = attr->cap.max_recv_sge;
 		qp->rq.queue = mmap(NULL, resp.rq_mi.size, PROT_READ | PROT_WRITE,
 				    MAP_SHARED,
-				    pd->context->cmd_fd, resp.rq_mi.offset);
+				    context->cmd_fd, resp.rq_mi.offset);
 		if ((void *)qp->rq.queue == MAP_FAILED) {
 			ibv_cmd_destroy_qp(&qp->ibv_qp);
 			free(qp);
@@ -479,7 +789,7 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 	qp->sq.max_inline = attr->cap.max_inline_data;
 	qp->sq.queue = mmap(NULL, resp.sq_mi.size, PROT_READ | PROT_WRITE,
 			    MAP_SHARED,
-			    pd->context->cmd_fd, resp.sq_mi.offset);
+			    context->cmd_fd, resp.sq_mi.offset);
 	if ((void *)qp->sq.queue == MAP_FAILED) {
 		if (qp->rq_mmap_info.size)
 			munmap(qp->rq.queue, qp->rq_mmap_info.size);
@@ -491,9 +801,37 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 	qp->sq_mmap_info = resp.sq_mi;
 	pthread_spin_init(&qp->sq.lock, PTHREAD_PROCESS_PRIVATE);
 
+	if (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) {
+		rxe_qp_fill_wr_pfns(qp, attr);
+		qp->vqp.comp_mask |= VERBS_QP_EX;
+	}
+
 	return &qp->ibv_qp;
 }
 
+static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
+				    struct ibv_qp_init_attr *attr)
+{
+	struct ibv_qp_init_attr_ex attr_ex = {};
+	struct ibv_qp *qp;
+
+	memcpy(&attr_ex, attr, sizeof(*attr));
+	attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD;
+	attr_ex.pd = pd;
+
+	qp = create_qp(pd->context, &attr_ex);
+	if (qp)
+		memcpy(attr, &attr_ex, sizeof(*attr));
+
+	return qp;
+}
+
+static struct ibv_qp *rxe_create_qp_ex(struct ibv_context *context,
+				       struct ibv_qp_init_attr_ex *attr)
+{
+	return create_qp(context, attr);
+}
+
 static int rxe_query_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr,
 			int attr_mask,
 			struct ibv_qp_init_attr *init_attr)
@@ -720,10 +1058,323 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 
 	pthread_spin_unlock(&sq->lock);
 
-	err =  post_send_db(ibqp);
+	err = post_send_db(ibqp);
 	return err ? err : rc;
 }
 
+/*
+ * ibv_wr_* work request builders.  WQEs are written in place into the
+ * send queue; the producer index is published and the doorbell rung
+ * once per wr_start/wr_complete session.
+ */
+static void rxe_wr_start(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+
+	pthread_spin_lock(&qp->sq.lock);
+
+	qp->wr_err = 0;
+	qp->cur_wqe = NULL;
+	qp->start_index = load_producer_index(qp->sq.queue);
+	qp->cur_index = qp->start_index;
+	qp->start_ssn = qp->ssn;
+}
+
+static int rxe_wr_complete(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+
+	if (unlikely(qp->wr_err)) {
+		qp->ssn = qp->start_ssn;
+		pthread_spin_unlock(&qp->sq.lock);
+		return qp->wr_err;
+	}
+
+	store_producer_index(qp->sq.queue, qp->cur_index);
+
+	pthread_spin_unlock(&qp->sq.lock);
+
+	return post_send_db(&qp->ibv_qp);
+}
+
+static void rxe_wr_abort(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+
+	qp->ssn = qp->start_ssn;
+	pthread_spin_unlock(&qp->sq.lock);
+}
+
+static struct rxe_send_wqe *rxe_wr_init(struct ibv_qp_ex *ibqp,
+					enum ibv_wr_opcode opcode)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_queue *q = qp->sq.queue;
+	struct rxe_send_wqe *wqe;
+
+	if (unlikely(qp->wr_err))
+		return NULL;
+
+	if (unlikely(((qp->cur_index + 1 - load_consumer_index_acquire(q)) &
+		      q->index_mask) == 0)) {
+		qp->wr_err = ENOMEM;
+		return NULL;
+	}
+
+	wqe = addr_from_index(q, qp->cur_index);
+	memset(wqe, 0, sizeof(*wqe));
+
+	wqe->wr.wr_id = ibqp->wr_id;
+	wqe->wr.opcode = opcode;
+	/* inline is selected by the data setter, not by wr_flags */
+	wqe->wr.send_flags = ibqp->wr_flags & ~IBV_SEND_INLINE;
+	wqe->ssn = qp->ssn++;
+
+	qp->cur_wqe = wqe;
+	qp->cur_index = next_index(q, qp->cur_index);
+	return wqe;
+}
+
+static void rxe_wr_send(struct ibv_qp_ex *ibqp)
+{
+	rxe_wr_init(ibqp, IBV_WR_SEND);
+}
+
+static void rxe_wr_send_imm(struct ibv_qp_ex *ibqp, __be32 imm_data)
+{
+	struct rxe_send_wqe *wqe = rxe_wr_init(ibqp, IBV_WR_SEND_WITH_IMM);
+
+	if (wqe)
+		wqe->wr.ex.imm_data = imm_data;
+}
+
+static void rxe_wr_send_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
+{
+	struct rxe_send_wqe *wqe = rxe_wr_init(ibqp, IBV_WR_SEND_WITH_INV);
+
+	if (wqe)
+		wqe->wr.ex.invalidate_rkey = invalidate_rkey;
+}
+
+static void rxe_wr_rdma(struct ibv_qp_ex *ibqp, enum ibv_wr_opcode opcode,
+			uint32_t rkey, uint64_t remote_addr, __be32 imm_data)
+{
+	struct rxe_send_wqe *wqe = rxe_wr_init(ibqp, opcode);
+
+	if (!wqe)
+		return;
+
+	wqe->wr.wr.rdma.remote_addr = remote_addr;
+	wqe->wr.wr.rdma.rkey = rkey;
+	wqe->wr.ex.imm_data = imm_data;
+	wqe->iova = remote_addr;
+}
+
+static void rxe_wr_rdma_write(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			      uint64_t remote_addr)
+{
+	rxe_wr_rdma(ibqp, IBV_WR_RDMA_WRITE, rkey, remote_addr, 0);
+}
+
+static void rxe_wr_rdma_write_imm(struct ibv_qp_ex *ibqp, uint32_t rkey,
+				  uint64_t remote_addr, __be32 imm_data)
+{
+	rxe_wr_rdma(ibqp, IBV_WR_RDMA_WRITE_WITH_IMM, rkey, remote_addr,
+		    imm_data);
+}
+
+static void rxe_wr_rdma_read(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			     uint64_t remote_addr)
+{
+	rxe_wr_rdma(ibqp, IBV_WR_RDMA_READ, rkey, remote_addr, 0);
+}
+
+static void rxe_wr_atomic(struct ibv_qp_ex *ibqp, enum ibv_wr_opcode opcode,
+			  uint32_t rkey, uint64_t remote_addr,
+			  uint64_t compare_add, uint64_t swap)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe;
+
+	if (remote_addr & 0x7) {
+		if (!qp->wr_err)
+			qp->wr_err = EINVAL;
+		return;
+	}
+
+	wqe = rxe_wr_init(ibqp, opcode);
+	if (!wqe)
+		return;
+
+	wqe->wr.wr.atomic.remote_addr = remote_addr;
+	wqe->wr.wr.atomic.compare_add = compare_add;
+	wqe->wr.wr.atomic.swap = swap;
+	wqe->wr.wr.atomic.rkey = rkey;
+	wqe->iova = remote_addr;
+}
+
+static void rxe_wr_atomic_cmp_swp(struct ibv_qp_ex *ibqp, uint32_t rkey,
+				  uint64_t remote_addr, uint64_t compare,
+				  uint64_t swap)
+{
+	rxe_wr_atomic(ibqp, IBV_WR_ATOMIC_CMP_AND_SWP, rkey, remote_addr,
+		      compare, swap);
+}
+
+static void rxe_wr_atomic_fetch_add(struct ibv_qp_ex *ibqp, uint32_t rkey,
+				    uint64_t remote_addr, uint64_t add)
+{
+	rxe_wr_atomic(ibqp, IBV_WR_ATOMIC_FETCH_AND_ADD, rkey, remote_addr,
+		      add, 0);
+}
+
+static void rxe_wr_local_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
+{
+	struct rxe_send_wqe *wqe = rxe_wr_init(ibqp, IBV_WR_LOCAL_INV);
+
+	if (wqe)
+		wqe->wr.ex.invalidate_rkey = invalidate_rkey;
+}
+
+static void rxe_wr_set_ud_addr(struct ibv_qp_ex *ibqp, struct ibv_ah *ibah,
+			       uint32_t remote_qpn, uint32_t remote_qkey)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->cur_wqe;
+
+	if (unlikely(qp->wr_err))
+		return;
+
+	memcpy(&wqe->av, &to_rah(ibah)->av, sizeof(wqe->av));
+	wqe->wr.wr.ud.remote_qpn = remote_qpn;
+	wqe->wr.wr.ud.remote_qkey = remote_qkey;
+}
+
+static void rxe_wr_set_dma(struct rxe_send_wqe *wqe, uint32_t length,
+			   uint32_t num_sge)
+{
+	wqe->dma.length = length;
+	wqe->dma.resid = length;
+	wqe->dma.num_sge = num_sge;
+}
+
+static void rxe_wr_set_sge(struct ibv_qp_ex *ibqp, uint32_t lkey,
+			   uint64_t addr, uint32_t length)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->cur_wqe;
+
+	if (unlikely(qp->wr_err))
+		return;
+
+	wqe->wr.num_sge = 1;
+	wqe->dma.sge[0].addr = addr;
+	wqe->dma.sge[0].length = length;
+	wqe->dma.sge[0].lkey = lkey;
+	rxe_wr_set_dma(wqe, length, 1);
+}
+
+static void rxe_wr_set_sge_list(struct ibv_qp_ex *ibqp, size_t num_sge,
+				const struct ibv_sge *sg_list)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->cur_wqe;
+	uint32_t length = 0;
+	size_t i;
+
+	if (unlikely(qp->wr_err))
+		return;
+
+	if (unlikely(num_sge > qp->sq.max_sge)) {
+		qp->wr_err = EINVAL;
+		return;
+	}
+
+	for (i = 0; i < num_sge; i++)
+		length += sg_list[i].length;
+
+	wqe->wr.num_sge = num_sge;
+	memcpy(wqe->dma.sge, sg_list, num_sge * sizeof(*sg_list));
+	rxe_wr_set_dma(wqe, length, num_sge);
+}
+
+static void rxe_wr_set_inline_data_list(struct ibv_qp_ex *ibqp,
+					size_t num_buf,
+					const struct ibv_data_buf *buf_list)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->cur_wqe;
+	uint8_t *inline_data;
+	uint32_t length = 0;
+	size_t i;
+
+	if (unlikely(qp->wr_err))
+		return;
+
+	for (i = 0; i < num_buf; i++)
+		length += buf_list[i].length;
+
+	if (unlikely(length > qp->sq.max_inline)) {
+		qp->wr_err = EINVAL;
+		return;
+	}
+
+	inline_data = wqe->dma.inline_data;
+	for (i = 0; i < num_buf; i++) {
+		memcpy(inline_data, buf_list[i].addr, buf_list[i].length);
+		inline_data += buf_list[i].length;
+	}
+
+	wqe->wr.send_flags |= IBV_SEND_INLINE;
+	rxe_wr_set_dma(wqe, length, 0);
+}
+
+static void rxe_wr_set_inline_data(struct ibv_qp_ex *ibqp, void *addr,
+				   size_t length)
+{
+	struct ibv_data_buf buf = { .addr = addr, .length = length };
+
+	rxe_wr_set_inline_data_list(ibqp, 1, &buf);
+}
+
+static void rxe_qp_fill_wr_pfns(struct rxe_qp *qp,
+				struct ibv_qp_init_attr_ex *attr)
+{
+	struct ibv_qp_ex *ibqp = &qp->vqp.qp_ex;
+	uint64_t ops = attr->send_ops_flags;
+
+	ibqp->wr_start = rxe_wr_start;
+	ibqp->wr_complete = rxe_wr_complete;
+	ibqp->wr_abort = rxe_wr_abort;
+
+	if (ops & IBV_QP_EX_WITH_SEND)
+		ibqp->wr_send = rxe_wr_send;
+	if (ops & IBV_QP_EX_WITH_SEND_WITH_IMM)
+		ibqp->wr_send_imm = rxe_wr_send_imm;
+	if (ops & IBV_QP_EX_WITH_SEND_WITH_INV)
+		ibqp->wr_send_inv = rxe_wr_send_inv;
+	if (ops & IBV_QP_EX_WITH_RDMA_WRITE)
+		ibqp->wr_rdma_write = rxe_wr_rdma_write;
+	if (ops & IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM)
+		ibqp->wr_rdma_write_imm = rxe_wr_rdma_write_imm;
+	if (ops & IBV_QP_EX_WITH_RDMA_READ)
+		ibqp->wr_rdma_read = rxe_wr_rdma_read;
+	if (ops & IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP)
+		ibqp->wr_atomic_cmp_swp = rxe_wr_atomic_cmp_swp;
+	if (ops & IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD)
+		ibqp->wr_atomic_fetch_add = rxe_wr_atomic_fetch_add;
+	if (ops & IBV_QP_EX_WITH_LOCAL_INV)
+		ibqp->wr_local_inv = rxe_wr_local_inv;
+
+	ibqp->wr_set_sge = rxe_wr_set_sge;
+	ibqp->wr_set_sge_list = rxe_wr_set_sge_list;
+	ibqp->wr_set_inline_data = rxe_wr_set_inline_data;
+	ibqp->wr_set_inline_data_list = rxe_wr_set_inline_data_list;
+
+	if (qp_type(qp) == IBV_QPT_UD)
+		ibqp->wr_set_ud_addr = rxe_wr_set_ud_addr;
+}
+
 static int rxe_post_recv(struct ibv_qp *ibqp,
 			 struct ibv_recv_wr *recv_wr,
 			 struct ibv_recv_wr **bad_wr)
@@ -840,6 +1491,7 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.reg_mr = rxe_reg_mr,
 	.dereg_mr = rxe_dereg_mr,
 	.create_cq = rxe_create_cq,
+	.create_cq_ex = rxe_create_cq_ex,
 	.poll_cq = rxe_poll_cq,
 	.req_notify_cq = ibv_cmd_req_notify_cq,
 	.resize_cq = rxe_resize_cq,
@@ -850,6 +1502,7 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.destroy_srq = rxe_destroy_srq,
 	.post_srq_recv = rxe_post_srq_recv,
 	.create_qp = rxe_create_qp,
+	.create_qp_ex = rxe_create_qp_ex,
 	.query_qp = rxe_query_qp,
 	.modify_qp = rxe_modify_qp,
 	.destroy_qp = rxe_destroy_qp,
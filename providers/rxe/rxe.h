@@ -57,11 +57,24 @@ struct rxe_context {
 	struct verbs_context	ibv_ctx;
 };
 
+enum rxe_cq_flags {
+	RXE_CQ_FLAGS_EXTENDED		= 1 << 0,
+	RXE_CQ_FLAGS_SINGLE_THREADED	= 1 << 1,
+};
+
 struct rxe_cq {
-	struct ibv_cq		ibv_cq;
+	union {
+		struct ibv_cq		ibv_cq;
+		struct ibv_cq_ex	ibv_cq_ex;
+	};
 	struct mminfo		mmap_info;
 	struct rxe_queue		*queue;
 	pthread_spinlock_t	lock;
+	uint32_t		flags;
+	/* extended CQ polling state, valid between start_poll and end_poll */
+	struct ib_uverbs_wc	*wc;
+	uint32_t		cur_index;
+	uint32_t		prod_index;
 };
 
 struct rxe_ah {
@@ -77,12 +90,21 @@ struct rxe_wq {
 };
 
 struct rxe_qp {
-	struct ibv_qp		ibv_qp;
+	union {
+		struct ibv_qp		ibv_qp;
+		struct verbs_qp		vqp;
+	};
 	struct mminfo		rq_mmap_info;
 	struct rxe_wq		rq;
 	struct mminfo		sq_mmap_info;
 	struct rxe_wq		sq;
 	unsigned int		ssn;
+	/* ibv_wr_* session state, valid between wr_start and wr_complete */
+	struct rxe_send_wqe	*cur_wqe;
+	uint32_t		cur_index;
+	uint32_t		start_index;
+	unsigned int		start_ssn;
+	int			wr_err;
 };
 
 #define qp_type(qp)		((qp)->ibv_qp.qp_type)
@@ -111,11 +133,21 @@ static inline struct rxe_cq *to_rcq(struct ibv_cq *ibcq)
 	return to_rxxx(cq, cq);
 }
 
+static inline struct rxe_cq *to_rcq_ex(struct ibv_cq_ex *ibcq)
+{
+	return container_of(ibcq, struct rxe_cq, ibv_cq_ex);
+}
+
 static inline struct rxe_qp *to_rqp(struct ibv_qp *ibqp)
 {
 	return to_rxxx(qp, qp);
 }
 
+static inline struct rxe_qp *to_rqp_ex(struct ibv_qp_ex *ibqp)
+{
+	return container_of(ibqp, struct rxe_qp, vqp.qp_ex);
+}
+
 static inline struct rxe_srq *to_rsrq(struct ibv_srq *ibsrq)
 {
 	return to_rxxx(srq, srq);
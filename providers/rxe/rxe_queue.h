@@ -96,6 +96,48 @@ static inline void advance_consumer(struct rxe_queue *q)
 		q->index_mask);
 }
 
+/*
+ * Batched helpers: a consumer loads the producer index once with acquire
+ * semantics, consumes any number of slots below it without further fences
+ * and publishes the new consumer index once at the end of the batch.  A
+ * producer likewise fills several slots and publishes them with a single
+ * release store of the producer index.
+ */
+static inline uint32_t load_producer_index(struct rxe_queue *q)
+{
+	return atomic_load_explicit(&q->producer_index,
+				    memory_order_acquire) & q->index_mask;
+}
+
+static inline uint32_t load_consumer_index(struct rxe_queue *q)
+{
+	/* Must hold consumer_index lock */
+	return atomic_load_explicit(&q->consumer_index,
+				    memory_order_relaxed) & q->index_mask;
+}
+
+static inline void store_consumer_index(struct rxe_queue *q,
+					uint32_t index)
+{
+	/* Must hold consumer_index lock */
+	atomic_store_explicit(&q->consumer_index, index & q->index_mask,
+			      memory_order_release);
+}
+
+static inline uint32_t load_consumer_index_acquire(struct rxe_queue *q)
+{
+	return atomic_load_explicit(&q->consumer_index,
+				    memory_order_acquire) & q->index_mask;
+}
+
+static inline void store_producer_index(struct rxe_queue *q,
+					uint32_t index)
+{
+	/* Must hold producer_index lock */
+	atomic_store_explicit(&q->producer_index, index & q->index_mask,
+			      memory_order_release);
+}
+
 static inline void *producer_addr(struct rxe_queue *q)
 {
 	/* Must hold producer_index lock */
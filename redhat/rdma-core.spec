@@ -622,6 +622,7 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %{_bindir}/rdma_xserver
 %{_bindir}/riostream
 %{_bindir}/rping
+%{_bindir}/rpolltime
 %{_bindir}/rstream
 %{_bindir}/ucmatose
 %{_bindir}/udaddy
@@ -635,6 +636,7 @@ rm -rf %{buildroot}/%{_sbindir}/srp_daemon.sh
 %{_mandir}/man1/rdma_xserver.*
 %{_mandir}/man1/riostream.*
 %{_mandir}/man1/rping.*
+%{_mandir}/man1/rpolltime.*
 %{_mandir}/man1/rstream.*
 %{_mandir}/man1/ucmatose.*
 %{_mandir}/man1/udaddy.*